@@ -0,0 +1,200 @@
+/*
+ * Image file round-trip test.
+ *
+ * Encodes images as QOI with encode_image and decodes them with a decoder written from the
+ * specification (qoiformat.org), checking that every pixel comes back opaque and unchanged:
+ *     palette:  reproduces a reported sequence of a few colors, in which a black pixel that is
+ *               not the start of a run once decoded as transparent.
+ *     runs:     rows of solid colors, with runs longer than one run op can hold.
+ *     gradient: slowly changing colors, for the difference ops.
+ *     colors:   random pixels from a small set of colors, for the index of seen pixels.
+ *     noise:    random pixels.
+ * Prints each case and exits with a non-zero status if any fails.
+ *
+ * Usage: image_file_test
+ */
+#include "renderer/image_file.h"
+#include <stdio.h>
+#include <string.h>
+#include <random>
+#include <vector>
+
+#define QOI_HEADER_SIZE 14
+#define QOI_END_MARKER_SIZE 8
+
+static uint32_t read_be32(const uint8_t *data)
+{
+    return (uint32_t) data[0] << 24 | (uint32_t) data[1] << 16 | (uint32_t) data[2] << 8 | data[3];
+}
+
+// Decode to RGBA, returning false on a malformed stream.
+static bool decode_qoi(const std::vector<uint8_t> &data, int *width, int *height, std::vector<uint8_t> *rgba)
+{
+    if ( data.size() < QOI_HEADER_SIZE + QOI_END_MARKER_SIZE || memcmp(&data[0], "qoif", 4) != 0 ) return false;
+    *width = read_be32(&data[4]);
+    *height = read_be32(&data[8]);
+    size_t num_pixels = (size_t) *width * *height;
+    rgba->resize(4 * num_pixels);
+
+    uint8_t index[64][4] = {};
+    uint8_t pixel[4] = { 0, 0, 0, 255 };
+    size_t p = QOI_HEADER_SIZE;
+    size_t end = data.size() - QOI_END_MARKER_SIZE;
+    uint32_t run = 0;
+    for (size_t i = 0; i < num_pixels; i++)
+    {
+        if ( run > 0 )
+        {
+            run--;
+        }
+        else
+        {
+            if ( p >= end ) return false;
+            uint8_t op = data[p++];
+            if ( op == 0xfe )
+            {
+                if ( p + 3 > end ) return false;
+                memcpy(pixel, &data[p], 3);
+                p += 3;
+            }
+            else if ( op == 0xff )
+            {
+                if ( p + 4 > end ) return false;
+                memcpy(pixel, &data[p], 4);
+                p += 4;
+            }
+            else if ( (op & 0xc0) == 0x00 )
+            {
+                memcpy(pixel, index[op], 4);
+            }
+            else if ( (op & 0xc0) == 0x40 )
+            {
+                pixel[0] += ((op >> 4) & 3) - 2;
+                pixel[1] += ((op >> 2) & 3) - 2;
+                pixel[2] += (op & 3) - 2;
+            }
+            else if ( (op & 0xc0) == 0x80 )
+            {
+                if ( p >= end ) return false;
+                uint8_t second = data[p++];
+                int dg = (op & 0x3f) - 32;
+                pixel[0] += dg + ((second >> 4) & 0xf) - 8;
+                pixel[1] += dg;
+                pixel[2] += dg + (second & 0xf) - 8;
+            }
+            else
+            {
+                run = op & 0x3f;
+            }
+            uint32_t hash = (pixel[0] * 3 + pixel[1] * 5 + pixel[2] * 7 + pixel[3] * 11) % 64;
+            memcpy(index[hash], pixel, 4);
+        }
+        memcpy(&(*rgba)[4 * i], pixel, 4);
+    }
+    return p == end && run == 0;
+}
+
+// Encode as QOI, decode, and compare with the opaque input.
+static bool round_trip(const char *name, const std::vector<uint8_t> &rgba, int width, int height)
+{
+    std::vector<uint8_t> encoded;
+    encode_image(ImageFileFormat::QOI, &rgba[0], width, height, &encoded);
+    int decoded_width, decoded_height;
+    std::vector<uint8_t> decoded;
+    if ( !decode_qoi(encoded, &decoded_width, &decoded_height, &decoded) )
+    {
+        printf("%-10s FAILED: malformed stream\n", name);
+        return false;
+    }
+    if ( decoded_width != width || decoded_height != height )
+    {
+        printf("%-10s FAILED: decoded as %dx%d, expected %dx%d\n", name, decoded_width, decoded_height, width, height);
+        return false;
+    }
+    for (size_t i = 0; i < (size_t) width * height; i++)
+    {
+        const uint8_t *in = &rgba[4 * i];
+        const uint8_t *out = &decoded[4 * i];
+        if ( in[0] != out[0] || in[1] != out[1] || in[2] != out[2] || out[3] != 255 )
+        {
+            printf("%-10s FAILED: pixel %zu is (%u,%u,%u,%u), expected (%u,%u,%u,255)\n",
+                   name, i, out[0], out[1], out[2], out[3], in[0], in[1], in[2]);
+            return false;
+        }
+    }
+    printf("%-10s passed: %dx%d, %zu bytes\n", name, width, height, encoded.size());
+    return true;
+}
+
+int main(void)
+{
+    bool passed = true;
+    std::mt19937 rng(1);
+    {
+        std::vector<uint8_t> rgba = {
+            255, 0, 0, 255,
+            0, 0, 0, 255,
+            10, 200, 30, 255,
+            0, 0, 255, 255,
+            10, 200, 30, 255,
+        };
+        passed &= round_trip("palette", rgba, 5, 1);
+    }
+    {
+        const int width = 300, height = 40;
+        std::vector<uint8_t> rgba(4 * width * height);
+        for (int y = 0; y < height; y++)
+        {
+            uint8_t shade = y % 4 == 0 ? 0 : 60 * (y % 4);
+            for (int x = 0; x < width; x++)
+            {
+                uint8_t *pixel = &rgba[4 * (y * width + x)];
+                pixel[0] = shade;
+                pixel[1] = shade / 2;
+                pixel[2] = 255 - shade;
+                pixel[3] = 255;
+            }
+        }
+        passed &= round_trip("runs", rgba, width, height);
+    }
+    {
+        const int width = 256, height = 256;
+        std::vector<uint8_t> rgba(4 * width * height);
+        for (int y = 0; y < height; y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                uint8_t *pixel = &rgba[4 * (y * width + x)];
+                pixel[0] = x;
+                pixel[1] = (x + y) / 2;
+                pixel[2] = y;
+                pixel[3] = 255;
+            }
+        }
+        passed &= round_trip("gradient", rgba, width, height);
+    }
+    {
+        const int width = 128, height = 128;
+        const uint8_t colors[][3] = { {0, 0, 0}, {255, 255, 255}, {255, 0, 0}, {10, 200, 30}, {0, 0, 255}, {128, 64, 32} };
+        std::vector<uint8_t> rgba(4 * width * height);
+        for (int i = 0; i < width * height; i++)
+        {
+            const uint8_t *color = colors[rng() % (sizeof(colors) / sizeof(colors[0]))];
+            memcpy(&rgba[4 * i], color, 3);
+            rgba[4 * i + 3] = 255;
+        }
+        passed &= round_trip("colors", rgba, width, height);
+    }
+    {
+        const int width = 97, height = 61;
+        std::vector<uint8_t> rgba(4 * width * height);
+        for (int i = 0; i < width * height; i++)
+        {
+            for (int c = 0; c < 3; c++) rgba[4 * i + c] = rng();
+            rgba[4 * i + 3] = 255;
+        }
+        passed &= round_trip("noise", rgba, width, height);
+    }
+    printf(passed ? "All image file tests passed.\n" : "Image file tests failed.\n");
+    return passed ? 0 : 1;
+}
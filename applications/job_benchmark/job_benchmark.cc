@@ -0,0 +1,117 @@
+/*
+ * Job system benchmark.
+ *
+ * Measures, for 1, 2, 4, ... workers up to the given maximum (default: one per hardware thread):
+ *     empty:        throughput of empty jobs submitted in batches from the main thread.
+ *     spawn:        throughput of jobs that recursively spawn and wait for two children,
+ *                   which exercises stealing and nested waits.
+ *     parallel_for: speedup of a compute-bound parallel_for over one worker.
+ *
+ * The job system is built into the benchmark with optimization (see GNUmakefile), so the
+ * numbers don't reflect the engine library's unoptimized build.
+ *
+ * Usage: job_benchmark [max_workers] [--pin]
+ */
+#include "jobs/job_system.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <vector>
+
+#define NUM_EMPTY_JOBS (1u << 20)
+#define EMPTY_JOB_BATCH 256u
+#define SPAWN_DEPTH 18
+#define PARALLEL_FOR_COUNT (1u << 24)
+#define PARALLEL_FOR_GRAIN 4096u
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void empty_job(void *data)
+{
+}
+
+struct SpawnData
+{
+    JobSystem *jobs;
+    int depth;
+};
+
+static void spawn_job(void *data)
+{
+    SpawnData *spawn = (SpawnData *) data;
+    if ( spawn->depth == 0 ) return;
+    SpawnData children[2] = {{spawn->jobs, spawn->depth - 1}, {spawn->jobs, spawn->depth - 1}};
+    Job child_jobs[2] = {{spawn_job, &children[0]}, {spawn_job, &children[1]}};
+    JobCounter counter;
+    spawn->jobs->submit(child_jobs, 2, &counter);
+    spawn->jobs->wait(&counter);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t max_workers = std::max(std::thread::hardware_concurrency(), 1u);
+    bool pin = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if ( strcmp(argv[i], "--pin") == 0 ) pin = true;
+        else max_workers = atoi(argv[i]);
+    }
+    printf("hardware threads: %u, pinning: %s\n", std::thread::hardware_concurrency(), pin ? "yes" : "no");
+    printf("%8s %16s %16s %16s %10s %10s\n", "workers", "empty (Mjobs/s)", "spawn (Mjobs/s)", "for (ms)", "speedup", "stolen");
+
+    std::vector<float> values(PARALLEL_FOR_COUNT);
+    for (uint32_t i = 0; i < PARALLEL_FOR_COUNT; i++) values[i] = i * 1e-4f;
+    std::vector<float> results(PARALLEL_FOR_COUNT);
+    double single_worker_for_time = 0;
+
+    for (uint32_t num_workers = 1; ; num_workers = std::min(2 * num_workers, max_workers))
+    {
+        JobSystem jobs;
+        jobs.init(num_workers, pin);
+
+        auto start = std::chrono::steady_clock::now();
+        {
+            Job batch[EMPTY_JOB_BATCH];
+            for (uint32_t i = 0; i < EMPTY_JOB_BATCH; i++) batch[i] = {empty_job, nullptr};
+            JobCounter counter;
+            for (uint32_t i = 0; i < NUM_EMPTY_JOBS; i += EMPTY_JOB_BATCH) jobs.submit(batch, EMPTY_JOB_BATCH, &counter);
+            jobs.wait(&counter);
+        }
+        double empty_time = seconds_since(start);
+
+        jobs.reset_statistics();
+        start = std::chrono::steady_clock::now();
+        {
+            SpawnData root = {&jobs, SPAWN_DEPTH};
+            JobCounter counter;
+            jobs.submit({spawn_job, &root}, &counter);
+            jobs.wait(&counter);
+        }
+        double spawn_time = seconds_since(start);
+        uint64_t stolen = 0;
+        for (uint32_t i = 0; i < num_workers; i++) stolen += jobs.statistics(i).jobs_stolen;
+        double num_spawned = (double) ((2u << SPAWN_DEPTH) - 1);
+
+        start = std::chrono::steady_clock::now();
+        jobs.parallel_for(PARALLEL_FOR_COUNT, PARALLEL_FOR_GRAIN, [&](uint32_t begin, uint32_t end) {
+            for (uint32_t i = begin; i < end; i++) results[i] = sinf(values[i]) * cosf(values[i]) + sqrtf(values[i]);
+        });
+        double for_time = seconds_since(start);
+        if ( num_workers == 1 ) single_worker_for_time = for_time;
+
+        printf("%8u %16.2f %16.2f %16.2f %10.2f %10lu\n",
+               num_workers,
+               NUM_EMPTY_JOBS / empty_time * 1e-6,
+               num_spawned / spawn_time * 1e-6,
+               for_time * 1e3,
+               single_worker_for_time / for_time,
+               (unsigned long) stolen);
+        jobs.shutdown();
+        if ( num_workers == max_workers ) break;
+    }
+}
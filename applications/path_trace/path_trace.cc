@@ -0,0 +1,136 @@
+/*
+ * Headless path tracing, without a GPU.
+ *
+ * Builds a scene of spheres on a floor lit by point lights, and path traces it with the renderer's
+ * CPU API. First measures the time per sample with 1, 2, 4, ... workers up to the maximum
+ * (default: one per hardware thread), then accumulates the given number of samples on every
+ * worker and saves the image as a PPM.
+ *
+ * Usage: path_trace [samples] [output.ppm] [max_workers]
+ */
+#include "renderer/renderer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <chrono>
+#include <vector>
+
+#define IMAGE_WIDTH 640
+#define IMAGE_HEIGHT 360
+#define DEFAULT_SAMPLES 64
+#define SCALING_SAMPLES 4
+#define SPHERE_RINGS 24
+#define SPHERE_SEGMENTS 48
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static RenderEntity create_mesh(Renderer *renderer, std::vector<vec3> &positions, std::vector<vec3> &normals, std::vector<uint32_t> &indices)
+{
+    PolygonMeshCreateInfo info = {};
+    info.num_vertices = positions.size();
+    info.positions = &positions[0];
+    info.normals = &normals[0];
+    info.num_indices = indices.size();
+    info.indices = &indices[0];
+    info.vertex_format = VertexFormat::Float;
+    return renderer->create_polygon_mesh(info);
+}
+
+static void build_scene(Renderer *renderer)
+{
+    // Floor.
+    {
+        std::vector<vec3> positions = { vec3(-20, 0, -20), vec3(20, 0, -20), vec3(20, 0, 20), vec3(-20, 0, 20) };
+        std::vector<vec3> normals(4, vec3(0, 1, 0));
+        std::vector<uint32_t> indices = { 0, 2, 1, 0, 3, 2 };
+        create_mesh(renderer, positions, normals, indices);
+    }
+    // A grid of unit spheres.
+    std::vector<vec3> positions;
+    std::vector<vec3> normals;
+    std::vector<uint32_t> indices;
+    for (int r = 0; r <= SPHERE_RINGS; r++)
+    {
+        float theta = M_PI * r / SPHERE_RINGS;
+        for (int s = 0; s <= SPHERE_SEGMENTS; s++)
+        {
+            float phi = 2 * M_PI * s / SPHERE_SEGMENTS;
+            vec3 n = vec3(sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi));
+            positions.push_back(n);
+            normals.push_back(n);
+        }
+    }
+    for (int r = 0; r < SPHERE_RINGS; r++)
+    {
+        for (int s = 0; s < SPHERE_SEGMENTS; s++)
+        {
+            uint32_t a = r * (SPHERE_SEGMENTS + 1) + s;
+            uint32_t b = a + SPHERE_SEGMENTS + 1;
+            indices.insert(indices.end(), {a, a + 1, b, a + 1, b + 1, b});
+        }
+    }
+    RenderEntity first_sphere = create_mesh(renderer, positions, normals, indices);
+    for (int z = -2; z <= 2; z++)
+    {
+        for (int x = -2; x <= 2; x++)
+        {
+            RenderEntity sphere = x == -2 && z == -2 ? first_sphere : renderer->create_polygon_mesh_instance(first_sphere);
+            renderer->set_transform(sphere, renderer->create_transform(vec3(3 * x, 1, 3 * z), vec3(0)));
+        }
+    }
+    vec4 light_colors[3] = { vec4(30, 20, 12, 1), vec4(8, 14, 30, 1), vec4(20, 20, 20, 1) };
+    vec3 light_positions[3] = { vec3(-5, 5, 3), vec3(6, 3, -4), vec3(0, 8, -8) };
+    for (int i = 0; i < 3; i++)
+    {
+        RenderEntity light = renderer->create_point_light();
+        renderer->set_attribute(light, AttributeType::Color, light_colors[i]);
+        renderer->set_transform(light, renderer->create_transform(light_positions[i], vec3(0)));
+    }
+    renderer->set_transform(renderer->get_camera(), renderer->create_transform(vec3(0, 7, 15), vec3(-0.45f, 0, 0)));
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t num_samples = argc > 1 ? atoi(argv[1]) : DEFAULT_SAMPLES;
+    const char *output_path = argc > 2 ? argv[2] : "path_trace.ppm";
+    uint32_t max_workers = argc > 3 ? atoi(argv[3]) : std::max(std::thread::hardware_concurrency(), 1u);
+
+    printf("%8s %16s %16s %10s\n", "workers", "sample (ms)", "Mpixels/s", "speedup");
+    double single_worker_time = 0;
+    for (uint32_t num_workers = 1; ; num_workers = std::min(2 * num_workers, max_workers))
+    {
+        JobSystem jobs;
+        jobs.init(num_workers, false);
+        {
+            Renderer renderer;
+            renderer.set_cpu_api();
+            renderer.set_job_system(&jobs);
+            build_scene(&renderer);
+            PathTracer path_tracer;
+            path_tracer.resize(IMAGE_WIDTH, IMAGE_HEIGHT);
+            // The first sample also builds the acceleration structures.
+            renderer.path_trace(&path_tracer);
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < SCALING_SAMPLES; i++) renderer.path_trace(&path_tracer);
+            double sample_time = seconds_since(start) / SCALING_SAMPLES;
+            if ( num_workers == 1 ) single_worker_time = sample_time;
+            printf("%8u %16.2f %16.2f %10.2f\n",
+                   num_workers,
+                   sample_time * 1e3,
+                   IMAGE_WIDTH * IMAGE_HEIGHT / sample_time * 1e-6,
+                   single_worker_time / sample_time);
+
+            if ( num_workers == max_workers )
+            {
+                while ( path_tracer.num_samples() < num_samples ) renderer.path_trace(&path_tracer);
+                if ( path_tracer.save_image(output_path) )
+                    printf("Saved %u samples per pixel to \"%s\".\n", path_tracer.num_samples(), output_path);
+            }
+        }
+        jobs.shutdown();
+        if ( num_workers == max_workers ) break;
+    }
+}
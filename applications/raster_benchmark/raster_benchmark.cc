@@ -0,0 +1,214 @@
+/*
+ * Software rasterizer benchmark.
+ *
+ * Scatters instances of a sphere and a torus through a box in front of the camera, lit by point
+ * lights, and renders it with the renderer's CPU API (see rasterizer.h) at 1920x1080. Measures
+ * the time per frame with 1, 2, 4, ... workers up to the maximum (default: one per hardware
+ * thread), then saves the last frame as a PPM.
+ *
+ * Given a capture format (ppm, qoi or png), then also measures the time per frame while writing
+ * each frame to raster_benchmark_NNN files: encoding and writing after each frame on the render
+ * thread, and with the renderer's frame capture, encoding on the workers (see frame_capture.h).
+ *
+ * Usage: raster_benchmark [num_instances] [output.ppm] [max_workers] [capture_format]
+ */
+#include "renderer/renderer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#define IMAGE_WIDTH 1920
+#define IMAGE_HEIGHT 1080
+#define DEFAULT_NUM_INSTANCES 2000
+#define NUM_LIGHTS 64
+#define NUM_FRAMES 8
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+struct MeshData
+{
+    std::vector<vec3> positions;
+    std::vector<vec3> normals;
+    std::vector<uint32_t> indices;
+};
+
+static void build_sphere(MeshData *mesh, int rings, int segments)
+{
+    for (int r = 0; r <= rings; r++)
+    {
+        float theta = M_PI * r / rings;
+        for (int s = 0; s <= segments; s++)
+        {
+            float phi = 2 * M_PI * s / segments;
+            vec3 n = vec3(sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi));
+            mesh->positions.push_back(0.5f * n);
+            mesh->normals.push_back(n);
+        }
+    }
+    for (int r = 0; r < rings; r++)
+    {
+        for (int s = 0; s < segments; s++)
+        {
+            uint32_t a = r * (segments + 1) + s;
+            uint32_t b = a + segments + 1;
+            mesh->indices.insert(mesh->indices.end(), {a, a + 1, b, a + 1, b + 1, b});
+        }
+    }
+}
+
+static void build_torus(MeshData *mesh, int rings, int segments)
+{
+    for (int r = 0; r <= rings; r++)
+    {
+        float theta = 2 * M_PI * r / rings;
+        for (int s = 0; s <= segments; s++)
+        {
+            float phi = 2 * M_PI * s / segments;
+            float radius = 0.35f + 0.15f * cosf(phi);
+            mesh->positions.push_back(vec3(radius * cosf(theta), 0.15f * sinf(phi), radius * sinf(theta)));
+            mesh->normals.push_back(vec3(cosf(phi) * cosf(theta), sinf(phi), cosf(phi) * sinf(theta)));
+        }
+    }
+    for (int r = 0; r < rings; r++)
+    {
+        for (int s = 0; s < segments; s++)
+        {
+            uint32_t a = r * (segments + 1) + s;
+            uint32_t b = a + segments + 1;
+            mesh->indices.insert(mesh->indices.end(), {a, a + 1, b, a + 1, b + 1, b});
+        }
+    }
+}
+
+static uint32_t build_scene(Renderer *renderer, uint32_t num_instances)
+{
+    MeshData meshes[2];
+    build_sphere(&meshes[0], 32, 64);
+    build_torus(&meshes[1], 48, 24);
+    RenderEntity prototypes[2];
+    for (int i = 0; i < 2; i++)
+    {
+        PolygonMeshCreateInfo info = {};
+        info.num_vertices = meshes[i].positions.size();
+        info.positions = &meshes[i].positions[0];
+        info.normals = &meshes[i].normals[0];
+        info.num_indices = meshes[i].indices.size();
+        info.indices = &meshes[i].indices[0];
+        info.vertex_format = VertexFormat::Float;
+        prototypes[i] = renderer->create_polygon_mesh(info);
+    }
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> unit(0.f, 1.f);
+    float size = cbrtf((float) num_instances);
+    uint32_t num_triangles = 0;
+    for (uint32_t i = 0; i < num_instances; i++)
+    {
+        // The prototypes are the first two instances.
+        RenderEntity mesh = i < 2 ? prototypes[i] : renderer->create_polygon_mesh_instance(prototypes[i % 2]);
+        vec3 position = size * vec3(unit(random) - 0.5f, unit(random) - 0.5f, -unit(random));
+        vec3 angles = 2 * (float) M_PI * vec3(unit(random), unit(random), unit(random));
+        renderer->set_transform(mesh, renderer->create_transform(position, angles));
+        num_triangles += meshes[i % 2].indices.size() / 3;
+    }
+    for (int i = 0; i < NUM_LIGHTS; i++)
+    {
+        RenderEntity light = renderer->create_point_light();
+        vec3 color = vec3(unit(random), unit(random), unit(random));
+        renderer->set_attribute(light, AttributeType::Color, vec4(0.1f * size * size * color, 1));
+        vec3 position = size * vec3(unit(random) - 0.5f, unit(random) - 0.5f, -unit(random));
+        renderer->set_transform(light, renderer->create_transform(position, vec3(0)));
+    }
+    renderer->set_transform(renderer->get_camera(), renderer->create_transform(vec3(0, 0, 0.6f * size), vec3(0)));
+    return num_triangles;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t num_instances = argc > 1 ? atoi(argv[1]) : DEFAULT_NUM_INSTANCES;
+    const char *output_path = argc > 2 ? argv[2] : "raster_benchmark.ppm";
+    uint32_t max_workers = argc > 3 ? atoi(argv[3]) : std::max(std::thread::hardware_concurrency(), 1u);
+    const char *capture_format = argc > 4 ? argv[4] : nullptr;
+    ImageFileFormat format = ImageFileFormat::PPM;
+    if ( capture_format != nullptr )
+    {
+        if ( strcmp(capture_format, "qoi") == 0 ) format = ImageFileFormat::QOI;
+        else if ( strcmp(capture_format, "png") == 0 ) format = ImageFileFormat::PNG;
+        else if ( strcmp(capture_format, "ppm") != 0 )
+        {
+            fprintf(stderr, "Unknown capture format \"%s\", expected ppm, qoi or png.\n", capture_format);
+            return 1;
+        }
+    }
+
+    printf("%8s %16s %16s %10s\n", "workers", "frame (ms)", "Mtriangles/s", "speedup");
+    double single_worker_time = 0;
+    for (uint32_t num_workers = 1; ; num_workers = std::min(2 * num_workers, max_workers))
+    {
+        JobSystem jobs;
+        jobs.init(num_workers, false);
+        {
+            Renderer renderer;
+            renderer.set_cpu_api();
+            renderer.set_job_system(&jobs);
+            uint32_t num_triangles = build_scene(&renderer, num_instances);
+            // The first frame also builds the acceleration structures.
+            uint32_t frame_slot = 0;
+            renderer.render(0, 0, IMAGE_WIDTH, IMAGE_HEIGHT, frame_slot);
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < NUM_FRAMES; i++)
+            {
+                frame_slot = (frame_slot + 1) % PLATFORM_FRAMES_IN_FLIGHT;
+                renderer.render(0, 0, IMAGE_WIDTH, IMAGE_HEIGHT, frame_slot);
+            }
+            double frame_time = seconds_since(start) / NUM_FRAMES;
+            if ( num_workers == 1 ) single_worker_time = frame_time;
+            printf("%8u %16.2f %16.2f %10.2f\n",
+                   num_workers,
+                   frame_time * 1e3,
+                   num_triangles / frame_time * 1e-6,
+                   single_worker_time / frame_time);
+
+            if ( num_workers == max_workers && renderer.cpu_frame().save_image(output_path) )
+                printf("Saved \"%s\".\n", output_path);
+
+            if ( num_workers == max_workers && capture_format != nullptr )
+            {
+                char path_format[64];
+                snprintf(path_format, sizeof(path_format), "raster_benchmark_%%03u.%s", image_file_extension(format));
+                std::vector<uint8_t> encoded;
+                start = std::chrono::steady_clock::now();
+                for (int i = 0; i < NUM_FRAMES; i++)
+                {
+                    frame_slot = (frame_slot + 1) % PLATFORM_FRAMES_IN_FLIGHT;
+                    renderer.render(0, 0, IMAGE_WIDTH, IMAGE_HEIGHT, frame_slot);
+                    char path[64];
+                    snprintf(path, sizeof(path), path_format, i);
+                    encode_image(format, renderer.cpu_frame().image(), IMAGE_WIDTH, IMAGE_HEIGHT, &encoded);
+                    write_image_file(path, encoded);
+                }
+                double synchronous_time = seconds_since(start) / NUM_FRAMES;
+
+                start = std::chrono::steady_clock::now();
+                renderer.start_capture(path_format, format);
+                for (int i = 0; i < NUM_FRAMES; i++)
+                {
+                    frame_slot = (frame_slot + 1) % PLATFORM_FRAMES_IN_FLIGHT;
+                    renderer.render(0, 0, IMAGE_WIDTH, IMAGE_HEIGHT, frame_slot);
+                }
+                renderer.stop_capture();
+                double capture_time = seconds_since(start) / NUM_FRAMES;
+                printf("Writing %s frames: %.2f ms per frame on the render thread, %.2f ms with frame capture.\n",
+                       capture_format, synchronous_time * 1e3, capture_time * 1e3);
+            }
+        }
+        jobs.shutdown();
+        if ( num_workers == max_workers ) break;
+    }
+}
@@ -0,0 +1,191 @@
+/*
+ * Ray query benchmark.
+ *
+ * Scatters mesh instances (spheres and tori of a few thousand triangles) with random positions
+ * and rotations through a cube, builds the instance and mesh BVHs, and measures ray query
+ * throughput for:
+ *     primary: rays from a camera outside the cube through a grid of pixels, which are coherent.
+ *     random:  rays from random points in random directions, which are incoherent.
+ * as closest-hit and any-hit queries, on the calling thread alone and split over every worker.
+ *
+ * Usage: ray_benchmark [num_instances] [max_workers]
+ */
+#include "jobs/job_system.h"
+#include "renderer/ray_query.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#define DEFAULT_NUM_INSTANCES 100000
+#define PRIMARY_RAYS_WIDTH 1024
+#define PRIMARY_RAYS_HEIGHT 1024
+#define NUM_RANDOM_RAYS (1u << 20)
+// Instances per unit of volume, each about a unit across.
+#define INSTANCE_DENSITY 0.02f
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void build_sphere(std::vector<vec3> *positions, std::vector<uint32_t> *indices, int rings, int segments)
+{
+    for (int r = 0; r <= rings; r++)
+    {
+        float theta = M_PI * r / rings;
+        for (int s = 0; s <= segments; s++)
+        {
+            float phi = 2 * M_PI * s / segments;
+            positions->push_back(0.5f * vec3(sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi)));
+        }
+    }
+    for (int r = 0; r < rings; r++)
+    {
+        for (int s = 0; s < segments; s++)
+        {
+            uint32_t a = r * (segments + 1) + s;
+            uint32_t b = a + segments + 1;
+            indices->insert(indices->end(), {a, b, a + 1, a + 1, b, b + 1});
+        }
+    }
+}
+
+static void build_torus(std::vector<vec3> *positions, std::vector<uint32_t> *indices, int rings, int segments)
+{
+    for (int r = 0; r <= rings; r++)
+    {
+        float theta = 2 * M_PI * r / rings;
+        for (int s = 0; s <= segments; s++)
+        {
+            float phi = 2 * M_PI * s / segments;
+            float radius = 0.35f + 0.15f * cosf(phi);
+            positions->push_back(vec3(radius * cosf(theta), 0.15f * sinf(phi), radius * sinf(theta)));
+        }
+    }
+    for (int r = 0; r < rings; r++)
+    {
+        for (int s = 0; s < segments; s++)
+        {
+            uint32_t a = r * (segments + 1) + s;
+            uint32_t b = a + segments + 1;
+            indices->insert(indices->end(), {a, a + 1, b, a + 1, b + 1, b});
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t num_instances = argc > 1 ? atoi(argv[1]) : DEFAULT_NUM_INSTANCES;
+    uint32_t max_workers = argc > 2 ? atoi(argv[2]) : 0;
+    JobSystem jobs;
+    jobs.init(max_workers, false);
+    printf("instances: %u, workers: %u, packet size: %u\n", num_instances, jobs.num_workers(), RAY_PACKET_SIZE);
+
+    // Meshes.
+    const int num_meshes = 3;
+    MeshBvh meshes[num_meshes];
+    Aabb mesh_bounds[num_meshes];
+    uint32_t num_triangles = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int m = 0; m < num_meshes; m++)
+    {
+        std::vector<vec3> positions;
+        std::vector<uint32_t> indices;
+        if ( m == 0 ) build_sphere(&positions, &indices, 32, 64);
+        else if ( m == 1 ) build_sphere(&positions, &indices, 8, 16);
+        else build_torus(&positions, &indices, 48, 24);
+        meshes[m].build(&jobs, &positions[0], positions.size(), &indices[0], indices.size());
+        for (vec3 p : positions) mesh_bounds[m].grow(p);
+        num_triangles += indices.size() / 3;
+    }
+    printf("mesh BVHs: %u triangles in %.2f ms\n", num_triangles, seconds_since(start) * 1e3);
+
+    // Instances.
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> unit(0.f, 1.f);
+    float scene_size = cbrtf(num_instances / INSTANCE_DENSITY);
+    std::vector<Aabb> instance_bounds(num_instances);
+    std::vector<RayQueryInstance> instances(num_instances);
+    for (uint32_t i = 0; i < num_instances; i++)
+    {
+        Transform transform;
+        transform.position = scene_size * vec3(unit(random), unit(random), unit(random));
+        transform.euler_angles = 2 * (float) M_PI * vec3(unit(random), unit(random), unit(random));
+        mat4 object_to_world = transform.matrix();
+        int mesh = i % num_meshes;
+        instance_bounds[i] = transform_aabb(object_to_world, mesh_bounds[mesh]);
+        instances[i].mesh = &meshes[mesh];
+        instances[i].world_to_object = glm::inverse(object_to_world);
+    }
+    Bvh instance_bvh;
+    start = std::chrono::steady_clock::now();
+    instance_bvh.build(&jobs, &instance_bounds[0], num_instances);
+    double build_time = seconds_since(start);
+    start = std::chrono::steady_clock::now();
+    instance_bvh.refit(&instance_bounds[0]);
+    double refit_time = seconds_since(start);
+    printf("instance BVH: %zu nodes, built in %.2f ms, refit in %.2f ms, SAH cost %.1f\n",
+           instance_bvh.nodes().size(), build_time * 1e3, refit_time * 1e3, instance_bvh.sah_cost());
+
+    // Rays.
+    std::vector<Ray> primary_rays(PRIMARY_RAYS_WIDTH * PRIMARY_RAYS_HEIGHT);
+    vec3 camera_position = vec3(0.5f * scene_size, 0.5f * scene_size, -0.5f * scene_size);
+    float tan_half_fov = tanf(0.5f * glm::radians(60.f));
+    for (uint32_t y = 0; y < PRIMARY_RAYS_HEIGHT; y++)
+    {
+        for (uint32_t x = 0; x < PRIMARY_RAYS_WIDTH; x++)
+        {
+            Ray &ray = primary_rays[x + PRIMARY_RAYS_WIDTH * y];
+            ray.origin = camera_position;
+            ray.direction = glm::normalize(vec3((2 * (x + 0.5f) / PRIMARY_RAYS_WIDTH - 1) * tan_half_fov,
+                                                (1 - 2 * (y + 0.5f) / PRIMARY_RAYS_HEIGHT) * tan_half_fov,
+                                                1));
+            ray.max_distance = FLT_MAX;
+        }
+    }
+    std::vector<Ray> random_rays(NUM_RANDOM_RAYS);
+    for (Ray &ray : random_rays)
+    {
+        ray.origin = scene_size * vec3(unit(random), unit(random), unit(random));
+        vec3 direction;
+        do direction = 2.f * vec3(unit(random), unit(random), unit(random)) - 1.f; while ( glm::dot(direction, direction) > 1 || glm::dot(direction, direction) < 1e-6f );
+        ray.direction = glm::normalize(direction);
+        ray.max_distance = scene_size;
+    }
+
+    printf("%8s %10s %10s %16s %16s %8s\n", "rays", "query", "count", "1 thread (Mr/s)", "workers (Mr/s)", "hits");
+    struct Batch
+    {
+        const char *name;
+        const std::vector<Ray> *rays;
+    };
+    Batch batches[] = {{"primary", &primary_rays}, {"random", &random_rays}};
+    std::vector<RayHit> hits;
+    for (const Batch &batch : batches)
+    {
+        uint32_t num_rays = batch.rays->size();
+        hits.resize(num_rays);
+        for (RayQueryType type : {RayQueryType::ClosestHit, RayQueryType::AnyHit})
+        {
+            start = std::chrono::steady_clock::now();
+            trace_rays(nullptr, type, instance_bvh, &instances[0], &(*batch.rays)[0], num_rays, &hits[0]);
+            double single_time = seconds_since(start);
+            start = std::chrono::steady_clock::now();
+            trace_rays(&jobs, type, instance_bvh, &instances[0], &(*batch.rays)[0], num_rays, &hits[0]);
+            double parallel_time = seconds_since(start);
+            uint32_t num_hits = 0;
+            for (const RayHit &hit : hits) num_hits += hit.instance != RAY_MISS;
+            printf("%8s %10s %10u %16.2f %16.2f %7.1f%%\n",
+                   batch.name,
+                   type == RayQueryType::ClosestHit ? "closest" : "any",
+                   num_rays,
+                   num_rays / single_time * 1e-6,
+                   num_rays / parallel_time * 1e-6,
+                   100.0 * num_hits / num_rays);
+        }
+    }
+    jobs.shutdown();
+}
@@ -1,8 +1,183 @@
 #include "engine.h"
 #include "renderer/renderer.h"
+#include "renderer/vertex_format.h"
 #include "platforms/glfw_vulkan_window.cc"
+#include "engine/platform/vk_print.h"
+#include "engine/memory/memory_tracking.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include <assert.h>
+#include <math.h>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+// Count heap allocations by interposing glibc's allocation functions, to check that the
+// renderer's steady-state frame doesn't allocate. Only allocations made in a renderer memory
+// scope are counted (see memory_tracking.h), which the renderer's jobs inherit on any worker,
+// so other threads, such as the platform's, the driver's and the I/O threads, don't disturb
+// the check. The warmup lasts until the scene's meshes have settled into the static shadow maps.
+#define FRAME_ALLOCATION_CHECK_WARMUP_FRAMES (RENDERER_SHADOW_SETTLE_FRAMES + 16)
+static std::atomic<uint64_t> g_num_renderer_allocations(0);
+static void count_allocation()
+{
+    if ( MemoryCurrentSubsystem() == MemorySubsystem::Renderer )
+        g_num_renderer_allocations.fetch_add(1, std::memory_order_relaxed);
+}
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t num, size_t size);
+extern "C" void *__libc_realloc(void *pointer, size_t size);
+extern "C" void *__libc_memalign(size_t alignment, size_t size);
+extern "C" void *__libc_valloc(size_t size);
+extern "C" void *__libc_pvalloc(size_t size);
+extern "C" void *malloc(size_t size)
+{
+    count_allocation();
+    return __libc_malloc(size);
+}
+extern "C" void *calloc(size_t num, size_t size)
+{
+    count_allocation();
+    return __libc_calloc(num, size);
+}
+extern "C" void *realloc(void *pointer, size_t size)
+{
+    count_allocation();
+    return __libc_realloc(pointer, size);
+}
+extern "C" void *memalign(size_t alignment, size_t size)
+{
+    count_allocation();
+    return __libc_memalign(alignment, size);
+}
+extern "C" void *aligned_alloc(size_t alignment, size_t size)
+{
+    count_allocation();
+    return __libc_memalign(alignment, size);
+}
+extern "C" int posix_memalign(void **pointer, size_t alignment, size_t size)
+{
+    count_allocation();
+    if ( alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0 ) return EINVAL;
+    void *allocation = __libc_memalign(alignment, size);
+    if ( allocation == nullptr ) return ENOMEM;
+    *pointer = allocation;
+    return 0;
+}
+extern "C" void *valloc(size_t size)
+{
+    count_allocation();
+    return __libc_valloc(size);
+}
+extern "C" void *pvalloc(size_t size)
+{
+    count_allocation();
+    return __libc_pvalloc(size);
+}
+
+struct MeshData
+{
+    std::vector<vec3> positions;
+    std::vector<vec3> normals;
+    std::vector<uint32_t> indices;
+};
+
+static void add_grid_indices(MeshData *mesh, int rings, int segments)
+{
+    for (int r = 0; r < rings; r++)
+    {
+        for (int s = 0; s < segments; s++)
+        {
+            uint32_t a = r * (segments + 1) + s;
+            uint32_t b = a + segments + 1;
+            mesh->indices.insert(mesh->indices.end(), {a, a + 1, b, a + 1, b + 1, b});
+        }
+    }
+}
+
+static void build_sphere(MeshData *mesh, int rings, int segments)
+{
+    for (int r = 0; r <= rings; r++)
+    {
+        float theta = M_PI * r / rings;
+        for (int s = 0; s <= segments; s++)
+        {
+            float phi = 2 * M_PI * s / segments;
+            vec3 n = vec3(sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi));
+            mesh->positions.push_back(0.5f * n);
+            mesh->normals.push_back(n);
+        }
+    }
+    add_grid_indices(mesh, rings, segments);
+}
+
+static void build_torus(MeshData *mesh, int rings, int segments)
+{
+    for (int r = 0; r <= rings; r++)
+    {
+        float theta = 2 * M_PI * r / rings;
+        for (int s = 0; s <= segments; s++)
+        {
+            float phi = 2 * M_PI * s / segments;
+            float radius = 0.35f + 0.15f * cosf(phi);
+            mesh->positions.push_back(vec3(radius * cosf(theta), 0.15f * sinf(phi), radius * sinf(theta)));
+            mesh->normals.push_back(vec3(cosf(phi) * cosf(theta), sinf(phi), cosf(phi) * sinf(theta)));
+        }
+    }
+    add_grid_indices(mesh, rings, segments);
+}
+
+static RenderEntity create_mesh(Renderer *renderer, MeshData &data, VertexFormat format, bool build_meshlets, bool build_lods)
+{
+    PolygonMeshCreateInfo info = {};
+    info.num_vertices = data.positions.size();
+    info.positions = &data.positions[0];
+    info.normals = &data.normals[0];
+    info.num_indices = data.indices.size();
+    info.indices = &data.indices[0];
+    info.vertex_format = format;
+    info.optimize = true;
+    info.build_meshlets = build_meshlets;
+    info.build_lods = build_lods;
+    return renderer->create_polygon_mesh(info);
+}
+
+// A row of instanced spheres, a row of instanced tori with LODs in a quantized format, and a
+// dense sphere culled by meshlets, lit by shadowed point lights, so that steady-state frames do
+// the renderer's per-entity work.
+static void build_scene(Renderer *renderer)
+{
+    MeshData sphere, torus, dense_sphere;
+    build_sphere(&sphere, 16, 32);
+    build_torus(&torus, 48, 24);
+    build_sphere(&dense_sphere, 128, 256);
+
+    RenderEntity sphere_mesh = create_mesh(renderer, sphere, VertexFormat::Float, false, false);
+    RenderEntity torus_mesh = create_mesh(renderer, torus, VertexFormat::QuantizedOct16, false, true);
+    const int row_length = 8;
+    for (int i = 0; i < row_length; i++)
+    {
+        RenderEntity mesh = i == 0 ? sphere_mesh : renderer->create_polygon_mesh_instance(sphere_mesh);
+        renderer->set_transform(mesh, renderer->create_transform(vec3(1.2f * (i - row_length / 2), -0.8f, -4 - i), vec3(0)));
+        mesh = i == 0 ? torus_mesh : renderer->create_polygon_mesh_instance(torus_mesh);
+        renderer->set_transform(mesh, renderer->create_transform(vec3(1.2f * (i - row_length / 2), 0.8f, -4 - i), vec3(0.3f * i, 0, 0.5f)));
+    }
+    // Only meshes not sharing their geometry are culled by meshlets.
+    RenderEntity dense_mesh = create_mesh(renderer, dense_sphere, VertexFormat::Float, true, false);
+    renderer->set_transform(dense_mesh, renderer->create_transform(vec3(0, 0, -3), vec3(0)));
+
+    const vec3 light_colors[] = { vec3(4, 3, 2), vec3(1, 2, 4), vec3(3, 1, 1), vec3(1, 3, 1) };
+    for (int i = 0; i < 4; i++)
+    {
+        RenderEntity light = renderer->create_point_light();
+        renderer->set_attribute(light, AttributeType::Color, vec4(light_colors[i], 1));
+        renderer->set_transform(light, renderer->create_transform(vec3(3.f * i - 4.5f, 2, -2 - 2.f * i), vec3(0)));
+    }
+
+    renderer->set_transform(renderer->get_camera(), renderer->create_transform(vec3(0, 0, 2), vec3(0)));
+}
 
 class Application : public PlatformListener
 {
@@ -11,36 +186,177 @@ public:
     void mouse_event_handler(MouseEvent e) override;
     void window_event_handler(WindowEvent e) override;
     void display_refresh_event_handler(DisplayRefreshEvent e) override;
-    Application(Renderer &renderer) :
-        m_renderer{renderer}
+    void start_capture(const char *path_format);
+    void shutdown();
+    // Whether a check failed.
+    bool failed() const { return m_failed; }
+    // Exit the loop once num_frames frames have been checked after the warmup, or never if 0.
+    Application(Platform *platform, Renderer &renderer, uint64_t num_frames) :
+        m_platform{platform}, m_renderer{renderer}, m_num_checked_frames{num_frames}
     {
     }
 private:
+    Platform *m_platform;
     Renderer &m_renderer;
+    uint64_t m_num_checked_frames;
+    uint64_t m_num_frames = 0;
+    // Steady-state frames are checked from this frame on.
+    uint64_t m_warmup_end = FRAME_ALLOCATION_CHECK_WARMUP_FRAMES;
+    bool m_checked_meshlets = false;
+    bool m_failed = false;
+    bool m_capturing = false;
+    // Of the last rendered frame, to convert the cursor to pixels.
+    int m_width = 0;
+    int m_height = 0;
 };
 
 void Application::keyboard_event_handler(KeyboardEvent e)
 {
+    if ( e.action == KEYBOARD_PRESS && e.key.code == KEY_M )
+    {
+        // Needs a build with MEMORY_TRACKING=1.
+        Json::Value statistics = MemoryStatisticsJson();
+        Json::cout << statistics << "\n";
+    }
+    if ( e.action == KEYBOARD_PRESS && e.key.code == KEY_C )
+    {
+        // Toggle capturing the presented frames to capture_00000.qoi, ...
+        if ( m_capturing )
+        {
+            m_renderer.stop_capture();
+            m_capturing = false;
+        }
+        else
+        {
+            start_capture("capture_%05u.qoi");
+        }
+    }
+}
+void Application::start_capture(const char *path_format)
+{
+    m_capturing = m_renderer.start_capture(path_format, ImageFileFormat::QOI);
+    // The capture's readback and encode buffers are created over its first frames.
+    if ( m_capturing ) m_warmup_end = std::max(m_warmup_end, m_num_frames + FRAME_ALLOCATION_CHECK_WARMUP_FRAMES);
 }
 void Application::mouse_event_handler(MouseEvent e)
 {
+    // The result comes a few frames later, see display_refresh_event_handler. The cursor is
+    // normalized from the bottom left, and picks are in pixels from the top left.
+    if ( e.action == MOUSE_BUTTON_PRESS && e.button.code == MOUSE_LEFT )
+        m_renderer.request_pick(e.cursor.x * m_width, (1 - e.cursor.y) * m_height);
 }
 void Application::window_event_handler(WindowEvent e)
 {
 }
 void Application::display_refresh_event_handler(DisplayRefreshEvent e)
 {
-    m_renderer.render(0, 0, e.framebuffer.width, e.framebuffer.height);
+    uint64_t num_allocations = g_num_renderer_allocations.load(std::memory_order_relaxed);
+    m_renderer.render(0, 0, e.framebuffer.width, e.framebuffer.height, e.frame_slot, e.command_buffer, e.swap_chain_image);
+    num_allocations = g_num_renderer_allocations.load(std::memory_order_relaxed) - num_allocations;
+    m_width = e.framebuffer.width;
+    m_height = e.framebuffer.height;
+    RenderPick pick;
+    if ( m_renderer.pick_result(&pick) )
+    {
+        if ( pick.entity != RENDER_ENTITY_NULL ) printf("Picked polygon mesh %u.\n", render_entity_index(pick.entity));
+        else if ( pick.nearest != RENDER_ENTITY_NULL ) printf("Picked polygon mesh %u near the cursor.\n", render_entity_index(pick.nearest));
+        else printf("Picked nothing.\n");
+    }
+    if ( ++m_num_frames <= m_warmup_end ) return;
+    // The scene's dense sphere is drawn from meshlets culled on the GPU.
+    if ( !m_checked_meshlets )
+    {
+        printf("%u meshes drawn from culled meshlets.\n", m_renderer.meshlet_meshes_drawn());
+        if ( m_renderer.meshlet_meshes_drawn() == 0 )
+        {
+            fprintf(stderr, C_RED "[%s] No meshes were drawn from culled meshlets.\n" C_RESET, __func__);
+            m_failed = true;
+        }
+        m_checked_meshlets = true;
+    }
+    if ( num_allocations > 0 )
+    {
+        fprintf(stderr, C_RED "[%s] Frame %llu made %llu heap allocations after warmup.\n" C_RESET,
+                __func__, (unsigned long long) m_num_frames, (unsigned long long) num_allocations);
+        m_failed = true;
+    }
+    if ( m_num_checked_frames > 0 && m_num_frames == m_warmup_end + m_num_checked_frames )
+        m_platform->exit_loop();
+}
+
+void Application::shutdown()
+{
+    if ( m_capturing ) m_renderer.stop_capture();
 }
 
-int main()
+// Round-trip normals through the octahedral encoding of the quantized vertex formats, see
+// vertex_format.h. Zero normals must encode as +Z rather than NaN.
+static bool check_octahedral_normals()
 {
+    const vec3 normals[] = {
+        vec3(1, 0, 0), vec3(-1, 0, 0), vec3(0, 1, 0), vec3(0, -1, 0), vec3(0, 0, 1), vec3(0, 0, -1),
+        glm::normalize(vec3(1, 2, 3)), glm::normalize(vec3(-3, 1, -2)), glm::normalize(vec3(2, -3, -1)),
+    };
+    bool succeeded = true;
+    for (vec3 n : normals)
+    {
+        vec3 decoded = octahedral_decode(octahedral_encode(n));
+        if ( !(glm::dot(decoded, n) > 0.9999f) )
+        {
+            fprintf(stderr, C_RED "[%s] (%g, %g, %g) decoded as (%g, %g, %g).\n" C_RESET,
+                    __func__, n.x, n.y, n.z, decoded.x, decoded.y, decoded.z);
+            succeeded = false;
+        }
+    }
+    vec2 zero = octahedral_encode(vec3(0));
+    if ( zero != vec2(0) )
+    {
+        fprintf(stderr, C_RED "[%s] The zero normal encoded as (%g, %g), not +Z.\n" C_RESET, __func__, zero.x, zero.y);
+        succeeded = false;
+    }
+    return succeeded;
+}
+
+// Usage: test [--frames <count>] [--capture <path format>]
+// With --frames, that many frames are checked after the warmup, then the application exits with
+// a failure status if a check failed, so that it can run unattended. --capture captures the
+// frames from the start, to check capturing as well.
+int main(int argc, char *argv[])
+{
+    uint64_t num_frames = 0;
+    const char *capture_path_format = nullptr;
+    for (int i = 1; i < argc; i++)
+    {
+        if ( strcmp(argv[i], "--frames") == 0 && i + 1 < argc ) num_frames = strtoull(argv[++i], nullptr, 10);
+        else if ( strcmp(argv[i], "--capture") == 0 && i + 1 < argc ) capture_path_format = argv[++i];
+        else
+        {
+            fprintf(stderr, C_RED "[%s] Usage: %s [--frames <count>] [--capture <path format>]\n" C_RESET, __func__, argv[0]);
+            return 1;
+        }
+    }
+
+    if ( !check_octahedral_normals() ) return 1;
+
     std::unique_ptr<Platform_GLFWVulkanWindow> platform = Platform_GLFWVulkanWindow::create();
 
+    JobSystem jobs;
+    jobs.init(0, false);
+
     Renderer renderer;
     renderer.set_api(platform->GetVulkanSystem());
-    Application app(renderer);
+    renderer.set_job_system(&jobs);
+    VulkanCompletionWaiter gpu_waiter;
+    gpu_waiter.init(platform->GetVulkanSystem(), &jobs);
+    renderer.set_gpu_completion_waiter(&gpu_waiter);
+    build_scene(&renderer);
+    Application app(platform.get(), renderer, num_frames);
+    if ( capture_path_format != nullptr ) app.start_capture(capture_path_format);
 
     platform->add_listener(&app);
     platform->enter_loop();
+    app.shutdown();
+    gpu_waiter.shutdown();
+    jobs.shutdown();
+    return app.failed() ? 1 : 0;
 }
@@ -2,6 +2,7 @@
 #define ENGINE_H_
 
 #include "platform/platform.h"
+#include "jobs/job_system.h"
 
 #endif // ENGINE_H_
 
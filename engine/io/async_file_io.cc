@@ -0,0 +1,426 @@
+#include "async_file_io.h"
+#include "ansi_color.h"
+#include "jobs/job_system.h"
+#include "jobs/task.h"
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <assert.h>
+#include <algorithm>
+
+// user_data of ring operations that aren't reads. Read handles start at 1.
+#define WAKE_USER_DATA (~0ull)
+#define CANCEL_USER_DATA (~0ull - 1)
+// Reads are split so that their lengths fit the 32-bit length of a submission.
+#define MAX_READ_SIZE (1u << 30)
+
+static int io_uring_setup(uint32_t entries, io_uring_params *params)
+{
+    return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int ring_fd, uint32_t to_submit, uint32_t min_complete, uint32_t flags)
+{
+    return (int) syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+bool AsyncFileIO::init(uint32_t queue_depth, uint32_t num_fallback_threads, bool force_thread_pool)
+{
+    assert(queue_depth > 0 && num_fallback_threads > 0);
+    m_queue_depth = queue_depth;
+    m_completion_jobs = nullptr;
+    m_stopping = false;
+    m_next_handle = 1;
+    m_num_submitted = 0;
+    m_num_outstanding = 0;
+    m_ring_fd = -1;
+    m_wake_fd = -1;
+
+    if ( !force_thread_pool && init_uring(queue_depth) )
+    {
+        m_backend = AsyncFileIOBackend::IOUring;
+        m_threads.emplace_back(&AsyncFileIO::uring_thread_loop, this);
+    }
+    else
+    {
+        if ( !force_thread_pool )
+            fprintf(stderr, C_YELLOW "[%s] io_uring is unavailable, falling back to a pread thread pool.\n" C_RESET, __func__);
+        m_backend = AsyncFileIOBackend::ThreadPool;
+        for (uint32_t i = 0; i < num_fallback_threads; i++)
+            m_threads.emplace_back(&AsyncFileIO::fallback_thread_loop, this);
+    }
+    return true;
+}
+
+void AsyncFileIO::shutdown()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    if ( m_backend == AsyncFileIOBackend::IOUring ) wake_uring_thread();
+    m_queue_condition.notify_all();
+    for (std::thread &thread : m_threads) thread.join();
+    m_threads.clear();
+    if ( m_backend == AsyncFileIOBackend::IOUring ) destroy_uring();
+}
+
+IORequestHandle AsyncFileIO::read(const IOReadRequest &request)
+{
+    assert(request.size > 0 && request.destination != nullptr);
+    assert(request.priority < IOPriority::NUM);
+    IORequestHandle handle;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        assert(!m_stopping);
+        handle = m_next_handle++;
+        m_requests[handle] = {request, 0, RequestState::Queued, false};
+        m_queues[(int) request.priority].push_back(handle);
+        m_num_outstanding++;
+    }
+    if ( m_backend == AsyncFileIOBackend::IOUring ) wake_uring_thread();
+    else m_queue_condition.notify_one();
+    return handle;
+}
+
+bool AsyncFileIO::cancel(IORequestHandle handle)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto it = m_requests.find(handle);
+    if ( it == m_requests.end() ) return false;
+    Request &request = it->second;
+    if ( request.state == RequestState::Queued )
+    {
+        std::deque<IORequestHandle> &queue = m_queues[(int) request.info.priority];
+        queue.erase(std::find(queue.begin(), queue.end(), handle));
+        complete(lock, handle, 0, true);
+        return true;
+    }
+    if ( !request.cancel_requested )
+    {
+        request.cancel_requested = true;
+        if ( m_backend == AsyncFileIOBackend::IOUring )
+        {
+            m_cancels.push_back(handle);
+            lock.unlock();
+            wake_uring_thread();
+        }
+    }
+    return true;
+}
+
+void AsyncFileIO::wait_idle()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_idle_condition.wait(lock, [&]() { return m_num_outstanding == 0; });
+}
+
+void AsyncFileIO::complete(std::unique_lock<std::mutex> &lock, IORequestHandle handle, int error, bool cancelled)
+{
+    auto it = m_requests.find(handle);
+    assert(it != m_requests.end());
+    IOReadResult result;
+    result.handle = handle;
+    result.destination = it->second.info.destination;
+    result.bytes_read = it->second.bytes_done;
+    result.error = error;
+    result.cancelled = cancelled;
+    std::function<void(const IOReadResult &)> on_complete = std::move(it->second.info.on_complete);
+    m_requests.erase(it);
+
+    if ( m_completion_jobs != nullptr )
+    {
+        struct Completion
+        {
+            AsyncFileIO *io;
+            std::function<void(const IOReadResult &)> on_complete;
+            IOReadResult result;
+        };
+        Completion *completion = new Completion{this, std::move(on_complete), result};
+        Job job;
+        job.function = [](void *data) {
+            Completion *completion = (Completion *) data;
+            if ( completion->on_complete ) completion->on_complete(completion->result);
+            completion->io->completion_handled();
+            delete completion;
+        };
+        job.data = completion;
+        lock.unlock();
+        m_completion_jobs->submit(job, nullptr);
+        lock.lock();
+        return;
+    }
+    lock.unlock();
+    if ( on_complete ) on_complete(result);
+    lock.lock();
+    if ( --m_num_outstanding == 0 ) m_idle_condition.notify_all();
+}
+
+void IOReadAwaitable::await_suspend(std::coroutine_handle<> handle)
+{
+    // The read can complete and resume the coroutine before read() returns, destroying this
+    // awaitable with the coroutine's frame, so this is not touched after the read is issued.
+    IOReadRequest request = m_request;
+    JobSystem *jobs = m_jobs;
+    request.on_complete = [this, handle, jobs](const IOReadResult &result) {
+        m_result = result;
+        jobs->submit(resume_coroutine_job(handle), nullptr);
+    };
+    m_io->read(request);
+}
+
+void AsyncFileIO::completion_handled()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if ( --m_num_outstanding == 0 ) m_idle_condition.notify_all();
+}
+
+bool AsyncFileIO::pop_queued(IORequestHandle *handle)
+{
+    for (int priority = 0; priority < NUM_IO_PRIORITIES; priority++)
+    {
+        if ( m_queues[priority].empty() ) continue;
+        *handle = m_queues[priority].front();
+        m_queues[priority].pop_front();
+        return true;
+    }
+    return false;
+}
+
+//--------------------------------------------------------------------------------
+// pread thread pool
+//--------------------------------------------------------------------------------
+void AsyncFileIO::fallback_thread_loop()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while ( true )
+    {
+        m_queue_condition.wait(lock, [&]() {
+            if ( m_stopping ) return true;
+            for (int i = 0; i < NUM_IO_PRIORITIES; i++) if ( !m_queues[i].empty() ) return true;
+            return false;
+        });
+        IORequestHandle handle;
+        if ( !pop_queued(&handle) )
+        {
+            if ( m_stopping ) break;
+            continue;
+        }
+        Request &request = m_requests[handle];
+        request.state = RequestState::Submitted;
+        IOReadRequest info = request.info;
+        uint64_t done = request.bytes_done;
+        lock.unlock();
+
+        int error = 0;
+        while ( done < info.size )
+        {
+            ssize_t n = pread(info.fd, (uint8_t *) info.destination + done, info.size - done, info.offset + done);
+            if ( n < 0 )
+            {
+                if ( errno == EINTR ) continue;
+                error = errno;
+                break;
+            }
+            if ( n == 0 ) break; // End of file.
+            done += n;
+        }
+
+        lock.lock();
+        m_requests[handle].bytes_done = done;
+        complete(lock, handle, error, false);
+    }
+}
+
+//--------------------------------------------------------------------------------
+// io_uring
+//--------------------------------------------------------------------------------
+bool AsyncFileIO::init_uring(uint32_t queue_depth)
+{
+    // Leave room in the submission queue for cancellations and the wake poll.
+    io_uring_params params = {};
+    m_ring_fd = io_uring_setup(2 * queue_depth, &params);
+    if ( m_ring_fd < 0 ) return false;
+    // IORING_OP_READ needs Linux 5.6, and fast poll arrived in 5.7.
+    if ( !(params.features & IORING_FEAT_FAST_POLL) )
+    {
+        close(m_ring_fd);
+        return false;
+    }
+
+    m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    m_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if ( single_mmap ) m_sq_ring_size = m_cq_ring_size = std::max(m_sq_ring_size, m_cq_ring_size);
+    m_sq_ring = mmap(nullptr, m_sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQ_RING);
+    if ( m_sq_ring == MAP_FAILED )
+    {
+        close(m_ring_fd);
+        return false;
+    }
+    m_cq_ring = single_mmap ? m_sq_ring : mmap(nullptr, m_cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_CQ_RING);
+    m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    m_sqes = (io_uring_sqe *) mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQES);
+    m_wake_fd = eventfd(0, EFD_CLOEXEC);
+    if ( m_cq_ring == MAP_FAILED || m_sqes == MAP_FAILED || m_wake_fd < 0 )
+    {
+        if ( m_cq_ring != MAP_FAILED && !single_mmap ) munmap(m_cq_ring, m_cq_ring_size);
+        if ( m_sqes != MAP_FAILED ) munmap(m_sqes, m_sqes_size);
+        if ( m_wake_fd >= 0 ) close(m_wake_fd);
+        munmap(m_sq_ring, m_sq_ring_size);
+        close(m_ring_fd);
+        return false;
+    }
+
+    uint8_t *sq = (uint8_t *) m_sq_ring;
+    m_sq_head = (uint32_t *) (sq + params.sq_off.head);
+    m_sq_tail = (uint32_t *) (sq + params.sq_off.tail);
+    m_sq_mask = (uint32_t *) (sq + params.sq_off.ring_mask);
+    m_sq_array = (uint32_t *) (sq + params.sq_off.array);
+    m_sq_entries = params.sq_entries;
+    uint8_t *cq = (uint8_t *) m_cq_ring;
+    m_cq_head = (uint32_t *) (cq + params.cq_off.head);
+    m_cq_tail = (uint32_t *) (cq + params.cq_off.tail);
+    m_cq_mask = (uint32_t *) (cq + params.cq_off.ring_mask);
+    m_cqes = (io_uring_cqe *) (cq + params.cq_off.cqes);
+    m_num_unsubmitted_sqes = 0;
+    return true;
+}
+
+void AsyncFileIO::destroy_uring()
+{
+    munmap(m_sqes, m_sqes_size);
+    if ( m_cq_ring != m_sq_ring ) munmap(m_cq_ring, m_cq_ring_size);
+    munmap(m_sq_ring, m_sq_ring_size);
+    close(m_wake_fd);
+    close(m_ring_fd);
+}
+
+void AsyncFileIO::wake_uring_thread()
+{
+    uint64_t one = 1;
+    ssize_t written = write(m_wake_fd, &one, sizeof(one));
+    (void) written;
+}
+
+// Returns a zeroed submission queue entry, or nullptr if the submission queue is full.
+// Without SQPOLL the kernel only reads entries in io_uring_enter on this thread, so the tail can be published before the entry is filled.
+io_uring_sqe *AsyncFileIO::get_sqe()
+{
+    uint32_t head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+    uint32_t tail = *m_sq_tail;
+    if ( tail - head >= m_sq_entries ) return nullptr;
+    uint32_t index = tail & *m_sq_mask;
+    m_sq_array[index] = index;
+    io_uring_sqe *sqe = &m_sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    __atomic_store_n(m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+    m_num_unsubmitted_sqes++;
+    return sqe;
+}
+
+void AsyncFileIO::uring_thread_loop()
+{
+    auto arm_wake_poll = [&]() {
+        io_uring_sqe *sqe = get_sqe();
+        assert(sqe != nullptr);
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = m_wake_fd;
+        sqe->poll32_events = POLLIN;
+        sqe->user_data = WAKE_USER_DATA;
+    };
+    arm_wake_poll();
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while ( true )
+    {
+        if ( m_stopping && m_requests.empty() ) break;
+
+        // Submit cancellations first, then as many reads as the queue depth allows, highest priority first.
+        for (IORequestHandle handle : m_cancels)
+        {
+            auto it = m_requests.find(handle);
+            if ( it == m_requests.end() || it->second.state != RequestState::Submitted ) continue;
+            io_uring_sqe *sqe = get_sqe();
+            if ( sqe == nullptr ) break;
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = -1;
+            sqe->addr = handle;
+            sqe->user_data = CANCEL_USER_DATA;
+        }
+        m_cancels.clear();
+        while ( m_num_submitted < m_queue_depth )
+        {
+            io_uring_sqe *sqe = get_sqe();
+            if ( sqe == nullptr ) break;
+            IORequestHandle handle;
+            if ( !pop_queued(&handle) )
+            {
+                // Give the entry back.
+                __atomic_store_n(m_sq_tail, *m_sq_tail - 1, __ATOMIC_RELEASE);
+                m_num_unsubmitted_sqes--;
+                break;
+            }
+            Request &request = m_requests[handle];
+            request.state = RequestState::Submitted;
+            m_num_submitted++;
+            uint64_t remaining = request.info.size - request.bytes_done;
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = request.info.fd;
+            sqe->off = request.info.offset + request.bytes_done;
+            sqe->addr = (uint64_t) ((uint8_t *) request.info.destination + request.bytes_done);
+            sqe->len = (uint32_t) std::min<uint64_t>(remaining, MAX_READ_SIZE);
+            sqe->user_data = handle;
+        }
+        lock.unlock();
+
+        int submitted = io_uring_enter(m_ring_fd, m_num_unsubmitted_sqes, 1, IORING_ENTER_GETEVENTS);
+        if ( submitted < 0 && errno != EINTR )
+            fprintf(stderr, C_RED "[%s] io_uring_enter failed: %s\n" C_RESET, __func__, strerror(errno));
+        if ( submitted > 0 ) m_num_unsubmitted_sqes -= submitted;
+
+        lock.lock();
+        uint32_t head = *m_cq_head;
+        while ( head != __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE) )
+        {
+            io_uring_cqe cqe = m_cqes[head & *m_cq_mask];
+            head++;
+            __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+            if ( cqe.user_data == WAKE_USER_DATA )
+            {
+                uint64_t value;
+                ssize_t n = ::read(m_wake_fd, &value, sizeof(value));
+                (void) n;
+                arm_wake_poll();
+                continue;
+            }
+            if ( cqe.user_data == CANCEL_USER_DATA ) continue;
+
+            IORequestHandle handle = cqe.user_data;
+            Request &request = m_requests[handle];
+            m_num_submitted--;
+            if ( cqe.res < 0 )
+            {
+                complete(lock, handle, cqe.res == -ECANCELED ? 0 : -cqe.res, cqe.res == -ECANCELED);
+                continue;
+            }
+            request.bytes_done += cqe.res;
+            if ( cqe.res == 0 || request.bytes_done == request.info.size )
+                complete(lock, handle, 0, false);
+            else if ( request.cancel_requested )
+                complete(lock, handle, 0, true);
+            else
+            {
+                // Continue a short read ahead of everything else of its priority.
+                request.state = RequestState::Queued;
+                m_queues[(int) request.info.priority].push_front(handle);
+            }
+        }
+    }
+}
@@ -0,0 +1,180 @@
+#ifndef ASYNC_FILE_IO_H_
+#define ASYNC_FILE_IO_H_
+/* async_file_io.h
+ *
+ * Asynchronous file reads for streaming assets without blocking the render thread.
+ *
+ * Reads are queued by priority and submitted in batches to an io_uring instance by an I/O
+ * thread, which also reaps their completions. If io_uring is unavailable (old kernels,
+ * seccomp-filtered containers), a pool of threads serves the queues with pread instead.
+ *
+ * Destinations can be any memory that outlives the read, such as mapped staging memory, so
+ * data goes from disk to the staging buffer with no copy in between. Short reads are
+ * continued until the requested size or end of file.
+ *
+ * Completion handlers run on an I/O thread, or as jobs if a job system is given, so that
+ * heavier work such as decoding doesn't hold up the I/O thread. Coroutines can instead
+ * co_await read_async, and are resumed as a job with the result (see jobs/task.h).
+ */
+#include <stdint.h>
+#include <functional>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <coroutine>
+
+class JobSystem;
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+enum class AsyncFileIOBackend
+{
+    IOUring,
+    ThreadPool,
+};
+
+enum class IOPriority
+{
+    High,
+    Normal,
+    Low,
+    NUM
+};
+#define NUM_IO_PRIORITIES ((int) IOPriority::NUM)
+
+typedef uint64_t IORequestHandle;
+#define IO_REQUEST_HANDLE_NULL 0ull
+
+struct IOReadResult
+{
+    IORequestHandle handle;
+    void *destination;
+    uint64_t bytes_read;
+    int error; // 0, or an errno value.
+    bool cancelled;
+};
+
+struct IOReadRequest
+{
+    int fd;
+    uint64_t offset;
+    uint64_t size;
+    void *destination;
+    IOPriority priority;
+    std::function<void(const IOReadResult &)> on_complete;
+};
+
+class AsyncFileIO;
+
+// Returned by AsyncFileIO::read_async. The request's on_complete is ignored.
+class IOReadAwaitable
+{
+public:
+    bool await_ready() { return false; }
+    void await_suspend(std::coroutine_handle<> handle);
+    IOReadResult await_resume() { return m_result; }
+private:
+    friend class AsyncFileIO;
+    IOReadAwaitable(AsyncFileIO *io, JobSystem *jobs, const IOReadRequest &request) :
+        m_io{io}, m_jobs{jobs}, m_request{request} {}
+    AsyncFileIO *m_io;
+    JobSystem *m_jobs;
+    IOReadRequest m_request;
+    IOReadResult m_result;
+};
+
+#define ASYNC_FILE_IO_DEFAULT_QUEUE_DEPTH 64u
+#define ASYNC_FILE_IO_DEFAULT_NUM_FALLBACK_THREADS 4u
+
+class AsyncFileIO
+{
+public:
+    // Uses io_uring unless force_thread_pool is set or io_uring can't be set up.
+    bool init(uint32_t queue_depth, uint32_t num_fallback_threads, bool force_thread_pool = false);
+    // Waits for outstanding reads.
+    void shutdown();
+    AsyncFileIOBackend backend() const { return m_backend; }
+    // Run completion handlers as jobs instead of on the I/O thread. Set before issuing reads.
+    // wait_idle doesn't run jobs, so the job system needs workers besides the waiting thread.
+    void set_completion_job_system(JobSystem *jobs) { m_completion_jobs = jobs; }
+
+    IORequestHandle read(const IOReadRequest &request);
+    // co_await read_async(jobs, request) suspends the coroutine until the read completes,
+    // then continues it as a job.
+    IOReadAwaitable read_async(JobSystem *jobs, const IOReadRequest &request) { return IOReadAwaitable(this, jobs, request); }
+    // Queued reads are cancelled immediately. Reads already submitted to io_uring are cancelled
+    // if the kernel hasn't completed them yet, and reads in progress on the thread pool run to completion.
+    // The completion's cancelled flag says whether cancellation took effect.
+    // Returns false if the handle is not outstanding.
+    bool cancel(IORequestHandle handle);
+    // Block until every read issued so far has completed.
+    void wait_idle();
+private:
+    enum class RequestState
+    {
+        Queued,
+        Submitted,
+    };
+    struct Request
+    {
+        IOReadRequest info;
+        uint64_t bytes_done;
+        RequestState state;
+        bool cancel_requested;
+    };
+
+    // Called with the lock held, which is released while the completion handler runs.
+    void complete(std::unique_lock<std::mutex> &lock, IORequestHandle handle, int error, bool cancelled);
+    void completion_handled();
+    bool pop_queued(IORequestHandle *handle);
+    void wake_uring_thread();
+    void uring_thread_loop();
+    void fallback_thread_loop();
+
+    bool init_uring(uint32_t queue_depth);
+    void destroy_uring();
+    io_uring_sqe *get_sqe();
+
+    AsyncFileIOBackend m_backend;
+    JobSystem *m_completion_jobs;
+    uint32_t m_queue_depth;
+    bool m_stopping;
+
+    std::mutex m_mutex;
+    std::condition_variable m_queue_condition;
+    std::condition_variable m_idle_condition;
+    std::deque<IORequestHandle> m_queues[NUM_IO_PRIORITIES];
+    std::unordered_map<IORequestHandle, Request> m_requests;
+    std::vector<IORequestHandle> m_cancels;
+    IORequestHandle m_next_handle;
+    uint32_t m_num_submitted;
+    uint32_t m_num_outstanding; // Until the completion handler has returned.
+
+    std::vector<std::thread> m_threads;
+
+    // io_uring state, owned by the single I/O thread once running.
+    int m_ring_fd;
+    int m_wake_fd; // eventfd polled through the ring, so that new requests wake the I/O thread.
+    void *m_sq_ring;
+    size_t m_sq_ring_size;
+    void *m_cq_ring;
+    size_t m_cq_ring_size;
+    io_uring_sqe *m_sqes;
+    size_t m_sqes_size;
+    uint32_t *m_sq_head;
+    uint32_t *m_sq_tail;
+    uint32_t *m_sq_mask;
+    uint32_t *m_sq_array;
+    uint32_t m_sq_entries;
+    uint32_t *m_cq_head;
+    uint32_t *m_cq_tail;
+    uint32_t *m_cq_mask;
+    io_uring_cqe *m_cqes;
+    uint32_t m_num_unsubmitted_sqes;
+};
+
+#endif // ASYNC_FILE_IO_H_
@@ -0,0 +1,303 @@
+#include "job_system.h"
+#include "ansi_color.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <assert.h>
+
+static thread_local const JobSystem *t_job_system = nullptr;
+static thread_local int t_worker_index = -1;
+
+static void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+bool JobSystem::init(uint32_t num_workers, bool pin_threads)
+{
+    assert(m_num_workers == 0);
+    if ( num_workers == 0 ) num_workers = std::max(std::thread::hardware_concurrency(), 1u);
+    m_num_workers = num_workers;
+    m_workers = new Worker[num_workers];
+    for (uint32_t i = 0; i < num_workers; i++)
+    {
+        m_workers[i].top = 0;
+        m_workers[i].bottom = 0;
+        m_workers[i].random_state = 2463534242u + 7919u * i;
+        m_workers[i].jobs_executed = 0;
+        m_workers[i].jobs_stolen = 0;
+    }
+    m_stopping = false;
+    m_injection_size = 0;
+    m_wake_epoch = 0;
+    m_num_sleeping = 0;
+
+    t_job_system = this;
+    t_worker_index = 0;
+    uint32_t num_cpus = std::max(std::thread::hardware_concurrency(), 1u);
+    for (uint32_t i = 1; i < num_workers; i++)
+    {
+        m_threads.emplace_back(&JobSystem::worker_loop, this, i);
+        if ( pin_threads )
+        {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(i % num_cpus, &cpus);
+            if ( pthread_setaffinity_np(m_threads.back().native_handle(), sizeof(cpus), &cpus) != 0 )
+                fprintf(stderr, C_YELLOW "[%s] Failed to pin worker %u to CPU %u.\n" C_RESET, __func__, i, i % num_cpus);
+        }
+    }
+    return true;
+}
+
+void JobSystem::shutdown()
+{
+    m_stopping = true;
+    m_wake_epoch.fetch_add(1);
+    m_wake_epoch.notify_all();
+    for (std::thread &thread : m_threads) thread.join();
+    m_threads.clear();
+    delete[] m_workers;
+    m_workers = nullptr;
+    m_num_workers = 0;
+    if ( t_job_system == this )
+    {
+        t_job_system = nullptr;
+        t_worker_index = -1;
+    }
+}
+
+int JobSystem::worker_index() const
+{
+    return t_job_system == this ? t_worker_index : -1;
+}
+
+//--------------------------------------------------------------------------------
+// Chase-Lev deque
+//--------------------------------------------------------------------------------
+bool JobSystem::push(Worker *worker, const Entry &entry)
+{
+    int64_t bottom = worker->bottom.load(std::memory_order_relaxed);
+    int64_t top = worker->top.load(std::memory_order_acquire);
+    if ( bottom - top >= JOB_SYSTEM_QUEUE_CAPACITY ) return false;
+    worker->entries[bottom % JOB_SYSTEM_QUEUE_CAPACITY] = entry;
+    worker->bottom.store(bottom + 1, std::memory_order_release);
+    return true;
+}
+
+bool JobSystem::pop(Worker *worker, Entry *entry)
+{
+    int64_t bottom = worker->bottom.load(std::memory_order_relaxed) - 1;
+    worker->bottom.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t top = worker->top.load(std::memory_order_relaxed);
+    if ( top > bottom )
+    {
+        worker->bottom.store(bottom + 1, std::memory_order_relaxed);
+        return false;
+    }
+    *entry = worker->entries[bottom % JOB_SYSTEM_QUEUE_CAPACITY];
+    if ( top == bottom )
+    {
+        // Last entry, race thieves for it.
+        bool won = worker->top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+        worker->bottom.store(bottom + 1, std::memory_order_relaxed);
+        return won;
+    }
+    return true;
+}
+
+bool JobSystem::steal(Worker *worker, Entry *entry)
+{
+    int64_t top = worker->top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t bottom = worker->bottom.load(std::memory_order_acquire);
+    if ( top >= bottom ) return false;
+    *entry = worker->entries[top % JOB_SYSTEM_QUEUE_CAPACITY];
+    return worker->top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+}
+
+//--------------------------------------------------------------------------------
+// Scheduling
+//--------------------------------------------------------------------------------
+void JobSystem::submit(const Job *jobs, uint32_t num_jobs, JobCounter *counter, JobCounter *dependency)
+{
+    if ( num_jobs == 0 ) return;
+    if ( counter != nullptr ) increment(counter, num_jobs);
+    MemorySubsystem subsystem = MemoryCurrentSubsystem();
+    if ( dependency != nullptr )
+    {
+        std::lock_guard<std::mutex> lock(dependency->m_mutex);
+        if ( dependency->m_count.load(std::memory_order_acquire) > 0 )
+        {
+            for (uint32_t i = 0; i < num_jobs; i++) dependency->m_continuations.push_back({jobs[i], counter, subsystem});
+            return;
+        }
+    }
+    // Enqueue in batches from the stack, so that submitting doesn't touch the heap.
+    Entry entries[64];
+    for (uint32_t first = 0; first < num_jobs; first += 64)
+    {
+        uint32_t n = std::min(num_jobs - first, 64u);
+        for (uint32_t i = 0; i < n; i++) entries[i] = {jobs[first + i], counter, subsystem};
+        enqueue(entries, n);
+    }
+}
+
+void JobSystem::enqueue(const Entry *entries, uint32_t num_entries)
+{
+    int index = worker_index();
+    uint32_t num_pushed = 0;
+    if ( index >= 0 )
+    {
+        while ( num_pushed < num_entries && push(&m_workers[index], entries[num_pushed]) ) num_pushed++;
+    }
+    if ( num_pushed < num_entries )
+    {
+        // Not a worker, or the worker's deque is full.
+        std::lock_guard<std::mutex> lock(m_injection_mutex);
+        m_injection_queue.insert(m_injection_queue.end(), entries + num_pushed, entries + num_entries);
+        m_injection_size.store(m_injection_queue.size(), std::memory_order_release);
+    }
+    // Sequentially consistent with the sleeping count and epoch wait in worker_loop, so wakeups aren't lost.
+    m_wake_epoch.fetch_add(1);
+    if ( m_num_sleeping.load() > 0 )
+    {
+        if ( num_entries == 1 ) m_wake_epoch.notify_one();
+        else m_wake_epoch.notify_all();
+    }
+}
+
+bool JobSystem::find_job(int worker_index, Entry *entry)
+{
+    if ( worker_index >= 0 && pop(&m_workers[worker_index], entry) ) return true;
+    if ( m_injection_size.load(std::memory_order_acquire) > 0 )
+    {
+        std::lock_guard<std::mutex> lock(m_injection_mutex);
+        if ( !m_injection_queue.empty() )
+        {
+            *entry = m_injection_queue.front();
+            m_injection_queue.pop_front();
+            m_injection_size.store(m_injection_queue.size(), std::memory_order_release);
+            return true;
+        }
+    }
+    // Try every other worker once, starting at a random one.
+    uint32_t start;
+    if ( worker_index >= 0 )
+    {
+        uint32_t &x = m_workers[worker_index].random_state;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        start = x % m_num_workers;
+    }
+    else
+    {
+        start = 0;
+    }
+    for (uint32_t i = 0; i < m_num_workers; i++)
+    {
+        uint32_t victim = (start + i) % m_num_workers;
+        if ( (int) victim == worker_index ) continue;
+        if ( steal(&m_workers[victim], entry) )
+        {
+            if ( worker_index >= 0 ) m_workers[worker_index].jobs_stolen++;
+            return true;
+        }
+    }
+    return false;
+}
+
+void JobSystem::execute(int worker_index, const Entry &entry)
+{
+    {
+        MemoryScope memory_scope(entry.subsystem);
+        entry.job.function(entry.job.data);
+    }
+    if ( worker_index >= 0 ) m_workers[worker_index].jobs_executed++;
+    if ( entry.counter != nullptr ) decrement(entry.counter);
+}
+
+void JobSystem::increment(JobCounter *counter, int amount)
+{
+    counter->m_count.fetch_add(amount, std::memory_order_relaxed);
+}
+
+void JobSystem::decrement(JobCounter *counter)
+{
+    int value = counter->m_count.load(std::memory_order_acquire);
+    while ( value > 1 )
+    {
+        if ( counter->m_count.compare_exchange_weak(value, value - 1, std::memory_order_acq_rel) ) return;
+    }
+    // Possibly the last job. Decrement under the lock, so that a waiter can't see zero and
+    // destroy the counter before this is done with it, and release the dependent jobs.
+    std::vector<JobCounter::Continuation> continuations;
+    {
+        std::lock_guard<std::mutex> lock(counter->m_mutex);
+        if ( counter->m_count.fetch_sub(1, std::memory_order_acq_rel) == 1 )
+            continuations.swap(counter->m_continuations);
+    }
+    for (JobCounter::Continuation &continuation : continuations)
+    {
+        Entry released = {continuation.job, continuation.counter, continuation.subsystem};
+        enqueue(&released, 1);
+    }
+}
+
+void JobSystem::wait(JobCounter *counter)
+{
+    int index = worker_index();
+    Entry entry;
+    while ( counter->m_count.load(std::memory_order_acquire) > 0 )
+    {
+        if ( find_job(index, &entry) ) execute(index, entry);
+        else cpu_relax();
+    }
+    // The job that finished the counter may still hold the counter's lock.
+    std::lock_guard<std::mutex> lock(counter->m_mutex);
+}
+
+void JobSystem::worker_loop(uint32_t worker_index)
+{
+    t_job_system = this;
+    t_worker_index = worker_index;
+    Entry entry;
+    while ( !m_stopping.load(std::memory_order_acquire) )
+    {
+        uint32_t epoch = m_wake_epoch.load(std::memory_order_acquire);
+        bool found = false;
+        for (int spin = 0; spin < JOB_SYSTEM_IDLE_SPINS && !found; spin++)
+        {
+            found = find_job(worker_index, &entry);
+            if ( !found ) cpu_relax();
+        }
+        if ( found )
+        {
+            execute(worker_index, entry);
+            continue;
+        }
+        // Sleep until something is submitted after the epoch was read.
+        m_num_sleeping.fetch_add(1);
+        m_wake_epoch.wait(epoch);
+        m_num_sleeping.fetch_sub(1);
+    }
+}
+
+JobWorkerStatistics JobSystem::statistics(uint32_t worker) const
+{
+    assert(worker < m_num_workers);
+    return { m_workers[worker].jobs_executed, m_workers[worker].jobs_stolen };
+}
+
+void JobSystem::reset_statistics()
+{
+    for (uint32_t i = 0; i < m_num_workers; i++)
+    {
+        m_workers[i].jobs_executed = 0;
+        m_workers[i].jobs_stolen = 0;
+    }
+}
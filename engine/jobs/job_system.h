@@ -0,0 +1,176 @@
+#ifndef JOB_SYSTEM_H_
+#define JOB_SYSTEM_H_
+/* job_system.h
+ *
+ * Work-stealing job scheduler.
+ *
+ * Each worker thread owns a bounded Chase-Lev deque ("Correct and Efficient Work-Stealing for
+ * Weak Memory Models", Lê et al.). Workers push and pop jobs at the bottom of their own deque,
+ * and idle workers steal from the top of others', so jobs spawned by a job stay on the core
+ * that spawned them unless another core runs out of work. Threads that are not workers (the
+ * I/O threads, say) submit through a shared injection queue.
+ *
+ * Completion is tracked with JobCounters: submitting jobs with a counter increments it by the
+ * number of jobs, and each job decrements it when it returns. wait() runs other jobs until a
+ * counter reaches zero, so waiting inside a job does not block a worker. Jobs can instead be
+ * submitted to start only once another counter reaches zero, to express dependencies.
+ *
+ * The thread that calls init is worker 0. It only runs jobs while it waits.
+ *
+ * Jobs run in the memory tracking subsystem (memory_tracking.h) of the thread that submitted
+ * them, so allocations made on workers are charged to the subsystem that asked for the work.
+ */
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <algorithm>
+#include <type_traits>
+#include "memory/memory_tracking.h"
+
+struct Job
+{
+    void (*function)(void *data);
+    void *data;
+};
+
+class JobCounter
+{
+public:
+    int value() const { return m_count.load(std::memory_order_acquire); }
+private:
+    friend class JobSystem;
+    struct Continuation
+    {
+        Job job;
+        JobCounter *counter;
+        MemorySubsystem subsystem;
+    };
+    std::atomic<int> m_count{0};
+    std::mutex m_mutex; // Guards the continuations.
+    std::vector<Continuation> m_continuations;
+};
+
+struct JobWorkerStatistics
+{
+    uint64_t jobs_executed;
+    uint64_t jobs_stolen;
+};
+
+#define JOB_SYSTEM_QUEUE_CAPACITY 4096
+// Spins looking for work before an idle worker sleeps.
+#define JOB_SYSTEM_IDLE_SPINS 64
+// parallel_for allocates its batches on the heap only beyond this many.
+#define JOB_SYSTEM_PARALLEL_FOR_INLINE_BATCHES 64
+
+class JobSystem
+{
+public:
+    // num_workers includes the calling thread. 0 uses one worker per hardware thread.
+    // Pinning binds worker i to CPU i, except the calling thread, which is left alone.
+    bool init(uint32_t num_workers, bool pin_threads);
+    void shutdown();
+    uint32_t num_workers() const { return m_num_workers; }
+    // The calling thread's worker index, or -1 if it is not a worker.
+    int worker_index() const;
+
+    // Safe to call from any thread, including from inside jobs. counter may be null.
+    // If dependency is not null, the jobs start only once it reaches zero.
+    void submit(const Job *jobs, uint32_t num_jobs, JobCounter *counter, JobCounter *dependency = nullptr);
+    void submit(Job job, JobCounter *counter, JobCounter *dependency = nullptr) { submit(&job, 1, counter, dependency); }
+    // Run jobs until the counter reaches zero.
+    void wait(JobCounter *counter);
+    // Count work that isn't a job, such as a file read, on a counter. Each increment must be
+    // matched by a decrement once the work is done, which releases dependents at zero.
+    void increment(JobCounter *counter, int amount = 1);
+    void decrement(JobCounter *counter);
+
+    // Calls function(begin, end) over [0, count) in batches of at most grain, and waits.
+    template <typename Function>
+    void parallel_for(uint32_t count, uint32_t grain, Function &&function);
+
+    JobWorkerStatistics statistics(uint32_t worker) const;
+    void reset_statistics();
+private:
+    struct Entry
+    {
+        Job job;
+        JobCounter *counter;
+        MemorySubsystem subsystem;
+    };
+    // Chase-Lev deque. Only the owner pushes and pops, anyone steals.
+    struct alignas(64) Worker
+    {
+        std::atomic<int64_t> top;
+        std::atomic<int64_t> bottom;
+        Entry entries[JOB_SYSTEM_QUEUE_CAPACITY];
+        uint32_t random_state;
+        uint64_t jobs_executed;
+        uint64_t jobs_stolen;
+    };
+    bool push(Worker *worker, const Entry &entry);
+    bool pop(Worker *worker, Entry *entry);
+    bool steal(Worker *worker, Entry *entry);
+
+    void enqueue(const Entry *entries, uint32_t num_entries);
+    bool find_job(int worker_index, Entry *entry);
+    void execute(int worker_index, const Entry &entry);
+    void worker_loop(uint32_t worker_index);
+
+    uint32_t m_num_workers = 0;
+    Worker *m_workers = nullptr;
+    std::vector<std::thread> m_threads;
+    std::atomic<bool> m_stopping;
+
+    std::mutex m_injection_mutex;
+    std::deque<Entry> m_injection_queue;
+    std::atomic<uint32_t> m_injection_size;
+
+    // Sleeping workers wait for the epoch to change, which every submission does.
+    std::atomic<uint32_t> m_wake_epoch;
+    std::atomic<uint32_t> m_num_sleeping;
+};
+
+template <typename Function>
+void JobSystem::parallel_for(uint32_t count, uint32_t grain, Function &&function)
+{
+    if ( count == 0 ) return;
+    if ( grain == 0 ) grain = 1;
+    struct Batch
+    {
+        std::remove_reference_t<Function> *function;
+        uint32_t begin;
+        uint32_t end;
+    };
+    uint32_t num_batches = (count + grain - 1) / grain;
+    // Small loops keep their batches on the stack, so that they don't touch the heap.
+    Batch inline_batches[JOB_SYSTEM_PARALLEL_FOR_INLINE_BATCHES];
+    Job inline_jobs[JOB_SYSTEM_PARALLEL_FOR_INLINE_BATCHES];
+    std::vector<Batch> heap_batches;
+    std::vector<Job> heap_jobs;
+    Batch *batches = inline_batches;
+    Job *jobs = inline_jobs;
+    if ( num_batches > JOB_SYSTEM_PARALLEL_FOR_INLINE_BATCHES )
+    {
+        heap_batches.resize(num_batches);
+        heap_jobs.resize(num_batches);
+        batches = &heap_batches[0];
+        jobs = &heap_jobs[0];
+    }
+    for (uint32_t i = 0; i < num_batches; i++)
+    {
+        batches[i] = {&function, i * grain, std::min(count, (i + 1) * grain)};
+        jobs[i].function = [](void *data) {
+            Batch *batch = (Batch *) data;
+            (*batch->function)(batch->begin, batch->end);
+        };
+        jobs[i].data = &batches[i];
+    }
+    JobCounter counter;
+    submit(jobs, num_batches, &counter);
+    wait(&counter);
+}
+
+#endif // JOB_SYSTEM_H_
@@ -0,0 +1,192 @@
+#ifndef TASK_H_
+#define TASK_H_
+/* task.h
+ *
+ * C++20 coroutines on the job system.
+ *
+ * A Task<T> is a coroutine that returns T. It is lazy: it starts when it is co_awaited by
+ * another coroutine, or when spawned as a job. When it finishes it resumes whatever awaited it.
+ * Awaitables resume suspended coroutines as jobs, so a coroutine waiting on a read or the GPU
+ * holds no thread, and thousands can be in flight at once:
+ *
+ *     Task<bool> load(JobSystem *jobs, AsyncFileIO *io, ...)
+ *     {
+ *         IOReadResult result = co_await io->read_async(jobs, request);
+ *         ...
+ *         co_await job_counter_zero(jobs, &decode_counter);
+ *         co_await gpu_waiter->timeline_reached(semaphore, value);
+ *         co_return true;
+ *     }
+ *     spawn(jobs, load(jobs, io, ...), &loads_counter);
+ *
+ * There are no exceptions in the engine, so an exception escaping a task terminates.
+ */
+#include "job_system.h"
+#include <coroutine>
+#include <exception>
+#include <utility>
+
+// A job that resumes the coroutine whose address is its data.
+inline Job resume_coroutine_job(std::coroutine_handle<> handle)
+{
+    Job job;
+    job.function = [](void *data) { std::coroutine_handle<>::from_address(data).resume(); };
+    job.data = handle.address();
+    return job;
+}
+
+template <typename T>
+class Task;
+
+namespace task_detail
+{
+    struct PromiseBase
+    {
+        std::coroutine_handle<> continuation;
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        // Resume the awaiting coroutine directly, without growing the stack.
+        struct FinalAwaitable
+        {
+            bool await_ready() noexcept { return false; }
+            template <typename Promise>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+            {
+                std::coroutine_handle<> continuation = handle.promise().continuation;
+                return continuation ? continuation : std::noop_coroutine();
+            }
+            void await_resume() noexcept {}
+        };
+        FinalAwaitable final_suspend() noexcept { return {}; }
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    template <typename T>
+    struct Promise : PromiseBase
+    {
+        T value;
+        Task<T> get_return_object();
+        void return_value(T v) { value = std::move(v); }
+        T result() { return std::move(value); }
+    };
+
+    template <>
+    struct Promise<void> : PromiseBase
+    {
+        Task<void> get_return_object();
+        void return_void() {}
+        void result() {}
+    };
+}
+
+template <typename T = void>
+class Task
+{
+public:
+    using promise_type = task_detail::Promise<T>;
+
+    Task() = default;
+    explicit Task(std::coroutine_handle<promise_type> handle) : m_handle{handle} {}
+    Task(Task &&other) : m_handle{std::exchange(other.m_handle, nullptr)} {}
+    Task &operator=(Task &&other)
+    {
+        if ( m_handle ) m_handle.destroy();
+        m_handle = std::exchange(other.m_handle, nullptr);
+        return *this;
+    }
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+    ~Task() { if ( m_handle ) m_handle.destroy(); }
+
+    // Start the task, and resume the awaiting coroutine with its result when it finishes.
+    auto operator co_await() &&
+    {
+        struct Awaitable
+        {
+            std::coroutine_handle<promise_type> handle;
+            bool await_ready() { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting)
+            {
+                handle.promise().continuation = awaiting;
+                return handle;
+            }
+            T await_resume() { return handle.promise().result(); }
+        };
+        return Awaitable{m_handle};
+    }
+private:
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+template <typename T>
+Task<T> task_detail::Promise<T>::get_return_object()
+{
+    return Task<T>{std::coroutine_handle<Promise<T>>::from_promise(*this)};
+}
+
+inline Task<void> task_detail::Promise<void>::get_return_object()
+{
+    return Task<void>{std::coroutine_handle<Promise<void>>::from_promise(*this)};
+}
+
+// co_await schedule(jobs) continues the coroutine as a job, on whichever worker picks it up.
+inline auto schedule(JobSystem *jobs)
+{
+    struct Awaitable
+    {
+        JobSystem *jobs;
+        bool await_ready() { return false; }
+        void await_suspend(std::coroutine_handle<> handle) { jobs->submit(resume_coroutine_job(handle), nullptr); }
+        void await_resume() {}
+    };
+    return Awaitable{jobs};
+}
+
+// co_await job_counter_zero(jobs, counter) continues the coroutine as a job once the counter reaches zero.
+inline auto job_counter_zero(JobSystem *jobs, JobCounter *counter)
+{
+    struct Awaitable
+    {
+        JobSystem *jobs;
+        JobCounter *counter;
+        bool await_ready() { return counter->value() == 0; }
+        void await_suspend(std::coroutine_handle<> handle) { jobs->submit(resume_coroutine_job(handle), nullptr, counter); }
+        void await_resume() {}
+    };
+    return Awaitable{jobs, counter};
+}
+
+namespace task_detail
+{
+    // Owns itself: starts immediately and destroys its frame when it finishes.
+    struct DetachedTask
+    {
+        struct promise_type
+        {
+            DetachedTask get_return_object() { return {}; }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() { std::terminate(); }
+        };
+    };
+
+    template <typename T>
+    DetachedTask run_detached(JobSystem *jobs, Task<T> task, JobCounter *counter)
+    {
+        co_await schedule(jobs);
+        co_await std::move(task);
+        if ( counter != nullptr ) jobs->decrement(counter);
+    }
+}
+
+// Run a task as a job, discarding its result. counter may be null, otherwise it is
+// incremented now and decremented when the task finishes, so it can be waited on.
+template <typename T>
+void spawn(JobSystem *jobs, Task<T> task, JobCounter *counter)
+{
+    if ( counter != nullptr ) jobs->increment(counter);
+    task_detail::run_detached(jobs, std::move(task), counter);
+}
+
+#endif // TASK_H_
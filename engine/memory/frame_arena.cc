@@ -0,0 +1,130 @@
+#include "frame_arena.h"
+#include "memory_tracking.h"
+#include "ansi_color.h"
+#include <stdio.h>
+#include <assert.h>
+#include <algorithm>
+
+static size_t align_up(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+bool LinearArena::init(size_t block_size)
+{
+    assert(block_size > 0);
+    m_block = (uint8_t *) MemoryAllocate(block_size);
+    if ( m_block == nullptr )
+    {
+        fprintf(stderr, C_RED "[%s] Failed to allocate a %zu byte block.\n" C_RESET, __func__, block_size);
+        return false;
+    }
+    m_block_size = block_size;
+    m_offset = 0;
+    m_used = 0;
+    m_peak = 0;
+    m_last_allocation = nullptr;
+    return true;
+}
+
+void LinearArena::destroy()
+{
+    for (Block &block : m_overflow_blocks) MemoryFree(block.data);
+    m_overflow_blocks.clear();
+    MemoryFree(m_block);
+    m_block = nullptr;
+    m_block_size = 0;
+}
+
+void *LinearArena::allocate(size_t size, size_t alignment)
+{
+    assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+    uint8_t *data = m_overflow_blocks.empty() ? m_block : m_overflow_blocks.back().data;
+    size_t data_size = m_overflow_blocks.empty() ? m_block_size : m_overflow_blocks.back().size;
+    size_t offset = align_up((size_t) data + m_offset, alignment) - (size_t) data;
+    if ( offset + size > data_size )
+    {
+        // Overflow. The next reset grows the block to fit this frame.
+        Block block;
+        block.size = std::max(size + alignment, m_block_size);
+        block.data = (uint8_t *) MemoryAllocate(block.size);
+        if ( block.data == nullptr )
+        {
+            fprintf(stderr, C_RED "[%s] Failed to allocate a %zu byte overflow block.\n" C_RESET, __func__, block.size);
+            return nullptr;
+        }
+        m_overflow_blocks.push_back(block);
+        data = block.data;
+        offset = align_up((size_t) data, alignment) - (size_t) data;
+    }
+    m_offset = offset + size;
+    m_used += size;
+    m_peak = std::max(m_peak, m_used);
+    m_last_allocation = data + offset;
+    return data + offset;
+}
+
+void LinearArena::free(void *pointer, size_t size)
+{
+    if ( pointer == nullptr || pointer != m_last_allocation ) return;
+    uint8_t *data = m_overflow_blocks.empty() ? m_block : m_overflow_blocks.back().data;
+    m_offset = (uint8_t *) pointer - data;
+    m_used -= size;
+    m_last_allocation = nullptr;
+}
+
+void LinearArena::reset()
+{
+    if ( !m_overflow_blocks.empty() )
+    {
+        // Replace the blocks with one that fits the peak, with slack for alignment padding.
+        size_t block_size = m_block_size;
+        for (Block &block : m_overflow_blocks)
+        {
+            block_size += block.size;
+            MemoryFree(block.data);
+        }
+        m_overflow_blocks.clear();
+        MemoryFree(m_block);
+        m_block = (uint8_t *) MemoryAllocate(block_size);
+        assert(m_block != nullptr);
+        m_block_size = block_size;
+    }
+    m_offset = 0;
+    m_used = 0;
+    m_last_allocation = nullptr;
+}
+
+bool FrameArenas::init(uint32_t num_frames, uint32_t num_threads, size_t block_size)
+{
+    assert(num_frames > 0 && num_threads > 0);
+    m_num_frames = num_frames;
+    m_num_threads = num_threads;
+    m_frame = 0;
+    m_arenas = new LinearArena[num_frames * num_threads];
+    for (uint32_t i = 0; i < num_frames * num_threads; i++)
+    {
+        if ( !m_arenas[i].init(block_size) ) return false;
+    }
+    return true;
+}
+
+void FrameArenas::destroy()
+{
+    for (uint32_t i = 0; i < m_num_frames * m_num_threads; i++) m_arenas[i].destroy();
+    delete[] m_arenas;
+    m_arenas = nullptr;
+}
+
+void FrameArenas::begin_frame(uint32_t frame)
+{
+    assert(frame < m_num_frames);
+    m_frame = frame;
+    for (uint32_t i = 0; i < m_num_threads; i++) m_arenas[frame * m_num_threads + i].reset();
+}
+
+LinearArena *FrameArenas::arena(uint32_t thread)
+{
+    assert(thread < m_num_threads);
+    return &m_arenas[m_frame * m_num_threads + thread];
+}
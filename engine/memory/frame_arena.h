@@ -0,0 +1,92 @@
+#ifndef FRAME_ARENA_H_
+#define FRAME_ARENA_H_
+/* frame_arena.h
+ *
+ * Bump allocation for transient per-frame data, such as draw lists and visible sets.
+ *
+ * A LinearArena hands out memory from one block by bumping an offset, and frees everything
+ * at once on reset. If a frame needs more than the block holds, overflow blocks are allocated,
+ * and the next reset replaces them all with one block large enough for that frame, so that
+ * once the working set has been seen the arena no longer touches the heap.
+ *
+ * FrameArenas keeps one arena per thread per frame in flight. A frame's arenas are reset only
+ * once the GPU has finished the frame that last used them (its fence has signaled), so data
+ * allocated during a frame stays valid for as long as that frame can still be in use.
+ *
+ * ArenaVector<T> is a std::vector allocating from an arena. Freeing is a no-op, except that
+ * the most recent allocation is given back, so a vector growing on its own reuses its space.
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+class LinearArena
+{
+public:
+    bool init(size_t block_size);
+    void destroy();
+    void *allocate(size_t size, size_t alignment = alignof(max_align_t));
+    void free(void *pointer, size_t size);
+    void reset();
+
+    size_t capacity() const { return m_block_size; }
+    // Bytes allocated since the last reset, and the most of any frame.
+    size_t used() const { return m_used; }
+    size_t peak() const { return m_peak; }
+private:
+    struct Block
+    {
+        uint8_t *data;
+        size_t size;
+    };
+    uint8_t *m_block = nullptr;
+    size_t m_block_size = 0;
+    size_t m_offset = 0;         // Into the current block, which is the last overflow block if any.
+    std::vector<Block> m_overflow_blocks;
+    size_t m_used = 0;
+    size_t m_peak = 0;
+    void *m_last_allocation = nullptr;
+};
+
+template <typename T>
+class ArenaAllocator
+{
+public:
+    typedef T value_type;
+    ArenaAllocator(LinearArena *arena) : m_arena{arena} {}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U> &other) : m_arena{other.arena()} {}
+
+    T *allocate(size_t n) { return (T *) m_arena->allocate(n * sizeof(T), alignof(T)); }
+    void deallocate(T *pointer, size_t n) { m_arena->free(pointer, n * sizeof(T)); }
+    LinearArena *arena() const { return m_arena; }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U> &other) const { return m_arena == other.arena(); }
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U> &other) const { return m_arena != other.arena(); }
+private:
+    LinearArena *m_arena;
+};
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+class FrameArenas
+{
+public:
+    // Threads are indexed by the caller, e.g. by job system worker index.
+    bool init(uint32_t num_frames, uint32_t num_threads, size_t block_size);
+    void destroy();
+    // Make frame the current frame and reset its arenas. Call only once the GPU work of the
+    // frame's previous use has completed.
+    void begin_frame(uint32_t frame);
+    LinearArena *arena(uint32_t thread);
+private:
+    uint32_t m_num_frames = 0;
+    uint32_t m_num_threads = 0;
+    uint32_t m_frame = 0;
+    LinearArena *m_arenas = nullptr; // [frame][thread]
+};
+
+#endif // FRAME_ARENA_H_
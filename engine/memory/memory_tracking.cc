@@ -0,0 +1,194 @@
+#include "memory_tracking.h"
+#include <json/json.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <atomic>
+#include <new>
+#include <algorithm>
+
+// Precedes every tracked allocation.
+struct AllocationHeader
+{
+    uint64_t size : 56;
+    uint64_t subsystem : 8;
+    uint32_t offset; // From the start of the underlying allocation.
+    uint32_t alignment;
+};
+static_assert(sizeof(AllocationHeader) == 16);
+
+struct alignas(64) SubsystemCounters
+{
+    std::atomic<uint64_t> current_bytes;
+    std::atomic<uint64_t> peak_bytes;
+    std::atomic<uint64_t> num_allocations;
+    std::atomic<uint64_t> frame_num_allocations;
+    std::atomic<uint64_t> frame_bytes_allocated;
+    std::atomic<uint64_t> last_frame_num_allocations;
+    std::atomic<uint64_t> last_frame_bytes_allocated;
+};
+static SubsystemCounters g_counters[NUM_MEMORY_SUBSYSTEMS];
+static thread_local MemorySubsystem t_subsystem = MemorySubsystem::Other;
+
+const char *MemorySubsystemName(MemorySubsystem subsystem)
+{
+    switch (subsystem)
+    {
+        case MemorySubsystem::Other: return "other";
+        case MemorySubsystem::Platform: return "platform";
+        case MemorySubsystem::Vulkan: return "vulkan";
+        case MemorySubsystem::Renderer: return "renderer";
+        case MemorySubsystem::Assets: return "assets";
+    }
+    return "unknown";
+}
+
+MemoryScope::MemoryScope(MemorySubsystem subsystem)
+{
+    m_previous = t_subsystem;
+    t_subsystem = subsystem;
+}
+
+MemoryScope::~MemoryScope()
+{
+    t_subsystem = m_previous;
+}
+
+MemorySubsystem MemoryCurrentSubsystem()
+{
+    return t_subsystem;
+}
+
+static void record_allocation(MemorySubsystem subsystem, uint64_t size)
+{
+#ifdef MEMORY_TRACKING
+    SubsystemCounters &counters = g_counters[(int) subsystem];
+    uint64_t current = counters.current_bytes.fetch_add(size, std::memory_order_relaxed) + size;
+    uint64_t peak = counters.peak_bytes.load(std::memory_order_relaxed);
+    while ( current > peak && !counters.peak_bytes.compare_exchange_weak(peak, current, std::memory_order_relaxed) ) {}
+    counters.num_allocations.fetch_add(1, std::memory_order_relaxed);
+    counters.frame_num_allocations.fetch_add(1, std::memory_order_relaxed);
+    counters.frame_bytes_allocated.fetch_add(size, std::memory_order_relaxed);
+#endif
+}
+
+static void record_free(MemorySubsystem subsystem, uint64_t size)
+{
+#ifdef MEMORY_TRACKING
+    g_counters[(int) subsystem].current_bytes.fetch_sub(size, std::memory_order_relaxed);
+#endif
+}
+
+void *MemoryAllocate(size_t size, size_t alignment)
+{
+    assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+    if ( alignment < sizeof(AllocationHeader) ) alignment = sizeof(AllocationHeader);
+    // The header takes a whole alignment unit before the returned pointer.
+    uint8_t *raw;
+    if ( alignment == sizeof(AllocationHeader) )
+        raw = (uint8_t *) malloc(alignment + size);
+    else
+        raw = (uint8_t *) aligned_alloc(alignment, (alignment + size + alignment - 1) & ~(alignment - 1));
+    if ( raw == nullptr ) return nullptr;
+    uint8_t *pointer = raw + alignment;
+    AllocationHeader *header = (AllocationHeader *) pointer - 1;
+    header->size = size;
+    header->subsystem = (uint64_t) t_subsystem;
+    header->offset = alignment;
+    header->alignment = alignment;
+    record_allocation(t_subsystem, size);
+    return pointer;
+}
+
+void *MemoryReallocate(void *pointer, size_t size, size_t alignment)
+{
+    if ( pointer == nullptr ) return MemoryAllocate(size, alignment);
+    AllocationHeader *header = (AllocationHeader *) pointer - 1;
+    if ( size <= header->size && header->alignment >= alignment )
+        return pointer;
+    void *new_pointer = MemoryAllocate(size, std::max<size_t>(alignment, header->alignment));
+    if ( new_pointer == nullptr ) return nullptr;
+    memcpy(new_pointer, pointer, header->size);
+    MemoryFree(pointer);
+    return new_pointer;
+}
+
+void MemoryFree(void *pointer)
+{
+    if ( pointer == nullptr ) return;
+    AllocationHeader *header = (AllocationHeader *) pointer - 1;
+    record_free((MemorySubsystem) header->subsystem, header->size);
+    free((uint8_t *) pointer - header->offset);
+}
+
+void MemoryTrackingEndFrame()
+{
+    for (SubsystemCounters &counters : g_counters)
+    {
+        counters.last_frame_num_allocations.store(counters.frame_num_allocations.exchange(0, std::memory_order_relaxed), std::memory_order_relaxed);
+        counters.last_frame_bytes_allocated.store(counters.frame_bytes_allocated.exchange(0, std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+}
+
+MemorySubsystemStatistics MemoryStatistics(MemorySubsystem subsystem)
+{
+    assert(subsystem < MemorySubsystem::NUM);
+    SubsystemCounters &counters = g_counters[(int) subsystem];
+    MemorySubsystemStatistics statistics;
+    statistics.current_bytes = counters.current_bytes.load(std::memory_order_relaxed);
+    statistics.peak_bytes = counters.peak_bytes.load(std::memory_order_relaxed);
+    statistics.num_allocations = counters.num_allocations.load(std::memory_order_relaxed);
+    statistics.frame_num_allocations = counters.last_frame_num_allocations.load(std::memory_order_relaxed);
+    statistics.frame_bytes_allocated = counters.last_frame_bytes_allocated.load(std::memory_order_relaxed);
+    return statistics;
+}
+
+Json::Value MemoryStatisticsJson()
+{
+    Json::Value json;
+    for (int i = 0; i < NUM_MEMORY_SUBSYSTEMS; i++)
+    {
+        MemorySubsystemStatistics statistics = MemoryStatistics((MemorySubsystem) i);
+        Json::Value &subsystem = json[MemorySubsystemName((MemorySubsystem) i)];
+        subsystem["current_bytes"] = (Json::UInt64) statistics.current_bytes;
+        subsystem["peak_bytes"] = (Json::UInt64) statistics.peak_bytes;
+        subsystem["num_allocations"] = (Json::UInt64) statistics.num_allocations;
+        subsystem["frame_num_allocations"] = (Json::UInt64) statistics.frame_num_allocations;
+        subsystem["frame_bytes_allocated"] = (Json::UInt64) statistics.frame_bytes_allocated;
+    }
+    return json;
+}
+
+//--------------------------------------------------------------------------------
+// Global operator new and delete
+//--------------------------------------------------------------------------------
+#ifdef MEMORY_TRACKING
+static void *tracked_new(size_t size, size_t alignment)
+{
+    void *pointer = MemoryAllocate(size == 0 ? 1 : size, alignment);
+    if ( pointer == nullptr ) throw std::bad_alloc();
+    return pointer;
+}
+
+void *operator new(size_t size) { return tracked_new(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void *operator new[](size_t size) { return tracked_new(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void *operator new(size_t size, std::align_val_t alignment) { return tracked_new(size, (size_t) alignment); }
+void *operator new[](size_t size, std::align_val_t alignment) { return tracked_new(size, (size_t) alignment); }
+void *operator new(size_t size, const std::nothrow_t &) noexcept { return MemoryAllocate(size == 0 ? 1 : size); }
+void *operator new[](size_t size, const std::nothrow_t &) noexcept { return MemoryAllocate(size == 0 ? 1 : size); }
+void *operator new(size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept { return MemoryAllocate(size == 0 ? 1 : size, (size_t) alignment); }
+void *operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept { return MemoryAllocate(size == 0 ? 1 : size, (size_t) alignment); }
+
+void operator delete(void *pointer) noexcept { MemoryFree(pointer); }
+void operator delete[](void *pointer) noexcept { MemoryFree(pointer); }
+void operator delete(void *pointer, size_t) noexcept { MemoryFree(pointer); }
+void operator delete[](void *pointer, size_t) noexcept { MemoryFree(pointer); }
+void operator delete(void *pointer, std::align_val_t) noexcept { MemoryFree(pointer); }
+void operator delete[](void *pointer, std::align_val_t) noexcept { MemoryFree(pointer); }
+void operator delete(void *pointer, size_t, std::align_val_t) noexcept { MemoryFree(pointer); }
+void operator delete[](void *pointer, size_t, std::align_val_t) noexcept { MemoryFree(pointer); }
+void operator delete(void *pointer, const std::nothrow_t &) noexcept { MemoryFree(pointer); }
+void operator delete[](void *pointer, const std::nothrow_t &) noexcept { MemoryFree(pointer); }
+void operator delete(void *pointer, std::align_val_t, const std::nothrow_t &) noexcept { MemoryFree(pointer); }
+void operator delete[](void *pointer, std::align_val_t, const std::nothrow_t &) noexcept { MemoryFree(pointer); }
+#endif // MEMORY_TRACKING
@@ -0,0 +1,70 @@
+#ifndef MEMORY_TRACKING_H_
+#define MEMORY_TRACKING_H_
+/* memory_tracking.h
+ *
+ * CPU allocation tracking by engine subsystem.
+ *
+ * When built with MEMORY_TRACKING, the engine replaces the global operator new and delete,
+ * and every allocation is tagged with the subsystem of the allocating thread's innermost
+ * MemoryScope (Other outside of any scope). Current and peak live bytes are kept per subsystem,
+ * along with allocation counts for the last completed frame, to find which subsystem is
+ * responsible for memory growth and to check that steady-state frames don't allocate.
+ * The Vulkan driver's host allocations are tracked through VulkanHostAllocator (vk.h).
+ *
+ * Jobs run with the subsystem of the thread that submitted them. Memory allocated directly
+ * with malloc is not tracked, so engine code that needs raw blocks uses MemoryAllocate.
+ *
+ * Without MEMORY_TRACKING, scopes do nothing and statistics are zero.
+ */
+#include <stdint.h>
+#include <stddef.h>
+
+namespace Json { class Value; }
+
+enum class MemorySubsystem : uint8_t
+{
+    Other,
+    Platform,
+    Vulkan,
+    Renderer,
+    Assets,
+    NUM
+};
+#define NUM_MEMORY_SUBSYSTEMS ((int) MemorySubsystem::NUM)
+
+const char *MemorySubsystemName(MemorySubsystem subsystem);
+
+struct MemorySubsystemStatistics
+{
+    uint64_t current_bytes;
+    uint64_t peak_bytes;
+    uint64_t num_allocations;       // Since startup.
+    uint64_t frame_num_allocations; // In the last completed frame.
+    uint64_t frame_bytes_allocated;
+};
+
+// Tag this thread's allocations with a subsystem while in scope. Scopes nest.
+class MemoryScope
+{
+public:
+    MemoryScope(MemorySubsystem subsystem);
+    ~MemoryScope();
+    MemoryScope(const MemoryScope &) = delete;
+    MemoryScope &operator=(const MemoryScope &) = delete;
+private:
+    MemorySubsystem m_previous;
+};
+MemorySubsystem MemoryCurrentSubsystem();
+
+// Tracked allocation, tagged with the current subsystem. Freed with MemoryFree.
+void *MemoryAllocate(size_t size, size_t alignment = 16);
+void *MemoryReallocate(void *pointer, size_t size, size_t alignment = 16);
+void MemoryFree(void *pointer);
+
+// Mark the end of a frame, making the per-frame counts since the last call available.
+void MemoryTrackingEndFrame();
+MemorySubsystemStatistics MemoryStatistics(MemorySubsystem subsystem);
+// Every subsystem's statistics, keyed by name, for printing with Json::cout (vk_print.h).
+Json::Value MemoryStatisticsJson();
+
+#endif // MEMORY_TRACKING_H_
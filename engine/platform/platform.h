@@ -3,6 +3,9 @@
 #include <vector>
 #include "platform_event.h"
 
+// Frames the CPU can record ahead of the GPU.
+#define PLATFORM_FRAMES_IN_FLIGHT 2
+
 class PlatformListener
 {
 public:
@@ -21,6 +24,8 @@ class Platform
 public:
     void add_listener(PlatformListener *listener);
     virtual void enter_loop() = 0;
+    // Return from enter_loop once the current frame is submitted.
+    virtual void exit_loop() = 0;
 //Would prefer to be protected, but glfw callbacks need access.
 //protected:
     void set_display_deltatime(double display_deltatime);
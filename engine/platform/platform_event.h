@@ -1,15 +1,27 @@
 #ifndef PLATFORM_EVENT_H_
 #define PLATFORM_EVENT_H_
 #include <stdint.h>
+#include <vulkan/vulkan.h>
 
 struct DisplayRefreshEvent
 {
     double dt;
     double time;
+    // The swap chain's extent. The platform recreates the swap chain when the framebuffer is
+    // resized, or when acquisition or presentation report it out of date or suboptimal.
     struct {
         uint16_t width;
         uint16_t height;
     } framebuffer;
+    // Which of the PLATFORM_FRAMES_IN_FLIGHT frames this is. The GPU work of the
+    // frame that last used this slot has completed.
+    uint32_t frame_slot;
+    // The frame's command buffer, being recorded, and the acquired swap chain image. The
+    // platform submits the buffer after the event, waiting for the image's acquisition at the
+    // transfer stage, and presents the image, which the listeners must leave in
+    // VK_IMAGE_LAYOUT_PRESENT_SRC_KHR. If there are none, the platform clears it.
+    VkCommandBuffer command_buffer;
+    uint32_t swap_chain_image;
 };
 
 enum WindowEventTypes
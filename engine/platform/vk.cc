@@ -2,7 +2,175 @@
 #include "vk_util.h"
 #include "vk_print.h"
 #include "ansi_color.h"
+#include "memory/memory_tracking.h"
 #include <set>
+#include <algorithm>
+
+static void *VKAPI_CALL vulkan_host_allocation(void *user_data, size_t size, size_t alignment, VkSystemAllocationScope scope)
+{
+    MemoryScope memory_scope(MemorySubsystem::Vulkan);
+    return MemoryAllocate(size, alignment);
+}
+
+static void *VKAPI_CALL vulkan_host_reallocation(void *user_data, void *original, size_t size, size_t alignment, VkSystemAllocationScope scope)
+{
+    if ( size == 0 )
+    {
+        MemoryFree(original);
+        return nullptr;
+    }
+    MemoryScope memory_scope(MemorySubsystem::Vulkan);
+    return MemoryReallocate(original, size, alignment);
+}
+
+static void VKAPI_CALL vulkan_host_free(void *user_data, void *memory)
+{
+    MemoryFree(memory);
+}
+
+const VkAllocationCallbacks *VulkanHostAllocator()
+{
+    static const VkAllocationCallbacks callbacks = {
+        nullptr,
+        vulkan_host_allocation,
+        vulkan_host_reallocation,
+        vulkan_host_free,
+        nullptr,
+        nullptr
+    };
+    return &callbacks;
+}
+
+/*
+ * Create a vulkan swap chain for the VulkanSystem's surface, of the framebuffer's size unless the
+ * surface dictates its own, and set up color target image views for each of its images.
+ */
+static bool create_swap_chain(VulkanSystem *vk_system, uint32_t framebuffer_width, uint32_t framebuffer_height, VkSwapchainKHR old_swap_chain)
+{
+    VkPhysicalDevice vk_physical_device = vk_system->physical_device;
+    VkDevice vk_device = vk_system->device;
+    VkSurfaceKHR vk_surface = vk_system->surface;
+
+    VkSwapchainKHR vk_swap_chain;
+    VkFormat vk_swap_chain_image_format = VK_FORMAT_B8G8R8A8_SRGB;
+    VkColorSpaceKHR vk_swap_chain_color_space = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
+    VkPresentModeKHR vk_swap_chain_present_mode = VK_PRESENT_MODE_FIFO_KHR;
+    VkImageUsageFlags vk_swap_chain_usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    VkExtent2D vk_swap_chain_extent;
+    {
+        VkSurfaceCapabilitiesKHR vk_surface_capabilities;
+        VK_SUCCEED( vkGetPhysicalDeviceSurfaceCapabilitiesKHR(vk_physical_device, vk_surface, &vk_surface_capabilities) );
+
+        auto vk_surface_formats =
+            vk_get_vector<VkSurfaceFormatKHR>(vkGetPhysicalDeviceSurfaceFormatsKHR, vk_physical_device, vk_surface);
+        if ( vk_surface_formats.empty() )
+        {
+            fprintf(stderr, C_RED "[%s] The created vulkan surface does not support at least one image format.", __func__);
+            return false;
+        }
+        if ( !std::any_of( vk_surface_formats.begin(),
+                          vk_surface_formats.end(),
+                          [&](auto v) { return v.format == vk_swap_chain_image_format && v.colorSpace == vk_swap_chain_color_space; } ) )
+        {
+            fprintf(stderr, C_RED "[%s] The created vulkan surface does not support the required image format and color space combination.", __func__);
+            return false;
+        }
+        auto vk_surface_present_modes =
+            vk_get_vector<VkPresentModeKHR>(vkGetPhysicalDeviceSurfacePresentModesKHR, vk_physical_device, vk_surface);
+        // Note: The FIFO present mode is guaranteed by the Vulkan spec.
+        if ( vk_surface_present_modes.empty() )
+        {
+            fprintf(stderr, C_RED "[%s] The created vulkan surface does not support at least one present mode.", __func__);
+            return false;
+        }
+
+        uint32_t vk_swap_chain_image_count;
+        {
+            uint32_t min_image_count = vk_surface_capabilities.minImageCount;
+            uint32_t max_image_count = vk_surface_capabilities.maxImageCount == 0 ? UINT32_MAX : vk_surface_capabilities.maxImageCount;
+            vk_swap_chain_image_count = std::max(min_image_count, 1u);
+            // Try to use more than one image, if possible.
+            if ( vk_swap_chain_image_count == 1 && max_image_count > 1 )
+            {
+                vk_swap_chain_image_count += 1;
+            }
+            // The VulkanSystem struct sets a cap on the number of images.
+            vk_swap_chain_image_count = std::min(vk_swap_chain_image_count, VULKAN_SYSTEM_SWAP_CHAIN_MAX_NUM_IMAGES);
+            assert( vk_swap_chain_image_count <= max_image_count );
+        }
+
+        VkSwapchainCreateInfoKHR info = { VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR };
+        info.surface = vk_surface;
+        info.imageFormat = vk_swap_chain_image_format;
+        info.imageColorSpace = vk_swap_chain_color_space;
+        info.presentMode = vk_swap_chain_present_mode;
+        // Surfaces whose size is determined by the swap chain report a current extent of UINT32_MAX.
+        vk_swap_chain_extent = vk_surface_capabilities.currentExtent;
+        if ( vk_swap_chain_extent.width == UINT32_MAX )
+        {
+            vk_swap_chain_extent.width = std::clamp(framebuffer_width,
+                                                    vk_surface_capabilities.minImageExtent.width,
+                                                    vk_surface_capabilities.maxImageExtent.width);
+            vk_swap_chain_extent.height = std::clamp(framebuffer_height,
+                                                     vk_surface_capabilities.minImageExtent.height,
+                                                     vk_surface_capabilities.maxImageExtent.height);
+        }
+        info.imageExtent = vk_swap_chain_extent;
+        info.minImageCount = vk_swap_chain_image_count;
+        info.imageArrayLayers = 1;
+        if ( vk_surface_capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT )
+            vk_swap_chain_usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        info.imageUsage = vk_swap_chain_usage;
+        info.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        info.preTransform = vk_surface_capabilities.currentTransform;
+        info.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+        info.clipped = VK_TRUE;
+        info.oldSwapchain = old_swap_chain;
+        VK_SUCCEED( vkCreateSwapchainKHR(vk_device, &info, nullptr, &vk_swap_chain ) );
+    }
+
+    /*
+     * Query the images from the swap chain.
+     */
+    auto vk_swap_chain_images = 
+        vk_get_vector<VkImage>(vkGetSwapchainImagesKHR, vk_device, vk_swap_chain);
+    assert( vk_swap_chain_images.size() <= VULKAN_SYSTEM_SWAP_CHAIN_MAX_NUM_IMAGES );
+
+    /*
+     * Set up color target image views for each image in the swap chain.
+     */
+    std::vector<VkImageView> vk_swap_chain_color_target_image_views;
+    for (uint32_t i = 0; i < vk_swap_chain_images.size(); i++)
+    {
+        VkImageViewCreateInfo info = { VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
+        info.image = vk_swap_chain_images[i];
+        info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        info.format = vk_swap_chain_image_format;
+        info.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+        info.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+        info.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+        info.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+        info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        info.subresourceRange.baseMipLevel = 0;
+        info.subresourceRange.levelCount = 1;
+        info.subresourceRange.baseArrayLayer = 0;
+        info.subresourceRange.layerCount = 1;
+        VkImageView view;
+        VK_SUCCEED( vkCreateImageView(vk_device, &info, nullptr, &view ) );
+        vk_swap_chain_color_target_image_views.push_back(view);
+    }
+
+    vk_system->swap_chain = vk_swap_chain;
+    vk_system->swap_chain_num_images = vk_swap_chain_images.size();
+    vk_system->swap_chain_usage = vk_swap_chain_usage;
+    vk_system->swap_chain_extent = vk_swap_chain_extent;
+    for (uint32_t i = 0; i < vk_swap_chain_images.size(); i++)
+    {
+        vk_system->swap_chain_images[i] = vk_swap_chain_images[i];
+        vk_system->swap_chain_color_target_image_views[i] = vk_swap_chain_color_target_image_views[i];
+    }
+    return true;
+}
 
 bool CreateVulkanSystem(VulkanSystem *vk_system,
                         std::function<bool(VkInstance, VkPhysicalDevice, VulkanSystemCreateSurfaceOutput *)> create_surface,
@@ -10,6 +178,7 @@ bool CreateVulkanSystem(VulkanSystem *vk_system,
                         const std::vector<std::string> &extra_instance_extensions,
                         const std::vector<std::string> &extra_device_extensions)
 {
+    MemoryScope memory_scope(MemorySubsystem::Vulkan);
     /*
      * Create the vulkan instance and return imported associated vulkan handles
      * in the VulkanSystem struct.
@@ -124,7 +293,7 @@ bool CreateVulkanSystem(VulkanSystem *vk_system,
         info.ppEnabledLayerNames = &explicit_layers[0];
         info.enabledExtensionCount = instance_extensions.size();
         info.ppEnabledExtensionNames = &instance_extensions[0];
-        VK_SUCCEED(vkCreateInstance(&info, nullptr, &vk_instance));
+        VK_SUCCEED(vkCreateInstance(&info, VulkanHostAllocator(), &vk_instance));
     }
 
     /*
@@ -304,82 +473,54 @@ bool CreateVulkanSystem(VulkanSystem *vk_system,
             queue_infos.push_back(info);
         }
 
-        VkDeviceCreateInfo info = { VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO };
-        info.queueCreateInfoCount = queue_infos.size();
-        info.pQueueCreateInfos = &queue_infos[0];
-        info.enabledExtensionCount = device_extensions.size();
-        info.ppEnabledExtensionNames = &device_extensions[0];
-        VK_SUCCEED(vkCreateDevice(vk_physical_device, &info, nullptr, &vk_device));
-    }
-
-
-    /*
-     * Create a vulkan swap chain.
-     */
-    VkSwapchainKHR vk_swap_chain;
-    VkFormat vk_swap_chain_image_format = VK_FORMAT_B8G8R8A8_SRGB;
-    VkColorSpaceKHR vk_swap_chain_color_space = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
-    VkPresentModeKHR vk_swap_chain_present_mode = VK_PRESENT_MODE_FIFO_KHR;
-    {
-        VkSurfaceCapabilitiesKHR vk_surface_capabilities;
-        VK_SUCCEED( vkGetPhysicalDeviceSurfaceCapabilitiesKHR(vk_physical_device, vk_surface, &vk_surface_capabilities) );
-
-        auto vk_surface_formats =
-            vk_get_vector<VkSurfaceFormatKHR>(vkGetPhysicalDeviceSurfaceFormatsKHR, vk_physical_device, vk_surface);
-        if ( vk_surface_formats.empty() )
+        // Features required from Vulkan 1.2.
+        VkPhysicalDeviceVulkan12Features supported_features_12 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES };
+        VkPhysicalDeviceFeatures2 supported_features = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+        supported_features.pNext = &supported_features_12;
+        vkGetPhysicalDeviceFeatures2(vk_physical_device, &supported_features);
+        if ( !supported_features_12.timelineSemaphore )
         {
-            fprintf(stderr, C_RED "[%s] The created vulkan surface does not support at least one image format.", __func__);
+            fprintf(stderr, C_RED "[%s] Chosen device does not support timeline semaphores.\n" C_RESET, __func__);
             return false;
         }
-        if ( !std::any_of( vk_surface_formats.begin(),
-                          vk_surface_formats.end(),
-                          [&](auto v) { return v.format == vk_swap_chain_image_format && v.colorSpace == vk_swap_chain_color_space; } ) )
-        {
-            fprintf(stderr, C_RED "[%s] The created vulkan surface does not support the required image format and color space combination.", __func__);
-            return false;
-        }
-        auto vk_surface_present_modes =
-            vk_get_vector<VkPresentModeKHR>(vkGetPhysicalDeviceSurfacePresentModesKHR, vk_physical_device, vk_surface);
-        // Note: The FIFO present mode is guaranteed by the Vulkan spec.
-        if ( vk_surface_present_modes.empty() )
+        // Descriptor indexing, for bindless descriptor arrays.
+        if (    !supported_features_12.descriptorIndexing
+             || !supported_features_12.runtimeDescriptorArray
+             || !supported_features_12.descriptorBindingPartiallyBound
+             || !supported_features_12.descriptorBindingUpdateUnusedWhilePending
+             || !supported_features_12.descriptorBindingStorageBufferUpdateAfterBind
+             || !supported_features_12.descriptorBindingSampledImageUpdateAfterBind
+             || !supported_features_12.shaderStorageBufferArrayNonUniformIndexing
+             || !supported_features_12.shaderSampledImageArrayNonUniformIndexing )
         {
-            fprintf(stderr, C_RED "[%s] The created vulkan surface does not support at least one present mode.", __func__);
+            fprintf(stderr, C_RED "[%s] Chosen device does not support the required descriptor indexing features.\n" C_RESET, __func__);
             return false;
         }
+        VkPhysicalDeviceVulkan12Features features_12 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES };
+        features_12.timelineSemaphore = VK_TRUE;
+        features_12.descriptorIndexing = VK_TRUE;
+        features_12.runtimeDescriptorArray = VK_TRUE;
+        features_12.descriptorBindingPartiallyBound = VK_TRUE;
+        features_12.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+        features_12.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+        features_12.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+        features_12.shaderStorageBufferArrayNonUniformIndexing = VK_TRUE;
+        features_12.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+        // Optional: sample counts from occlusion queries, for measuring overdraw.
+        VkPhysicalDeviceFeatures features = {};
+        features.occlusionQueryPrecise = supported_features.features.occlusionQueryPrecise;
 
-        uint32_t vk_swap_chain_image_count;
-        {
-            uint32_t min_image_count = vk_surface_capabilities.minImageCount;
-            uint32_t max_image_count = vk_surface_capabilities.maxImageCount == 0 ? UINT32_MAX : vk_surface_capabilities.maxImageCount;
-            vk_swap_chain_image_count = std::max(min_image_count, 1u);
-            // Try to use more than one image, if possible.
-            if ( vk_swap_chain_image_count == 1 && max_image_count > 1 )
-            {
-                vk_swap_chain_image_count += 1;
-            }
-            // The VulkanSystem struct sets a cap on the number of images.
-            vk_swap_chain_image_count = std::min(vk_swap_chain_image_count, VULKAN_SYSTEM_SWAP_CHAIN_MAX_NUM_IMAGES);
-            assert( vk_swap_chain_image_count <= max_image_count );
-        }
-
-        VkSwapchainCreateInfoKHR info = { VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR };
-        info.surface = vk_surface;
-        info.imageFormat = vk_swap_chain_image_format;
-        info.imageColorSpace = vk_swap_chain_color_space;
-        info.presentMode = vk_swap_chain_present_mode;
-        info.imageExtent.width = created_surface.initial_framebuffer_pixel_width;
-        info.imageExtent.height = created_surface.initial_framebuffer_pixel_height;
-        info.minImageCount = vk_swap_chain_image_count;
-        info.imageArrayLayers = 1;
-        info.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
-        info.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
-        info.preTransform = vk_surface_capabilities.currentTransform;
-        info.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
-        info.clipped = VK_TRUE;
-        info.oldSwapchain = VK_NULL_HANDLE;
-        VK_SUCCEED( vkCreateSwapchainKHR(vk_device, &info, nullptr, &vk_swap_chain ) );
+        VkDeviceCreateInfo info = { VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO };
+        info.pNext = &features_12;
+        info.pEnabledFeatures = &features;
+        info.queueCreateInfoCount = queue_infos.size();
+        info.pQueueCreateInfos = &queue_infos[0];
+        info.enabledExtensionCount = device_extensions.size();
+        info.ppEnabledExtensionNames = &device_extensions[0];
+        VK_SUCCEED(vkCreateDevice(vk_physical_device, &info, VulkanHostAllocator(), &vk_device));
     }
 
+
     /*
      * Query the opaque queue handles.
      */
@@ -390,37 +531,6 @@ bool CreateVulkanSystem(VulkanSystem *vk_system,
     VkQueue vk_presentation_queue;
     vkGetDeviceQueue(vk_device, vk_presentation_family, 0, &vk_presentation_queue);
 
-    /*
-     * Query the images from the swap chain.
-     */
-    auto vk_swap_chain_images = 
-        vk_get_vector<VkImage>(vkGetSwapchainImagesKHR, vk_device, vk_swap_chain);
-    assert( vk_swap_chain_images.size() <= VULKAN_SYSTEM_SWAP_CHAIN_MAX_NUM_IMAGES );
-
-    /*
-     * Set up color target image views for each image in the swap chain.
-     */
-    std::vector<VkImageView> vk_swap_chain_color_target_image_views;
-    for (uint32_t i = 0; i < vk_swap_chain_images.size(); i++)
-    {
-        VkImageViewCreateInfo info = { VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
-        info.image = vk_swap_chain_images[i];
-        info.viewType = VK_IMAGE_VIEW_TYPE_2D;
-        info.format = vk_swap_chain_image_format;
-        info.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
-        info.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
-        info.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
-        info.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
-        info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        info.subresourceRange.baseMipLevel = 0;
-        info.subresourceRange.levelCount = 1;
-        info.subresourceRange.baseArrayLayer = 0;
-        info.subresourceRange.layerCount = 1;
-        VkImageView view;
-        VK_SUCCEED( vkCreateImageView(vk_device, &info, nullptr, &view ) );
-        vk_swap_chain_color_target_image_views.push_back(view);
-    }
-
     /*
      * Set up the VulkanSystem.
      */
@@ -434,12 +544,148 @@ bool CreateVulkanSystem(VulkanSystem *vk_system,
     vk_system->compute_queue = vk_compute_queue;
     vk_system->presentation_queue = vk_presentation_queue;
     vk_system->surface = vk_surface;
-    vk_system->swap_chain = vk_swap_chain;
-    vk_system->swap_chain_num_images = vk_swap_chain_images.size();
-    for (uint32_t i = 0; i < vk_swap_chain_images.size(); i++)
+    return create_swap_chain(vk_system,
+                             created_surface.initial_framebuffer_pixel_width,
+                             created_surface.initial_framebuffer_pixel_height,
+                             VK_NULL_HANDLE);
+}
+
+
+bool RecreateVulkanSwapChain(VulkanSystem *vk_system, uint32_t framebuffer_width, uint32_t framebuffer_height)
+{
+    MemoryScope memory_scope(MemorySubsystem::Vulkan);
+    // The old images may still be in use by submitted frames.
+    VK_SUCCEED( vkDeviceWaitIdle(vk_system->device) );
+    VkSwapchainKHR old_swap_chain = vk_system->swap_chain;
+    VkImageView old_image_views[VULKAN_SYSTEM_SWAP_CHAIN_MAX_NUM_IMAGES];
+    uint32_t old_num_images = vk_system->swap_chain_num_images;
+    for (uint32_t i = 0; i < old_num_images; i++)
+        old_image_views[i] = vk_system->swap_chain_color_target_image_views[i];
+
+    bool created = create_swap_chain(vk_system, framebuffer_width, framebuffer_height, old_swap_chain);
+    for (uint32_t i = 0; i < old_num_images; i++)
+        vkDestroyImageView(vk_system->device, old_image_views[i], nullptr);
+    vkDestroySwapchainKHR(vk_system->device, old_swap_chain, nullptr);
+    if ( !created )
     {
-        vk_system->swap_chain_images[i] = vk_swap_chain_images[i];
-        vk_system->swap_chain_color_target_image_views[i] = vk_swap_chain_color_target_image_views[i];
+        vk_system->swap_chain = VK_NULL_HANDLE;
+        vk_system->swap_chain_num_images = 0;
+    }
+    return created;
+}
+
+
+uint32_t VulkanFindMemoryType(VkPhysicalDevice physical_device,
+                              uint32_t memory_type_bits,
+                              VkMemoryPropertyFlags properties)
+{
+    VkPhysicalDeviceMemoryProperties memory_properties;
+    vkGetPhysicalDeviceMemoryProperties(physical_device, &memory_properties);
+    for (uint32_t i = 0; i < memory_properties.memoryTypeCount; i++)
+    {
+        if ( (memory_type_bits & (1u << i)) == 0 ) continue;
+        if ( (memory_properties.memoryTypes[i].propertyFlags & properties) == properties )
+            return i;
     }
+    return UINT32_MAX;
+}
+
+
+bool CreateVulkanBuffer(VulkanSystem *vk_system,
+                        VkDeviceSize size,
+                        VkBufferUsageFlags usage,
+                        VkMemoryPropertyFlags memory_properties,
+                        VulkanBuffer *buffer)
+{
+    VkBuffer vk_buffer;
+    {
+        VkBufferCreateInfo info = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+        info.size = size;
+        info.usage = usage;
+        info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        VK_SUCCEED( vkCreateBuffer(vk_system->device, &info, nullptr, &vk_buffer) );
+    }
+    VkMemoryRequirements requirements;
+    vkGetBufferMemoryRequirements(vk_system->device, vk_buffer, &requirements);
+    uint32_t memory_type = VulkanFindMemoryType(vk_system->physical_device, requirements.memoryTypeBits, memory_properties);
+    if ( memory_type == UINT32_MAX )
+    {
+        fprintf(stderr, C_RED "[%s] No memory type supports the requested buffer memory properties.\n" C_RESET, __func__);
+        vkDestroyBuffer(vk_system->device, vk_buffer, nullptr);
+        return false;
+    }
+    VkDeviceMemory vk_memory;
+    {
+        VkMemoryAllocateInfo info = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
+        info.allocationSize = requirements.size;
+        info.memoryTypeIndex = memory_type;
+        if ( vkAllocateMemory(vk_system->device, &info, nullptr, &vk_memory) != VK_SUCCESS )
+        {
+            fprintf(stderr, C_RED "[%s] Failed to allocate %llu bytes of buffer memory.\n" C_RESET, __func__, (unsigned long long) requirements.size);
+            vkDestroyBuffer(vk_system->device, vk_buffer, nullptr);
+            return false;
+        }
+    }
+    VK_SUCCEED( vkBindBufferMemory(vk_system->device, vk_buffer, vk_memory, 0) );
+    // The memory type may have more properties than requested, such as being coherent.
+    VkPhysicalDeviceMemoryProperties device_memory_properties;
+    vkGetPhysicalDeviceMemoryProperties(vk_system->physical_device, &device_memory_properties);
+    memory_properties = device_memory_properties.memoryTypes[memory_type].propertyFlags;
+
+    void *mapped = nullptr;
+    if ( memory_properties & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT )
+    {
+        VK_SUCCEED( vkMapMemory(vk_system->device, vk_memory, 0, VK_WHOLE_SIZE, 0, &mapped) );
+    }
+
+    buffer->buffer = vk_buffer;
+    buffer->memory = vk_memory;
+    buffer->size = size;
+    buffer->memory_properties = memory_properties;
+    buffer->mapped = mapped;
+    return true;
+}
+
+
+void DestroyVulkanBuffer(VulkanSystem *vk_system, VulkanBuffer *buffer)
+{
+    if ( buffer->mapped != nullptr )
+        vkUnmapMemory(vk_system->device, buffer->memory);
+    vkDestroyBuffer(vk_system->device, buffer->buffer, nullptr);
+    vkFreeMemory(vk_system->device, buffer->memory, nullptr);
+    *buffer = {};
+}
+
+
+bool CreateVulkanShaderModule(VulkanSystem *vk_system, const char *spirv_path, VkShaderModule *shader_module)
+{
+    FILE *file = fopen(spirv_path, "rb");
+    if ( file == nullptr )
+    {
+        fprintf(stderr, C_RED "[%s] Failed to open shader \"%s\".\n" C_RESET, __func__, spirv_path);
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if ( size <= 0 || size % 4 != 0 )
+    {
+        fprintf(stderr, C_RED "[%s] \"%s\" is not a SPIR-V binary.\n" C_RESET, __func__, spirv_path);
+        fclose(file);
+        return false;
+    }
+    std::vector<uint32_t> code(size / 4);
+    size_t read = fread(&code[0], 1, size, file);
+    fclose(file);
+    if ( read != (size_t) size )
+    {
+        fprintf(stderr, C_RED "[%s] Failed to read shader \"%s\".\n" C_RESET, __func__, spirv_path);
+        return false;
+    }
+
+    VkShaderModuleCreateInfo info = { VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO };
+    info.codeSize = size;
+    info.pCode = &code[0];
+    VK_SUCCEED( vkCreateShaderModule(vk_system->device, &info, nullptr, shader_module) );
     return true;
 }
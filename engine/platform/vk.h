@@ -3,6 +3,7 @@
 #include <vulkan/vulkan.h>
 #include <functional>
 #include <string>
+#include <vector>
 
 struct VulkanSystem
 {
@@ -26,6 +27,10 @@ struct VulkanSystem
     VkSwapchainKHR swap_chain;
 
     uint32_t swap_chain_num_images;
+    // Updated when the swap chain is recreated, see RecreateVulkanSwapChain.
+    VkExtent2D swap_chain_extent;
+    // Includes VK_IMAGE_USAGE_TRANSFER_SRC_BIT if the surface supports it, to read frames back.
+    VkImageUsageFlags swap_chain_usage;
     #define VULKAN_SYSTEM_SWAP_CHAIN_MAX_NUM_IMAGES 4u
     VkImage swap_chain_images[VULKAN_SYSTEM_SWAP_CHAIN_MAX_NUM_IMAGES];
     VkImageView swap_chain_color_target_image_views[VULKAN_SYSTEM_SWAP_CHAIN_MAX_NUM_IMAGES];
@@ -38,12 +43,49 @@ struct VulkanSystemCreateSurfaceOutput
     uint32_t initial_framebuffer_pixel_height;
 };
 
+// Host allocation callbacks that track the driver's CPU allocations as the Vulkan subsystem
+// (see memory/memory_tracking.h). Used for the instance and device.
+const VkAllocationCallbacks *VulkanHostAllocator();
+
 bool CreateVulkanSystem(VulkanSystem *vk_system,
                         std::function<bool(VkInstance, VkPhysicalDevice, VulkanSystemCreateSurfaceOutput *)> create_surface,
                         const std::vector<std::string> &extra_explicit_layers,
                         const std::vector<std::string> &extra_instance_extensions,
                         const std::vector<std::string> &extra_device_extensions);
 
+// Replace the swap chain with one fitting the surface, e.g. after acquisition or presentation
+// returned VK_ERROR_OUT_OF_DATE_KHR or VK_SUBOPTIMAL_KHR. Waits for the device to idle, since the
+// old images may be in use. The framebuffer size is used if the surface doesn't dictate its own.
+bool RecreateVulkanSwapChain(VulkanSystem *vk_system, uint32_t framebuffer_width, uint32_t framebuffer_height);
+
+/*
+ * A VkBuffer with its own dedicated memory allocation.
+ * If the memory is host-visible, it is persistently mapped at creation.
+ */
+struct VulkanBuffer
+{
+    VkBuffer buffer;
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    VkMemoryPropertyFlags memory_properties; // Of the memory type used, a superset of those requested.
+    void *mapped; // nullptr if not host-visible.
+};
+
+// Returns UINT32_MAX if no memory type satisfies the requirements.
+uint32_t VulkanFindMemoryType(VkPhysicalDevice physical_device,
+                              uint32_t memory_type_bits,
+                              VkMemoryPropertyFlags properties);
+
+bool CreateVulkanBuffer(VulkanSystem *vk_system,
+                        VkDeviceSize size,
+                        VkBufferUsageFlags usage,
+                        VkMemoryPropertyFlags memory_properties,
+                        VulkanBuffer *buffer);
+void DestroyVulkanBuffer(VulkanSystem *vk_system, VulkanBuffer *buffer);
+
+// Load a SPIR-V binary from disk.
+bool CreateVulkanShaderModule(VulkanSystem *vk_system, const char *spirv_path, VkShaderModule *shader_module);
+
 // Helper macro
 #define VK_SUCCEED(call) \
     do { \
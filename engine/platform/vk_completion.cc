@@ -0,0 +1,124 @@
+#include "vk_completion.h"
+#include "jobs/task.h"
+#include "ansi_color.h"
+#include <stdio.h>
+#include <assert.h>
+
+bool VulkanCompletionAwaitable::await_ready()
+{
+    return m_waiter->signaled(m_fence, m_semaphore, m_value);
+}
+
+void VulkanCompletionAwaitable::await_suspend(std::coroutine_handle<> handle)
+{
+    m_waiter->add({m_fence, m_semaphore, m_value, handle});
+}
+
+bool VulkanCompletionWaiter::init(VulkanSystem *vk, JobSystem *jobs)
+{
+    m_vk = vk;
+    m_jobs = jobs;
+    m_stopping = false;
+    m_wake_value = 0;
+    VkSemaphoreTypeCreateInfo type_info = { VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO };
+    type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    type_info.initialValue = 0;
+    VkSemaphoreCreateInfo info = { VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+    info.pNext = &type_info;
+    if ( vkCreateSemaphore(vk->device, &info, nullptr, &m_wake_semaphore) != VK_SUCCESS )
+    {
+        fprintf(stderr, C_RED "[%s] Failed to create the wake semaphore.\n" C_RESET, __func__);
+        return false;
+    }
+    m_thread = std::thread(&VulkanCompletionWaiter::thread_loop, this);
+    return true;
+}
+
+void VulkanCompletionWaiter::shutdown()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+        VkSemaphoreSignalInfo signal_info = { VK_STRUCTURE_TYPE_SEMAPHORE_SIGNAL_INFO };
+        signal_info.semaphore = m_wake_semaphore;
+        signal_info.value = ++m_wake_value;
+        VK_SUCCEED( vkSignalSemaphore(m_vk->device, &signal_info) );
+    }
+    m_condition.notify_one();
+    m_thread.join();
+    m_waits.clear();
+    vkDestroySemaphore(m_vk->device, m_wake_semaphore, nullptr);
+}
+
+bool VulkanCompletionWaiter::signaled(VkFence fence, VkSemaphore semaphore, uint64_t value)
+{
+    if ( fence != VK_NULL_HANDLE ) return vkGetFenceStatus(m_vk->device, fence) == VK_SUCCESS;
+    uint64_t current;
+    VK_SUCCEED( vkGetSemaphoreCounterValue(m_vk->device, semaphore, &current) );
+    return current >= value;
+}
+
+void VulkanCompletionWaiter::add(const Wait &wait)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        assert(!m_stopping);
+        m_waits.push_back(wait);
+        VkSemaphoreSignalInfo signal_info = { VK_STRUCTURE_TYPE_SEMAPHORE_SIGNAL_INFO };
+        signal_info.semaphore = m_wake_semaphore;
+        signal_info.value = ++m_wake_value;
+        VK_SUCCEED( vkSignalSemaphore(m_vk->device, &signal_info) );
+    }
+    m_condition.notify_one();
+}
+
+void VulkanCompletionWaiter::thread_loop()
+{
+    std::vector<VkSemaphore> semaphores;
+    std::vector<uint64_t> values;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while ( true )
+    {
+        m_condition.wait(lock, [&]() { return m_stopping || !m_waits.empty(); });
+        if ( m_stopping ) break;
+
+        // Resume the coroutines whose waits are done.
+        bool has_fences = false;
+        for (size_t i = 0; i < m_waits.size(); )
+        {
+            Wait &wait = m_waits[i];
+            if ( signaled(wait.fence, wait.semaphore, wait.value) )
+            {
+                m_jobs->submit(resume_coroutine_job(wait.handle), nullptr);
+                m_waits[i] = m_waits.back();
+                m_waits.pop_back();
+                continue;
+            }
+            if ( wait.fence != VK_NULL_HANDLE ) has_fences = true;
+            i++;
+        }
+        if ( m_waits.empty() ) continue;
+
+        // Block until any pending value is reached or a wait is added.
+        semaphores.clear();
+        values.clear();
+        semaphores.push_back(m_wake_semaphore);
+        values.push_back(m_wake_value + 1);
+        for (Wait &wait : m_waits)
+        {
+            if ( wait.fence != VK_NULL_HANDLE ) continue;
+            semaphores.push_back(wait.semaphore);
+            values.push_back(wait.value);
+        }
+        lock.unlock();
+        VkSemaphoreWaitInfo wait_info = { VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO };
+        wait_info.flags = VK_SEMAPHORE_WAIT_ANY_BIT;
+        wait_info.semaphoreCount = semaphores.size();
+        wait_info.pSemaphores = &semaphores[0];
+        wait_info.pValues = &values[0];
+        VkResult result = vkWaitSemaphores(m_vk->device, &wait_info, has_fences ? VULKAN_COMPLETION_WAITER_FENCE_POLL_NS : ~0ull);
+        if ( result != VK_SUCCESS && result != VK_TIMEOUT )
+            fprintf(stderr, C_RED "[%s] vkWaitSemaphores failed (%d).\n" C_RESET, __func__, (int) result);
+        lock.lock();
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef VK_COMPLETION_H_
+#define VK_COMPLETION_H_
+/* vk_completion.h
+ *
+ * Awaitables for GPU work, so that coroutines (see jobs/task.h) can wait for a fence or a
+ * timeline semaphore value without blocking a thread each:
+ *
+ *     uint64_t value = uploader.end_async(...);
+ *     co_await gpu_waiter->timeline_reached(uploader.semaphore(), value);
+ *
+ * One thread waits on every pending timeline value at once with vkWaitSemaphores, and resumes
+ * each waiting coroutine as a job when its value is reached. Fences can't be waited on
+ * together with semaphores, so pending fences are polled instead, which timeline semaphores
+ * should be preferred over.
+ */
+#include "vk.h"
+#include "jobs/job_system.h"
+#include <coroutine>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// How often pending fences are polled.
+#define VULKAN_COMPLETION_WAITER_FENCE_POLL_NS 1000000ull
+
+class VulkanCompletionWaiter;
+
+class VulkanCompletionAwaitable
+{
+public:
+    bool await_ready();
+    void await_suspend(std::coroutine_handle<> handle);
+    void await_resume() {}
+private:
+    friend class VulkanCompletionWaiter;
+    VulkanCompletionAwaitable(VulkanCompletionWaiter *waiter, VkFence fence, VkSemaphore semaphore, uint64_t value) :
+        m_waiter{waiter}, m_fence{fence}, m_semaphore{semaphore}, m_value{value} {}
+    VulkanCompletionWaiter *m_waiter;
+    VkFence m_fence;
+    VkSemaphore m_semaphore;
+    uint64_t m_value;
+};
+
+class VulkanCompletionWaiter
+{
+public:
+    bool init(VulkanSystem *vk, JobSystem *jobs);
+    // Coroutines still waiting are not resumed.
+    void shutdown();
+
+    // co_await these to continue as a job once the GPU has signaled the fence or semaphore value.
+    VulkanCompletionAwaitable fence_signaled(VkFence fence) { return VulkanCompletionAwaitable(this, fence, VK_NULL_HANDLE, 0); }
+    VulkanCompletionAwaitable timeline_reached(VkSemaphore semaphore, uint64_t value) { return VulkanCompletionAwaitable(this, VK_NULL_HANDLE, semaphore, value); }
+private:
+    friend class VulkanCompletionAwaitable;
+    struct Wait
+    {
+        VkFence fence; // VK_NULL_HANDLE if waiting on a semaphore.
+        VkSemaphore semaphore;
+        uint64_t value;
+        std::coroutine_handle<> handle;
+    };
+    bool signaled(VkFence fence, VkSemaphore semaphore, uint64_t value);
+    void add(const Wait &wait);
+    void thread_loop();
+
+    VulkanSystem *m_vk;
+    JobSystem *m_jobs;
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::vector<Wait> m_waits;
+    bool m_stopping;
+    // Signaled from the host to interrupt the thread's vkWaitSemaphores when a wait is added.
+    VkSemaphore m_wake_semaphore;
+    uint64_t m_wake_value;
+};
+
+#endif // VK_COMPLETION_H_
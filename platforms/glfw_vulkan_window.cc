@@ -2,6 +2,7 @@
 
 #include "engine/engine.h"
 #include "engine/platform/vk.h"
+#include "engine/memory/memory_tracking.h"
 
 #include <GLFW/glfw3.h>
 #ifndef GLFW_INCLUDE_VULKAN
@@ -82,6 +83,7 @@ class Platform_GLFWVulkanWindow : public Platform
 public:
     static std::unique_ptr<Platform_GLFWVulkanWindow> create();
     void enter_loop() override;
+    void exit_loop() override;
 
     static Platform_GLFWVulkanWindow *Get()
     {
@@ -95,8 +97,22 @@ public:
 private:
     GLFWwindow *glfw_window;
     VulkanSystem vk_system;
-    VkCommandPool command_pool;
-    VkCommandBuffer command_buffer;
+    // The framebuffer size the swap chain was last created for.
+    int swap_chain_framebuffer_width;
+    int swap_chain_framebuffer_height;
+    // Waits while the window is minimized. Returns false if the window is closed meanwhile or
+    // the swap chain can't be created.
+    bool recreate_swap_chain();
+    // Per-frame objects are reused once the frame's fence has signaled.
+    struct Frame
+    {
+        VkCommandPool command_pool;
+        VkCommandBuffer command_buffer;
+        VkFence fence;
+        VkSemaphore acquire_semaphore;
+        VkSemaphore release_semaphore;
+    };
+    Frame frames[PLATFORM_FRAMES_IN_FLIGHT];
 
     static Platform_GLFWVulkanWindow *m_active;
     Platform_GLFWVulkanWindow();
@@ -202,6 +218,7 @@ static void glfw_framebuffer_size_callback(GLFWwindow *window, int width, int he
 std::unique_ptr<Platform_GLFWVulkanWindow> Platform_GLFWVulkanWindow::create()
 {
     assert(!m_active);
+    MemoryScope memory_scope(MemorySubsystem::Platform);
 
     if ( !glfwInit() )
     {
@@ -289,33 +306,71 @@ std::unique_ptr<Platform_GLFWVulkanWindow> Platform_GLFWVulkanWindow::create()
     }
 
     platform->vk_system = vk_system;
+    glfwGetFramebufferSize(glfw_window, &platform->swap_chain_framebuffer_width, &platform->swap_chain_framebuffer_height);
 
-    VkCommandPool command_pool;
+    for (Frame &frame : platform->frames)
     {
-        VkCommandPoolCreateInfo info = { VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO };
-        info.queueFamilyIndex = vk_system.graphics_family;
-        info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-        vkCreateCommandPool(vk_system.device, &info, nullptr, &command_pool);
-    }
-    VkCommandBuffer command_buffer;
-    {
-        VkCommandBufferAllocateInfo info = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
-        info.commandPool = command_pool;
-        info.commandBufferCount = 1;
-        info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-        vkAllocateCommandBuffers(vk_system.device, &info, &command_buffer);
+        {
+            VkCommandPoolCreateInfo info = { VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO };
+            info.queueFamilyIndex = vk_system.graphics_family;
+            info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+            VK_SUCCEED( vkCreateCommandPool(vk_system.device, &info, nullptr, &frame.command_pool) );
+        }
+        {
+            VkCommandBufferAllocateInfo info = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
+            info.commandPool = frame.command_pool;
+            info.commandBufferCount = 1;
+            info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            VK_SUCCEED( vkAllocateCommandBuffers(vk_system.device, &info, &frame.command_buffer) );
+        }
+        {
+            VkFenceCreateInfo info = { VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
+            info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+            VK_SUCCEED( vkCreateFence(vk_system.device, &info, nullptr, &frame.fence) );
+        }
+        {
+            VkSemaphoreCreateInfo info = { VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+            VK_SUCCEED( vkCreateSemaphore(vk_system.device, &info, nullptr, &frame.acquire_semaphore) );
+            VK_SUCCEED( vkCreateSemaphore(vk_system.device, &info, nullptr, &frame.release_semaphore) );
+        }
     }
-    platform->command_pool = command_pool;
-    platform->command_buffer = command_buffer;
 
     m_active = platform.get();
     return platform;
 }
 
 
+void Platform_GLFWVulkanWindow::exit_loop()
+{
+    glfwSetWindowShouldClose(glfw_window, GLFW_TRUE);
+}
+
+bool Platform_GLFWVulkanWindow::recreate_swap_chain()
+{
+    // No swap chain can be created for a minimized window's empty framebuffer.
+    int width, height;
+    glfwGetFramebufferSize(glfw_window, &width, &height);
+    while ( (width == 0 || height == 0) && !glfwWindowShouldClose(glfw_window) )
+    {
+        glfwWaitEvents();
+        glfwGetFramebufferSize(glfw_window, &width, &height);
+    }
+    if ( glfwWindowShouldClose(glfw_window) ) return false;
+    if ( !RecreateVulkanSwapChain(&vk_system, (uint32_t) width, (uint32_t) height) )
+    {
+        fprintf(stderr, C_RED "[GLFW] Failed to recreate the swap chain.\n" C_RESET);
+        return false;
+    }
+    swap_chain_framebuffer_width = width;
+    swap_chain_framebuffer_height = height;
+    return true;
+}
+
 void Platform_GLFWVulkanWindow::enter_loop()
 {
+    MemoryScope memory_scope(MemorySubsystem::Platform);
     double display_time = glfwGetTime();
+    uint32_t frame_slot = 0;
     while( !glfwWindowShouldClose(glfw_window) )
     {
         glfwPollEvents();
@@ -328,72 +383,109 @@ void Platform_GLFWVulkanWindow::enter_loop()
             display_time = new_display_time;
         }
 
-        VkSemaphore acquire_semaphore;
-        {
-            VkSemaphoreCreateInfo info = { VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
-            VK_SUCCEED( vkCreateSemaphore(vk_system.device, &info, nullptr, &acquire_semaphore) );
-        }
-        VkSemaphore release_semaphore;
-        {
-            VkSemaphoreCreateInfo info = { VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
-            VK_SUCCEED( vkCreateSemaphore(vk_system.device, &info, nullptr, &release_semaphore) );
-        }
+        // Wait until the GPU is done with this slot's previous frame before reusing its objects.
+        Frame &frame = frames[frame_slot];
+        VK_SUCCEED( vkWaitForFences(vk_system.device, 1, &frame.fence, VK_TRUE, ~0ull) );
 
         uint32_t image_index;
-        VK_SUCCEED( vkAcquireNextImageKHR(vk_system.device, vk_system.swap_chain, ~0ull, acquire_semaphore, VK_NULL_HANDLE, &image_index) );
+        VkResult acquired = vkAcquireNextImageKHR(vk_system.device, vk_system.swap_chain, ~0ull, frame.acquire_semaphore, VK_NULL_HANDLE, &image_index);
+        if ( acquired == VK_ERROR_OUT_OF_DATE_KHR )
+        {
+            // Nothing was acquired, so the slot's fence and semaphore are left as they were.
+            if ( !recreate_swap_chain() ) break;
+            continue;
+        }
+        assert( acquired == VK_SUCCESS || acquired == VK_SUBOPTIMAL_KHR );
         assert( image_index < vk_system.swap_chain_num_images );
+        VK_SUCCEED( vkResetFences(vk_system.device, 1, &frame.fence) );
 
-        vkResetCommandPool(vk_system.device, command_pool, VK_COMMAND_POOL_RESET_RELEASE_RESOURCES_BIT );
+        vkResetCommandPool(vk_system.device, frame.command_pool, 0);
 
-        {
-            VkCommandBufferBeginInfo begin_info = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
-            begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-            VK_SUCCEED( vkBeginCommandBuffer(command_buffer, &begin_info) );
+        VkCommandBufferBeginInfo begin_info = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+        begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        VK_SUCCEED( vkBeginCommandBuffer(frame.command_buffer, &begin_info) );
 
-            VkClearColorValue color = { 0,0,0,1 };
-            VkImageSubresourceRange range = {};
-            range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            range.levelCount = 1;
-            range.layerCount = 1;
-            vkCmdClearColorImage(command_buffer, vk_system.swap_chain_images[image_index], VK_IMAGE_LAYOUT_GENERAL, &color, 1, &range);
+        // Listeners record the frame into the command buffer.
+        DisplayRefreshEvent e;
+        e.time = display_time;
+        e.dt = display_deltatime;
+        e.framebuffer.width = (uint16_t) vk_system.swap_chain_extent.width;
+        e.framebuffer.height = (uint16_t) vk_system.swap_chain_extent.height;
+        e.frame_slot = frame_slot;
+        e.command_buffer = frame.command_buffer;
+        e.swap_chain_image = image_index;
+        emit_display_refresh_event(e);
 
-            VK_SUCCEED( vkEndCommandBuffer(command_buffer) );
+        if ( m_listeners.empty() )
+        {
+            // Nothing writes the image, so clear it to present something defined.
+            VkImageMemoryBarrier barrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+            barrier.srcAccessMask = 0;
+            barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.image = vk_system.swap_chain_images[image_index];
+            barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+            vkCmdPipelineBarrier(frame.command_buffer,
+                                 VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                                 0, nullptr, 0, nullptr, 1, &barrier);
+            VkClearColorValue color = { 0,0,0,1 };
+            vkCmdClearColorImage(frame.command_buffer, barrier.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &color, 1, &barrier.subresourceRange);
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = 0;
+            barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            barrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+            vkCmdPipelineBarrier(frame.command_buffer,
+                                 VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+                                 0, nullptr, 0, nullptr, 1, &barrier);
         }
+        VK_SUCCEED( vkEndCommandBuffer(frame.command_buffer) );
 
-        VkPipelineStageFlags stage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        // The swap chain image is first written by a transfer (see DisplayRefreshEvent).
+        VkPipelineStageFlags stage = VK_PIPELINE_STAGE_TRANSFER_BIT;
         VkSubmitInfo submit_info = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
         submit_info.waitSemaphoreCount = 1;
-        submit_info.pWaitSemaphores = &acquire_semaphore;
+        submit_info.pWaitSemaphores = &frame.acquire_semaphore;
         submit_info.pWaitDstStageMask = &stage;
         submit_info.signalSemaphoreCount = 1;
-        submit_info.pSignalSemaphores = &release_semaphore;
+        submit_info.pSignalSemaphores = &frame.release_semaphore;
         submit_info.commandBufferCount = 1;
-        submit_info.pCommandBuffers = &command_buffer;
-        vkQueueSubmit(vk_system.graphics_queue, 1, &submit_info, VK_NULL_HANDLE);
-
-        DisplayRefreshEvent e;
-        e.time = display_time;
-        e.dt = display_deltatime;
-        int framebuffer_width, framebuffer_height;
-        glfwGetFramebufferSize(glfw_window, &framebuffer_width, &framebuffer_height);
-        e.framebuffer.width = (uint16_t) framebuffer_width;
-        e.framebuffer.height = (uint16_t) framebuffer_height;
-        emit_display_refresh_event(e);
+        submit_info.pCommandBuffers = &frame.command_buffer;
+        VK_SUCCEED( vkQueueSubmit(vk_system.graphics_queue, 1, &submit_info, frame.fence) );
 
         VkPresentInfoKHR present_info = { VK_STRUCTURE_TYPE_PRESENT_INFO_KHR };
         present_info.waitSemaphoreCount = 1;
-        present_info.pWaitSemaphores = &release_semaphore; //?
+        present_info.pWaitSemaphores = &frame.release_semaphore; //?
         present_info.swapchainCount = 1;
         present_info.pSwapchains = &vk_system.swap_chain;
         present_info.pImageIndices = &image_index;
-        VK_SUCCEED( vkQueuePresentKHR(vk_system.graphics_queue, &present_info) );
+        VkResult presented = vkQueuePresentKHR(vk_system.graphics_queue, &present_info);
+        assert( presented == VK_SUCCESS || presented == VK_SUBOPTIMAL_KHR || presented == VK_ERROR_OUT_OF_DATE_KHR );
 
-        VK_SUCCEED( vkDeviceWaitIdle(vk_system.device) );
+        frame_slot = (frame_slot + 1) % PLATFORM_FRAMES_IN_FLIGHT;
+        MemoryTrackingEndFrame();
 
-        vkDestroySemaphore(vk_system.device, acquire_semaphore, nullptr);
-        vkDestroySemaphore(vk_system.device, release_semaphore, nullptr);
+        // A suboptimal swap chain still presents, but no longer matches the surface. Resizes are
+        // also checked directly, since not every platform reports them through the results.
+        int framebuffer_width, framebuffer_height;
+        glfwGetFramebufferSize(glfw_window, &framebuffer_width, &framebuffer_height);
+        if ( acquired == VK_SUBOPTIMAL_KHR || presented != VK_SUCCESS
+             || framebuffer_width != swap_chain_framebuffer_width || framebuffer_height != swap_chain_framebuffer_height )
+        {
+            if ( !recreate_swap_chain() ) break;
+        }
     }
 
+    VK_SUCCEED( vkDeviceWaitIdle(vk_system.device) );
+    for (Frame &frame : frames)
+    {
+        vkDestroySemaphore(vk_system.device, frame.acquire_semaphore, nullptr);
+        vkDestroySemaphore(vk_system.device, frame.release_semaphore, nullptr);
+        vkDestroyFence(vk_system.device, frame.fence, nullptr);
+        vkDestroyCommandPool(vk_system.device, frame.command_pool, nullptr);
+    }
     glfwDestroyWindow(glfw_window);
     glfwTerminate();
 }
@@ -0,0 +1,392 @@
+#include "renderer/asset_file.h"
+#include "renderer/mesh_optimize.h"
+#include "engine/memory/memory_tracking.h"
+#include "ansi_color.h"
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <atomic>
+#include <algorithm>
+
+/*
+ * LZ4 block format.
+ * A block is a series of sequences: a token (literal length << 4 | (match length - 4)), literal length
+ * extension bytes, the literals, a 16-bit little-endian match offset and match length extension bytes.
+ * Lengths of 15 are extended by bytes added to them until a byte that is not 255.
+ * The last sequence has only literals. Matches end at least 5 bytes, and start at least 12 bytes,
+ * before the end of the block.
+ */
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5
+#define LZ4_MATCH_START_LIMIT 12
+#define LZ4_MAX_OFFSET 65535
+#define LZ4_HASH_BITS 16
+
+static void lz4_write_length(std::vector<uint8_t> *out, size_t length)
+{
+    while ( length >= 255 )
+    {
+        out->push_back(255);
+        length -= 255;
+    }
+    out->push_back((uint8_t) length);
+}
+
+static void lz4_write_sequence(std::vector<uint8_t> *out, const uint8_t *literals, size_t num_literals, uint32_t offset, size_t match_length)
+{
+    size_t match_code = match_length == 0 ? 0 : match_length - LZ4_MIN_MATCH;
+    out->push_back((uint8_t) ((std::min<size_t>(num_literals, 15) << 4) | std::min<size_t>(match_code, 15)));
+    if ( num_literals >= 15 ) lz4_write_length(out, num_literals - 15);
+    out->insert(out->end(), literals, literals + num_literals);
+    if ( match_length == 0 ) return;
+    out->push_back((uint8_t) (offset & 0xFF));
+    out->push_back((uint8_t) (offset >> 8));
+    if ( match_code >= 15 ) lz4_write_length(out, match_code - 15);
+}
+
+static uint32_t lz4_read_32(const uint8_t *p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static void lz4_compress(const uint8_t *data, size_t size, std::vector<uint8_t> *out)
+{
+    out->clear();
+    std::vector<uint32_t> table(1u << LZ4_HASH_BITS, UINT32_MAX);
+    size_t anchor = 0;
+    size_t position = 0;
+    size_t match_start_limit = size > LZ4_MATCH_START_LIMIT ? size - LZ4_MATCH_START_LIMIT : 0;
+    while ( position < match_start_limit )
+    {
+        uint32_t sequence = lz4_read_32(data + position);
+        uint32_t hash = (sequence * 2654435761u) >> (32 - LZ4_HASH_BITS);
+        uint32_t reference = table[hash];
+        table[hash] = (uint32_t) position;
+        if ( reference == UINT32_MAX || position - reference > LZ4_MAX_OFFSET || lz4_read_32(data + reference) != sequence )
+        {
+            position++;
+            continue;
+        }
+        size_t length = LZ4_MIN_MATCH;
+        while ( position + length < size - LZ4_LAST_LITERALS && data[reference + length] == data[position + length] ) length++;
+        lz4_write_sequence(out, data + anchor, position - anchor, (uint32_t) (position - reference), length);
+        position += length;
+        anchor = position;
+    }
+    lz4_write_sequence(out, data + anchor, size - anchor, 0, 0);
+}
+
+static bool lz4_decompress(const uint8_t *in, size_t in_size, uint8_t *out, size_t out_size)
+{
+    size_t ip = 0;
+    size_t op = 0;
+    auto read_length = [&](size_t *length) {
+        uint8_t byte;
+        do {
+            if ( ip >= in_size ) return false;
+            byte = in[ip++];
+            *length += byte;
+        } while ( byte == 255 );
+        return true;
+    };
+    while ( ip < in_size )
+    {
+        uint8_t token = in[ip++];
+        size_t num_literals = token >> 4;
+        if ( num_literals == 15 && !read_length(&num_literals) ) return false;
+        if ( num_literals > in_size - ip || num_literals > out_size - op ) return false;
+        memcpy(out + op, in + ip, num_literals);
+        ip += num_literals;
+        op += num_literals;
+        if ( ip == in_size ) break; // The last sequence has no match.
+
+        if ( in_size - ip < 2 ) return false;
+        size_t offset = in[ip] | (in[ip + 1] << 8);
+        ip += 2;
+        size_t match_length = token & 15;
+        if ( match_length == 15 && !read_length(&match_length) ) return false;
+        match_length += LZ4_MIN_MATCH;
+        if ( offset == 0 || offset > op || match_length > out_size - op ) return false;
+        // Matches may overlap their own output, so copy forwards byte by byte.
+        for (size_t i = 0; i < match_length; i++) out[op + i] = out[op - offset + i];
+        op += match_length;
+    }
+    return op == out_size;
+}
+
+bool AssetFile::open(const char *path)
+{
+    int fd = ::open(path, O_RDONLY);
+    if ( fd < 0 )
+    {
+        fprintf(stderr, C_RED "[%s] Failed to open asset file \"%s\".\n" C_RESET, __func__, path);
+        return false;
+    }
+    struct stat st;
+    if ( fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(AssetFileHeader) )
+    {
+        fprintf(stderr, C_RED "[%s] \"%s\" is too small to be an asset file.\n" C_RESET, __func__, path);
+        ::close(fd);
+        return false;
+    }
+    void *mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if ( mapping == MAP_FAILED )
+    {
+        fprintf(stderr, C_RED "[%s] Failed to map asset file \"%s\".\n" C_RESET, __func__, path);
+        return false;
+    }
+    m_data = (const uint8_t *) mapping;
+    m_size = st.st_size;
+
+    m_header = (const AssetFileHeader *) m_data;
+    if ( m_header->magic != ASSET_FILE_MAGIC || m_header->version != ASSET_FILE_VERSION || m_header->file_size != m_size )
+    {
+        fprintf(stderr, C_RED "[%s] \"%s\" is not a version %u asset file.\n" C_RESET, __func__, path, ASSET_FILE_VERSION);
+        close();
+        return false;
+    }
+    size_t tables_size = sizeof(AssetFileHeader)
+                       + m_header->num_chunks * sizeof(AssetChunk)
+                       + m_header->num_meshes * sizeof(AssetMesh)
+                       + m_header->num_point_lights * sizeof(AssetPointLight);
+    if ( tables_size > m_size )
+    {
+        fprintf(stderr, C_RED "[%s] \"%s\" is truncated.\n" C_RESET, __func__, path);
+        close();
+        return false;
+    }
+    m_chunks = (const AssetChunk *) (m_header + 1);
+    m_meshes = (const AssetMesh *) (m_chunks + m_header->num_chunks);
+    m_point_lights = (const AssetPointLight *) (m_meshes + m_header->num_meshes);
+
+    // Validate everything the loader indexes with, so that it can trust the tables.
+    for (uint32_t i = 0; i < m_header->num_chunks; i++)
+    {
+        const AssetChunk &chunk = m_chunks[i];
+        bool valid = chunk.offset % ASSET_FILE_ALIGNMENT == 0
+                  && chunk.offset <= m_size && chunk.stored_size <= m_size - chunk.offset
+                  && (chunk.compression == AssetCompression::LZ4 || (chunk.compression == AssetCompression::None && chunk.stored_size == chunk.size));
+        if ( !valid )
+        {
+            fprintf(stderr, C_RED "[%s] \"%s\" has an invalid chunk %u.\n" C_RESET, __func__, path, i);
+            close();
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < m_header->num_meshes; i++)
+    {
+        const AssetMesh &mesh = m_meshes[i];
+        bool valid = mesh.vertex_format < VertexFormat::NUM
+                  && mesh.num_vertices > 0
+                  && mesh.index_type == MeshPool::index_type_for(mesh.num_vertices)
+                  && mesh.vertex_chunk < m_header->num_chunks
+                  && m_chunks[mesh.vertex_chunk].size == (uint64_t) mesh.num_vertices * vertex_format_info(mesh.vertex_format).stride
+                  && mesh.num_lods >= 1 && mesh.num_lods <= MESH_LOD_MAX_LEVELS;
+        for (uint32_t j = 0; valid && j < mesh.num_lods; j++)
+        {
+            valid = mesh.lods[j].index_chunk < m_header->num_chunks
+                 && mesh.lods[j].num_indices > 0 && mesh.lods[j].num_indices % 3 == 0
+                 && m_chunks[mesh.lods[j].index_chunk].size == MeshPool::num_index_words(mesh.index_type, mesh.lods[j].num_indices) * sizeof(uint32_t);
+        }
+        if ( !valid )
+        {
+            fprintf(stderr, C_RED "[%s] \"%s\" has an invalid mesh %u.\n" C_RESET, __func__, path, i);
+            close();
+            return false;
+        }
+    }
+    // Chunks are read front to back.
+    madvise((void *) m_data, m_size, MADV_SEQUENTIAL);
+    return true;
+}
+
+void AssetFile::close()
+{
+    if ( m_data != nullptr ) munmap((void *) m_data, m_size);
+    m_data = nullptr;
+    m_size = 0;
+}
+
+bool decode_asset_chunks(JobSystem *jobs, const AssetFile &file, const AssetChunkDecode *decodes, uint32_t num_decodes)
+{
+    std::atomic<bool> failed(false);
+    jobs->parallel_for(num_decodes, 1, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; i++)
+        {
+            const AssetChunk &chunk = file.chunks()[decodes[i].chunk];
+            const uint8_t *data = decodes[i].source != nullptr ? decodes[i].source : file.chunk_data(decodes[i].chunk);
+            if ( chunk.compression == AssetCompression::None )
+            {
+                memcpy(decodes[i].destination, data, chunk.size);
+            }
+            else if ( !lz4_decompress(data, chunk.stored_size, decodes[i].destination, chunk.size) )
+            {
+                fprintf(stderr, C_RED "[decode_asset_chunks] Chunk %u is corrupt.\n" C_RESET, decodes[i].chunk);
+                failed = true;
+            }
+        }
+    });
+    return !failed;
+}
+
+uint32_t AssetFileWriter::add_chunk(std::vector<uint8_t> &&data)
+{
+    MemoryScope memory_scope(MemorySubsystem::Assets);
+    m_chunks.push_back(std::move(data));
+    return m_chunks.size() - 1;
+}
+
+void AssetFileWriter::add_polygon_mesh(PolygonMeshCreateInfo info, Transform transform)
+{
+    MemoryScope memory_scope(MemorySubsystem::Assets);
+    assert(info.num_vertices > 0 && info.num_indices > 0 && info.num_indices % 3 == 0);
+    std::vector<vec3> positions(info.positions, info.positions + info.num_vertices);
+    std::vector<vec3> normals(info.normals, info.normals + info.num_vertices);
+    std::vector<uint32_t> indices(info.indices, info.indices + info.num_indices);
+    if ( info.optimize )
+    {
+        MeshOptimizeReport report;
+        optimize_mesh(&indices[0], info.num_indices, &positions[0], &normals[0], info.num_vertices,
+                      vertex_format_info(info.vertex_format).stride, &report);
+        if ( info.optimize_report != nullptr ) *info.optimize_report = report;
+    }
+    std::vector<MeshLodLevel> lod_levels;
+    if ( info.build_lods )
+    {
+        build_lod_chain(&lod_levels, &indices[0], info.num_indices, &positions[0], info.num_vertices, MESH_LOD_MAX_LEVELS);
+        for (size_t i = 1; i < lod_levels.size(); i++)
+        {
+            if ( info.optimize )
+                optimize_vertex_cache(&lod_levels[i].indices[0], lod_levels[i].indices.size(), info.num_vertices);
+        }
+    }
+    else
+    {
+        lod_levels.push_back({indices, 0});
+    }
+
+    AssetMesh mesh = {};
+    for (int i = 0; i < 3; i++)
+    {
+        mesh.position[i] = transform.position[i];
+        mesh.euler_angles[i] = transform.euler_angles[i];
+    }
+    mesh.vertex_format = info.vertex_format;
+    mesh.num_vertices = info.num_vertices;
+    mesh.index_type = MeshPool::index_type_for(info.num_vertices);
+
+    VertexQuantization quantization = compute_vertex_quantization(&positions[0], info.num_vertices);
+    vec3 bounds_center = quantization.bounds_min + 0.5f * quantization.bounds_extent;
+    float bounds_radius = 0;
+    for (int i = 0; i < info.num_vertices; i++)
+        bounds_radius = std::max(bounds_radius, glm::length(positions[i] - bounds_center));
+    for (int i = 0; i < 3; i++)
+    {
+        mesh.bounds_min[i] = quantization.bounds_min[i];
+        mesh.bounds_extent[i] = quantization.bounds_extent[i];
+        mesh.bounds_center[i] = bounds_center[i];
+    }
+    mesh.bounds_radius = bounds_radius;
+
+    std::vector<uint8_t> vertex_data(info.num_vertices * vertex_format_info(info.vertex_format).stride);
+    encode_vertices(info.vertex_format, quantization, &positions[0], &normals[0], info.num_vertices, &vertex_data[0]);
+    mesh.vertex_chunk = add_chunk(std::move(vertex_data));
+
+    mesh.num_lods = lod_levels.size();
+    for (uint32_t i = 0; i < mesh.num_lods; i++)
+    {
+        uint32_t num_indices = lod_levels[i].indices.size();
+        std::vector<uint8_t> index_data(MeshPool::num_index_words(mesh.index_type, num_indices) * sizeof(uint32_t));
+        MeshPool::encode_indices(mesh.index_type, num_indices, &lod_levels[i].indices[0], &index_data[0]);
+        mesh.lods[i].index_chunk = add_chunk(std::move(index_data));
+        mesh.lods[i].num_indices = num_indices;
+        mesh.lods[i].error = lod_levels[i].error;
+    }
+    m_meshes.push_back(mesh);
+}
+
+void AssetFileWriter::add_point_light(Transform transform, vec4 color)
+{
+    MemoryScope memory_scope(MemorySubsystem::Assets);
+    AssetPointLight light;
+    for (int i = 0; i < 3; i++)
+    {
+        light.position[i] = transform.position[i];
+        light.euler_angles[i] = transform.euler_angles[i];
+    }
+    for (int i = 0; i < 4; i++) light.color[i] = color[i];
+    m_point_lights.push_back(light);
+}
+
+bool AssetFileWriter::write(const char *path, bool compress)
+{
+    MemoryScope memory_scope(MemorySubsystem::Assets);
+    AssetFileHeader header = {};
+    header.magic = ASSET_FILE_MAGIC;
+    header.version = ASSET_FILE_VERSION;
+    header.num_chunks = m_chunks.size();
+    header.num_meshes = m_meshes.size();
+    header.num_point_lights = m_point_lights.size();
+
+    // Compress chunks where it pays off, and lay them out after the tables.
+    std::vector<AssetChunk> chunks(m_chunks.size());
+    std::vector<std::vector<uint8_t>> compressed(m_chunks.size());
+    uint64_t offset = sizeof(AssetFileHeader)
+                    + chunks.size() * sizeof(AssetChunk)
+                    + m_meshes.size() * sizeof(AssetMesh)
+                    + m_point_lights.size() * sizeof(AssetPointLight);
+    for (size_t i = 0; i < m_chunks.size(); i++)
+    {
+        AssetChunk &chunk = chunks[i];
+        chunk.size = m_chunks[i].size();
+        chunk.stored_size = chunk.size;
+        chunk.compression = AssetCompression::None;
+        if ( compress && chunk.size > 0 )
+        {
+            lz4_compress(&m_chunks[i][0], chunk.size, &compressed[i]);
+            if ( compressed[i].size() <= ASSET_FILE_MAX_COMPRESSION_RATIO * chunk.size )
+            {
+                chunk.compression = AssetCompression::LZ4;
+                chunk.stored_size = compressed[i].size();
+            }
+        }
+        offset = (offset + ASSET_FILE_ALIGNMENT - 1) / ASSET_FILE_ALIGNMENT * ASSET_FILE_ALIGNMENT;
+        chunk.offset = offset;
+        offset += chunk.stored_size;
+    }
+    header.file_size = offset;
+
+    FILE *file = fopen(path, "wb");
+    if ( file == nullptr )
+    {
+        fprintf(stderr, C_RED "[%s] Failed to open \"%s\" for writing.\n" C_RESET, __func__, path);
+        return false;
+    }
+    bool wrote = fwrite(&header, sizeof(header), 1, file) == 1;
+    if ( !chunks.empty() ) wrote = wrote && fwrite(&chunks[0], sizeof(AssetChunk), chunks.size(), file) == chunks.size();
+    if ( !m_meshes.empty() ) wrote = wrote && fwrite(&m_meshes[0], sizeof(AssetMesh), m_meshes.size(), file) == m_meshes.size();
+    if ( !m_point_lights.empty() ) wrote = wrote && fwrite(&m_point_lights[0], sizeof(AssetPointLight), m_point_lights.size(), file) == m_point_lights.size();
+    for (size_t i = 0; wrote && i < chunks.size(); i++)
+    {
+        static const uint8_t padding[ASSET_FILE_ALIGNMENT] = {};
+        long position = ftell(file);
+        wrote = fwrite(padding, 1, chunks[i].offset - position, file) == chunks[i].offset - position;
+        const std::vector<uint8_t> &data = chunks[i].compression == AssetCompression::LZ4 ? compressed[i] : m_chunks[i];
+        if ( chunks[i].stored_size > 0 )
+            wrote = wrote && fwrite(&data[0], 1, chunks[i].stored_size, file) == chunks[i].stored_size;
+    }
+    if ( fclose(file) != 0 ) wrote = false;
+    if ( !wrote )
+    {
+        fprintf(stderr, C_RED "[%s] Failed to write \"%s\".\n" C_RESET, __func__, path);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,145 @@
+#ifndef RENDERER_ASSET_FILE_H_
+#define RENDERER_ASSET_FILE_H_
+/* asset_file.h
+ *
+ * Binary container for polygon meshes and the renderer's scene data (mesh and point light
+ * entities with their transforms), built to be loaded without parsing.
+ *
+ * Layout, all little-endian:
+ *     AssetFileHeader
+ *     AssetChunk[num_chunks]
+ *     AssetMesh[num_meshes]
+ *     AssetPointLight[num_point_lights]
+ *     chunk data, each chunk aligned to ASSET_FILE_ALIGNMENT
+ *
+ * Mesh vertex and index chunks hold exactly the bytes the mesh pool stores on the GPU: vertices
+ * in the mesh's vertex format and indices narrowed to its index type. Loading maps the file and
+ * copies or decodes each chunk straight into staging memory, so there is no intermediate copy.
+ * Chunks may be LZ4 block compressed, and are then decoded on worker threads.
+ *
+ * Files with a different version are rejected rather than converted.
+ */
+#include "renderer/renderer.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#define ASSET_FILE_MAGIC 0x54534552u // "REST"
+#define ASSET_FILE_VERSION 1u
+#define ASSET_FILE_ALIGNMENT 64u
+// Compressed chunks are only kept if they are at most this fraction of the raw size.
+#define ASSET_FILE_MAX_COMPRESSION_RATIO 0.9f
+
+enum class AssetCompression : uint32_t
+{
+    None,
+    LZ4,
+};
+
+struct AssetFileHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t file_size;
+    uint32_t num_chunks;
+    uint32_t num_meshes;
+    uint32_t num_point_lights;
+    uint32_t reserved;
+};
+static_assert(sizeof(AssetFileHeader) == 32);
+
+struct AssetChunk
+{
+    uint64_t offset;      // From the start of the file, a multiple of ASSET_FILE_ALIGNMENT.
+    uint64_t stored_size; // In the file.
+    uint64_t size;        // Decoded.
+    AssetCompression compression;
+    uint32_t reserved;
+};
+static_assert(sizeof(AssetChunk) == 32);
+
+struct AssetMeshLod
+{
+    uint32_t index_chunk;
+    uint32_t num_indices;
+    float error;
+};
+
+struct AssetMesh
+{
+    float position[3];
+    float euler_angles[3];
+    VertexFormat vertex_format;
+    uint8_t reserved[3];
+    uint32_t num_vertices;
+    VkIndexType index_type;
+    float bounds_min[3];
+    float bounds_extent[3];
+    float bounds_center[3];
+    float bounds_radius;
+    uint32_t vertex_chunk;
+    uint32_t num_lods; // LOD 0 is the full mesh.
+    AssetMeshLod lods[MESH_LOD_MAX_LEVELS];
+};
+static_assert(sizeof(AssetMesh) == 84 + 12 * MESH_LOD_MAX_LEVELS);
+
+struct AssetPointLight
+{
+    float position[3];
+    float euler_angles[3];
+    float color[4];
+};
+static_assert(sizeof(AssetPointLight) == 40);
+
+/*
+ * A read-only mapping of an asset file. The tables point into the mapping, and are valid until close.
+ */
+class AssetFile
+{
+public:
+    bool open(const char *path);
+    void close();
+
+    const AssetFileHeader &header() const { return *m_header; }
+    const AssetChunk *chunks() const { return m_chunks; }
+    const AssetMesh *meshes() const { return m_meshes; }
+    const AssetPointLight *point_lights() const { return m_point_lights; }
+    const uint8_t *chunk_data(uint32_t chunk) const { return m_data + m_chunks[chunk].offset; }
+private:
+    const uint8_t *m_data = nullptr;
+    size_t m_size = 0;
+    const AssetFileHeader *m_header;
+    const AssetChunk *m_chunks;
+    const AssetMesh *m_meshes;
+    const AssetPointLight *m_point_lights;
+};
+
+struct AssetChunkDecode
+{
+    uint32_t chunk;
+    uint8_t *destination; // chunks()[chunk].size bytes.
+    const uint8_t *source; // The chunk's stored bytes if already read, or nullptr to use the mapped file.
+};
+// Copy or decompress chunks to their destinations as jobs, one per chunk.
+// Returns false if any compressed chunk is corrupt.
+bool decode_asset_chunks(JobSystem *jobs, const AssetFile &file, const AssetChunkDecode *decodes, uint32_t num_decodes);
+
+/*
+ * Builds an asset file. Meshes are processed as create_polygon_mesh would with the same create info.
+ * Meshlets are not stored, so build_meshlets is ignored.
+ */
+class AssetFileWriter
+{
+public:
+    void add_polygon_mesh(PolygonMeshCreateInfo info, Transform transform);
+    void add_point_light(Transform transform, vec4 color);
+    bool write(const char *path, bool compress);
+private:
+    uint32_t add_chunk(std::vector<uint8_t> &&data);
+
+    std::vector<std::vector<uint8_t>> m_chunks;
+    std::vector<AssetMesh> m_meshes;
+    std::vector<AssetPointLight> m_point_lights;
+};
+
+#endif // RENDERER_ASSET_FILE_H_
@@ -0,0 +1,287 @@
+#include "renderer/bvh.h"
+#include <assert.h>
+#include <math.h>
+#include <atomic>
+#include <algorithm>
+
+Aabb transform_aabb(const mat4 &m, const Aabb &b)
+{
+    if ( b.empty() ) return b;
+    // Transform the center, and take the extent along each output axis from the absolute matrix.
+    vec3 center = vec3(m * vec4(b.center(), 1));
+    vec3 half_extent = 0.5f * (b.max - b.min);
+    vec3 extent = glm::abs(vec3(m[0])) * half_extent.x + glm::abs(vec3(m[1])) * half_extent.y + glm::abs(vec3(m[2])) * half_extent.z;
+    Aabb result;
+    result.min = center - extent;
+    result.max = center + extent;
+    return result;
+}
+
+struct Bvh::BuildContext
+{
+    JobSystem *jobs;
+    const Aabb *bounds;
+    std::vector<vec3> centroids;
+    std::atomic<uint32_t> num_nodes;
+};
+
+void Bvh::build(JobSystem *jobs, const Aabb *bounds, uint32_t num_primitives)
+{
+    m_nodes.clear();
+    m_parents.clear();
+    m_primitives.resize(num_primitives);
+    m_primitive_leaves.resize(num_primitives);
+    m_build_sah_cost = 0;
+    if ( num_primitives == 0 ) return;
+
+    BuildContext context;
+    context.jobs = jobs;
+    context.bounds = bounds;
+    context.centroids.resize(num_primitives);
+    for (uint32_t i = 0; i < num_primitives; i++)
+    {
+        m_primitives[i] = i;
+        context.centroids[i] = bounds[i].center();
+    }
+    // A binary tree with single-primitive leaves is the largest possible.
+    m_nodes.resize(2 * num_primitives - 1);
+    m_parents.resize(2 * num_primitives - 1);
+    m_parents[0] = BVH_NODE_NULL;
+    context.num_nodes.store(1, std::memory_order_relaxed);
+    build_node(&context, 0, 0, num_primitives, 0);
+    uint32_t num_nodes = context.num_nodes.load(std::memory_order_relaxed);
+    m_nodes.resize(num_nodes);
+    m_parents.resize(num_nodes);
+
+    for (uint32_t n = 0; n < num_nodes; n++)
+    {
+        const BvhNode &node = m_nodes[n];
+        if ( !node.is_leaf() ) continue;
+        for (uint32_t i = node.first; i < node.first + node.count; i++) m_primitive_leaves[m_primitives[i]] = n;
+    }
+    m_refit_marks.assign(num_nodes, 0);
+    m_weighted_area = 0;
+    for (const BvhNode &node : m_nodes) m_weighted_area += node.bounds().surface_area() * node_cost(node);
+    m_build_sah_cost = sah_cost();
+}
+
+void Bvh::build_node(BuildContext *context, uint32_t node, uint32_t begin, uint32_t end, uint32_t depth)
+{
+    const Aabb *bounds = context->bounds;
+    const vec3 *centroids = &context->centroids[0];
+    Aabb node_bounds;
+    Aabb centroid_bounds;
+    for (uint32_t i = begin; i < end; i++)
+    {
+        node_bounds.grow(bounds[m_primitives[i]]);
+        centroid_bounds.grow(centroids[m_primitives[i]]);
+    }
+    m_nodes[node].min = node_bounds.min;
+    m_nodes[node].max = node_bounds.max;
+    uint32_t count = end - begin;
+
+    // Find the cheapest split between bins, on any axis. Small nodes need fewer bins.
+    int num_bins = (int) std::min<uint32_t>(count, BVH_NUM_BINS);
+    int best_axis = -1;
+    uint32_t best_split = 0;
+    float best_cost = FLT_MAX;
+    if ( count > 1 && depth < BVH_MAX_DEPTH )
+    {
+        float node_area = node_bounds.surface_area();
+        float inverse_area = node_area > 0 ? 1 / node_area : 0;
+        // Bin on all three axes in one pass over the primitives.
+        vec3 scale;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float extent = centroid_bounds.max[axis] - centroid_bounds.min[axis];
+            scale[axis] = extent > 0 ? num_bins / extent : 0;
+        }
+        Aabb bin_bounds[3][BVH_NUM_BINS];
+        uint32_t bin_counts[3][BVH_NUM_BINS] = {};
+        for (uint32_t i = begin; i < end; i++)
+        {
+            uint32_t p = m_primitives[i];
+            const Aabb &b = bounds[p];
+            for (int axis = 0; axis < 3; axis++)
+            {
+                int bin = std::min((int) ((centroids[p][axis] - centroid_bounds.min[axis]) * scale[axis]), num_bins - 1);
+                bin_counts[axis][bin]++;
+                bin_bounds[axis][bin].grow(b);
+            }
+        }
+        for (int axis = 0; axis < 3; axis++)
+        {
+            if ( scale[axis] == 0 ) continue;
+            // Sweep from the left, then evaluate each split sweeping from the right.
+            float left_areas[BVH_NUM_BINS - 1];
+            uint32_t left_counts[BVH_NUM_BINS - 1];
+            Aabb left;
+            uint32_t left_count = 0;
+            for (int b = 0; b < num_bins - 1; b++)
+            {
+                left.grow(bin_bounds[axis][b]);
+                left_count += bin_counts[axis][b];
+                left_areas[b] = left.surface_area();
+                left_counts[b] = left_count;
+            }
+            Aabb right;
+            uint32_t right_count = 0;
+            for (int b = num_bins - 1; b > 0; b--)
+            {
+                right.grow(bin_bounds[axis][b]);
+                right_count += bin_counts[axis][b];
+                if ( left_counts[b - 1] == 0 || right_count == 0 ) continue;
+                float cost = BVH_TRAVERSAL_COST + BVH_INTERSECTION_COST * inverse_area
+                           * (left_areas[b - 1] * left_counts[b - 1] + right.surface_area() * right_count);
+                if ( cost < best_cost )
+                {
+                    best_axis = axis;
+                    best_split = b;
+                    best_cost = cost;
+                }
+            }
+        }
+    }
+
+    uint32_t middle;
+    if ( best_axis >= 0 && (best_cost < BVH_INTERSECTION_COST * count || count > BVH_MAX_LEAF_SIZE) )
+    {
+        float min = centroid_bounds.min[best_axis];
+        float scale = num_bins / (centroid_bounds.max[best_axis] - min);
+        // The same bin computation as when binning, so both sides are non-empty.
+        middle = std::partition(&m_primitives[begin], &m_primitives[0] + end, [&](uint32_t p) {
+            return (uint32_t) std::min((int) ((centroids[p][best_axis] - min) * scale), num_bins - 1) < best_split;
+        }) - &m_primitives[0];
+    }
+    else if ( best_axis < 0 && count > BVH_MAX_LEAF_SIZE && depth < BVH_MAX_DEPTH )
+    {
+        // The centroids coincide, so any split is as good. Halve the primitives to keep leaves small.
+        middle = begin + count / 2;
+    }
+    else
+    {
+        m_nodes[node].first = begin;
+        m_nodes[node].count = count;
+        return;
+    }
+
+    uint32_t children = context->num_nodes.fetch_add(2, std::memory_order_relaxed);
+    m_nodes[node].first = children;
+    m_nodes[node].count = 0;
+    m_parents[children] = node;
+    m_parents[children + 1] = node;
+    if ( context->jobs != nullptr && count >= BVH_PARALLEL_BUILD_MIN_PRIMITIVES )
+    {
+        struct ChildBuild
+        {
+            Bvh *bvh;
+            BuildContext *context;
+            uint32_t node;
+            uint32_t begin;
+            uint32_t end;
+            uint32_t depth;
+        };
+        ChildBuild left = { this, context, children, begin, middle, depth + 1 };
+        Job job;
+        job.function = [](void *data) {
+            ChildBuild *build = (ChildBuild *) data;
+            build->bvh->build_node(build->context, build->node, build->begin, build->end, build->depth);
+        };
+        job.data = &left;
+        JobCounter counter;
+        context->jobs->submit(job, &counter);
+        build_node(context, children + 1, middle, end, depth + 1);
+        context->jobs->wait(&counter);
+    }
+    else
+    {
+        build_node(context, children, begin, middle, depth + 1);
+        build_node(context, children + 1, middle, end, depth + 1);
+    }
+}
+
+void Bvh::refit_node(uint32_t n, const Aabb *bounds)
+{
+    BvhNode &node = m_nodes[n];
+    Aabb b;
+    if ( node.is_leaf() )
+    {
+        for (uint32_t i = node.first; i < node.first + node.count; i++) b.grow(bounds[m_primitives[i]]);
+    }
+    else
+    {
+        b = m_nodes[node.first].bounds();
+        b.grow(m_nodes[node.first + 1].bounds());
+    }
+    m_weighted_area += (b.surface_area() - node.bounds().surface_area()) * node_cost(node);
+    node.min = b.min;
+    node.max = b.max;
+}
+
+void Bvh::refit(const Aabb *bounds)
+{
+    for (uint32_t n = m_nodes.size(); n-- > 0;) refit_node(n, bounds);
+    // Recomputed, so rounding doesn't accumulate over incremental refits.
+    m_weighted_area = 0;
+    for (const BvhNode &node : m_nodes) m_weighted_area += node.bounds().surface_area() * node_cost(node);
+}
+
+void Bvh::refit(const Aabb *bounds, const uint32_t *moved, uint32_t num_moved)
+{
+    if ( m_nodes.empty() ) return;
+    // Past this, most of the tree is touched anyway, and a full pass avoids sorting.
+    if ( num_moved >= m_primitives.size() / 4 )
+    {
+        refit(bounds);
+        return;
+    }
+    // Collect the leaves of the moved primitives and their ancestors, each once.
+    m_refit_nodes.clear();
+    for (uint32_t i = 0; i < num_moved; i++)
+    {
+        assert(moved[i] < m_primitive_leaves.size());
+        uint32_t n = m_primitive_leaves[moved[i]];
+        while ( n != BVH_NODE_NULL && !m_refit_marks[n] )
+        {
+            m_refit_marks[n] = 1;
+            m_refit_nodes.push_back(n);
+            n = m_parents[n];
+        }
+    }
+    // Children come after their parents, so descending order refits them first.
+    std::sort(m_refit_nodes.begin(), m_refit_nodes.end(), [](uint32_t a, uint32_t b) { return a > b; });
+    for (uint32_t n : m_refit_nodes)
+    {
+        refit_node(n, bounds);
+        m_refit_marks[n] = 0;
+    }
+}
+
+float Bvh::sah_cost() const
+{
+    if ( m_nodes.empty() ) return 0;
+    float root_area = m_nodes[0].bounds().surface_area();
+    if ( root_area <= 0 ) return BVH_INTERSECTION_COST * m_primitives.size();
+    return m_weighted_area / root_area;
+}
+
+void MeshBvh::build(JobSystem *jobs, const vec3 *_positions, uint32_t num_vertices, const uint32_t *_indices, uint32_t num_indices)
+{
+    assert(num_indices % 3 == 0);
+    positions.assign(_positions, _positions + num_vertices);
+    uint32_t num_triangles = num_indices / 3;
+    std::vector<Aabb> triangle_bounds(num_triangles);
+    for (uint32_t t = 0; t < num_triangles; t++)
+    {
+        for (int k = 0; k < 3; k++) triangle_bounds[t].grow(positions[_indices[3*t + k]]);
+    }
+    bvh.build(jobs, triangle_bounds.data(), num_triangles);
+
+    // Store the triangles in leaf order, so leaves index them directly.
+    indices.resize(num_indices);
+    const std::vector<uint32_t> &order = bvh.primitives();
+    for (uint32_t t = 0; t < num_triangles; t++)
+    {
+        for (int k = 0; k < 3; k++) indices[3*t + k] = _indices[3*order[t] + k];
+    }
+}
@@ -0,0 +1,142 @@
+#ifndef RENDERER_BVH_H_
+#define RENDERER_BVH_H_
+/* bvh.h
+ *
+ * Bounding volume hierarchies on the CPU, for picking, ray queries and culling.
+ *
+ * A Bvh is built over the bounding boxes of any primitives: mesh instances in world space, or a
+ * mesh's triangles in object space (MeshBvh). Nodes are split with the surface area heuristic,
+ * binning primitive centroids into BVH_NUM_BINS bins per axis ("On fast Construction of SAH-based
+ * Bounding Volume Hierarchies", Wald). Subtrees of at least BVH_PARALLEL_BUILD_MIN_PRIMITIVES
+ * are built on jobs.
+ *
+ * When primitives move, the tree is refit: the bounds of the leaves holding them and of those
+ * leaves' ancestors are recomputed, keeping the topology. Refitting is much cheaper than a
+ * rebuild but degrades the tree as primitives drift from where they were split, so owners compare
+ * sah_cost() against the cost when built and rebuild past BVH_REBUILD_COST_RATIO.
+ *
+ * Nodes are stored with both children adjacent and after their parent, so reverse node order
+ * visits children before parents.
+ */
+#include "engine/jobs/job_system.h"
+#include "renderer/transform.h"
+#include <stdint.h>
+#include <float.h>
+#include <vector>
+
+#define BVH_NUM_BINS 16
+#define BVH_MAX_LEAF_SIZE 4
+// Deeper nodes are made leaves, however many primitives they hold.
+#define BVH_MAX_DEPTH 48
+#define BVH_PARALLEL_BUILD_MIN_PRIMITIVES 4096
+// SAH costs of visiting a node and of testing a primitive.
+#define BVH_TRAVERSAL_COST 1.f
+#define BVH_INTERSECTION_COST 1.f
+#define BVH_REBUILD_COST_RATIO 1.5f
+#define BVH_NODE_NULL (~0u)
+
+struct Aabb
+{
+    vec3 min = vec3(FLT_MAX);
+    vec3 max = vec3(-FLT_MAX);
+
+    void grow(vec3 p) { min = glm::min(min, p); max = glm::max(max, p); }
+    void grow(const Aabb &b) { min = glm::min(min, b.min); max = glm::max(max, b.max); }
+    vec3 center() const { return 0.5f * (min + max); }
+    bool empty() const { return min.x > max.x; }
+    float surface_area() const
+    {
+        if ( empty() ) return 0;
+        vec3 d = max - min;
+        return 2 * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+};
+// The bounds of a box under an affine transform.
+Aabb transform_aabb(const mat4 &m, const Aabb &b);
+
+struct BvhNode
+{
+    vec3 min;
+    uint32_t first; // Leaves: the first of their primitives. Interior nodes: the first child.
+    vec3 max;
+    uint32_t count; // Leaves: the number of primitives. 0 for interior nodes.
+
+    bool is_leaf() const { return count > 0; }
+    Aabb bounds() const { Aabb b; b.min = min; b.max = max; return b; }
+};
+
+class Bvh
+{
+public:
+    // Build over num_primitives boxes. jobs may be null.
+    void build(JobSystem *jobs, const Aabb *bounds, uint32_t num_primitives);
+    // Refit after every primitive may have moved.
+    void refit(const Aabb *bounds);
+    // Refit after the given primitives moved. Primitives may be listed more than once.
+    void refit(const Aabb *bounds, const uint32_t *moved, uint32_t num_moved);
+
+    // Expected cost of a ray query relative to a root box test, by the surface area heuristic.
+    float sah_cost() const;
+    float build_sah_cost() const { return m_build_sah_cost; }
+    bool degraded() const { return sah_cost() > BVH_REBUILD_COST_RATIO * m_build_sah_cost; }
+
+    bool empty() const { return m_nodes.empty(); }
+    const std::vector<BvhNode> &nodes() const { return m_nodes; }
+    // The primitives of leaf n are primitives()[n.first, n.first + n.count).
+    const std::vector<uint32_t> &primitives() const { return m_primitives; }
+
+    // Calls visit(primitive) for the primitives of every leaf whose bounds satisfy overlaps(aabb),
+    // which must also hold for every ancestor's bounds (e.g. an intersection test).
+    template <typename Overlaps, typename Visit>
+    void query(Overlaps &&overlaps, Visit &&visit) const;
+private:
+    struct BuildContext;
+    void build_node(BuildContext *context, uint32_t node, uint32_t begin, uint32_t end, uint32_t depth);
+    void refit_node(uint32_t node, const Aabb *bounds);
+    float node_cost(const BvhNode &node) const { return node.is_leaf() ? BVH_INTERSECTION_COST * node.count : BVH_TRAVERSAL_COST; }
+
+    std::vector<BvhNode> m_nodes;
+    std::vector<uint32_t> m_primitives;
+    std::vector<uint32_t> m_parents;        // Indexed by node, BVH_NODE_NULL for the root.
+    std::vector<uint32_t> m_primitive_leaves; // Indexed by primitive.
+    // Refit scratch.
+    std::vector<uint8_t> m_refit_marks;
+    std::vector<uint32_t> m_refit_nodes;
+    // Sum of the nodes' surface areas weighted by their cost, kept up to date by refits.
+    double m_weighted_area = 0;
+    float m_build_sah_cost = 0;
+};
+
+// A triangle mesh's LOD 0 with a BVH over its triangles, in object space.
+struct MeshBvh
+{
+    std::vector<vec3> positions;
+    // Triangles in the order of the BVH's primitives, so leaf n holds triangles [n.first, n.first + n.count).
+    std::vector<uint32_t> indices;
+    Bvh bvh;
+
+    void build(JobSystem *jobs, const vec3 *positions, uint32_t num_vertices, const uint32_t *indices, uint32_t num_indices);
+};
+
+template <typename Overlaps, typename Visit>
+void Bvh::query(Overlaps &&overlaps, Visit &&visit) const
+{
+    if ( m_nodes.empty() ) return;
+    uint32_t stack[BVH_MAX_DEPTH + 1];
+    uint32_t stack_size = 0;
+    stack[stack_size++] = 0;
+    while ( stack_size > 0 )
+    {
+        const BvhNode &node = m_nodes[stack[--stack_size]];
+        if ( !overlaps(node.bounds()) ) continue;
+        if ( node.is_leaf() )
+        {
+            for (uint32_t i = node.first; i < node.first + node.count; i++) visit(m_primitives[i]);
+            continue;
+        }
+        stack[stack_size++] = node.first + 1;
+        stack[stack_size++] = node.first;
+    }
+}
+
+#endif // RENDERER_BVH_H_
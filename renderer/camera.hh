@@ -1,10 +1,44 @@
 #ifndef RENDERER_CAMERA_H_
+#define RENDERER_CAMERA_H_
+#include "renderer/transform.h"
+
+// Planes are (normal, d) with normals pointing into the frustum, so a point p is inside a plane if dot(plane, vec4(p, 1)) >= 0.
+struct Frustum
+{
+    vec4 planes[6]; // left, right, bottom, top, near, far
+};
+
+// Extract the frustum planes of a view-projection matrix (Gribb and Hartmann), for a [0,1] clip depth range.
+inline Frustum frustum_from_matrix(const mat4 &m)
+{
+    vec4 row[4];
+    for (int i = 0; i < 4; i++) row[i] = vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+    Frustum frustum;
+    frustum.planes[0] = row[3] + row[0];
+    frustum.planes[1] = row[3] - row[0];
+    frustum.planes[2] = row[3] + row[1];
+    frustum.planes[3] = row[3] - row[1];
+    frustum.planes[4] = row[2];
+    frustum.planes[5] = row[3] - row[2];
+    for (int i = 0; i < 6; i++)
+        frustum.planes[i] /= glm::length(vec3(frustum.planes[i]));
+    return frustum;
+}
 
 class Camera
 {
 public:
-private:
-    Transform transform;
+    float fov_y = glm::radians(60.f);
+    float near_plane = 0.1f;
+    float far_plane = 1000.f;
+
+    mat4 projection_matrix(float aspect) const
+    {
+        // Vulkan clip space has y pointing down.
+        mat4 projection = glm::perspective(fov_y, aspect, near_plane, far_plane);
+        projection[1][1] *= -1;
+        return projection;
+    }
 };
 
-#endif
+#endif // RENDERER_CAMERA_H_
@@ -0,0 +1,184 @@
+#include "renderer/descriptor_heap.h"
+#include "ansi_color.h"
+#include <stdio.h>
+#include <assert.h>
+#include <algorithm>
+
+static const VkDescriptorType descriptor_types[NUM_DESCRIPTOR_HEAP_ARRAYS] = {
+    VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+    VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+    VK_DESCRIPTOR_TYPE_SAMPLER,
+};
+
+bool DescriptorHeap::init(VulkanSystem *_vk, uint32_t num_frames_in_flight)
+{
+    vk = _vk;
+    frame_slot = 0;
+
+    VkPhysicalDeviceVulkan12Properties properties_12 = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES };
+    VkPhysicalDeviceProperties2 properties = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2 };
+    properties.pNext = &properties_12;
+    vkGetPhysicalDeviceProperties2(vk->physical_device, &properties);
+    uint32_t capacities[NUM_DESCRIPTOR_HEAP_ARRAYS] = {
+        std::min({DESCRIPTOR_HEAP_MAX_STORAGE_BUFFERS,
+                  properties_12.maxDescriptorSetUpdateAfterBindStorageBuffers,
+                  properties_12.maxPerStageDescriptorUpdateAfterBindStorageBuffers}),
+        std::min({DESCRIPTOR_HEAP_MAX_SAMPLED_IMAGES,
+                  properties_12.maxDescriptorSetUpdateAfterBindSampledImages,
+                  properties_12.maxPerStageDescriptorUpdateAfterBindSampledImages}),
+        std::min({DESCRIPTOR_HEAP_MAX_SAMPLERS,
+                  properties_12.maxDescriptorSetUpdateAfterBindSamplers,
+                  properties_12.maxPerStageDescriptorUpdateAfterBindSamplers}),
+    };
+    for (int i = 0; i < NUM_DESCRIPTOR_HEAP_ARRAYS; i++)
+    {
+        arrays[i].capacity = capacities[i];
+        arrays[i].num_used = 0;
+        arrays[i].free_indices.clear();
+        arrays[i].removed.assign(num_frames_in_flight, {});
+    }
+
+    {
+        VkDescriptorSetLayoutBinding bindings[NUM_DESCRIPTOR_HEAP_ARRAYS];
+        VkDescriptorBindingFlags binding_flags[NUM_DESCRIPTOR_HEAP_ARRAYS];
+        for (int i = 0; i < NUM_DESCRIPTOR_HEAP_ARRAYS; i++)
+        {
+            bindings[i] = {};
+            bindings[i].binding = i;
+            bindings[i].descriptorType = descriptor_types[i];
+            bindings[i].descriptorCount = capacities[i];
+            bindings[i].stageFlags = VK_SHADER_STAGE_ALL;
+            binding_flags[i] = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT
+                             | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT
+                             | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+        }
+        VkDescriptorSetLayoutBindingFlagsCreateInfo flags_info = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO };
+        flags_info.bindingCount = NUM_DESCRIPTOR_HEAP_ARRAYS;
+        flags_info.pBindingFlags = binding_flags;
+        VkDescriptorSetLayoutCreateInfo info = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+        info.pNext = &flags_info;
+        info.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+        info.bindingCount = NUM_DESCRIPTOR_HEAP_ARRAYS;
+        info.pBindings = bindings;
+        if ( vkCreateDescriptorSetLayout(vk->device, &info, nullptr, &descriptor_set_layout) != VK_SUCCESS )
+        {
+            fprintf(stderr, C_RED "[%s] Failed to create the descriptor heap set layout.\n" C_RESET, __func__);
+            return false;
+        }
+    }
+    {
+        VkDescriptorPoolSize pool_sizes[NUM_DESCRIPTOR_HEAP_ARRAYS];
+        for (int i = 0; i < NUM_DESCRIPTOR_HEAP_ARRAYS; i++) pool_sizes[i] = { descriptor_types[i], capacities[i] };
+        VkDescriptorPoolCreateInfo info = { VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+        info.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+        info.maxSets = 1;
+        info.poolSizeCount = NUM_DESCRIPTOR_HEAP_ARRAYS;
+        info.pPoolSizes = pool_sizes;
+        VK_SUCCEED( vkCreateDescriptorPool(vk->device, &info, nullptr, &descriptor_pool) );
+    }
+    {
+        VkDescriptorSetAllocateInfo info = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+        info.descriptorPool = descriptor_pool;
+        info.descriptorSetCount = 1;
+        info.pSetLayouts = &descriptor_set_layout;
+        VK_SUCCEED( vkAllocateDescriptorSets(vk->device, &info, &descriptor_set) );
+    }
+    printf(C_CYAN "Descriptor heap: %u storage buffers, %u sampled images, %u samplers.\n" C_RESET,
+           capacities[0], capacities[1], capacities[2]);
+    return true;
+}
+
+void DescriptorHeap::destroy()
+{
+    vkDestroyDescriptorPool(vk->device, descriptor_pool, nullptr);
+    vkDestroyDescriptorSetLayout(vk->device, descriptor_set_layout, nullptr);
+}
+
+DescriptorIndex DescriptorHeap::allocate_index(DescriptorHeapArray array)
+{
+    Array &a = arrays[(int) array];
+    if ( !a.free_indices.empty() )
+    {
+        DescriptorIndex index = a.free_indices.back();
+        a.free_indices.pop_back();
+        return index;
+    }
+    if ( a.num_used == a.capacity )
+    {
+        fprintf(stderr, C_RED "[%s] Descriptor heap array %d is full (%u descriptors).\n" C_RESET, __func__, (int) array, a.capacity);
+        return DESCRIPTOR_INDEX_NULL;
+    }
+    return a.num_used++;
+}
+
+DescriptorIndex DescriptorHeap::add_storage_buffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range)
+{
+    DescriptorIndex index = allocate_index(DescriptorHeapArray::StorageBuffer);
+    if ( index == DESCRIPTOR_INDEX_NULL ) return index;
+    VkDescriptorBufferInfo buffer_info = { buffer, offset, range };
+    VkWriteDescriptorSet write = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+    write.dstSet = descriptor_set;
+    write.dstBinding = (uint32_t) DescriptorHeapArray::StorageBuffer;
+    write.dstArrayElement = index;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write.pBufferInfo = &buffer_info;
+    vkUpdateDescriptorSets(vk->device, 1, &write, 0, nullptr);
+    return index;
+}
+
+DescriptorIndex DescriptorHeap::add_sampled_image(VkImageView image_view, VkImageLayout layout)
+{
+    DescriptorIndex index = allocate_index(DescriptorHeapArray::SampledImage);
+    if ( index == DESCRIPTOR_INDEX_NULL ) return index;
+    VkDescriptorImageInfo image_info = { VK_NULL_HANDLE, image_view, layout };
+    VkWriteDescriptorSet write = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+    write.dstSet = descriptor_set;
+    write.dstBinding = (uint32_t) DescriptorHeapArray::SampledImage;
+    write.dstArrayElement = index;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+    write.pImageInfo = &image_info;
+    vkUpdateDescriptorSets(vk->device, 1, &write, 0, nullptr);
+    return index;
+}
+
+DescriptorIndex DescriptorHeap::add_sampler(VkSampler sampler)
+{
+    DescriptorIndex index = allocate_index(DescriptorHeapArray::Sampler);
+    if ( index == DESCRIPTOR_INDEX_NULL ) return index;
+    VkDescriptorImageInfo image_info = { sampler, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_UNDEFINED };
+    VkWriteDescriptorSet write = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+    write.dstSet = descriptor_set;
+    write.dstBinding = (uint32_t) DescriptorHeapArray::Sampler;
+    write.dstArrayElement = index;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+    write.pImageInfo = &image_info;
+    vkUpdateDescriptorSets(vk->device, 1, &write, 0, nullptr);
+    return index;
+}
+
+void DescriptorHeap::remove(DescriptorHeapArray array, DescriptorIndex index)
+{
+    Array &a = arrays[(int) array];
+    assert(index < a.num_used);
+    // Frames in flight may still read the descriptor.
+    a.removed[frame_slot].push_back(index);
+}
+
+void DescriptorHeap::begin_frame(uint32_t _frame_slot)
+{
+    assert(_frame_slot < arrays[0].removed.size());
+    frame_slot = _frame_slot;
+    for (Array &a : arrays)
+    {
+        a.free_indices.insert(a.free_indices.end(), a.removed[frame_slot].begin(), a.removed[frame_slot].end());
+        a.removed[frame_slot].clear();
+    }
+}
+
+void DescriptorHeap::bind(VkCommandBuffer command_buffer, VkPipelineBindPoint bind_point, VkPipelineLayout pipeline_layout, uint32_t set) const
+{
+    vkCmdBindDescriptorSets(command_buffer, bind_point, pipeline_layout, set, 1, &descriptor_set, 0, nullptr);
+}
@@ -0,0 +1,81 @@
+#ifndef RENDERER_DESCRIPTOR_HEAP_H_
+#define RENDERER_DESCRIPTOR_HEAP_H_
+/* descriptor_heap.h
+ *
+ * Bindless resource descriptors, using descriptor indexing (core in Vulkan 1.2).
+ *
+ * One descriptor set holds large arrays of storage buffers, sampled images and samplers.
+ * A resource is added once and keeps its index into its array until removed, and shaders reach
+ * it through that index. Draws select resources by passing indices in push constants or
+ * instance data, so the set is bound once per command buffer rather than per draw.
+ *
+ * The arrays are partially bound and update-after-bind, so resources can be added while command
+ * buffers using the set are in flight. A removed index still holds its old descriptor, which the
+ * GPU may be reading, so it is reused only once the frames in flight have completed.
+ *
+ * The set, as declared in GLSL with GL_EXT_nonuniform_qualifier (a buffer block type can be
+ * declared more than once on the storage buffer binding):
+ *     layout(std430, set = 1, binding = 0) buffer StorageBuffers { uint words[]; } storage_buffers[];
+ *     layout(set = 1, binding = 1) uniform texture2D sampled_images[];
+ *     layout(set = 1, binding = 2) uniform sampler samplers[];
+ *
+ * Call only from the render thread.
+ */
+#include "engine/platform/vk.h"
+#include <stdint.h>
+#include <vector>
+
+typedef uint32_t DescriptorIndex;
+#define DESCRIPTOR_INDEX_NULL (~0u)
+
+// Clamped to the device's update-after-bind limits.
+#define DESCRIPTOR_HEAP_MAX_STORAGE_BUFFERS (1u << 16)
+#define DESCRIPTOR_HEAP_MAX_SAMPLED_IMAGES (1u << 16)
+#define DESCRIPTOR_HEAP_MAX_SAMPLERS 256u
+
+enum class DescriptorHeapArray
+{
+    StorageBuffer,
+    SampledImage,
+    Sampler,
+    NUM
+};
+#define NUM_DESCRIPTOR_HEAP_ARRAYS ((int) DescriptorHeapArray::NUM)
+
+class DescriptorHeap
+{
+public:
+    bool init(VulkanSystem *vk, uint32_t num_frames_in_flight);
+    void destroy();
+
+    // Return DESCRIPTOR_INDEX_NULL if the array is full.
+    DescriptorIndex add_storage_buffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range);
+    DescriptorIndex add_sampled_image(VkImageView image_view, VkImageLayout layout);
+    DescriptorIndex add_sampler(VkSampler sampler);
+    void remove(DescriptorHeapArray array, DescriptorIndex index);
+
+    // frame_slot is the platform's frame in flight, whose previous GPU work has completed.
+    // Indices removed during that frame's previous use become free.
+    void begin_frame(uint32_t frame_slot);
+
+    VkDescriptorSetLayout set_layout() const { return descriptor_set_layout; }
+    void bind(VkCommandBuffer command_buffer, VkPipelineBindPoint bind_point, VkPipelineLayout pipeline_layout, uint32_t set) const;
+private:
+    struct Array
+    {
+        uint32_t capacity;
+        uint32_t num_used;                   // Indices below this have been handed out.
+        std::vector<DescriptorIndex> free_indices;
+        std::vector<std::vector<DescriptorIndex>> removed; // [frame slot]
+    };
+    DescriptorIndex allocate_index(DescriptorHeapArray array);
+
+    VulkanSystem *vk;
+    VkDescriptorSetLayout descriptor_set_layout;
+    VkDescriptorPool descriptor_pool;
+    VkDescriptorSet descriptor_set;
+    uint32_t frame_slot;
+    Array arrays[NUM_DESCRIPTOR_HEAP_ARRAYS];
+};
+
+#endif // RENDERER_DESCRIPTOR_HEAP_H_
@@ -0,0 +1,219 @@
+#include "renderer/draw_pipelines.h"
+#include "renderer/light_clusters.h"
+#include "renderer/path_tracer.h"
+#include "ansi_color.h"
+#include <stdio.h>
+#include <assert.h>
+
+// What differs between the pipelines drawing meshes.
+struct PipelineDescription
+{
+    VertexFormat vertex_format;
+    // Only the position attribute is fetched by depth-only pipelines.
+    uint32_t num_attributes;
+    VkShaderModule vertex_shader;
+    // VK_NULL_HANDLE for depth-only pipelines.
+    VkShaderModule fragment_shader;
+    const VkSpecializationInfo *fragment_specialization;
+    VkPipelineLayout layout;
+    VkRenderPass render_pass;
+    uint32_t subpass;
+    VkPipelineDepthStencilStateCreateInfo depth_stencil;
+    bool depth_bias;
+    uint32_t num_color_attachments;
+};
+
+static VkPipeline create_pipeline(VulkanSystem *vk, const PipelineDescription &description)
+{
+    // The vertex format is the vertex shader's specialization constant 0.
+    uint32_t vertex_format = (uint32_t) description.vertex_format;
+    VkSpecializationMapEntry vertex_format_entry = { 0, 0, sizeof(uint32_t) };
+    VkSpecializationInfo vertex_specialization = { 1, &vertex_format_entry, sizeof(uint32_t), &vertex_format };
+    VkPipelineShaderStageCreateInfo stages[2];
+    stages[0] = { VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO };
+    stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+    stages[0].module = description.vertex_shader;
+    stages[0].pName = "main";
+    stages[0].pSpecializationInfo = &vertex_specialization;
+    stages[1] = { VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO };
+    stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    stages[1].module = description.fragment_shader;
+    stages[1].pName = "main";
+    stages[1].pSpecializationInfo = description.fragment_specialization;
+
+    const VertexFormatInfo &format_info = vertex_format_info(description.vertex_format);
+    assert(description.num_attributes <= format_info.num_attributes);
+    VkVertexInputBindingDescription binding = { 0, format_info.stride, VK_VERTEX_INPUT_RATE_VERTEX };
+    VkPipelineVertexInputStateCreateInfo vertex_input = { VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO };
+    vertex_input.vertexBindingDescriptionCount = 1;
+    vertex_input.pVertexBindingDescriptions = &binding;
+    vertex_input.vertexAttributeDescriptionCount = description.num_attributes;
+    vertex_input.pVertexAttributeDescriptions = format_info.attributes;
+
+    VkPipelineInputAssemblyStateCreateInfo input_assembly = { VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO };
+    input_assembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+    VkPipelineViewportStateCreateInfo viewport = { VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO };
+    viewport.viewportCount = 1;
+    viewport.scissorCount = 1;
+    VkDynamicState dynamic_states[2] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+    VkPipelineDynamicStateCreateInfo dynamic = { VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO };
+    dynamic.dynamicStateCount = 2;
+    dynamic.pDynamicStates = dynamic_states;
+
+    VkPipelineRasterizationStateCreateInfo rasterization = { VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO };
+    rasterization.polygonMode = VK_POLYGON_MODE_FILL;
+    rasterization.cullMode = VK_CULL_MODE_NONE;
+    rasterization.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+    rasterization.lineWidth = 1;
+    rasterization.depthBiasEnable = description.depth_bias;
+    rasterization.depthBiasConstantFactor = DRAW_PIPELINES_SHADOW_DEPTH_BIAS;
+    rasterization.depthBiasSlopeFactor = DRAW_PIPELINES_SHADOW_SLOPE_BIAS;
+
+    VkPipelineMultisampleStateCreateInfo multisample = { VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO };
+    multisample.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+    // The shading stage's color and ID, without blending.
+    VkPipelineColorBlendAttachmentState blend_attachments[2] = {};
+    blend_attachments[0].colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    blend_attachments[1].colorWriteMask = VK_COLOR_COMPONENT_R_BIT;
+    assert(description.num_color_attachments <= 2);
+    VkPipelineColorBlendStateCreateInfo blend = { VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO };
+    blend.attachmentCount = description.num_color_attachments;
+    blend.pAttachments = blend_attachments;
+
+    VkGraphicsPipelineCreateInfo info = { VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
+    info.stageCount = description.fragment_shader != VK_NULL_HANDLE ? 2 : 1;
+    info.pStages = stages;
+    info.pVertexInputState = &vertex_input;
+    info.pInputAssemblyState = &input_assembly;
+    info.pViewportState = &viewport;
+    info.pRasterizationState = &rasterization;
+    info.pMultisampleState = &multisample;
+    info.pDepthStencilState = &description.depth_stencil;
+    info.pColorBlendState = &blend;
+    info.pDynamicState = &dynamic;
+    info.layout = description.layout;
+    info.renderPass = description.render_pass;
+    info.subpass = description.subpass;
+    VkPipeline pipeline;
+    VK_SUCCEED( vkCreateGraphicsPipelines(vk->device, VK_NULL_HANDLE, 1, &info, nullptr, &pipeline) );
+    return pipeline;
+}
+
+bool DrawPipelines::init(VulkanSystem *vk,
+                         const char *shader_directory,
+                         VkPipelineLayout draw_layout,
+                         const MainPass &main_pass,
+                         const ShadowAtlas &shadow_atlas)
+{
+    m_vk = vk;
+    enum { MESH_DEPTH_VERT, MESH_VERT, MESH_FRAG, SHADOW_VERT, NUM_SHADERS };
+    const char *shader_names[NUM_SHADERS] = { "mesh_depth.vert.spv", "mesh.vert.spv", "mesh.frag.spv", "shadow.vert.spv" };
+    VkShaderModule shaders[NUM_SHADERS];
+    for (int i = 0; i < NUM_SHADERS; i++)
+    {
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/%s", shader_directory, shader_names[i]);
+        if ( !CreateVulkanShaderModule(vk, path, &shaders[i]) )
+        {
+            fprintf(stderr, C_RED "[%s] Failed to load the mesh shaders.\n" C_RESET, __func__);
+            for (int j = 0; j < i; j++) vkDestroyShaderModule(vk->device, shaders[j], nullptr);
+            return false;
+        }
+    }
+
+    // The light clustering, the albedo and the shadow atlas layout are the fragment shader's
+    // specialization constants 0 to 7, all 4 bytes.
+    struct {
+        uint32_t light_clusters[3];
+        float albedo;
+        uint32_t shadow_atlas_size;
+        uint32_t shadow_atlas_tile_size;
+        float shadow_atlas_near_factor;
+        uint32_t shadow_slot_null;
+    } fragment_constants = {
+        { LIGHT_CLUSTERS_X, LIGHT_CLUSTERS_Y, LIGHT_CLUSTERS_Z },
+        PATH_TRACER_ALBEDO,
+        SHADOW_ATLAS_SIZE,
+        SHADOW_ATLAS_TILE_SIZE,
+        SHADOW_ATLAS_NEAR_FACTOR,
+        SHADOW_SLOT_NULL,
+    };
+    VkSpecializationMapEntry fragment_entries[8];
+    for (uint32_t i = 0; i < 8; i++) fragment_entries[i] = { i, 4 * i, 4 };
+    VkSpecializationInfo fragment_specialization = { 8, fragment_entries, sizeof(fragment_constants), &fragment_constants };
+
+    for (int f = 0; f < NUM_VERTEX_FORMATS; f++)
+    {
+        PipelineDescription description = {};
+        description.vertex_format = (VertexFormat) f;
+        description.layout = draw_layout;
+
+        description.num_attributes = 1;
+        description.vertex_shader = shaders[MESH_DEPTH_VERT];
+        description.render_pass = main_pass.render_pass(true);
+        description.subpass = MainPass::subpass(true, MainPassStage::Depth);
+        description.depth_stencil = MainPass::depth_stencil_state(true, MainPassStage::Depth);
+        m_depth[f] = create_pipeline(vk, description);
+
+        description.num_attributes = 2;
+        description.vertex_shader = shaders[MESH_VERT];
+        description.fragment_shader = shaders[MESH_FRAG];
+        description.fragment_specialization = &fragment_specialization;
+        description.num_color_attachments = 2;
+        for (int prepass = 0; prepass < 2; prepass++)
+        {
+            description.render_pass = main_pass.render_pass(prepass);
+            description.subpass = MainPass::subpass(prepass, MainPassStage::Shading);
+            description.depth_stencil = MainPass::depth_stencil_state(prepass, MainPassStage::Shading);
+            m_shading[prepass][f] = create_pipeline(vk, description);
+        }
+
+        // The shadow atlas's render passes are compatible, so one pipeline draws into either.
+        description.num_attributes = 1;
+        description.vertex_shader = shaders[SHADOW_VERT];
+        description.fragment_shader = VK_NULL_HANDLE;
+        description.fragment_specialization = nullptr;
+        description.num_color_attachments = 0;
+        description.layout = shadow_atlas.pipeline_layout();
+        description.render_pass = shadow_atlas.render_pass();
+        description.subpass = 0;
+        description.depth_stencil = { VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO };
+        description.depth_stencil.depthTestEnable = VK_TRUE;
+        description.depth_stencil.depthWriteEnable = VK_TRUE;
+        description.depth_stencil.depthCompareOp = VK_COMPARE_OP_LESS;
+        description.depth_bias = true;
+        m_shadow[f] = create_pipeline(vk, description);
+    }
+    for (int i = 0; i < NUM_SHADERS; i++) vkDestroyShaderModule(vk->device, shaders[i], nullptr);
+    return true;
+}
+
+void DrawPipelines::destroy()
+{
+    for (int f = 0; f < NUM_VERTEX_FORMATS; f++)
+    {
+        vkDestroyPipeline(m_vk->device, m_depth[f], nullptr);
+        vkDestroyPipeline(m_vk->device, m_shading[0][f], nullptr);
+        vkDestroyPipeline(m_vk->device, m_shading[1][f], nullptr);
+        vkDestroyPipeline(m_vk->device, m_shadow[f], nullptr);
+    }
+}
+
+VkPipeline DrawPipelines::main_pass(bool prepass, MainPassStage stage, VertexFormat format) const
+{
+    assert((int) format < NUM_VERTEX_FORMATS);
+    if ( stage == MainPassStage::Depth )
+    {
+        assert(prepass);
+        return m_depth[(int) format];
+    }
+    return m_shading[prepass][(int) format];
+}
+
+VkPipeline DrawPipelines::shadow(VertexFormat format) const
+{
+    assert((int) format < NUM_VERTEX_FORMATS);
+    return m_shadow[(int) format];
+}
@@ -0,0 +1,52 @@
+#ifndef RENDERER_DRAW_PIPELINES_H_
+#define RENDERER_DRAW_PIPELINES_H_
+/* draw_pipelines.h
+ *
+ * The graphics pipelines drawing polygon meshes from the mesh pool.
+ *
+ * Vertices are fetched by the vertex input, so there is a pipeline per vertex format (see
+ * vertex_format.h) for each render pass and stage meshes are drawn in, with the format's
+ * attributes and the format specialized into the vertex shader. These are:
+ *     depth:   the main pass's pre-pass (see main_pass.h), fetching only positions, with no
+ *              fragment shader.
+ *     shading: the main pass drawing color and IDs, with and without the pre-pass, whose render
+ *              passes differ in their subpasses and depth tests.
+ *     shadow:  the cube faces of the shadow atlas (see shadow_atlas.h), depth only, with a depth
+ *              bias against surfaces shadowing themselves.
+ * Meshes are drawn from both sides, as by the CPU rasterizer. The viewport and scissor are
+ * dynamic.
+ *
+ * Shaders are loaded from the directory of compiled SPIR-V shaders:
+ *     mesh_depth.vert.spv, mesh.vert.spv, mesh.frag.spv, shadow.vert.spv
+ */
+#include "engine/platform/vk.h"
+#include "renderer/vertex_format.h"
+#include "renderer/main_pass.h"
+#include "renderer/shadow_atlas.h"
+
+// Of the shadow pipelines, in units of the atlas's depth precision and of the depth slope.
+#define DRAW_PIPELINES_SHADOW_DEPTH_BIAS 2.f
+#define DRAW_PIPELINES_SHADOW_SLOPE_BIAS 2.f
+
+class DrawPipelines
+{
+public:
+    // Main pass pipelines use the draw pipeline layout, see GpuDrawConstants, and shadow
+    // pipelines the shadow atlas's.
+    bool init(VulkanSystem *vk,
+              const char *shader_directory,
+              VkPipelineLayout draw_layout,
+              const MainPass &main_pass,
+              const ShadowAtlas &shadow_atlas);
+    void destroy();
+
+    VkPipeline main_pass(bool prepass, MainPassStage stage, VertexFormat format) const;
+    VkPipeline shadow(VertexFormat format) const;
+private:
+    VulkanSystem *m_vk;
+    VkPipeline m_depth[NUM_VERTEX_FORMATS];
+    VkPipeline m_shading[2][NUM_VERTEX_FORMATS]; // [prepass]
+    VkPipeline m_shadow[NUM_VERTEX_FORMATS];
+};
+
+#endif // RENDERER_DRAW_PIPELINES_H_
@@ -0,0 +1,79 @@
+#include "renderer/draw_sort.h"
+#include <algorithm>
+
+#define RADIX_SIZE (1u << DRAW_SORT_RADIX_BITS)
+
+uint64_t *sort_draw_keys(JobSystem *jobs, LinearArena *arena, uint64_t *keys, uint64_t *scratch, uint32_t num_keys)
+{
+    if ( num_keys <= 1 ) return keys;
+    // Few enough chunks that parallel_for keeps its batches off the heap.
+    uint32_t chunk_size = std::max<uint32_t>(DRAW_SORT_JOB_KEYS,
+                                             (num_keys + JOB_SYSTEM_PARALLEL_FOR_INLINE_BATCHES - 1) / JOB_SYSTEM_PARALLEL_FOR_INLINE_BATCHES);
+    uint32_t num_chunks = (num_keys + chunk_size - 1) / chunk_size;
+
+    // The bits set in some keys but not all.
+    uint64_t *chunk_any = (uint64_t *) arena->allocate(2 * num_chunks * sizeof(uint64_t), alignof(uint64_t));
+    uint64_t *chunk_all = chunk_any + num_chunks;
+    jobs->parallel_for(num_chunks, 1, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t c = begin; c < end; c++)
+        {
+            uint64_t any = 0;
+            uint64_t all = ~0ull;
+            for (uint32_t i = c * chunk_size; i < std::min(num_keys, (c + 1) * chunk_size); i++)
+            {
+                any |= keys[i];
+                all &= keys[i];
+            }
+            chunk_any[c] = any;
+            chunk_all[c] = all;
+        }
+    });
+    uint64_t any = 0;
+    uint64_t all = ~0ull;
+    for (uint32_t c = 0; c < num_chunks; c++)
+    {
+        any |= chunk_any[c];
+        all &= chunk_all[c];
+    }
+    uint64_t varying = any & ~all;
+
+    // [chunk][digit] counts, then each chunk's next position for the digit.
+    uint32_t *offsets = (uint32_t *) arena->allocate(num_chunks * RADIX_SIZE * sizeof(uint32_t), alignof(uint32_t));
+    for (uint32_t shift = DRAW_SORT_INDEX_BITS; shift < 64; shift += DRAW_SORT_RADIX_BITS)
+    {
+        if ( ((varying >> shift) & (RADIX_SIZE - 1)) == 0 ) continue;
+        // Captured by value, as the counts could otherwise alias them.
+        jobs->parallel_for(num_chunks, 1, [=](uint32_t begin, uint32_t end) {
+            for (uint32_t c = begin; c < end; c++)
+            {
+                uint32_t *counts = offsets + c * RADIX_SIZE;
+                memset(counts, 0, RADIX_SIZE * sizeof(uint32_t));
+                uint32_t chunk_end = std::min(num_keys, (c + 1) * chunk_size);
+                for (uint32_t i = c * chunk_size; i < chunk_end; i++)
+                    counts[(keys[i] >> shift) & (RADIX_SIZE - 1)]++;
+            }
+        });
+        // Digit by digit, then chunk by chunk, so that equal digits keep their order.
+        uint32_t position = 0;
+        for (uint32_t d = 0; d < RADIX_SIZE; d++)
+        {
+            for (uint32_t c = 0; c < num_chunks; c++)
+            {
+                uint32_t count = offsets[c * RADIX_SIZE + d];
+                offsets[c * RADIX_SIZE + d] = position;
+                position += count;
+            }
+        }
+        jobs->parallel_for(num_chunks, 1, [=](uint32_t begin, uint32_t end) {
+            for (uint32_t c = begin; c < end; c++)
+            {
+                uint32_t *next = offsets + c * RADIX_SIZE;
+                uint32_t chunk_end = std::min(num_keys, (c + 1) * chunk_size);
+                for (uint32_t i = c * chunk_size; i < chunk_end; i++)
+                    scratch[next[(keys[i] >> shift) & (RADIX_SIZE - 1)]++] = keys[i];
+            }
+        });
+        std::swap(keys, scratch);
+    }
+    return keys;
+}
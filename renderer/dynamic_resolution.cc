@@ -0,0 +1,97 @@
+#include "renderer/dynamic_resolution.h"
+#include "ansi_color.h"
+#include <stdio.h>
+#include <assert.h>
+#include <math.h>
+#include <algorithm>
+
+bool DynamicResolution::init(VulkanSystem *vk, uint32_t num_frames)
+{
+    assert(num_frames <= DYNAMIC_RESOLUTION_MAX_FRAMES);
+    m_vk = vk;
+    m_num_frames = num_frames;
+    {
+        VkQueryPoolCreateInfo info = { VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+        info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        info.queryCount = 2 * num_frames;
+        VK_SUCCEED( vkCreateQueryPool(vk->device, &info, nullptr, &m_query_pool) );
+    }
+    for (uint32_t i = 0; i < DYNAMIC_RESOLUTION_MAX_FRAMES; i++) m_query_pending[i] = false;
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(vk->physical_device, &properties);
+    m_timestamps = properties.limits.timestampComputeAndGraphics;
+    m_timestamp_period = properties.limits.timestampPeriod;
+    if ( !m_timestamps )
+    {
+        printf(C_YELLOW "Dynamic resolution: no timestamps on the graphics queue, rendering at full resolution.\n" C_RESET);
+    }
+    return true;
+}
+
+void DynamicResolution::destroy()
+{
+    vkDestroyQueryPool(m_vk->device, m_query_pool, nullptr);
+}
+
+void DynamicResolution::set_budget(float milliseconds)
+{
+    assert(milliseconds >= 0);
+    m_budget_milliseconds = milliseconds;
+    if ( milliseconds == 0 ) m_scale = 1;
+}
+
+void DynamicResolution::set_min_scale(float min_scale)
+{
+    assert(min_scale > 0 && min_scale <= 1);
+    m_min_scale = min_scale;
+    m_scale = std::max(m_scale, min_scale);
+}
+
+void DynamicResolution::begin_frame(uint32_t frame)
+{
+    assert(frame < m_num_frames);
+    m_frame = frame;
+    if ( !m_query_pending[frame] ) return;
+    m_query_pending[frame] = false;
+    uint64_t timestamps[2];
+    VkResult result = vkGetQueryPoolResults(m_vk->device, m_query_pool, 2 * frame, 2,
+                                            sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    if ( result != VK_SUCCESS || timestamps[1] < timestamps[0] ) return;
+    update((float) ((timestamps[1] - timestamps[0]) * (double) m_timestamp_period * 1e-6), m_query_scale[frame]);
+}
+
+void DynamicResolution::update(float milliseconds, float frame_scale)
+{
+    if ( m_gpu_milliseconds == 0 ) m_gpu_milliseconds = milliseconds;
+    else m_gpu_milliseconds += DYNAMIC_RESOLUTION_SMOOTHING * (milliseconds - m_gpu_milliseconds);
+    if ( m_budget_milliseconds == 0 ) return;
+
+    float target = m_budget_milliseconds * (1 - DYNAMIC_RESOLUTION_HEADROOM);
+    float estimate = frame_scale * sqrtf(target / std::max(milliseconds, 1e-3f));
+    estimate = std::clamp(estimate, m_min_scale, 1.f);
+    if ( estimate < m_scale ) m_scale = estimate;
+    else m_scale += DYNAMIC_RESOLUTION_RAISE_RATE * (estimate - m_scale);
+}
+
+VkExtent2D DynamicResolution::render_extent(uint32_t width, uint32_t height) const
+{
+    VkExtent2D extent;
+    extent.width = std::clamp((uint32_t) lroundf(width * m_scale), 1u, std::max(width, 1u));
+    extent.height = std::clamp((uint32_t) lroundf(height * m_scale), 1u, std::max(height, 1u));
+    return extent;
+}
+
+void DynamicResolution::record_begin(VkCommandBuffer command_buffer)
+{
+    if ( !m_timestamps ) return;
+    vkCmdResetQueryPool(command_buffer, m_query_pool, 2 * m_frame, 2);
+    vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_query_pool, 2 * m_frame);
+}
+
+void DynamicResolution::record_end(VkCommandBuffer command_buffer)
+{
+    if ( !m_timestamps ) return;
+    vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_query_pool, 2 * m_frame + 1);
+    m_query_pending[m_frame] = true;
+    m_query_scale[m_frame] = m_scale;
+}
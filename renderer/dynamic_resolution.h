@@ -0,0 +1,71 @@
+#ifndef RENDERER_DYNAMIC_RESOLUTION_H_
+#define RENDERER_DYNAMIC_RESOLUTION_H_
+/* dynamic_resolution.h
+ *
+ * Scaling the resolution the view is rendered at, to keep the GPU's frame time within a budget.
+ *
+ * Each frame's GPU time is measured with timestamps written at the start and end of its
+ * commands, and read back when its frame slot is reused. The scale applies to both axes of the
+ * framebuffer, so the pixels drawn go with its square. From the time measured at the scale the
+ * frame was rendered at, the scale meeting the budget, less DYNAMIC_RESOLUTION_HEADROOM for
+ * noise, is estimated as if all of the time were per pixel. As part of it is not, the estimate
+ * undershoots the change needed, and the scale converges over a few frames rather than
+ * oscillating. Scaling down takes the estimate at once, so that a load spike costs few frames
+ * over the budget, while scaling up moves DYNAMIC_RESOLUTION_RAISE_RATE of the way to it per
+ * frame, so that noise does not make the resolution flicker.
+ *
+ * The view is drawn over the render extent of the framebuffer-sized targets and scaled up to the
+ * swap chain image, see main_pass.h.
+ */
+#include "engine/platform/vk.h"
+#include <stdint.h>
+
+#define DYNAMIC_RESOLUTION_MAX_FRAMES 4
+#define DYNAMIC_RESOLUTION_DEFAULT_MIN_SCALE 0.5f
+// Of the budget.
+#define DYNAMIC_RESOLUTION_HEADROOM 0.1f
+#define DYNAMIC_RESOLUTION_RAISE_RATE 0.05f
+// The weight of each frame's time in the smoothed time.
+#define DYNAMIC_RESOLUTION_SMOOTHING 0.1f
+
+class DynamicResolution
+{
+public:
+    bool init(VulkanSystem *vk, uint32_t num_frames);
+    void destroy();
+
+    // 0 turns scaling off, rendering at the framebuffer size.
+    void set_budget(float milliseconds);
+    void set_min_scale(float min_scale);
+    // Read back the GPU time of the frame's previous use, whose GPU work has completed, and update the scale.
+    void begin_frame(uint32_t frame);
+    float scale() const { return m_scale; }
+    // The size to render a framebuffer at, at least a pixel.
+    VkExtent2D render_extent(uint32_t width, uint32_t height) const;
+    // Smoothed, 0 until measured.
+    float gpu_milliseconds() const { return m_gpu_milliseconds; }
+
+    // Write the frame's timestamps, at the start and end of its command buffer.
+    void record_begin(VkCommandBuffer command_buffer);
+    void record_end(VkCommandBuffer command_buffer);
+private:
+    void update(float milliseconds, float frame_scale);
+
+    VulkanSystem *m_vk;
+    uint32_t m_num_frames;
+    uint32_t m_frame = 0;
+    bool m_timestamps;
+    // Nanoseconds per timestamp tick.
+    float m_timestamp_period;
+    // Two queries per frame slot, pending until read back.
+    VkQueryPool m_query_pool;
+    bool m_query_pending[DYNAMIC_RESOLUTION_MAX_FRAMES];
+    float m_query_scale[DYNAMIC_RESOLUTION_MAX_FRAMES];
+
+    float m_budget_milliseconds = 0;
+    float m_min_scale = DYNAMIC_RESOLUTION_DEFAULT_MIN_SCALE;
+    float m_scale = 1;
+    float m_gpu_milliseconds = 0;
+};
+
+#endif // RENDERER_DYNAMIC_RESOLUTION_H_
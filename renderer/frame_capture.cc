@@ -0,0 +1,218 @@
+#include "renderer/frame_capture.h"
+#include "engine/memory/memory_tracking.h"
+#include "ansi_color.h"
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+void FrameCapture::init(VulkanSystem *vk, uint32_t num_frames)
+{
+    m_vk = vk;
+    m_num_frames = num_frames;
+    for (Buffer &buffer : m_buffers) buffer.capture = this;
+}
+
+void FrameCapture::destroy()
+{
+    if ( m_capturing ) stop();
+    for (Buffer &buffer : m_buffers)
+    {
+        if ( buffer.has_readback ) DestroyVulkanBuffer(m_vk, &buffer.readback);
+        buffer.has_readback = false;
+    }
+}
+
+bool FrameCapture::start(JobSystem *jobs, const char *path_format, ImageFileFormat format)
+{
+    if ( m_capturing ) return false;
+    if ( strlen(path_format) >= FRAME_CAPTURE_MAX_PATH )
+    {
+        fprintf(stderr, C_RED "[%s] The capture path \"%s\" is too long.\n" C_RESET, __func__, path_format);
+        return false;
+    }
+    m_jobs = jobs;
+    strcpy(m_path_format, path_format);
+    m_format = format;
+    m_capturing = true;
+    m_frames_captured = 0;
+    m_stalls = 0;
+    m_failures.store(0, std::memory_order_relaxed);
+    // A copy in each frame in flight, and an encode on each worker.
+    m_num_buffers = std::min<uint32_t>(m_num_frames + jobs->num_workers(), FRAME_CAPTURE_MAX_BUFFERS);
+    assert(m_num_buffers > m_num_frames);
+    return true;
+}
+
+void FrameCapture::stop()
+{
+    assert(m_capturing);
+    if ( m_vk != nullptr ) VK_SUCCEED( vkDeviceWaitIdle(m_vk->device) );
+    for (uint32_t i = 0; i < m_num_buffers; i++)
+    {
+        if ( m_buffers[i].state == BufferState::Copying ) encode(&m_buffers[i]);
+    }
+    for (uint32_t i = 0; i < m_num_buffers; i++)
+    {
+        m_jobs->wait(&m_buffers[i].counter);
+        m_buffers[i].state = BufferState::Free;
+    }
+    m_capturing = false;
+    printf(C_CYAN "Frame capture: wrote %u frames, waited for encoding %u times.\n" C_RESET,
+           m_frames_captured - failures(), m_stalls);
+}
+
+void FrameCapture::begin_frame(uint32_t frame)
+{
+    m_frame = frame;
+    if ( !m_capturing ) return;
+    for (uint32_t i = 0; i < m_num_buffers; i++)
+    {
+        Buffer &buffer = m_buffers[i];
+        if ( buffer.state == BufferState::Copying && buffer.frame == frame ) encode(&buffer);
+    }
+}
+
+FrameCapture::Buffer *FrameCapture::acquire_buffer(uint32_t width, uint32_t height)
+{
+    Buffer *oldest = nullptr;
+    Buffer *chosen = nullptr;
+    for (uint32_t i = 0; i < m_num_buffers && chosen == nullptr; i++)
+    {
+        Buffer &buffer = m_buffers[i];
+        if ( buffer.state == BufferState::Encoding && buffer.counter.value() == 0 ) buffer.state = BufferState::Free;
+        if ( buffer.state == BufferState::Free ) chosen = &buffer;
+        else if ( buffer.state == BufferState::Encoding && (oldest == nullptr || buffer.sequence < oldest->sequence) ) oldest = &buffer;
+    }
+    if ( chosen == nullptr )
+    {
+        // There are more buffers than frames in flight, so some are encoding.
+        assert(oldest != nullptr);
+        m_stalls++;
+        m_jobs->wait(&oldest->counter);
+        chosen = oldest;
+    }
+    chosen->sequence = m_frames_captured++;
+    chosen->width = width;
+    chosen->height = height;
+    chosen->format = m_format;
+    snprintf(chosen->path, sizeof(chosen->path), m_path_format, chosen->sequence);
+    return chosen;
+}
+
+void FrameCapture::record(VkCommandBuffer command_buffer, VkImage image, VkImageLayout layout, VkFormat format, uint32_t width, uint32_t height)
+{
+    assert(m_capturing && m_vk != nullptr);
+    assert(format == VK_FORMAT_B8G8R8A8_SRGB || format == VK_FORMAT_B8G8R8A8_UNORM
+           || format == VK_FORMAT_R8G8B8A8_SRGB || format == VK_FORMAT_R8G8B8A8_UNORM);
+    Buffer *buffer = acquire_buffer(width, height);
+    buffer->bgra = format == VK_FORMAT_B8G8R8A8_SRGB || format == VK_FORMAT_B8G8R8A8_UNORM;
+    VkDeviceSize size = 4 * (VkDeviceSize) width * height;
+    if ( buffer->has_readback && buffer->readback.size < size )
+    {
+        DestroyVulkanBuffer(m_vk, &buffer->readback);
+        buffer->has_readback = false;
+    }
+    if ( !buffer->has_readback )
+    {
+        // Cached memory is much faster for the CPU to read.
+        VkMemoryPropertyFlags memory_properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+        if ( VulkanFindMemoryType(m_vk->physical_device, ~0u, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT) != UINT32_MAX )
+            memory_properties |= VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+        if ( !CreateVulkanBuffer(m_vk, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, memory_properties, &buffer->readback) )
+        {
+            fprintf(stderr, C_RED "[%s] Failed to create a %ux%u readback buffer, frame %u is not captured.\n" C_RESET,
+                    __func__, width, height, buffer->sequence);
+            m_failures.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        buffer->has_readback = true;
+    }
+
+    VkImageMemoryBarrier image_barrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+    image_barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+    image_barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    image_barrier.oldLayout = layout;
+    image_barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    image_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    image_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    image_barrier.image = image;
+    image_barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+    vkCmdPipelineBarrier(command_buffer,
+                         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                         0, nullptr, 0, nullptr, 1, &image_barrier);
+    VkBufferImageCopy copy = {};
+    copy.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+    copy.imageExtent = { width, height, 1 };
+    vkCmdCopyImageToBuffer(command_buffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, buffer->readback.buffer, 1, &copy);
+    // The image was only read, so later work just has to wait for the layout transition.
+    image_barrier.srcAccessMask = 0;
+    image_barrier.dstAccessMask = 0;
+    image_barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    image_barrier.newLayout = layout;
+    VkBufferMemoryBarrier buffer_barrier = { VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER };
+    buffer_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    buffer_barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    buffer_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    buffer_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    buffer_barrier.buffer = buffer->readback.buffer;
+    buffer_barrier.offset = 0;
+    buffer_barrier.size = size;
+    vkCmdPipelineBarrier(command_buffer,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
+                         0, nullptr, 1, &buffer_barrier, 1, &image_barrier);
+    buffer->from_readback = true;
+    buffer->state = BufferState::Copying;
+    buffer->frame = m_frame;
+}
+
+void FrameCapture::capture(const uint8_t *rgba, uint32_t width, uint32_t height)
+{
+    assert(m_capturing);
+    Buffer *buffer = acquire_buffer(width, height);
+    buffer->from_readback = false;
+    buffer->bgra = false;
+    buffer->rgba.assign(rgba, rgba + 4 * (size_t) width * height);
+    encode(buffer);
+}
+
+void FrameCapture::encode(Buffer *buffer)
+{
+    buffer->state = BufferState::Encoding;
+    m_jobs->submit({ encode_job, buffer }, &buffer->counter);
+}
+
+void FrameCapture::encode_job(void *data)
+{
+    // Written out like an asset, rather than as part of the frame that submitted it.
+    MemoryScope memory_scope(MemorySubsystem::Assets);
+    Buffer *buffer = (Buffer *) data;
+    size_t num_pixels = (size_t) buffer->width * buffer->height;
+    const uint8_t *rgba = buffer->rgba.data();
+    if ( buffer->from_readback )
+    {
+        const VulkanBuffer &readback = buffer->readback;
+        if ( !(readback.memory_properties & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) )
+        {
+            VkMappedMemoryRange range = { VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE };
+            range.memory = readback.memory;
+            range.offset = 0;
+            range.size = VK_WHOLE_SIZE;
+            VK_SUCCEED( vkInvalidateMappedMemoryRanges(buffer->capture->m_vk->device, 1, &range) );
+        }
+        rgba = (const uint8_t *) readback.mapped;
+        if ( buffer->bgra )
+        {
+            buffer->rgba.resize(4 * num_pixels);
+            for (size_t i = 0; i < num_pixels; i++)
+            {
+                buffer->rgba[4*i + 0] = rgba[4*i + 2];
+                buffer->rgba[4*i + 1] = rgba[4*i + 1];
+                buffer->rgba[4*i + 2] = rgba[4*i + 0];
+                buffer->rgba[4*i + 3] = rgba[4*i + 3];
+            }
+            rgba = buffer->rgba.data();
+        }
+    }
+    encode_image(buffer->format, rgba, buffer->width, buffer->height, &buffer->encoded);
+    if ( !write_image_file(buffer->path, buffer->encoded) ) buffer->capture->m_failures.fetch_add(1, std::memory_order_relaxed);
+}
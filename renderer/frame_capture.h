@@ -0,0 +1,100 @@
+#ifndef RENDERER_FRAME_CAPTURE_H_
+#define RENDERER_FRAME_CAPTURE_H_
+/* frame_capture.h
+ *
+ * Writing rendered frames to image files, e.g. to produce image sequences, without holding up
+ * the frame loop.
+ *
+ * Each captured frame is copied into one of a ring of host-visible readback buffers by a command
+ * recorded in the frame. The copy has completed once the frame slot is reused (see
+ * DisplayRefreshEvent), when begin_frame hands the buffer to a job that converts, encodes and
+ * writes it (see image_file.h), so the render thread waits neither for the GPU nor for encoding.
+ * The buffer returns to the ring when its job is done. There are enough buffers for the frames
+ * in flight and an encode on each worker. If encoding falls further behind, capturing waits for
+ * the oldest encode, running jobs meanwhile, so that no frame is dropped from the sequence.
+ *
+ * With the CPU API, frames are copied from the rasterizer's image, and encoded right away.
+ */
+#include "engine/platform/vk.h"
+#include "engine/jobs/job_system.h"
+#include "renderer/image_file.h"
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+#define FRAME_CAPTURE_MAX_BUFFERS 16
+#define FRAME_CAPTURE_MAX_PATH 256
+
+class FrameCapture
+{
+public:
+    // vk is null with the CPU API.
+    void init(VulkanSystem *vk, uint32_t num_frames);
+    void destroy();
+
+    // Capture the frames recorded from now on, to files named by path_format, a printf format of
+    // the capture's frame number, e.g. "frames/%05u.qoi". Returns false if already capturing.
+    bool start(JobSystem *jobs, const char *path_format, ImageFileFormat format);
+    // Write the frames recorded so far, waiting for their copies and encodes. Call between
+    // frames, after the last captured frame was submitted.
+    void stop();
+    bool capturing() const { return m_capturing; }
+    uint32_t frames_captured() const { return m_frames_captured; }
+    // How many times capturing had to wait for an encode.
+    uint32_t stalls() const { return m_stalls; }
+    uint32_t failures() const { return m_failures.load(std::memory_order_relaxed); }
+
+    // Encode the frames copied in the frame slot's previous use, whose GPU work has completed.
+    // Call every frame, capturing or not.
+    void begin_frame(uint32_t frame);
+    // Copy an image with 8-bit RGBA or BGRA texels, written by earlier commands, to a readback
+    // buffer, leaving it in its layout.
+    void record(VkCommandBuffer command_buffer, VkImage image, VkImageLayout layout, VkFormat format, uint32_t width, uint32_t height);
+    // Capture an 8-bit RGBA image, with the CPU API.
+    void capture(const uint8_t *rgba, uint32_t width, uint32_t height);
+private:
+    enum class BufferState
+    {
+        Free,
+        Copying,
+        Encoding,
+    };
+    struct Buffer
+    {
+        FrameCapture *capture;
+        BufferState state = BufferState::Free;
+        VulkanBuffer readback;
+        bool has_readback = false;
+        uint32_t frame;    // The frame slot it was copied in.
+        uint32_t sequence; // The capture's frame number.
+        uint32_t width;
+        uint32_t height;
+        bool from_readback; // Or from rgba.
+        bool bgra;
+        ImageFileFormat format;
+        char path[FRAME_CAPTURE_MAX_PATH];
+        // Reused, so that capturing doesn't allocate once they have grown to the frame size.
+        std::vector<uint8_t> rgba;
+        std::vector<uint8_t> encoded;
+        JobCounter counter;
+    };
+    // A free buffer, for the next frame number.
+    Buffer *acquire_buffer(uint32_t width, uint32_t height);
+    void encode(Buffer *buffer);
+    static void encode_job(void *data);
+
+    VulkanSystem *m_vk;
+    JobSystem *m_jobs;
+    uint32_t m_num_frames;
+    uint32_t m_frame = 0;
+    bool m_capturing = false;
+    char m_path_format[FRAME_CAPTURE_MAX_PATH];
+    ImageFileFormat m_format;
+    uint32_t m_frames_captured = 0;
+    uint32_t m_stalls = 0;
+    std::atomic<uint32_t> m_failures{0};
+    Buffer m_buffers[FRAME_CAPTURE_MAX_BUFFERS];
+    uint32_t m_num_buffers;
+};
+
+#endif // RENDERER_FRAME_CAPTURE_H_
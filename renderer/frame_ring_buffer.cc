@@ -0,0 +1,91 @@
+#include "renderer/frame_ring_buffer.h"
+#include "ansi_color.h"
+#include <stdio.h>
+#include <assert.h>
+#include <algorithm>
+
+static VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+bool FrameRingBuffer::init(VulkanSystem *_vk, uint32_t _num_frames, VkDeviceSize _frame_size, VkDeviceSize _max_binding_range)
+{
+    vk = _vk;
+    num_frames = _num_frames;
+    max_binding_range = _max_binding_range;
+    frame = 0;
+    frame_offset.store(0, std::memory_order_relaxed);
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(vk->physical_device, &properties);
+    offset_alignment = std::max(properties.limits.minUniformBufferOffsetAlignment, properties.limits.minStorageBufferOffsetAlignment);
+    atom_size = properties.limits.nonCoherentAtomSize;
+    // Regions start on atoms, so that flushing one frame never touches another's.
+    frame_size = align_up(_frame_size, std::max(offset_alignment, atom_size));
+
+    // Prefer memory the GPU reads at full speed, where it is host-visible (resizable BAR, integrated GPUs).
+    VkMemoryPropertyFlags memory_properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+    if ( VulkanFindMemoryType(vk->physical_device, ~0u, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != UINT32_MAX )
+        memory_properties |= VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    VkDeviceSize size = align_up(num_frames * frame_size + max_binding_range, atom_size);
+    if ( !CreateVulkanBuffer(vk,
+                             size,
+                             VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                             memory_properties,
+                             &ring) )
+    {
+        fprintf(stderr, C_RED "[%s] Failed to create a %llu byte frame ring buffer.\n" C_RESET, __func__, (unsigned long long) size);
+        return false;
+    }
+    coherent = (ring.memory_properties & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+    return true;
+}
+
+void FrameRingBuffer::destroy()
+{
+    DestroyVulkanBuffer(vk, &ring);
+}
+
+void FrameRingBuffer::begin_frame(uint32_t _frame)
+{
+    assert(_frame < num_frames);
+    frame = _frame;
+    frame_offset.store(0, std::memory_order_relaxed);
+}
+
+FrameRingAllocation FrameRingBuffer::allocate(VkDeviceSize size, VkDeviceSize alignment)
+{
+    alignment = std::max(alignment, offset_alignment);
+    VkDeviceSize offset = frame_offset.load(std::memory_order_relaxed);
+    VkDeviceSize aligned;
+    do {
+        aligned = align_up(offset, alignment);
+    } while ( !frame_offset.compare_exchange_weak(offset, aligned + size, std::memory_order_relaxed) );
+    if ( aligned + size > frame_size ) return { nullptr, 0 };
+    VkDeviceSize buffer_offset = frame * frame_size + aligned;
+    return { (uint8_t *) ring.mapped + buffer_offset, (uint32_t) buffer_offset };
+}
+
+void FrameRingBuffer::end_frame()
+{
+    VkDeviceSize used = frame_offset.load(std::memory_order_relaxed);
+    if ( used > frame_size )
+    {
+        fprintf(stderr, C_YELLOW "[%s] Frame data needed %llu bytes of a %llu byte region, and some was dropped.\n" C_RESET,
+                __func__, (unsigned long long) used, (unsigned long long) frame_size);
+        used = frame_size;
+    }
+    if ( coherent || used == 0 ) return;
+    VkMappedMemoryRange range = { VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE };
+    range.memory = ring.memory;
+    range.offset = frame * frame_size;
+    range.size = align_up(used, atom_size);
+    VK_SUCCEED( vkFlushMappedMemoryRanges(vk->device, 1, &range) );
+}
+
+VkDescriptorBufferInfo FrameRingBuffer::descriptor_info(VkDeviceSize range) const
+{
+    assert(range <= max_binding_range);
+    return { ring.buffer, 0, range };
+}
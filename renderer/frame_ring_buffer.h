@@ -0,0 +1,66 @@
+#ifndef RENDERER_FRAME_RING_BUFFER_H_
+#define RENDERER_FRAME_RING_BUFFER_H_
+/* frame_ring_buffer.h
+ *
+ * Per-frame uniform and instance data in one persistently mapped, host-visible buffer.
+ *
+ * The buffer is split into a region per frame in flight. During a frame, data is sub-allocated
+ * from the frame's region by bumping an offset and written in place through the mapping, and
+ * shaders find it through dynamic offsets into descriptors written once over the whole buffer.
+ * Nothing is created, mapped or updated per draw. As with FrameArenas, a frame's region is only
+ * reused once the GPU has finished the frame that last used it.
+ *
+ * Allocation is thread-safe, so parallel passes can write their results straight into GPU-visible
+ * memory. The memory may be write-combined, so it should be written sequentially and never read.
+ *
+ * If the memory is not host-coherent, end_frame flushes the frame's written range, rounded out to
+ * nonCoherentAtomSize. It must be called after the last write and before the frame is submitted.
+ */
+#include "engine/platform/vk.h"
+#include <stdint.h>
+#include <atomic>
+
+struct FrameRingAllocation
+{
+    void *data;      // nullptr if the frame's region is full.
+    uint32_t offset; // From the start of the buffer, to pass as a dynamic offset.
+};
+
+class FrameRingBuffer
+{
+public:
+    // Dynamic descriptors over the buffer may cover up to max_binding_range bytes past their offset.
+    bool init(VulkanSystem *vk, uint32_t num_frames, VkDeviceSize frame_size, VkDeviceSize max_binding_range);
+    void destroy();
+
+    void begin_frame(uint32_t frame);
+    // Offsets are aligned for use as both uniform and storage buffer dynamic offsets.
+    FrameRingAllocation allocate(VkDeviceSize size, VkDeviceSize alignment = 16);
+    template <typename T>
+    T *allocate(uint32_t count, uint32_t *offset)
+    {
+        FrameRingAllocation allocation = allocate(count * sizeof(T), alignof(T));
+        *offset = allocation.offset;
+        return (T *) allocation.data;
+    }
+    void end_frame();
+
+    VkBuffer buffer() const { return ring.buffer; }
+    // For a dynamic uniform or storage buffer binding of range bytes.
+    VkDescriptorBufferInfo descriptor_info(VkDeviceSize range) const;
+private:
+    VulkanSystem *vk;
+    VulkanBuffer ring;
+    uint32_t num_frames;
+    VkDeviceSize frame_size;
+    VkDeviceSize max_binding_range;
+    VkDeviceSize offset_alignment;
+    VkDeviceSize atom_size;
+    bool coherent;
+
+    uint32_t frame;
+    // Bytes requested from the frame's region, which may exceed frame_size if it overflowed.
+    std::atomic<VkDeviceSize> frame_offset;
+};
+
+#endif // RENDERER_FRAME_RING_BUFFER_H_
@@ -0,0 +1,403 @@
+#include "renderer/image_file.h"
+#include "ansi_color.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF 0x40
+#define QOI_OP_LUMA 0x80
+#define QOI_OP_RUN 0xc0
+#define QOI_OP_RGB 0xfe
+#define QOI_MAX_RUN 62
+
+#define DEFLATE_MIN_MATCH 3
+#define DEFLATE_MAX_MATCH 258
+#define DEFLATE_WINDOW 32768
+#define DEFLATE_HASH_BITS 15
+#define DEFLATE_END_OF_BLOCK 256
+
+static void write_be32(std::vector<uint8_t> *out, uint32_t value)
+{
+    out->push_back(value >> 24);
+    out->push_back(value >> 16);
+    out->push_back(value >> 8);
+    out->push_back(value);
+}
+
+static void encode_ppm(const uint8_t *rgba, int width, int height, std::vector<uint8_t> *out)
+{
+    char header[64];
+    int header_size = snprintf(header, sizeof(header), "P6\n%d %d\n255\n", width, height);
+    out->resize(header_size + 3 * (size_t) width * height);
+    memcpy(out->data(), header, header_size);
+    uint8_t *rgb = out->data() + header_size;
+    for (size_t i = 0; i < (size_t) width * height; i++)
+    {
+        for (int c = 0; c < 3; c++) rgb[3*i + c] = rgba[4*i + c];
+    }
+}
+
+static void encode_qoi(const uint8_t *rgba, int width, int height, std::vector<uint8_t> *out)
+{
+    out->clear();
+    out->insert(out->end(), { 'q', 'o', 'i', 'f' });
+    write_be32(out, width);
+    write_be32(out, height);
+    out->push_back(3); // RGB
+    out->push_back(0); // sRGB
+    // The decoder's index of seen pixels starts out as transparent black, so it is kept as RGBA
+    // here too: its unset entries never match an opaque pixel.
+    uint8_t index[64][4] = {};
+    uint8_t previous[3] = { 0, 0, 0 };
+    uint32_t run = 0;
+    size_t num_pixels = (size_t) width * height;
+    for (size_t i = 0; i < num_pixels; i++)
+    {
+        const uint8_t *pixel = rgba + 4 * i;
+        if ( pixel[0] == previous[0] && pixel[1] == previous[1] && pixel[2] == previous[2] )
+        {
+            if ( ++run == QOI_MAX_RUN || i == num_pixels - 1 )
+            {
+                out->push_back(QOI_OP_RUN | (run - 1));
+                run = 0;
+            }
+            continue;
+        }
+        if ( run > 0 )
+        {
+            out->push_back(QOI_OP_RUN | (run - 1));
+            run = 0;
+        }
+        const uint8_t color[4] = { pixel[0], pixel[1], pixel[2], 255 };
+        uint32_t hash = (color[0] * 3 + color[1] * 5 + color[2] * 7 + color[3] * 11) % 64;
+        if ( memcmp(index[hash], color, 4) == 0 )
+        {
+            out->push_back(QOI_OP_INDEX | hash);
+        }
+        else
+        {
+            memcpy(index[hash], color, 4);
+            int8_t dr = pixel[0] - previous[0];
+            int8_t dg = pixel[1] - previous[1];
+            int8_t db = pixel[2] - previous[2];
+            int8_t dr_dg = dr - dg;
+            int8_t db_dg = db - dg;
+            if ( dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1 )
+            {
+                out->push_back(QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+            }
+            else if ( dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7 )
+            {
+                out->push_back(QOI_OP_LUMA | (dg + 32));
+                out->push_back((dr_dg + 8) << 4 | (db_dg + 8));
+            }
+            else
+            {
+                out->insert(out->end(), { QOI_OP_RGB, pixel[0], pixel[1], pixel[2] });
+            }
+        }
+        memcpy(previous, pixel, 3);
+    }
+    out->insert(out->end(), { 0, 0, 0, 0, 0, 0, 0, 1 });
+}
+
+static uint32_t crc32(const uint8_t *data, size_t size, uint32_t crc = 0)
+{
+    static const auto table = [] {
+        std::vector<uint32_t> t(256);
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            t[i] = c;
+        }
+        return t;
+    }();
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++) crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+static uint32_t adler32(const uint8_t *data, size_t size)
+{
+    uint32_t a = 1;
+    uint32_t b = 0;
+    while ( size > 0 )
+    {
+        // The largest block whose sums can't overflow before the modulo.
+        size_t block = std::min<size_t>(size, 5552);
+        for (size_t i = 0; i < block; i++)
+        {
+            a += data[i];
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+        data += block;
+        size -= block;
+    }
+    return b << 16 | a;
+}
+
+// Bits are packed from the least significant, and Huffman codes from their most significant bit.
+struct BitWriter
+{
+    std::vector<uint8_t> *out;
+    uint64_t bits = 0;
+    uint32_t num_bits = 0;
+
+    void write(uint32_t value, uint32_t count)
+    {
+        bits |= (uint64_t) value << num_bits;
+        num_bits += count;
+        while ( num_bits >= 8 )
+        {
+            out->push_back(bits);
+            bits >>= 8;
+            num_bits -= 8;
+        }
+    }
+    void flush()
+    {
+        if ( num_bits > 0 ) out->push_back(bits);
+        bits = 0;
+        num_bits = 0;
+    }
+};
+
+struct DeflateCode
+{
+    uint16_t code; // Bit-reversed, to be written as is.
+    uint16_t length;
+};
+
+struct DeflateTables
+{
+    DeflateCode literals[288];
+    // By match length: the length symbol, and its extra bits and their count.
+    uint16_t length_symbols[DEFLATE_MAX_MATCH + 1];
+    uint16_t length_extra[DEFLATE_MAX_MATCH + 1];
+    uint8_t length_extra_bits[DEFLATE_MAX_MATCH + 1];
+};
+
+static const DeflateTables &deflate_tables()
+{
+    static const DeflateTables tables = [] {
+        DeflateTables t;
+        for (uint32_t symbol = 0; symbol < 288; symbol++)
+        {
+            uint32_t code;
+            uint32_t length;
+            if ( symbol < 144 ) { code = 0x30 + symbol; length = 8; }
+            else if ( symbol < 256 ) { code = 0x190 + symbol - 144; length = 9; }
+            else if ( symbol < 280 ) { code = symbol - 256; length = 7; }
+            else { code = 0xc0 + symbol - 280; length = 8; }
+            uint32_t reversed = 0;
+            for (uint32_t i = 0; i < length; i++) reversed |= ((code >> i) & 1) << (length - 1 - i);
+            t.literals[symbol] = { (uint16_t) reversed, (uint16_t) length };
+        }
+        static const uint16_t bases[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                            35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+        static const uint8_t extra_bits[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                                3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+        for (int i = 0; i < 29; i++)
+        {
+            // 258 has its own symbol, rather than being 227 with extra bits 31.
+            int end = i < 28 ? bases[i + 1] : DEFLATE_MAX_MATCH + 1;
+            for (int length = bases[i]; length < end; length++)
+            {
+                t.length_symbols[length] = 257 + i;
+                t.length_extra[length] = length - bases[i];
+                t.length_extra_bits[length] = extra_bits[i];
+            }
+        }
+        return t;
+    }();
+    return tables;
+}
+
+// distance is in [1, DEFLATE_WINDOW].
+static void write_distance(BitWriter *writer, uint32_t distance)
+{
+    uint32_t d = distance - 1;
+    uint32_t code;
+    uint32_t extra_bits;
+    if ( d < 4 )
+    {
+        code = d;
+        extra_bits = 0;
+    }
+    else
+    {
+        uint32_t top_bit = 31 - __builtin_clz(d);
+        code = 2 * top_bit + ((d >> (top_bit - 1)) & 1);
+        extra_bits = top_bit - 1;
+    }
+    // Distance codes are 5 bits, written from their most significant bit.
+    uint32_t reversed = 0;
+    for (int i = 0; i < 5; i++) reversed |= ((code >> i) & 1) << (4 - i);
+    writer->write(reversed, 5);
+    if ( extra_bits > 0 ) writer->write(d & ((1u << extra_bits) - 1), extra_bits);
+}
+
+static void deflate_fixed(const uint8_t *data, size_t size, std::vector<uint8_t> *out)
+{
+    const DeflateTables &tables = deflate_tables();
+    BitWriter writer = { out };
+    // One final block with fixed codes.
+    writer.write(1, 1);
+    writer.write(1, 2);
+    std::vector<uint32_t> table(1u << DEFLATE_HASH_BITS, UINT32_MAX);
+    size_t position = 0;
+    while ( position < size )
+    {
+        if ( position + DEFLATE_MIN_MATCH <= size )
+        {
+            uint32_t sequence = data[position] | data[position + 1] << 8 | data[position + 2] << 16;
+            uint32_t hash = (sequence * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+            uint32_t reference = table[hash];
+            table[hash] = (uint32_t) position;
+            if ( reference != UINT32_MAX && position - reference <= DEFLATE_WINDOW
+                 && memcmp(data + reference, data + position, DEFLATE_MIN_MATCH) == 0 )
+            {
+                size_t max_length = std::min<size_t>(DEFLATE_MAX_MATCH, size - position);
+                size_t length = DEFLATE_MIN_MATCH;
+                while ( length < max_length && data[reference + length] == data[position + length] ) length++;
+                const DeflateCode &code = tables.literals[tables.length_symbols[length]];
+                writer.write(code.code, code.length);
+                if ( tables.length_extra_bits[length] > 0 ) writer.write(tables.length_extra[length], tables.length_extra_bits[length]);
+                write_distance(&writer, (uint32_t) (position - reference));
+                position += length;
+                continue;
+            }
+        }
+        const DeflateCode &code = tables.literals[data[position]];
+        writer.write(code.code, code.length);
+        position++;
+    }
+    const DeflateCode &end = tables.literals[DEFLATE_END_OF_BLOCK];
+    writer.write(end.code, end.length);
+    writer.flush();
+}
+
+static uint8_t paeth(int a, int b, int c)
+{
+    int p = a + b - c;
+    int pa = abs(p - a);
+    int pb = abs(p - b);
+    int pc = abs(p - c);
+    if ( pa <= pb && pa <= pc ) return a;
+    return pb <= pc ? b : c;
+}
+
+static void write_png_chunk(std::vector<uint8_t> *out, const char *type, const uint8_t *data, size_t size)
+{
+    write_be32(out, (uint32_t) size);
+    size_t start = out->size();
+    out->insert(out->end(), type, type + 4);
+    out->insert(out->end(), data, data + size);
+    write_be32(out, crc32(out->data() + start, out->size() - start));
+}
+
+static void encode_png(const uint8_t *rgba, int width, int height, std::vector<uint8_t> *out)
+{
+    // Each row is its filter type, then its filtered RGB bytes.
+    size_t row_size = 3 * (size_t) width;
+    std::vector<uint8_t> filtered((1 + row_size) * height);
+    std::vector<uint8_t> rows[2] = { std::vector<uint8_t>(row_size, 0), std::vector<uint8_t>(row_size) };
+    std::vector<uint8_t> candidates[3] = { std::vector<uint8_t>(row_size), std::vector<uint8_t>(row_size), std::vector<uint8_t>(row_size) };
+    for (int y = 0; y < height; y++)
+    {
+        const uint8_t *above = rows[y & 1].data();
+        uint8_t *row = rows[(y + 1) & 1].data();
+        for (int x = 0; x < width; x++)
+        {
+            for (int c = 0; c < 3; c++) row[3*x + c] = rgba[4 * ((size_t) y * width + x) + c];
+        }
+        uint32_t costs[3] = {};
+        for (size_t i = 0; i < row_size; i++)
+        {
+            int left = i >= 3 ? row[i - 3] : 0;
+            int up_left = i >= 3 ? above[i - 3] : 0;
+            uint8_t residuals[3] = { (uint8_t) (row[i] - left), (uint8_t) (row[i] - above[i]), (uint8_t) (row[i] - paeth(left, above[i], up_left)) };
+            for (int f = 0; f < 3; f++)
+            {
+                candidates[f][i] = residuals[f];
+                // Small signed residuals compress best.
+                costs[f] += residuals[f] < 128 ? residuals[f] : 256 - residuals[f];
+            }
+        }
+        int best = std::min_element(costs, costs + 3) - costs;
+        uint8_t *destination = filtered.data() + (1 + row_size) * y;
+        static const uint8_t filter_types[3] = { 1, 2, 4 }; // Sub, Up, Paeth
+        destination[0] = filter_types[best];
+        memcpy(destination + 1, candidates[best].data(), row_size);
+    }
+
+    out->clear();
+    out->insert(out->end(), { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' });
+    uint8_t header[13];
+    for (int i = 0; i < 4; i++)
+    {
+        header[i] = width >> (24 - 8 * i);
+        header[4 + i] = height >> (24 - 8 * i);
+    }
+    header[8] = 8;  // Bits per channel.
+    header[9] = 2;  // RGB
+    header[10] = 0; // Deflate
+    header[11] = 0; // Adaptive filtering
+    header[12] = 0; // Not interlaced
+    write_png_chunk(out, "IHDR", header, sizeof(header));
+    std::vector<uint8_t> zlib = { 0x78, 0x01 };
+    deflate_fixed(filtered.data(), filtered.size(), &zlib);
+    write_be32(&zlib, adler32(filtered.data(), filtered.size()));
+    write_png_chunk(out, "IDAT", zlib.data(), zlib.size());
+    write_png_chunk(out, "IEND", nullptr, 0);
+}
+
+void encode_image(ImageFileFormat format, const uint8_t *rgba, int width, int height, std::vector<uint8_t> *out)
+{
+    switch ( format )
+    {
+    case ImageFileFormat::PPM: encode_ppm(rgba, width, height, out); break;
+    case ImageFileFormat::QOI: encode_qoi(rgba, width, height, out); break;
+    case ImageFileFormat::PNG: encode_png(rgba, width, height, out); break;
+    }
+}
+
+const char *image_file_extension(ImageFileFormat format)
+{
+    switch ( format )
+    {
+    case ImageFileFormat::PPM: return "ppm";
+    case ImageFileFormat::QOI: return "qoi";
+    case ImageFileFormat::PNG: return "png";
+    }
+    return "";
+}
+
+bool write_ppm_image(const char *path, const uint8_t *rgba, int width, int height)
+{
+    std::vector<uint8_t> data;
+    encode_ppm(rgba, width, height, &data);
+    return write_image_file(path, data);
+}
+
+bool write_image_file(const char *path, const std::vector<uint8_t> &data)
+{
+    FILE *file = fopen(path, "wb");
+    if ( file == nullptr )
+    {
+        fprintf(stderr, C_RED "[%s] Failed to open \"%s\".\n" C_RESET, __func__, path);
+        return false;
+    }
+    bool written = fwrite(data.data(), 1, data.size(), file) == data.size();
+    written &= fclose(file) == 0;
+    if ( !written )
+    {
+        fprintf(stderr, C_RED "[%s] Failed to write \"%s\".\n" C_RESET, __func__, path);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,43 @@
+#ifndef RENDERER_IMAGE_FILE_H_
+#define RENDERER_IMAGE_FILE_H_
+/* image_file.h
+ *
+ * Images rendered on the CPU, as 8-bit sRGB RGBA rows from the top, and writing them to files.
+ *
+ * Rendered frames are opaque, so files store RGB. QOI ("The Quite OK Image Format", qoiformat.org)
+ * is the fastest to encode, compressing runs and small color changes between neighbouring pixels.
+ * PNG is read by more tools. Its rows are filtered with whichever of the Sub, Up and Paeth
+ * predictors leaves the smallest residuals, then deflated with fixed Huffman codes and greedy
+ * matches found through a hash table, trading some compression for encoding speed.
+ */
+#include <stdint.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+// Linear [0, 1] to an 8-bit sRGB value, clamping.
+inline uint8_t encode_srgb(float linear)
+{
+    linear = std::clamp(linear, 0.f, 1.f);
+    float encoded = linear <= 0.0031308f ? 12.92f * linear : 1.055f * powf(linear, 1 / 2.4f) - 0.055f;
+    return (uint8_t) lrintf(encoded * 255);
+}
+
+enum class ImageFileFormat
+{
+    PPM,
+    QOI,
+    PNG,
+};
+
+// Encode an RGBA image, dropping alpha, replacing the contents of out.
+void encode_image(ImageFileFormat format, const uint8_t *rgba, int width, int height, std::vector<uint8_t> *out);
+// The file name extension, without the dot.
+const char *image_file_extension(ImageFileFormat format);
+
+// Write an RGBA image as a binary PPM, dropping alpha.
+bool write_ppm_image(const char *path, const uint8_t *rgba, int width, int height);
+// Write encoded data to a file, printing an error if it fails.
+bool write_image_file(const char *path, const std::vector<uint8_t> &data);
+
+#endif // RENDERER_IMAGE_FILE_H_
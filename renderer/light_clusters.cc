@@ -0,0 +1,181 @@
+#include "renderer/light_clusters.h"
+#include "ansi_color.h"
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <algorithm>
+
+void LightClusters::set_projection(float fov_y, float aspect, float near_plane, float far_plane)
+{
+    if ( fov_y == m_fov_y && aspect == m_aspect && near_plane == m_near_plane && far_plane == m_far_plane ) return;
+    m_fov_y = fov_y;
+    m_aspect = aspect;
+    m_near_plane = near_plane;
+    m_far_plane = far_plane;
+
+    float log_ratio = logf(far_plane / near_plane);
+    m_z_scale = LIGHT_CLUSTERS_Z / log_ratio;
+    m_z_bias = -LIGHT_CLUSTERS_Z * logf(near_plane) / log_ratio;
+    for (int z = 0; z <= LIGHT_CLUSTERS_Z; z++)
+        m_slice_depths[z] = near_plane * powf(far_plane / near_plane, z / (float) LIGHT_CLUSTERS_Z);
+    float tan_half_fov = tanf(0.5f * fov_y);
+    for (int x = 0; x <= LIGHT_CLUSTERS_X; x++)
+        m_tile_x[x] = (-1 + 2 * x / (float) LIGHT_CLUSTERS_X) * tan_half_fov * aspect;
+    // Tiles count down from the top of the viewport.
+    for (int y = 0; y <= LIGHT_CLUSTERS_Y; y++)
+        m_tile_y[y] = (1 - 2 * y / (float) LIGHT_CLUSTERS_Y) * tan_half_fov;
+
+    for (int z = 0; z < LIGHT_CLUSTERS_Z; z++)
+    {
+        float near_depth = m_slice_depths[z];
+        float far_depth = m_slice_depths[z + 1];
+        for (int y = 0; y < LIGHT_CLUSTERS_Y; y++)
+        {
+            for (int x = 0; x < LIGHT_CLUSTERS_X; x++)
+            {
+                // The cluster is a frustum piece, bounded by its corners at both depths.
+                Bounds &bounds = m_bounds[x + LIGHT_CLUSTERS_X * (y + LIGHT_CLUSTERS_Y * z)];
+                bounds.min.x = std::min(m_tile_x[x] * near_depth, m_tile_x[x] * far_depth);
+                bounds.max.x = std::max(m_tile_x[x + 1] * near_depth, m_tile_x[x + 1] * far_depth);
+                bounds.min.y = std::min(m_tile_y[y + 1] * near_depth, m_tile_y[y + 1] * far_depth);
+                bounds.max.y = std::max(m_tile_y[y] * near_depth, m_tile_y[y] * far_depth);
+                bounds.min.z = near_depth;
+                bounds.max.z = far_depth;
+            }
+        }
+    }
+}
+
+// The light's tiles in one slice, inclusive.
+struct TileRect
+{
+    uint8_t min_x;
+    uint8_t max_x;
+    uint8_t min_y;
+    uint8_t max_y;
+};
+
+struct SliceResult
+{
+    uint32_t *light_indices;
+    uint32_t num_light_indices;
+    uint32_t counts[LIGHT_CLUSTERS_X * LIGHT_CLUSTERS_Y];
+};
+
+static int tile_index(float coordinate, const float *edges, int num_tiles)
+{
+    // Edges are at unit depth, and may be descending. Clamped to the grid, so lights past the
+    // screen edges still cover the border tiles.
+    float t = (coordinate - edges[0]) / (edges[num_tiles] - edges[0]);
+    return std::clamp((int) floorf(t * num_tiles), 0, num_tiles - 1);
+}
+
+bool LightClusters::assign(JobSystem *jobs,
+                           FrameArenas *arenas,
+                           const LightClusterLights &lights,
+                           FrameRingBuffer *ring,
+                           uint32_t *clusters_offset,
+                           uint32_t *light_indices_offset)
+{
+    SliceResult slices[LIGHT_CLUSTERS_Z];
+    jobs->parallel_for(LIGHT_CLUSTERS_Z, 1, [&](uint32_t begin, uint32_t end) {
+        LinearArena *arena = arenas->arena(jobs->worker_index());
+        for (uint32_t z = begin; z < end; z++)
+        {
+            SliceResult &slice = slices[z];
+            float near_depth = m_slice_depths[z];
+            float far_depth = m_slice_depths[z + 1];
+
+            // Gather the lights reaching the slice, with the tiles they cover.
+            ArenaVector<uint32_t> slice_lights(arena);
+            ArenaVector<TileRect> rects(arena);
+            slice_lights.reserve(lights.num_lights);
+            rects.reserve(lights.num_lights);
+            for (uint32_t i = 0; i < lights.num_lights; i++)
+            {
+                float x = lights.x[i];
+                float y = lights.y[i];
+                float depth = lights.depth[i];
+                float radius = lights.radius[i];
+                if ( depth + radius < near_depth || depth - radius > far_depth ) continue;
+                // x / depth is monotonic in each, so the extents projected to unit depth
+                // are at the nearest and farthest depths of the sphere within the slice.
+                float min_depth = std::max(depth - radius, near_depth);
+                float max_depth = std::min(depth + radius, far_depth);
+                float min_x = std::min((x - radius) / min_depth, (x - radius) / max_depth);
+                float max_x = std::max((x + radius) / min_depth, (x + radius) / max_depth);
+                float min_y = std::min((y - radius) / min_depth, (y - radius) / max_depth);
+                float max_y = std::max((y + radius) / min_depth, (y + radius) / max_depth);
+                if ( max_x < m_tile_x[0] || min_x > m_tile_x[LIGHT_CLUSTERS_X] ) continue;
+                if ( max_y < m_tile_y[LIGHT_CLUSTERS_Y] || min_y > m_tile_y[0] ) continue;
+                TileRect rect;
+                rect.min_x = tile_index(min_x, m_tile_x, LIGHT_CLUSTERS_X);
+                rect.max_x = tile_index(max_x, m_tile_x, LIGHT_CLUSTERS_X);
+                // Tile y counts down, so the top of the sphere is the lowest tile.
+                rect.min_y = tile_index(max_y, m_tile_y, LIGHT_CLUSTERS_Y);
+                rect.max_y = tile_index(min_y, m_tile_y, LIGHT_CLUSTERS_Y);
+                slice_lights.push_back(i);
+                rects.push_back(rect);
+            }
+
+            // Test each candidate cluster exactly.
+            ArenaVector<uint32_t> light_indices(arena);
+            light_indices.reserve(4 * slice_lights.size());
+            for (int y = 0; y < LIGHT_CLUSTERS_Y; y++)
+            {
+                for (int x = 0; x < LIGHT_CLUSTERS_X; x++)
+                {
+                    const Bounds &bounds = m_bounds[x + LIGHT_CLUSTERS_X * (y + LIGHT_CLUSTERS_Y * z)];
+                    uint32_t count = 0;
+                    for (uint32_t j = 0; j < slice_lights.size(); j++)
+                    {
+                        const TileRect &rect = rects[j];
+                        if ( x < rect.min_x || x > rect.max_x || y < rect.min_y || y > rect.max_y ) continue;
+                        uint32_t i = slice_lights[j];
+                        float dx = std::max({bounds.min.x - lights.x[i], 0.f, lights.x[i] - bounds.max.x});
+                        float dy = std::max({bounds.min.y - lights.y[i], 0.f, lights.y[i] - bounds.max.y});
+                        float dz = std::max({bounds.min.z - lights.depth[i], 0.f, lights.depth[i] - bounds.max.z});
+                        if ( dx*dx + dy*dy + dz*dz > lights.radius[i] * lights.radius[i] ) continue;
+                        light_indices.push_back(i);
+                        count++;
+                    }
+                    slice.counts[x + LIGHT_CLUSTERS_X * y] = count;
+                }
+            }
+            // Copied out, as the vector gives its memory back to the arena when it goes out of scope.
+            slice.num_light_indices = light_indices.size();
+            slice.light_indices = (uint32_t *) arena->allocate(light_indices.size() * sizeof(uint32_t), alignof(uint32_t));
+            memcpy(slice.light_indices, light_indices.data(), light_indices.size() * sizeof(uint32_t));
+        }
+    });
+
+    uint32_t total = 0;
+    for (const SliceResult &slice : slices) total += slice.num_light_indices;
+    if ( total > LIGHT_CLUSTERS_MAX_LIGHT_INDICES )
+    {
+        fprintf(stderr, C_YELLOW "[%s] %u cluster light indices, only %u are kept.\n" C_RESET, __func__, total, LIGHT_CLUSTERS_MAX_LIGHT_INDICES);
+        total = LIGHT_CLUSTERS_MAX_LIGHT_INDICES;
+    }
+    GpuLightCluster *clusters = ring->allocate<GpuLightCluster>(NUM_LIGHT_CLUSTERS, clusters_offset);
+    uint32_t *light_indices = ring->allocate<uint32_t>(std::max(total, 1u), light_indices_offset);
+    if ( clusters == nullptr || light_indices == nullptr ) return false;
+
+    // Lay out the slices' lists one after another, writing sequentially.
+    uint32_t offset = 0;
+    for (int z = 0; z < LIGHT_CLUSTERS_Z; z++)
+    {
+        const SliceResult &slice = slices[z];
+        uint32_t slice_offset = offset;
+        for (int c = 0; c < LIGHT_CLUSTERS_X * LIGHT_CLUSTERS_Y; c++)
+        {
+            GpuLightCluster cluster;
+            cluster.offset = offset;
+            cluster.count = std::min(slice.counts[c], total - offset);
+            clusters[c + LIGHT_CLUSTERS_X * LIGHT_CLUSTERS_Y * z] = cluster;
+            offset += cluster.count;
+        }
+        memcpy(&light_indices[slice_offset], slice.light_indices, (offset - slice_offset) * sizeof(uint32_t));
+    }
+    return true;
+}
@@ -0,0 +1,86 @@
+#ifndef RENDERER_LIGHT_CLUSTERS_H_
+#define RENDERER_LIGHT_CLUSTERS_H_
+/* light_clusters.h
+ *
+ * Clustered assignment of point lights to the view frustum ("Clustered Deferred and Forward
+ * Shading", Olsson et al.).
+ *
+ * The frustum is divided into a grid of clusters (froxels): screen tiles, each split into
+ * depth slices spaced exponentially between the near and far planes. Each frame, every light's
+ * sphere is tested against the view-space bounds of the clusters it may touch, giving each
+ * cluster a list of light indices, so shading only evaluates the lights of its fragment's cluster.
+ *
+ * Assignment runs on the CPU, one job per depth slice. A light only visits the tiles covered by
+ * its bounds at that slice, then each candidate cluster is tested exactly against the sphere.
+ * The results are written to the frame ring buffer as a GpuLightCluster per cluster, indexed by
+ *     x + LIGHT_CLUSTERS_X * (y + LIGHT_CLUSTERS_Y * z)
+ * where x and y are the tile from the top left of the viewport and
+ *     z = floor(log(view depth) * z_scale() + z_bias())
+ * and a shared array of 32-bit light indices that the clusters' ranges point into.
+ */
+#include "engine/jobs/job_system.h"
+#include "engine/memory/frame_arena.h"
+#include "renderer/frame_ring_buffer.h"
+#include "renderer/transform.h"
+#include <stdint.h>
+
+#define LIGHT_CLUSTERS_X 16
+#define LIGHT_CLUSTERS_Y 9
+#define LIGHT_CLUSTERS_Z 24
+#define NUM_LIGHT_CLUSTERS (LIGHT_CLUSTERS_X * LIGHT_CLUSTERS_Y * LIGHT_CLUSTERS_Z)
+// Light indices over all clusters per frame. Beyond this, lights are left out of clusters.
+#define LIGHT_CLUSTERS_MAX_LIGHT_INDICES (1u << 20)
+
+struct GpuLightCluster
+{
+    uint32_t offset; // Into the light index array.
+    uint32_t count;
+};
+
+// View-space light spheres, as separate arrays for the slice loops. Depth is the distance
+// in front of the camera, -z in view space.
+struct LightClusterLights
+{
+    uint32_t num_lights;
+    const float *x;
+    const float *y;
+    const float *depth;
+    const float *radius;
+};
+
+class LightClusters
+{
+public:
+    // Recompute the cluster bounds, if the projection has changed.
+    void set_projection(float fov_y, float aspect, float near_plane, float far_plane);
+    float z_scale() const { return m_z_scale; }
+    float z_bias() const { return m_z_bias; }
+
+    // Assign lights to clusters, allocating the results from the ring buffer. Temporary lists are
+    // allocated from the calling workers' frame arenas. Returns false if the ring buffer is full.
+    bool assign(JobSystem *jobs,
+                FrameArenas *arenas,
+                const LightClusterLights &lights,
+                FrameRingBuffer *ring,
+                uint32_t *clusters_offset,
+                uint32_t *light_indices_offset);
+private:
+    struct Bounds
+    {
+        vec3 min; // x, y, depth
+        vec3 max;
+    };
+    Bounds m_bounds[NUM_LIGHT_CLUSTERS];
+    float m_slice_depths[LIGHT_CLUSTERS_Z + 1];
+    // Tile edges at unit depth.
+    float m_tile_x[LIGHT_CLUSTERS_X + 1];
+    float m_tile_y[LIGHT_CLUSTERS_Y + 1];
+    float m_z_scale;
+    float m_z_bias;
+    float m_fov_y = 0;
+    float m_aspect = 0;
+    float m_near_plane = 0;
+    float m_far_plane = 0;
+};
+
+#endif // RENDERER_LIGHT_CLUSTERS_H_
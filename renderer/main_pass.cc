@@ -0,0 +1,366 @@
+#include "renderer/main_pass.h"
+#include "ansi_color.h"
+#include <stdio.h>
+#include <assert.h>
+#include <algorithm>
+
+// The color target is cleared and left to be blitted from, and the depth target is cleared and
+// discarded. The ID target is cleared and left to be copied from if its IDs are stored, and
+// otherwise discarded, which does not affect compatibility. With the pre-pass, subpass 0 writes
+// depth only and subpass 1 reads it.
+static VkRenderPass create_render_pass(VulkanSystem *vk, bool prepass, bool store_ids)
+{
+    VkAttachmentDescription attachments[3] = {};
+    attachments[0].format = MAIN_PASS_COLOR_FORMAT;
+    attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
+    attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    attachments[0].finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    attachments[1].format = MAIN_PASS_DEPTH_FORMAT;
+    attachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
+    attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachments[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    attachments[2].format = MAIN_PASS_ID_FORMAT;
+    attachments[2].samples = VK_SAMPLE_COUNT_1_BIT;
+    attachments[2].loadOp = store_ids ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachments[2].storeOp = store_ids ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachments[2].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachments[2].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachments[2].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    attachments[2].finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    // The shading pipelines' outputs 0 and 1.
+    VkAttachmentReference color_references[2] = {
+        { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL },
+        { 2, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL },
+    };
+    VkAttachmentReference depth_reference = { 1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+    // Shading after the pre-pass only tests depth.
+    VkAttachmentReference depth_read_reference = { 1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL };
+
+    VkSubpassDescription subpasses[2] = {};
+    subpasses[0].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpasses[0].pDepthStencilAttachment = &depth_reference;
+    if ( prepass )
+    {
+        subpasses[1].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpasses[1].colorAttachmentCount = 2;
+        subpasses[1].pColorAttachments = color_references;
+        subpasses[1].pDepthStencilAttachment = &depth_read_reference;
+    }
+    else
+    {
+        subpasses[0].colorAttachmentCount = 2;
+        subpasses[0].pColorAttachments = color_references;
+    }
+
+    uint32_t last_subpass = prepass ? 1 : 0;
+    VkSubpassDependency dependencies[3] = {};
+    // After the previous frame's depth tests, and blit and copy from the color and ID targets.
+    dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[0].dstSubpass = 0;
+    dependencies[0].srcStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    dependencies[0].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    // Before the blit and the copy of picked IDs.
+    dependencies[1].srcSubpass = last_subpass;
+    dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    dependencies[1].dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    dependencies[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    dependencies[2].srcSubpass = 0;
+    dependencies[2].dstSubpass = 1;
+    dependencies[2].srcStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    dependencies[2].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    dependencies[2].dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    dependencies[2].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+    dependencies[2].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+
+    VkRenderPassCreateInfo info = { VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO };
+    info.attachmentCount = 3;
+    info.pAttachments = attachments;
+    info.subpassCount = prepass ? 2 : 1;
+    info.pSubpasses = subpasses;
+    info.dependencyCount = prepass ? 3 : 2;
+    info.pDependencies = dependencies;
+    VkRenderPass render_pass;
+    VK_SUCCEED( vkCreateRenderPass(vk->device, &info, nullptr, &render_pass) );
+    return render_pass;
+}
+
+bool MainPass::init(VulkanSystem *vk, uint32_t num_frames)
+{
+    assert(num_frames <= MAIN_PASS_MAX_FRAMES);
+    m_vk = vk;
+    m_num_frames = num_frames;
+    m_render_pass = create_render_pass(vk, false, false);
+    m_prepass_render_pass = create_render_pass(vk, true, false);
+    m_id_render_pass = create_render_pass(vk, false, true);
+    m_prepass_id_render_pass = create_render_pass(vk, true, true);
+    {
+        VkQueryPoolCreateInfo info = { VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+        info.queryType = VK_QUERY_TYPE_OCCLUSION;
+        info.queryCount = num_frames;
+        VK_SUCCEED( vkCreateQueryPool(vk->device, &info, nullptr, &m_query_pool) );
+    }
+    for (uint32_t i = 0; i < MAIN_PASS_MAX_FRAMES; i++) m_query_pending[i] = false;
+    // Imprecise queries may only tell whether any sample passed.
+    VkPhysicalDeviceFeatures features;
+    vkGetPhysicalDeviceFeatures(vk->physical_device, &features);
+    m_precise_queries = features.occlusionQueryPrecise;
+    if ( !m_precise_queries )
+    {
+        printf(C_YELLOW "Main pass: no precise occlusion queries, overdraw is not measured and the automatic depth pre-pass stays off.\n" C_RESET);
+    }
+    return true;
+}
+
+void MainPass::destroy()
+{
+    destroy_targets();
+    vkDestroyQueryPool(m_vk->device, m_query_pool, nullptr);
+    vkDestroyRenderPass(m_vk->device, m_render_pass, nullptr);
+    vkDestroyRenderPass(m_vk->device, m_prepass_render_pass, nullptr);
+    vkDestroyRenderPass(m_vk->device, m_id_render_pass, nullptr);
+    vkDestroyRenderPass(m_vk->device, m_prepass_id_render_pass, nullptr);
+}
+
+bool MainPass::create_target(Target *target, VkFormat format, VkImageUsageFlags usage, VkImageAspectFlags aspect)
+{
+    {
+        VkImageCreateInfo info = { VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
+        info.imageType = VK_IMAGE_TYPE_2D;
+        info.format = format;
+        info.extent = { m_width, m_height, 1 };
+        info.mipLevels = 1;
+        info.arrayLayers = 1;
+        info.samples = VK_SAMPLE_COUNT_1_BIT;
+        info.tiling = VK_IMAGE_TILING_OPTIMAL;
+        info.usage = usage;
+        info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        if ( vkCreateImage(m_vk->device, &info, nullptr, &target->image) != VK_SUCCESS ) return false;
+    }
+    {
+        VkMemoryRequirements requirements;
+        vkGetImageMemoryRequirements(m_vk->device, target->image, &requirements);
+        uint32_t memory_type = VulkanFindMemoryType(m_vk->physical_device, requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        VkMemoryAllocateInfo info = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
+        info.allocationSize = requirements.size;
+        info.memoryTypeIndex = memory_type;
+        if ( memory_type == UINT32_MAX || vkAllocateMemory(m_vk->device, &info, nullptr, &target->memory) != VK_SUCCESS )
+        {
+            vkDestroyImage(m_vk->device, target->image, nullptr);
+            return false;
+        }
+        VK_SUCCEED( vkBindImageMemory(m_vk->device, target->image, target->memory, 0) );
+    }
+    {
+        VkImageViewCreateInfo info = { VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
+        info.image = target->image;
+        info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        info.format = format;
+        info.subresourceRange = { aspect, 0, 1, 0, 1 };
+        VK_SUCCEED( vkCreateImageView(m_vk->device, &info, nullptr, &target->view) );
+    }
+    return true;
+}
+
+void MainPass::destroy_target(Target *target)
+{
+    vkDestroyImageView(m_vk->device, target->view, nullptr);
+    vkDestroyImage(m_vk->device, target->image, nullptr);
+    vkFreeMemory(m_vk->device, target->memory, nullptr);
+}
+
+void MainPass::destroy_targets()
+{
+    if ( !m_has_targets ) return;
+    vkDestroyFramebuffer(m_vk->device, m_framebuffer, nullptr);
+    vkDestroyFramebuffer(m_vk->device, m_prepass_framebuffer, nullptr);
+    destroy_target(&m_color);
+    destroy_target(&m_depth);
+    destroy_target(&m_ids);
+    m_has_targets = false;
+}
+
+bool MainPass::resize(uint32_t width, uint32_t height)
+{
+    // The previous targets may still be in use by frames in flight.
+    VK_SUCCEED( vkDeviceWaitIdle(m_vk->device) );
+    destroy_targets();
+    m_width = width;
+    m_height = height;
+    if ( !create_target(&m_color, MAIN_PASS_COLOR_FORMAT,
+                        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_IMAGE_ASPECT_COLOR_BIT) )
+    {
+        fprintf(stderr, C_RED "[%s] Failed to create the %ux%u color target.\n" C_RESET, __func__, width, height);
+        return false;
+    }
+    if ( !create_target(&m_depth, MAIN_PASS_DEPTH_FORMAT, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_IMAGE_ASPECT_DEPTH_BIT) )
+    {
+        fprintf(stderr, C_RED "[%s] Failed to create the %ux%u depth target.\n" C_RESET, __func__, width, height);
+        destroy_target(&m_color);
+        return false;
+    }
+    if ( !create_target(&m_ids, MAIN_PASS_ID_FORMAT,
+                        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_IMAGE_ASPECT_COLOR_BIT) )
+    {
+        fprintf(stderr, C_RED "[%s] Failed to create the %ux%u ID target.\n" C_RESET, __func__, width, height);
+        destroy_target(&m_color);
+        destroy_target(&m_depth);
+        return false;
+    }
+    // Framebuffers are only compatible with render passes with the same subpasses. The render
+    // passes storing IDs are compatible with those that don't.
+    VkImageView views[3] = { m_color.view, m_depth.view, m_ids.view };
+    VkFramebufferCreateInfo info = { VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO };
+    info.attachmentCount = 3;
+    info.pAttachments = views;
+    info.width = width;
+    info.height = height;
+    info.layers = 1;
+    info.renderPass = m_render_pass;
+    VK_SUCCEED( vkCreateFramebuffer(m_vk->device, &info, nullptr, &m_framebuffer) );
+    info.renderPass = m_prepass_render_pass;
+    VK_SUCCEED( vkCreateFramebuffer(m_vk->device, &info, nullptr, &m_prepass_framebuffer) );
+    m_has_targets = true;
+    return true;
+}
+
+void MainPass::begin_frame(uint32_t frame)
+{
+    assert(frame < m_num_frames);
+    m_frame = frame;
+    if ( m_query_pending[frame] )
+    {
+        uint64_t samples;
+        VkResult result = vkGetQueryPoolResults(m_vk->device, m_query_pool, frame, 1,
+                                                sizeof(samples), &samples, sizeof(samples), VK_QUERY_RESULT_64_BIT);
+        if ( result == VK_SUCCESS && m_query_pixels[frame] > 0 )
+        {
+            float overdraw = (float) ((double) samples / m_query_pixels[frame]);
+            if ( m_overdraw == 0 ) m_overdraw = overdraw;
+            else m_overdraw += MAIN_PASS_OVERDRAW_SMOOTHING * (overdraw - m_overdraw);
+        }
+        m_query_pending[frame] = false;
+    }
+    switch ( m_mode )
+    {
+    case DepthPrepassMode::Off:
+        m_prepass = false;
+        break;
+    case DepthPrepassMode::On:
+        m_prepass = true;
+        break;
+    case DepthPrepassMode::Auto:
+        if ( !m_precise_queries ) m_prepass = false;
+        else if ( !m_prepass && m_overdraw > MAIN_PASS_PREPASS_ON_OVERDRAW ) m_prepass = true;
+        else if ( m_prepass && m_overdraw < MAIN_PASS_PREPASS_OFF_OVERDRAW ) m_prepass = false;
+        break;
+    }
+}
+
+uint32_t MainPass::subpass(bool prepass, MainPassStage stage)
+{
+    assert(prepass || stage == MainPassStage::Shading);
+    return prepass && stage == MainPassStage::Shading ? 1 : 0;
+}
+
+VkPipelineDepthStencilStateCreateInfo MainPass::depth_stencil_state(bool prepass, MainPassStage stage)
+{
+    VkPipelineDepthStencilStateCreateInfo info = { VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO };
+    info.depthTestEnable = VK_TRUE;
+    // Without writes, or discards in the shaders, EQUAL lets the hardware reject hidden
+    // fragments before shading them.
+    bool shading_after_prepass = prepass && stage == MainPassStage::Shading;
+    info.depthWriteEnable = shading_after_prepass ? VK_FALSE : VK_TRUE;
+    info.depthCompareOp = shading_after_prepass ? VK_COMPARE_OP_EQUAL : VK_COMPARE_OP_LESS;
+    return info;
+}
+
+void MainPass::record(VkCommandBuffer command_buffer, uint32_t swap_chain_image, VkExtent2D render_extent, bool store_ids, const DrawOpaque &draw)
+{
+    assert(m_has_targets && swap_chain_image < m_vk->swap_chain_num_images);
+    assert(render_extent.width > 0 && render_extent.width <= m_width && render_extent.height > 0 && render_extent.height <= m_height);
+    bool measure = m_precise_queries;
+    if ( measure ) vkCmdResetQueryPool(command_buffer, m_query_pool, m_frame, 1);
+
+    VkClearValue clear_values[3] = {};
+    clear_values[1].depthStencil = { 1.f, 0 };
+    clear_values[2].color.uint32[0] = MAIN_PASS_ID_NULL;
+    VkRenderPassBeginInfo begin_info = { VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO };
+    if ( store_ids ) begin_info.renderPass = m_prepass ? m_prepass_id_render_pass : m_id_render_pass;
+    else begin_info.renderPass = render_pass(m_prepass);
+    begin_info.framebuffer = m_prepass ? m_prepass_framebuffer : m_framebuffer;
+    begin_info.renderArea = { { 0, 0 }, render_extent };
+    begin_info.clearValueCount = 3;
+    begin_info.pClearValues = clear_values;
+    vkCmdBeginRenderPass(command_buffer, &begin_info, VK_SUBPASS_CONTENTS_INLINE);
+    VkViewport viewport = { 0, 0, (float) render_extent.width, (float) render_extent.height, 0, 1 };
+    VkRect2D scissor = { { 0, 0 }, render_extent };
+    vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+    vkCmdSetScissor(command_buffer, 0, 1, &scissor);
+
+    if ( measure ) vkCmdBeginQuery(command_buffer, m_query_pool, m_frame, VK_QUERY_CONTROL_PRECISE_BIT);
+    if ( m_prepass )
+    {
+        draw(command_buffer, MainPassStage::Depth);
+        if ( measure ) vkCmdEndQuery(command_buffer, m_query_pool, m_frame);
+        vkCmdNextSubpass(command_buffer, VK_SUBPASS_CONTENTS_INLINE);
+        draw(command_buffer, MainPassStage::Shading);
+    }
+    else
+    {
+        draw(command_buffer, MainPassStage::Shading);
+        if ( measure ) vkCmdEndQuery(command_buffer, m_query_pool, m_frame);
+    }
+    vkCmdEndRenderPass(command_buffer);
+    if ( measure )
+    {
+        m_query_pending[m_frame] = true;
+        m_query_pixels[m_frame] = render_extent.width * render_extent.height;
+    }
+
+    // Scale the render extent to the whole swap chain image.
+    VkImage swap_chain = m_vk->swap_chain_images[swap_chain_image];
+    VkImageMemoryBarrier barrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = swap_chain;
+    barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+    vkCmdPipelineBarrier(command_buffer,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                         0, nullptr, 0, nullptr, 1, &barrier);
+    VkImageBlit blit = {};
+    blit.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+    blit.srcOffsets[1] = { (int32_t) render_extent.width, (int32_t) render_extent.height, 1 };
+    blit.dstSubresource = blit.srcSubresource;
+    // The platform recreates the swap chain to follow the framebuffer (see DisplayRefreshEvent).
+    assert(m_width == m_vk->swap_chain_extent.width && m_height == m_vk->swap_chain_extent.height);
+    blit.dstOffsets[1] = { (int32_t) m_width, (int32_t) m_height, 1 };
+    vkCmdBlitImage(command_buffer,
+                   m_color.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                   swap_chain, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                   1, &blit, VK_FILTER_LINEAR);
+    // Presentation waits on a semaphore, so the layout transition needs no later stage.
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = 0;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    vkCmdPipelineBarrier(command_buffer,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+                         0, nullptr, 0, nullptr, 1, &barrier);
+}
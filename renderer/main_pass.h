@@ -0,0 +1,137 @@
+#ifndef RENDERER_MAIN_PASS_H_
+#define RENDERER_MAIN_PASS_H_
+/* main_pass.h
+ *
+ * The render pass drawing the view into a swap chain image, with an optional depth pre-pass.
+ *
+ * The view is drawn into color and depth targets the size of the framebuffer, over a render
+ * extent that may be smaller (see dynamic_resolution.h), which is then scaled to the swap chain
+ * image with a linear blit. The targets are not reallocated when the render extent changes.
+ *
+ * With the pre-pass, the render pass has two subpasses. The first draws the opaque geometry to
+ * depth only, with pipelines that fetch only vertex positions and have no fragment shader. The
+ * second draws it again with shading, testing depth EQUAL without writing it, so that each pixel
+ * is shaded once, by the surface the pre-pass found nearest. Without the pre-pass, there is one
+ * subpass that shades as it tests depth LESS. The pre-pass transforms the geometry twice, which
+ * pays off when most shaded fragments would otherwise be hidden by later ones.
+ *
+ * Overdraw is measured with a precise occlusion query around the first pass that tests depth
+ * LESS, which is the pre-pass or the shading pass, with the same draws in the same order. It
+ * counts the samples passing the depth test, which without the pre-pass are the fragments shaded.
+ * The count per pixel of the view is read back when the frame slot is reused, and smoothed. In
+ * Auto mode, the pre-pass is turned on when the overdraw rises above
+ * MAIN_PASS_PREPASS_ON_OVERDRAW, and off when it falls below MAIN_PASS_PREPASS_OFF_OVERDRAW, so
+ * that a scene near the threshold does not switch every frame.
+ *
+ * The shading pipelines also write an ID for each fragment to the ID target: gl_InstanceIndex
+ * plus one, MAIN_PASS_ID_NULL where nothing was drawn. The IDs are only stored in frames
+ * that read some of them back (see object_picker.h). Otherwise the render pass discards them,
+ * which on tiled GPUs keeps them from ever being written to memory.
+ *
+ * Pipelines are built against a render pass and subpass, so the shading pipelines come in two
+ * variants, see render_pass and subpass, and draw_pipelines.h.
+ */
+#include "engine/platform/vk.h"
+#include <stdint.h>
+#include <functional>
+
+// The platform's swap chain format, so that the blit to it is a copy at full resolution.
+#define MAIN_PASS_COLOR_FORMAT VK_FORMAT_B8G8R8A8_SRGB
+#define MAIN_PASS_DEPTH_FORMAT VK_FORMAT_D32_SFLOAT
+#define MAIN_PASS_ID_FORMAT VK_FORMAT_R32_UINT
+#define MAIN_PASS_ID_NULL 0
+#define MAIN_PASS_MAX_FRAMES 4
+// Depth-passing samples per pixel.
+#define MAIN_PASS_PREPASS_ON_OVERDRAW 2.5f
+#define MAIN_PASS_PREPASS_OFF_OVERDRAW 1.75f
+// The weight of each frame's measurement in the smoothed overdraw.
+#define MAIN_PASS_OVERDRAW_SMOOTHING 0.1f
+
+enum class DepthPrepassMode
+{
+    Off,
+    On,
+    // On while the measured overdraw is high. Off if the device lacks precise occlusion queries.
+    Auto,
+};
+
+enum class MainPassStage
+{
+    // The pre-pass: positions only and no fragment shader, testing depth LESS and writing it.
+    Depth,
+    // Testing depth EQUAL without writing it after the pre-pass, or LESS and writing it without.
+    Shading,
+};
+
+class MainPass
+{
+public:
+    bool init(VulkanSystem *vk, uint32_t num_frames);
+    void destroy();
+    // Create the targets for a framebuffer size, the largest render extent.
+    bool resize(uint32_t width, uint32_t height);
+    uint32_t width() const { return m_width; }
+    uint32_t height() const { return m_height; }
+
+    // Read back the overdraw measured in the frame's previous use, whose GPU work has completed,
+    // and choose whether this frame has a pre-pass.
+    void begin_frame(uint32_t frame);
+    void set_mode(DepthPrepassMode mode) { m_mode = mode; }
+    bool prepass() const { return m_prepass; }
+    // Smoothed, 0 until measured.
+    float overdraw() const { return m_overdraw; }
+
+    // What the pipelines drawing a stage are built with, for the render pass with or without the
+    // pre-pass. The shading stage has two color outputs, the color and the ID.
+    VkRenderPass render_pass(bool prepass) const { return prepass ? m_prepass_render_pass : m_render_pass; }
+    static uint32_t subpass(bool prepass, MainPassStage stage);
+    static VkPipelineDepthStencilStateCreateInfo depth_stencil_state(bool prepass, MainPassStage stage);
+
+    // Record the render pass over the render extent, clearing it, then its scaling into a swap
+    // chain image, which is left for presentation. The swap chain image is first written by a
+    // transfer, so its acquisition should be waited on at VK_PIPELINE_STAGE_TRANSFER_BIT. draw
+    // records the opaque draws of a stage: the Depth stage if this frame has a pre-pass, then the
+    // Shading stage. The viewport and scissor are set to the render extent. With store_ids, the
+    // ID target is left in VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL to be copied from.
+    typedef std::function<void(VkCommandBuffer command_buffer, MainPassStage stage)> DrawOpaque;
+    void record(VkCommandBuffer command_buffer, uint32_t swap_chain_image, VkExtent2D render_extent, bool store_ids, const DrawOpaque &draw);
+    VkImage id_image() const { return m_ids.image; }
+private:
+    struct Target
+    {
+        VkImage image;
+        VkDeviceMemory memory;
+        VkImageView view;
+    };
+    bool create_target(Target *target, VkFormat format, VkImageUsageFlags usage, VkImageAspectFlags aspect);
+    void destroy_target(Target *target);
+    void destroy_targets();
+
+    VulkanSystem *m_vk;
+    uint32_t m_num_frames;
+    uint32_t m_frame = 0;
+    VkRenderPass m_render_pass;
+    VkRenderPass m_prepass_render_pass;
+    // Compatible with the above, storing the IDs.
+    VkRenderPass m_id_render_pass;
+    VkRenderPass m_prepass_id_render_pass;
+    uint32_t m_width = 0;
+    uint32_t m_height = 0;
+    bool m_has_targets = false;
+    Target m_color;
+    Target m_depth;
+    Target m_ids;
+    VkFramebuffer m_framebuffer;
+    VkFramebuffer m_prepass_framebuffer;
+
+    DepthPrepassMode m_mode = DepthPrepassMode::Auto;
+    bool m_prepass = false;
+    bool m_precise_queries;
+    // A query per frame slot, pending until read back.
+    VkQueryPool m_query_pool;
+    bool m_query_pending[MAIN_PASS_MAX_FRAMES];
+    uint32_t m_query_pixels[MAIN_PASS_MAX_FRAMES];
+    float m_overdraw = 0;
+};
+
+#endif // RENDERER_MAIN_PASS_H_
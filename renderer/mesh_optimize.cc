@@ -0,0 +1,354 @@
+#include "renderer/mesh_optimize.h"
+#include <math.h>
+#include <string.h>
+#include <assert.h>
+#include <vector>
+#include <algorithm>
+
+VertexCacheStatistics analyze_vertex_cache(const uint32_t *indices, uint32_t num_indices, uint32_t num_vertices, uint32_t cache_size)
+{
+    // FIFO cache. A vertex is in the cache if it was inserted less than cache_size insertions ago.
+    std::vector<uint32_t> inserted_at(num_vertices, 0);
+    uint32_t insertions = 0;
+    for (uint32_t i = 0; i < num_indices; i++)
+    {
+        uint32_t v = indices[i];
+        if ( inserted_at[v] == 0 || insertions - inserted_at[v] >= cache_size )
+        {
+            insertions++;
+            inserted_at[v] = insertions;
+        }
+    }
+    VertexCacheStatistics stats;
+    stats.vertices_transformed = insertions;
+    stats.acmr = num_indices == 0 ? 0 : insertions / (num_indices / 3.f);
+    stats.atvr = num_vertices == 0 ? 0 : insertions / (float) num_vertices;
+    return stats;
+}
+
+VertexFetchStatistics analyze_vertex_fetch(const uint32_t *indices, uint32_t num_indices, uint32_t num_vertices, uint32_t vertex_size)
+{
+    const uint32_t line_size = 64;
+    const uint32_t num_lines = 256;
+    uint32_t lines[num_lines];
+    for (uint32_t i = 0; i < num_lines; i++) lines[i] = UINT32_MAX;
+
+    uint32_t bytes_fetched = 0;
+    for (uint32_t i = 0; i < num_indices; i++)
+    {
+        uint32_t start = indices[i] * vertex_size;
+        uint32_t end = start + vertex_size;
+        for (uint32_t line = start / line_size; line <= (end - 1) / line_size; line++)
+        {
+            uint32_t slot = line % num_lines;
+            if ( lines[slot] != line )
+            {
+                lines[slot] = line;
+                bytes_fetched += line_size;
+            }
+        }
+    }
+    VertexFetchStatistics stats;
+    stats.bytes_fetched = bytes_fetched;
+    stats.overfetch = num_vertices == 0 ? 0 : bytes_fetched / (float) (num_vertices * vertex_size);
+    return stats;
+}
+
+/*
+ * Forsyth's vertex cache optimization.
+ * Triangles are emitted greedily by score, where a triangle's score is the sum of its vertices'
+ * scores. Vertices score highly when they are recently used (in a simulated LRU cache) and when
+ * few unemitted triangles still reference them, so that they can leave the cache.
+ */
+#define FORSYTH_CACHE_SIZE 32
+static const float forsyth_cache_decay_power = 1.5f;
+static const float forsyth_last_triangle_score = 0.75f;
+static const float forsyth_valence_boost_scale = 2.0f;
+static const float forsyth_valence_boost_power = 0.5f;
+
+static float forsyth_vertex_score(int cache_position, uint32_t remaining_valence)
+{
+    if ( remaining_valence == 0 ) return -1.f;
+    float score = 0.f;
+    if ( cache_position >= 0 )
+    {
+        if ( cache_position < 3 )
+        {
+            // The vertices of the last triangle are scored lower, to avoid emitting strips
+            // which would evict the rest of the cache.
+            score = forsyth_last_triangle_score;
+        }
+        else
+        {
+            float scale = 1.f / (FORSYTH_CACHE_SIZE - 3);
+            score = powf(1.f - (cache_position - 3) * scale, forsyth_cache_decay_power);
+        }
+    }
+    score += forsyth_valence_boost_scale * powf((float) remaining_valence, -forsyth_valence_boost_power);
+    return score;
+}
+
+void optimize_vertex_cache(uint32_t *indices, uint32_t num_indices, uint32_t num_vertices)
+{
+    assert(num_indices % 3 == 0);
+    uint32_t num_triangles = num_indices / 3;
+    if ( num_triangles == 0 ) return;
+
+    // Vertex -> triangle adjacency, in compressed rows.
+    std::vector<uint32_t> remaining_valence(num_vertices, 0);
+    for (uint32_t i = 0; i < num_indices; i++) remaining_valence[indices[i]]++;
+    std::vector<uint32_t> adjacency_offsets(num_vertices + 1, 0);
+    for (uint32_t v = 0; v < num_vertices; v++) adjacency_offsets[v+1] = adjacency_offsets[v] + remaining_valence[v];
+    std::vector<uint32_t> adjacency(num_indices);
+    {
+        std::vector<uint32_t> fill(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+        for (uint32_t i = 0; i < num_indices; i++) adjacency[fill[indices[i]]++] = i / 3;
+    }
+
+    std::vector<int> cache_position(num_vertices, -1);
+    std::vector<float> vertex_score(num_vertices);
+    for (uint32_t v = 0; v < num_vertices; v++) vertex_score[v] = forsyth_vertex_score(-1, remaining_valence[v]);
+    std::vector<float> triangle_score(num_triangles);
+    std::vector<bool> emitted(num_triangles, false);
+    for (uint32_t t = 0; t < num_triangles; t++)
+        triangle_score[t] = vertex_score[indices[3*t]] + vertex_score[indices[3*t+1]] + vertex_score[indices[3*t+2]];
+
+    int best_triangle = 0;
+    for (uint32_t t = 1; t < num_triangles; t++)
+        if ( triangle_score[t] > triangle_score[best_triangle] ) best_triangle = t;
+
+    uint32_t cache[FORSYTH_CACHE_SIZE + 3];
+    uint32_t cache_count = 0;
+    uint32_t input_cursor = 0;
+    std::vector<uint32_t> output(num_indices);
+    for (uint32_t emitted_count = 0; emitted_count < num_triangles; emitted_count++)
+    {
+        if ( best_triangle < 0 )
+        {
+            // Nothing in the cache is adjacent to an unemitted triangle. Fall back to input order.
+            while ( emitted[input_cursor] ) input_cursor++;
+            best_triangle = input_cursor;
+        }
+        uint32_t t = best_triangle;
+        const uint32_t *tri = &indices[3*t];
+        memcpy(&output[3*emitted_count], tri, 3 * sizeof(uint32_t));
+        emitted[t] = true;
+
+        // Remove the triangle from its vertices' remaining adjacency.
+        for (int k = 0; k < 3; k++)
+        {
+            uint32_t v = tri[k];
+            uint32_t *adjacent = &adjacency[adjacency_offsets[v]];
+            for (uint32_t j = 0; j < remaining_valence[v]; j++)
+            {
+                if ( adjacent[j] == t )
+                {
+                    adjacent[j] = adjacent[remaining_valence[v] - 1];
+                    break;
+                }
+            }
+            remaining_valence[v]--;
+        }
+
+        // Move the triangle's vertices to the front of the LRU cache.
+        uint32_t new_cache[FORSYTH_CACHE_SIZE + 3];
+        uint32_t new_cache_count = 0;
+        for (int k = 0; k < 3; k++)
+        {
+            if ( k > 0 && (tri[k] == tri[0] || (k == 2 && tri[2] == tri[1])) ) continue;
+            new_cache[new_cache_count++] = tri[k];
+        }
+        for (uint32_t j = 0; j < cache_count; j++)
+        {
+            uint32_t v = cache[j];
+            if ( v == tri[0] || v == tri[1] || v == tri[2] ) continue;
+            new_cache[new_cache_count++] = v;
+        }
+        // Vertices pushed past the cache size are evicted.
+        for (uint32_t j = FORSYTH_CACHE_SIZE; j < new_cache_count; j++)
+        {
+            uint32_t v = new_cache[j];
+            cache_position[v] = -1;
+            vertex_score[v] = forsyth_vertex_score(-1, remaining_valence[v]);
+        }
+        cache_count = std::min(new_cache_count, (uint32_t) FORSYTH_CACHE_SIZE);
+        memcpy(cache, new_cache, cache_count * sizeof(uint32_t));
+        for (uint32_t j = 0; j < cache_count; j++)
+        {
+            uint32_t v = cache[j];
+            cache_position[v] = j;
+            vertex_score[v] = forsyth_vertex_score(j, remaining_valence[v]);
+        }
+
+        // Rescore the unemitted triangles touching the cache, and pick the best of them next.
+        best_triangle = -1;
+        float best_score = -1.f;
+        for (uint32_t j = 0; j < cache_count; j++)
+        {
+            uint32_t v = cache[j];
+            const uint32_t *adjacent = &adjacency[adjacency_offsets[v]];
+            for (uint32_t a = 0; a < remaining_valence[v]; a++)
+            {
+                uint32_t at = adjacent[a];
+                float score = vertex_score[indices[3*at]] + vertex_score[indices[3*at+1]] + vertex_score[indices[3*at+2]];
+                triangle_score[at] = score;
+                if ( score > best_score )
+                {
+                    best_score = score;
+                    best_triangle = at;
+                }
+            }
+        }
+    }
+    memcpy(indices, &output[0], num_indices * sizeof(uint32_t));
+}
+
+void optimize_overdraw(uint32_t *indices, uint32_t num_indices, const vec3 *positions, uint32_t num_vertices, float threshold)
+{
+    assert(num_indices % 3 == 0);
+    uint32_t num_triangles = num_indices / 3;
+    if ( num_triangles == 0 ) return;
+
+    // Hard cluster boundaries are where the cache is effectively flushed: a triangle all of whose vertices miss.
+    // Clusters are then split further at soft boundaries, wherever the running ACMR of the cluster is below
+    // the threshold times the ACMR of the whole hard cluster, so reordering them costs little cache efficiency.
+    std::vector<uint32_t> cluster_starts;
+    {
+        std::vector<uint32_t> inserted_at(num_vertices, 0);
+        uint32_t insertions = 0;
+        std::vector<uint32_t> misses(num_triangles);
+        for (uint32_t t = 0; t < num_triangles; t++)
+        {
+            uint32_t m = 0;
+            for (int k = 0; k < 3; k++)
+            {
+                uint32_t v = indices[3*t + k];
+                if ( inserted_at[v] == 0 || insertions - inserted_at[v] >= MESH_OPTIMIZE_CACHE_SIZE )
+                {
+                    insertions++;
+                    inserted_at[v] = insertions;
+                    m++;
+                }
+            }
+            misses[t] = m;
+        }
+        std::vector<uint32_t> hard_starts;
+        for (uint32_t t = 0; t < num_triangles; t++)
+            if ( t == 0 || misses[t] == 3 ) hard_starts.push_back(t);
+        hard_starts.push_back(num_triangles);
+
+        for (size_t h = 0; h + 1 < hard_starts.size(); h++)
+        {
+            uint32_t start = hard_starts[h];
+            uint32_t end = hard_starts[h+1];
+            uint32_t hard_misses = 0;
+            for (uint32_t t = start; t < end; t++) hard_misses += misses[t];
+            float hard_acmr = hard_misses / (float) (end - start);
+
+            uint32_t cluster_start = start;
+            uint32_t cluster_misses = 0;
+            cluster_starts.push_back(start);
+            for (uint32_t t = start; t < end; t++)
+            {
+                cluster_misses += misses[t];
+                float running_acmr = cluster_misses / (float) (t + 1 - cluster_start);
+                if ( t + 1 < end && t + 1 - cluster_start >= 8 && running_acmr < hard_acmr * threshold && misses[t+1] > 0 )
+                {
+                    cluster_start = t + 1;
+                    cluster_misses = 0;
+                    cluster_starts.push_back(cluster_start);
+                }
+            }
+        }
+        cluster_starts.push_back(num_triangles);
+    }
+    uint32_t num_clusters = cluster_starts.size() - 1;
+    if ( num_clusters <= 1 ) return;
+
+    // Sort clusters by how much they face away from the mesh center, outward-facing first.
+    // Outward-facing clusters are more likely to occlude the rest of the mesh.
+    vec3 mesh_centroid = vec3(0);
+    float mesh_area = 0;
+    std::vector<vec3> cluster_centroid(num_clusters, vec3(0));
+    std::vector<vec3> cluster_normal(num_clusters, vec3(0));
+    std::vector<float> cluster_area(num_clusters, 0.f);
+    for (uint32_t c = 0; c < num_clusters; c++)
+    {
+        for (uint32_t t = cluster_starts[c]; t < cluster_starts[c+1]; t++)
+        {
+            vec3 a = positions[indices[3*t]];
+            vec3 b = positions[indices[3*t+1]];
+            vec3 d = positions[indices[3*t+2]];
+            vec3 n = glm::cross(b - a, d - a); // Length is twice the area.
+            float area = 0.5f * glm::length(n);
+            vec3 centroid = (a + b + d) / 3.f;
+            cluster_centroid[c] += centroid * area;
+            cluster_normal[c] += n;
+            cluster_area[c] += area;
+        }
+        mesh_centroid += cluster_centroid[c];
+        mesh_area += cluster_area[c];
+    }
+    if ( mesh_area > 0 ) mesh_centroid /= mesh_area;
+
+    std::vector<float> sort_key(num_clusters);
+    for (uint32_t c = 0; c < num_clusters; c++)
+    {
+        if ( cluster_area[c] == 0 || glm::length(cluster_normal[c]) == 0 )
+        {
+            sort_key[c] = 0;
+            continue;
+        }
+        vec3 centroid = cluster_centroid[c] / cluster_area[c];
+        sort_key[c] = glm::dot(centroid - mesh_centroid, glm::normalize(cluster_normal[c]));
+    }
+    std::vector<uint32_t> order(num_clusters);
+    for (uint32_t c = 0; c < num_clusters; c++) order[c] = c;
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return sort_key[a] > sort_key[b]; });
+
+    std::vector<uint32_t> output;
+    output.reserve(num_indices);
+    for (uint32_t c : order)
+        output.insert(output.end(), &indices[3*cluster_starts[c]], &indices[3*cluster_starts[c+1]]);
+    memcpy(indices, &output[0], num_indices * sizeof(uint32_t));
+}
+
+void optimize_vertex_fetch_remap(uint32_t *remap, uint32_t *indices, uint32_t num_indices, uint32_t num_vertices)
+{
+    for (uint32_t v = 0; v < num_vertices; v++) remap[v] = UINT32_MAX;
+    uint32_t next = 0;
+    for (uint32_t i = 0; i < num_indices; i++)
+    {
+        uint32_t &r = remap[indices[i]];
+        if ( r == UINT32_MAX ) r = next++;
+        indices[i] = r;
+    }
+    for (uint32_t v = 0; v < num_vertices; v++)
+        if ( remap[v] == UINT32_MAX ) remap[v] = next++;
+}
+
+template <typename T>
+static void apply_remap(T *data, const uint32_t *remap, uint32_t num_vertices)
+{
+    std::vector<T> copy(data, data + num_vertices);
+    for (uint32_t v = 0; v < num_vertices; v++) data[remap[v]] = copy[v];
+}
+
+void optimize_mesh(uint32_t *indices, uint32_t num_indices,
+                   vec3 *positions, vec3 *normals, uint32_t num_vertices,
+                   uint32_t vertex_size,
+                   MeshOptimizeReport *report)
+{
+    report->cache_before = analyze_vertex_cache(indices, num_indices, num_vertices, MESH_OPTIMIZE_CACHE_SIZE);
+    report->fetch_before = analyze_vertex_fetch(indices, num_indices, num_vertices, vertex_size);
+
+    optimize_vertex_cache(indices, num_indices, num_vertices);
+    optimize_overdraw(indices, num_indices, positions, num_vertices, MESH_OPTIMIZE_DEFAULT_OVERDRAW_THRESHOLD);
+    std::vector<uint32_t> remap(num_vertices);
+    optimize_vertex_fetch_remap(&remap[0], indices, num_indices, num_vertices);
+    apply_remap(positions, &remap[0], num_vertices);
+    apply_remap(normals, &remap[0], num_vertices);
+
+    report->cache_after = analyze_vertex_cache(indices, num_indices, num_vertices, MESH_OPTIMIZE_CACHE_SIZE);
+    report->fetch_after = analyze_vertex_fetch(indices, num_indices, num_vertices, vertex_size);
+}
@@ -0,0 +1,58 @@
+#ifndef RENDERER_MESH_OPTIMIZE_H_
+#define RENDERER_MESH_OPTIMIZE_H_
+/* mesh_optimize.h
+ *
+ * Reordering of triangle-list meshes for GPU throughput. None of these change the
+ * rendered surface, only the order in which triangles and vertices are stored.
+ *
+ *     optimize_vertex_cache: Reorder triangles for post-transform vertex cache reuse
+ *                            (Forsyth, "Linear-Speed Vertex Cache Optimisation").
+ *     optimize_overdraw:     Reorder clusters of cache-optimized triangles so that outward-facing
+ *                            clusters are drawn first (Sander et al., "Fast Triangle Reordering
+ *                            for Vertex Locality and Reduced Overdraw"), keeping the ACMR within
+ *                            a threshold of the cache-optimized order.
+ *     optimize_vertex_fetch: Reorder vertices into first-use order for vertex fetch locality.
+ *
+ * optimize_mesh applies all three in that order.
+ */
+#include "renderer/transform.h"
+#include <stdint.h>
+
+#define MESH_OPTIMIZE_CACHE_SIZE 16
+#define MESH_OPTIMIZE_DEFAULT_OVERDRAW_THRESHOLD 1.05f
+
+struct VertexCacheStatistics
+{
+    uint32_t vertices_transformed;
+    float acmr; // Average cache miss ratio: transformed vertices per triangle. 0.5 is ideal for large grids.
+    float atvr; // Average transformed vertex ratio: transformed vertices per vertex. 1.0 is ideal.
+};
+// Simulates a FIFO post-transform cache of the given size.
+VertexCacheStatistics analyze_vertex_cache(const uint32_t *indices, uint32_t num_indices, uint32_t num_vertices, uint32_t cache_size);
+
+struct VertexFetchStatistics
+{
+    uint32_t bytes_fetched;
+    float overfetch; // Bytes fetched per byte of vertex data. 1.0 is ideal.
+};
+// Simulates a direct-mapped cache of 64-byte lines in front of the vertex buffer.
+VertexFetchStatistics analyze_vertex_fetch(const uint32_t *indices, uint32_t num_indices, uint32_t num_vertices, uint32_t vertex_size);
+
+void optimize_vertex_cache(uint32_t *indices, uint32_t num_indices, uint32_t num_vertices);
+void optimize_overdraw(uint32_t *indices, uint32_t num_indices, const vec3 *positions, uint32_t num_vertices, float threshold);
+// Writes remap[old_vertex] = new_vertex and rewrites the indices. Unreferenced vertices are moved to the end.
+void optimize_vertex_fetch_remap(uint32_t *remap, uint32_t *indices, uint32_t num_indices, uint32_t num_vertices);
+
+struct MeshOptimizeReport
+{
+    VertexCacheStatistics cache_before;
+    VertexCacheStatistics cache_after;
+    VertexFetchStatistics fetch_before;
+    VertexFetchStatistics fetch_after;
+};
+void optimize_mesh(uint32_t *indices, uint32_t num_indices,
+                   vec3 *positions, vec3 *normals, uint32_t num_vertices,
+                   uint32_t vertex_size,
+                   MeshOptimizeReport *report);
+
+#endif // RENDERER_MESH_OPTIMIZE_H_
@@ -0,0 +1,260 @@
+#include "renderer/mesh_pool.h"
+#include "ansi_color.h"
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+void RangeAllocator::init(uint32_t capacity)
+{
+    m_capacity = capacity;
+    m_used = 0;
+    m_free_ranges.clear();
+    m_free_ranges.push_back({0, capacity});
+}
+
+bool RangeAllocator::allocate(uint32_t size, uint32_t alignment, uint32_t *offset)
+{
+    assert(size > 0 && alignment > 0);
+    for (size_t i = 0; i < m_free_ranges.size(); i++)
+    {
+        Range range = m_free_ranges[i];
+        uint32_t aligned_offset = ((range.offset + alignment - 1) / alignment) * alignment;
+        uint32_t padding = aligned_offset - range.offset;
+        if ( range.size < size || range.size - size < padding ) continue;
+
+        // The alignment padding stays in the free list as its own range.
+        Range tail = { aligned_offset + size, range.size - padding - size };
+        if ( padding > 0 )
+        {
+            m_free_ranges[i].size = padding;
+            if ( tail.size > 0 ) m_free_ranges.insert(m_free_ranges.begin() + i + 1, tail);
+        }
+        else if ( tail.size > 0 )
+        {
+            m_free_ranges[i] = tail;
+        }
+        else
+        {
+            m_free_ranges.erase(m_free_ranges.begin() + i);
+        }
+        *offset = aligned_offset;
+        m_used += size;
+        return true;
+    }
+    return false;
+}
+
+void RangeAllocator::free(uint32_t offset, uint32_t size)
+{
+    assert(size > 0 && offset + size <= m_capacity);
+    // Find the first free range after the freed range.
+    size_t i = 0;
+    while ( i < m_free_ranges.size() && m_free_ranges[i].offset < offset ) i++;
+    assert(i == m_free_ranges.size() || offset + size <= m_free_ranges[i].offset);
+    assert(i == 0 || m_free_ranges[i-1].offset + m_free_ranges[i-1].size <= offset);
+
+    bool merge_previous = i > 0 && m_free_ranges[i-1].offset + m_free_ranges[i-1].size == offset;
+    bool merge_next = i < m_free_ranges.size() && offset + size == m_free_ranges[i].offset;
+    if ( merge_previous && merge_next )
+    {
+        m_free_ranges[i-1].size += size + m_free_ranges[i].size;
+        m_free_ranges.erase(m_free_ranges.begin() + i);
+    }
+    else if ( merge_previous )
+    {
+        m_free_ranges[i-1].size += size;
+    }
+    else if ( merge_next )
+    {
+        m_free_ranges[i].offset = offset;
+        m_free_ranges[i].size += size;
+    }
+    else
+    {
+        m_free_ranges.insert(m_free_ranges.begin() + i, {offset, size});
+    }
+    m_used -= size;
+}
+
+
+bool MeshPool::init(VulkanSystem *_vk, uint32_t vertex_word_capacity, uint32_t index_word_capacity)
+{
+    vk = _vk;
+    if ( !CreateVulkanBuffer(vk,
+                             vertex_word_capacity * sizeof(uint32_t),
+                             VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                             &vertex_buffer) )
+    {
+        fprintf(stderr, C_RED "[%s] Failed to create mesh pool vertex buffer.\n" C_RESET, __func__);
+        return false;
+    }
+    if ( !CreateVulkanBuffer(vk,
+                             index_word_capacity * sizeof(uint32_t),
+                             VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                             &index_buffer) )
+    {
+        fprintf(stderr, C_RED "[%s] Failed to create mesh pool index buffer.\n" C_RESET, __func__);
+        DestroyVulkanBuffer(vk, &vertex_buffer);
+        return false;
+    }
+    vertex_word_ranges.init(vertex_word_capacity);
+    index_word_ranges.init(index_word_capacity);
+    return true;
+}
+
+void MeshPool::destroy()
+{
+    DestroyVulkanBuffer(vk, &index_buffer);
+    DestroyVulkanBuffer(vk, &vertex_buffer);
+}
+
+bool MeshPool::allocate(VertexFormat vertex_format, uint32_t num_vertices, uint32_t num_indices, MeshAllocation *allocation)
+{
+    uint32_t stride_words = vertex_format_info(vertex_format).stride / 4;
+    MeshAllocation a;
+    a.vertex_format = vertex_format;
+    a.num_vertices = num_vertices;
+    a.num_vertex_words = num_vertices * stride_words;
+    a.num_indices = num_indices;
+    a.index_type = index_type_for(num_vertices);
+    a.num_index_words = num_index_words(a.index_type, num_indices);
+    if ( !vertex_word_ranges.allocate(a.num_vertex_words, stride_words, &a.vertex_word_offset) )
+    {
+        fprintf(stderr, C_RED "[%s] Mesh pool is out of vertex space (%u/%u words used, %u requested).\n" C_RESET,
+                __func__, vertex_word_ranges.used(), vertex_word_ranges.capacity(), a.num_vertex_words);
+        return false;
+    }
+    if ( !index_word_ranges.allocate(a.num_index_words, 1, &a.index_word_offset) )
+    {
+        fprintf(stderr, C_RED "[%s] Mesh pool is out of index space (%u/%u words used, %u requested).\n" C_RESET,
+                __func__, index_word_ranges.used(), index_word_ranges.capacity(), a.num_index_words);
+        vertex_word_ranges.free(a.vertex_word_offset, a.num_vertex_words);
+        return false;
+    }
+    *allocation = a;
+    return true;
+}
+
+void MeshPool::free(const MeshAllocation &allocation)
+{
+    vertex_word_ranges.free(allocation.vertex_word_offset, allocation.num_vertex_words);
+    index_word_ranges.free(allocation.index_word_offset, allocation.num_index_words);
+}
+
+VkIndexType MeshPool::index_type_for(uint32_t num_vertices)
+{
+    // Indices are relative to the mesh's vertex offset, so 16 bits address 65536 vertices.
+    return num_vertices <= 65536 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+}
+
+uint32_t MeshPool::num_index_words(VkIndexType index_type, uint32_t num_indices)
+{
+    return index_type == VK_INDEX_TYPE_UINT16 ? (num_indices + 1) / 2 : num_indices;
+}
+
+void MeshPool::encode_indices(VkIndexType index_type, uint32_t num_indices, const uint32_t *indices, uint8_t *out)
+{
+    if ( index_type == VK_INDEX_TYPE_UINT16 )
+    {
+        uint16_t *indices_16 = (uint16_t *) out;
+        for (uint32_t i = 0; i < num_indices; i++)
+        {
+            assert(indices[i] <= 0xFFFF);
+            indices_16[i] = (uint16_t) indices[i];
+        }
+        // Zero the padding index of an odd-length index list.
+        if ( num_indices & 1 ) indices_16[num_indices] = 0;
+    }
+    else
+    {
+        memcpy(out, indices, num_indices * sizeof(uint32_t));
+    }
+}
+
+void MeshPool::upload(StagingUploader *uploader,
+                      const MeshAllocation &allocation,
+                      const VertexQuantization &quantization,
+                      const vec3 *positions,
+                      const vec3 *normals,
+                      const uint32_t *indices)
+{
+    VkDeviceSize vertex_bytes = allocation.num_vertex_words * sizeof(uint32_t);
+    VkDeviceSize index_bytes = allocation.num_index_words * sizeof(uint32_t);
+    uint8_t *staging = uploader->begin(vertex_bytes + index_bytes);
+    assert(staging != nullptr);
+
+    // Encode and narrow straight into the mapped staging memory.
+    encode_vertices(allocation.vertex_format, quantization, positions, normals, allocation.num_vertices, staging);
+    encode_indices(allocation.index_type, allocation.num_indices, indices, staging + vertex_bytes);
+
+    uploader->copy_to_buffer(0, vertex_buffer.buffer, allocation.vertex_word_offset * sizeof(uint32_t), vertex_bytes);
+    uploader->copy_to_buffer(vertex_bytes, index_buffer.buffer, allocation.index_word_offset * sizeof(uint32_t), index_bytes);
+    uploader->end_and_wait(VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT);
+}
+
+bool MeshPool::allocate_indices(const MeshAllocation &allocation, uint32_t num_indices, MeshIndexRange *range)
+{
+    MeshIndexRange r;
+    r.num_indices = num_indices;
+    r.num_index_words = num_index_words(allocation.index_type, num_indices);
+    if ( !index_word_ranges.allocate(r.num_index_words, 1, &r.index_word_offset) )
+    {
+        fprintf(stderr, C_RED "[%s] Mesh pool is out of index space (%u/%u words used, %u requested).\n" C_RESET,
+                __func__, index_word_ranges.used(), index_word_ranges.capacity(), r.num_index_words);
+        return false;
+    }
+    *range = r;
+    return true;
+}
+
+void MeshPool::free_indices(const MeshIndexRange &range)
+{
+    index_word_ranges.free(range.index_word_offset, range.num_index_words);
+}
+
+void MeshPool::upload_indices(StagingUploader *uploader,
+                              const MeshAllocation &allocation,
+                              const MeshIndexRange &range,
+                              const uint32_t *indices)
+{
+    VkDeviceSize index_bytes = range.num_index_words * sizeof(uint32_t);
+    uint8_t *staging = uploader->begin(index_bytes);
+    assert(staging != nullptr);
+    encode_indices(allocation.index_type, range.num_indices, indices, staging);
+    uploader->copy_to_buffer(0, index_buffer.buffer, range.index_word_offset * sizeof(uint32_t), index_bytes);
+    uploader->end_and_wait(VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT);
+}
+
+void MeshPool::copy_vertices(StagingUploader *uploader, VkDeviceSize staging_offset, const MeshAllocation &allocation)
+{
+    uploader->copy_to_buffer(staging_offset,
+                             vertex_buffer.buffer,
+                             allocation.vertex_word_offset * sizeof(uint32_t),
+                             allocation.num_vertex_words * sizeof(uint32_t));
+}
+
+void MeshPool::copy_indices(StagingUploader *uploader, VkDeviceSize staging_offset, const MeshIndexRange &range)
+{
+    uploader->copy_to_buffer(staging_offset,
+                             index_buffer.buffer,
+                             range.index_word_offset * sizeof(uint32_t),
+                             range.num_index_words * sizeof(uint32_t));
+}
+
+MeshIndexRange MeshPool::index_range(const MeshAllocation &allocation)
+{
+    return { allocation.index_word_offset, allocation.num_index_words, allocation.num_indices };
+}
+
+void MeshPool::bind_vertex_buffer(VkCommandBuffer command_buffer)
+{
+    VkDeviceSize offset = 0;
+    vkCmdBindVertexBuffers(command_buffer, 0, 1, &vertex_buffer.buffer, &offset);
+}
+
+void MeshPool::bind_index_buffer(VkCommandBuffer command_buffer, VkIndexType index_type)
+{
+    vkCmdBindIndexBuffer(command_buffer, index_buffer.buffer, 0, index_type);
+}
@@ -0,0 +1,139 @@
+#ifndef RENDERER_MESH_POOL_H_
+#define RENDERER_MESH_POOL_H_
+/* mesh_pool.h
+ *
+ * All polygon mesh geometry lives in two large device-local buffers, one for vertices
+ * and one for indices. Each mesh is a sub-allocated range of both, so the renderer can
+ * bind the pool once and draw any mesh with vkCmdDrawIndexed(firstIndex, vertexOffset).
+ *
+ * Vertex storage is allocated in 32-bit words, aligned to the stride of the mesh's
+ * vertex format, so meshes of every format share the one vertex buffer and vertexOffset
+ * is the word offset divided by the stride in words.
+ *
+ * Index storage is allocated in 32-bit words. Meshes with at most 65536 vertices store
+ * 16-bit indices (relative to their vertex offset), two per word, and larger meshes store
+ * 32-bit indices. The index buffer is bound at offset 0 once per index type, so
+ * firstIndex is the word offset scaled by the number of indices per word.
+ */
+#include "engine/platform/vk.h"
+#include "renderer/transform.h"
+#include "renderer/vertex_format.h"
+#include "renderer/staging_uploader.h"
+#include <vector>
+#include <stdint.h>
+
+#define MESH_POOL_DEFAULT_VERTEX_WORD_CAPACITY (1u << 24)
+#define MESH_POOL_DEFAULT_INDEX_WORD_CAPACITY (1u << 24)
+
+/*
+ * First-fit allocator of [offset, offset+size) ranges within a fixed capacity.
+ * Alignments need not be powers of two.
+ * The free list is kept sorted by offset and adjacent ranges are coalesced on free.
+ */
+class RangeAllocator
+{
+public:
+    void init(uint32_t capacity);
+    bool allocate(uint32_t size, uint32_t alignment, uint32_t *offset);
+    void free(uint32_t offset, uint32_t size);
+
+    uint32_t capacity() const { return m_capacity; }
+    uint32_t used() const { return m_used; }
+private:
+    struct Range
+    {
+        uint32_t offset;
+        uint32_t size;
+    };
+    std::vector<Range> m_free_ranges;
+    uint32_t m_capacity;
+    uint32_t m_used;
+};
+
+struct MeshAllocation
+{
+    VertexFormat vertex_format;
+    uint32_t vertex_word_offset; // In 32-bit words, a multiple of the vertex stride.
+    uint32_t num_vertex_words;
+    uint32_t num_vertices;
+    uint32_t index_word_offset; // In 32-bit words.
+    uint32_t num_index_words;
+    uint32_t num_indices;
+    VkIndexType index_type;
+
+    int32_t vertex_offset() const
+    {
+        return (int32_t) (vertex_word_offset / (vertex_format_info(vertex_format).stride / 4));
+    }
+    uint32_t first_index() const
+    {
+        return index_type == VK_INDEX_TYPE_UINT16 ? 2*index_word_offset : index_word_offset;
+    }
+};
+
+// Additional indices drawn with a mesh allocation's vertices, in the allocation's index type, e.g. a LOD.
+struct MeshIndexRange
+{
+    uint32_t index_word_offset; // In 32-bit words.
+    uint32_t num_index_words;
+    uint32_t num_indices;
+
+    uint32_t first_index(VkIndexType index_type) const
+    {
+        return index_type == VK_INDEX_TYPE_UINT16 ? 2*index_word_offset : index_word_offset;
+    }
+};
+
+class MeshPool
+{
+public:
+    bool init(VulkanSystem *vk, uint32_t vertex_word_capacity, uint32_t index_word_capacity);
+    void destroy();
+
+    bool allocate(VertexFormat vertex_format, uint32_t num_vertices, uint32_t num_indices, MeshAllocation *allocation);
+    void free(const MeshAllocation &allocation);
+
+    // Encode mesh data into the allocated ranges. Vertices are written in the allocation's
+    // vertex format, and indices are narrowed to 16 bits if the allocation uses 16-bit indices.
+    // This blocks until the transfer has completed.
+    void upload(StagingUploader *uploader,
+                const MeshAllocation &allocation,
+                const VertexQuantization &quantization,
+                const vec3 *positions,
+                const vec3 *normals,
+                const uint32_t *indices);
+
+    bool allocate_indices(const MeshAllocation &allocation, uint32_t num_indices, MeshIndexRange *range);
+    void free_indices(const MeshIndexRange &range);
+    // Blocks until the transfer has completed.
+    void upload_indices(StagingUploader *uploader,
+                        const MeshAllocation &allocation,
+                        const MeshIndexRange &range,
+                        const uint32_t *indices);
+    // The allocation's own indices as a range.
+    static MeshIndexRange index_range(const MeshAllocation &allocation);
+
+    // Record copies of already encoded vertices or indices from the uploader's staging memory,
+    // so that many meshes can be uploaded in one batch (see asset_file.h).
+    void copy_vertices(StagingUploader *uploader, VkDeviceSize staging_offset, const MeshAllocation &allocation);
+    void copy_indices(StagingUploader *uploader, VkDeviceSize staging_offset, const MeshIndexRange &range);
+
+    static VkIndexType index_type_for(uint32_t num_vertices);
+    static uint32_t num_index_words(VkIndexType index_type, uint32_t num_indices);
+    // Narrow indices to the index type. 16-bit index lists are padded to a whole word.
+    static void encode_indices(VkIndexType index_type, uint32_t num_indices, const uint32_t *indices, uint8_t *out);
+
+    void bind_vertex_buffer(VkCommandBuffer command_buffer);
+    void bind_index_buffer(VkCommandBuffer command_buffer, VkIndexType index_type);
+    // The buffers are also usable as storage buffers, e.g. for vertex pulling.
+    VkBuffer vertices() const { return vertex_buffer.buffer; }
+    VkBuffer indices() const { return index_buffer.buffer; }
+private:
+    VulkanSystem *vk;
+    VulkanBuffer vertex_buffer;
+    VulkanBuffer index_buffer;
+    RangeAllocator vertex_word_ranges;
+    RangeAllocator index_word_ranges;
+};
+
+#endif // RENDERER_MESH_POOL_H_
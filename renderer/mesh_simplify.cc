@@ -0,0 +1,300 @@
+#include "renderer/mesh_simplify.h"
+#include <math.h>
+#include <string.h>
+#include <assert.h>
+#include <algorithm>
+
+// Border planes are weighted above the surface planes so that open borders keep their shape.
+#define BORDER_WEIGHT 10.0
+
+/*
+ * Sum of squared distances to a set of weighted planes, as the quadric form
+ *     Q(p) = p^T A p + 2 b.p + c.
+ */
+struct Quadric
+{
+    double a00, a01, a02, a11, a12, a22;
+    double b0, b1, b2;
+    double c;
+    double weight;
+};
+
+static void quadric_add_plane(Quadric *q, vec3 normal, float distance, double weight)
+{
+    double nx = normal.x, ny = normal.y, nz = normal.z, d = distance;
+    q->a00 += weight * nx * nx;
+    q->a01 += weight * nx * ny;
+    q->a02 += weight * nx * nz;
+    q->a11 += weight * ny * ny;
+    q->a12 += weight * ny * nz;
+    q->a22 += weight * nz * nz;
+    q->b0 += weight * d * nx;
+    q->b1 += weight * d * ny;
+    q->b2 += weight * d * nz;
+    q->c += weight * d * d;
+    q->weight += weight;
+}
+
+static void quadric_add(Quadric *q, const Quadric &r)
+{
+    q->a00 += r.a00; q->a01 += r.a01; q->a02 += r.a02;
+    q->a11 += r.a11; q->a12 += r.a12; q->a22 += r.a22;
+    q->b0 += r.b0; q->b1 += r.b1; q->b2 += r.b2;
+    q->c += r.c;
+    q->weight += r.weight;
+}
+
+// Mean squared distance to the quadric's planes.
+static double quadric_error(const Quadric &q, vec3 p)
+{
+    double x = p.x, y = p.y, z = p.z;
+    double value = q.a00*x*x + q.a11*y*y + q.a22*z*z
+                 + 2*(q.a01*x*y + q.a02*x*z + q.a12*y*z)
+                 + 2*(q.b0*x + q.b1*y + q.b2*z)
+                 + q.c;
+    return q.weight > 0 ? fabs(value) / q.weight : 0;
+}
+
+struct Edge
+{
+    uint32_t a;
+    uint32_t b;
+    bool operator<(const Edge &other) const { return a < other.a || (a == other.a && b < other.b); }
+    bool operator==(const Edge &other) const { return a == other.a && b == other.b; }
+};
+
+struct Collapse
+{
+    uint32_t from;
+    uint32_t to;
+    bool border;
+    double error;
+};
+
+uint32_t simplify_mesh(uint32_t *destination,
+                       const uint32_t *indices, uint32_t num_indices,
+                       const vec3 *positions, uint32_t num_vertices,
+                       uint32_t target_num_indices,
+                       float *result_error)
+{
+    assert(num_indices % 3 == 0);
+    memcpy(destination, indices, num_indices * sizeof(uint32_t));
+    uint32_t count = num_indices;
+    target_num_indices -= target_num_indices % 3;
+    *result_error = 0;
+
+    // Vertices sharing a position are mapped to one representative, and are seams if there is more than one.
+    std::vector<uint32_t> rep(num_vertices);
+    std::vector<uint8_t> seam(num_vertices, 0);
+    {
+        std::vector<uint32_t> order(num_vertices);
+        for (uint32_t v = 0; v < num_vertices; v++) order[v] = v;
+        auto position_less = [&](uint32_t i, uint32_t j) {
+            const vec3 &p = positions[i], &q = positions[j];
+            if ( p.x != q.x ) return p.x < q.x;
+            if ( p.y != q.y ) return p.y < q.y;
+            return p.z < q.z;
+        };
+        std::sort(order.begin(), order.end(), position_less);
+        for (uint32_t i = 0; i < num_vertices; )
+        {
+            uint32_t j = i + 1;
+            while ( j < num_vertices && positions[order[j]] == positions[order[i]] ) j++;
+            for (uint32_t k = i; k < j; k++)
+            {
+                rep[order[k]] = order[i];
+                seam[order[k]] = j - i > 1;
+            }
+            i = j;
+        }
+    }
+
+    // Undirected edges between representatives of the current triangles, sorted. Edges used by one triangle are borders.
+    std::vector<Edge> edges;
+    auto gather_edges = [&]() {
+        edges.clear();
+        for (uint32_t i = 0; i < count; i += 3)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                uint32_t a = rep[destination[i + k]];
+                uint32_t b = rep[destination[i + (k + 1) % 3]];
+                edges.push_back({std::min(a, b), std::max(a, b)});
+            }
+        }
+        std::sort(edges.begin(), edges.end());
+    };
+
+    // Quadrics are accumulated per representative. Vertices on borders may only collapse along them.
+    std::vector<Quadric> quadrics(num_vertices, Quadric{});
+    std::vector<uint8_t> border(num_vertices, 0);
+    gather_edges();
+    for (uint32_t i = 0; i < count; i += 3)
+    {
+        vec3 p[3];
+        for (int k = 0; k < 3; k++) p[k] = positions[destination[i + k]];
+        vec3 n = glm::cross(p[1] - p[0], p[2] - p[0]);
+        float length = glm::length(n);
+        if ( length == 0 ) continue;
+        n /= length;
+        double area = 0.5 * length;
+        for (int k = 0; k < 3; k++)
+            quadric_add_plane(&quadrics[rep[destination[i + k]]], n, -glm::dot(n, p[0]), area);
+
+        for (int k = 0; k < 3; k++)
+        {
+            uint32_t a = rep[destination[i + k]];
+            uint32_t b = rep[destination[i + (k + 1) % 3]];
+            Edge edge = {std::min(a, b), std::max(a, b)};
+            auto range = std::equal_range(edges.begin(), edges.end(), edge);
+            if ( range.second - range.first != 1 ) continue;
+            border[a] = border[b] = 1;
+            // Plane through the border edge, perpendicular to the triangle.
+            vec3 e = positions[b] - positions[a];
+            vec3 border_normal = glm::cross(e, n);
+            float border_length = glm::length(border_normal);
+            if ( border_length == 0 ) continue;
+            border_normal /= border_length;
+            double weight = BORDER_WEIGHT * glm::dot(e, e);
+            quadric_add_plane(&quadrics[a], border_normal, -glm::dot(border_normal, positions[a]), weight);
+            quadric_add_plane(&quadrics[b], border_normal, -glm::dot(border_normal, positions[a]), weight);
+        }
+    }
+
+    std::vector<Collapse> collapses;
+    std::vector<uint8_t> locked(num_vertices);
+    std::vector<uint32_t> remap(num_vertices);
+    std::vector<uint32_t> adjacency_offsets(num_vertices + 1);
+    std::vector<uint32_t> adjacency;
+    double max_error = 0;
+    while ( count > target_num_indices )
+    {
+        // Rank the collapses of every edge, in the cheaper allowed direction.
+        gather_edges();
+        collapses.clear();
+        for (size_t i = 0; i < edges.size(); )
+        {
+            size_t j = i + 1;
+            while ( j < edges.size() && edges[j] == edges[i] ) j++;
+            Edge edge = edges[i];
+            bool border_edge = j - i == 1;
+            i = j;
+            if ( edge.a == edge.b ) continue;
+
+            Collapse best = {0, 0, border_edge, INFINITY};
+            uint32_t ends[2] = {edge.a, edge.b};
+            for (int k = 0; k < 2; k++)
+            {
+                uint32_t from = ends[k], to = ends[1 - k];
+                if ( seam[from] || (border[from] && !border_edge) ) continue;
+                Quadric q = quadrics[from];
+                quadric_add(&q, quadrics[to]);
+                double error = quadric_error(q, positions[to]);
+                if ( error < best.error )
+                {
+                    best.from = from;
+                    best.to = to;
+                    best.error = error;
+                }
+            }
+            if ( best.error != INFINITY ) collapses.push_back(best);
+        }
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse &a, const Collapse &b) { return a.error < b.error; });
+
+        // Triangles around each vertex.
+        std::fill(adjacency_offsets.begin(), adjacency_offsets.end(), 0);
+        for (uint32_t i = 0; i < count; i++) adjacency_offsets[destination[i] + 1]++;
+        for (uint32_t v = 0; v < num_vertices; v++) adjacency_offsets[v + 1] += adjacency_offsets[v];
+        adjacency.resize(count);
+        {
+            std::vector<uint32_t> fill(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+            for (uint32_t i = 0; i < count; i++) adjacency[fill[destination[i]]++] = i / 3;
+        }
+
+        // Apply the cheapest collapses whose neighbourhoods don't overlap, so that each
+        // flip test below sees the final positions of the neighbourhood.
+        std::fill(locked.begin(), locked.end(), 0);
+        for (uint32_t v = 0; v < num_vertices; v++) remap[v] = v;
+        uint32_t triangles_to_remove = (count - target_num_indices) / 3;
+        uint32_t triangles_removed = 0;
+        uint32_t num_applied = 0;
+        for (const Collapse &collapse : collapses)
+        {
+            if ( locked[collapse.from] || locked[collapse.to] ) continue;
+
+            // Reject collapses that would flip a triangle around the moving vertex.
+            bool flips = false;
+            vec3 target = positions[collapse.to];
+            for (uint32_t i = adjacency_offsets[collapse.from]; i < adjacency_offsets[collapse.from + 1] && !flips; i++)
+            {
+                const uint32_t *triangle = &destination[3 * adjacency[i]];
+                vec3 p[3], moved[3];
+                bool contains_to = false;
+                for (int k = 0; k < 3; k++)
+                {
+                    p[k] = positions[triangle[k]];
+                    moved[k] = triangle[k] == collapse.from ? target : p[k];
+                    if ( rep[triangle[k]] == collapse.to ) contains_to = true;
+                }
+                if ( contains_to ) continue;
+                vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+                vec3 after = glm::cross(moved[1] - moved[0], moved[2] - moved[0]);
+                if ( glm::dot(before, after) <= 0 ) flips = true;
+            }
+            if ( flips ) continue;
+
+            remap[collapse.from] = collapse.to;
+            quadric_add(&quadrics[collapse.to], quadrics[collapse.from]);
+            max_error = std::max(max_error, collapse.error);
+            num_applied++;
+            for (uint32_t end : {collapse.from, collapse.to})
+            {
+                for (uint32_t i = adjacency_offsets[end]; i < adjacency_offsets[end + 1]; i++)
+                {
+                    const uint32_t *triangle = &destination[3 * adjacency[i]];
+                    for (int k = 0; k < 3; k++) locked[rep[triangle[k]]] = locked[triangle[k]] = 1;
+                }
+            }
+            triangles_removed += collapse.border ? 1 : 2;
+            if ( triangles_removed >= triangles_to_remove ) break;
+        }
+        if ( num_applied == 0 ) break;
+
+        // Rewrite the triangles and drop those that became degenerate.
+        uint32_t new_count = 0;
+        for (uint32_t i = 0; i < count; i += 3)
+        {
+            uint32_t a = remap[destination[i]], b = remap[destination[i + 1]], c = remap[destination[i + 2]];
+            if ( rep[a] == rep[b] || rep[b] == rep[c] || rep[c] == rep[a] ) continue;
+            destination[new_count++] = a;
+            destination[new_count++] = b;
+            destination[new_count++] = c;
+        }
+        count = new_count;
+    }
+    *result_error = (float) sqrt(max_error);
+    return count;
+}
+
+void build_lod_chain(std::vector<MeshLodLevel> *lods,
+                     const uint32_t *indices, uint32_t num_indices,
+                     const vec3 *positions, uint32_t num_vertices,
+                     uint32_t max_levels)
+{
+    lods->clear();
+    lods->push_back({std::vector<uint32_t>(indices, indices + num_indices), 0});
+    uint32_t previous = num_indices;
+    while ( lods->size() < max_levels && previous / 3 >= MESH_LOD_MIN_TRIANGLES )
+    {
+        uint32_t target = 3 * (uint32_t) ((previous / 3) * MESH_LOD_REDUCTION);
+        MeshLodLevel lod;
+        lod.indices.resize(num_indices);
+        uint32_t count = simplify_mesh(&lod.indices[0], indices, num_indices, positions, num_vertices, target, &lod.error);
+        if ( count == 0 || count > previous * (1 - MESH_LOD_MIN_REDUCTION) ) break;
+        lod.indices.resize(count);
+        // Simplifying from LOD 0 each time gives each LOD its own error, which should not decrease along the chain.
+        lod.error = std::max(lod.error, lods->back().error);
+        lods->push_back(std::move(lod));
+        previous = count;
+    }
+}
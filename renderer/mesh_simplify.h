@@ -0,0 +1,47 @@
+#ifndef RENDERER_MESH_SIMPLIFY_H_
+#define RENDERER_MESH_SIMPLIFY_H_
+/* mesh_simplify.h
+ *
+ * Simplification of triangle-list meshes by edge collapse with quadric error metrics
+ * (Garland and Heckbert, "Surface Simplification Using Quadric Error Metrics").
+ *
+ * Edges are only collapsed onto one of their existing vertices, so a simplified index list
+ * references a subset of the original vertices and can be drawn with the same vertex buffer.
+ * Open borders only collapse along themselves, and vertices on attribute seams (several
+ * vertices sharing a position) are never moved, so the simplified mesh does not crack.
+ *
+ * Errors are object-space distances: the root mean square distance, weighted by area,
+ * of the collapsed vertices from the planes of the original triangles around them.
+ */
+#include "renderer/transform.h"
+#include <stdint.h>
+#include <vector>
+
+#define MESH_LOD_MAX_LEVELS 8
+// Each LOD aims for this fraction of the previous LOD's triangles.
+#define MESH_LOD_REDUCTION 0.5f
+// The chain stops at a LOD with fewer triangles than this,
+#define MESH_LOD_MIN_TRIANGLES 64
+// or when simplification can reduce a LOD by less than this fraction.
+#define MESH_LOD_MIN_REDUCTION 0.1f
+
+// Writes at most num_indices indices to destination and returns the number written.
+// Stops at target_num_indices, or earlier if no more edges can be collapsed.
+uint32_t simplify_mesh(uint32_t *destination,
+                       const uint32_t *indices, uint32_t num_indices,
+                       const vec3 *positions, uint32_t num_vertices,
+                       uint32_t target_num_indices,
+                       float *result_error);
+
+struct MeshLodLevel
+{
+    std::vector<uint32_t> indices;
+    float error; // Object-space deviation from LOD 0, see above.
+};
+// LOD 0 is the given mesh with an error of 0. Each further LOD is simplified from LOD 0.
+void build_lod_chain(std::vector<MeshLodLevel> *lods,
+                     const uint32_t *indices, uint32_t num_indices,
+                     const vec3 *positions, uint32_t num_vertices,
+                     uint32_t max_levels);
+
+#endif // RENDERER_MESH_SIMPLIFY_H_
@@ -0,0 +1,298 @@
+#include "renderer/meshlet_culler.h"
+#include "ansi_color.h"
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <assert.h>
+
+#define NUM_BINDINGS 5
+
+bool MeshletCuller::init(VulkanSystem *_vk, const char *shader_directory)
+{
+    vk = _vk;
+    struct {
+        VulkanBuffer *buffer;
+        VkDeviceSize size;
+        VkBufferUsageFlags usage;
+    } buffers[NUM_BINDINGS] = {
+        { &meshlet_buffer, MESHLET_CULLER_DEFAULT_MESHLET_CAPACITY * sizeof(GpuMeshlet),
+          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT },
+        { &vertex_buffer, MESHLET_CULLER_DEFAULT_VERTEX_CAPACITY * sizeof(uint32_t),
+          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT },
+        { &triangle_buffer, MESHLET_CULLER_DEFAULT_TRIANGLE_CAPACITY * sizeof(uint32_t),
+          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT },
+        { &output_index_buffer, 3 * MESHLET_CULLER_DEFAULT_TRIANGLE_CAPACITY * sizeof(uint32_t),
+          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT },
+        { &draw_buffer, MESHLET_CULLER_DEFAULT_DRAW_CAPACITY * sizeof(VkDrawIndexedIndirectCommand),
+          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT },
+    };
+    for (int i = 0; i < NUM_BINDINGS; i++)
+    {
+        if ( !CreateVulkanBuffer(vk, buffers[i].size, buffers[i].usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffers[i].buffer) )
+        {
+            fprintf(stderr, C_RED "[%s] Failed to create meshlet culling buffer %d.\n" C_RESET, __func__, i);
+            for (int j = 0; j < i; j++) DestroyVulkanBuffer(vk, buffers[j].buffer);
+            return false;
+        }
+    }
+    meshlet_ranges.init(MESHLET_CULLER_DEFAULT_MESHLET_CAPACITY);
+    vertex_ranges.init(MESHLET_CULLER_DEFAULT_VERTEX_CAPACITY);
+    triangle_ranges.init(MESHLET_CULLER_DEFAULT_TRIANGLE_CAPACITY);
+    output_index_ranges.init(3 * MESHLET_CULLER_DEFAULT_TRIANGLE_CAPACITY);
+    draw_ranges.init(MESHLET_CULLER_DEFAULT_DRAW_CAPACITY);
+
+    {
+        VkDescriptorSetLayoutBinding bindings[NUM_BINDINGS];
+        for (int i = 0; i < NUM_BINDINGS; i++)
+        {
+            bindings[i] = {};
+            bindings[i].binding = i;
+            bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            bindings[i].descriptorCount = 1;
+            bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        }
+        VkDescriptorSetLayoutCreateInfo info = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+        info.bindingCount = NUM_BINDINGS;
+        info.pBindings = bindings;
+        VK_SUCCEED( vkCreateDescriptorSetLayout(vk->device, &info, nullptr, &descriptor_set_layout) );
+    }
+    {
+        VkDescriptorPoolSize pool_size = { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, NUM_BINDINGS };
+        VkDescriptorPoolCreateInfo info = { VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+        info.maxSets = 1;
+        info.poolSizeCount = 1;
+        info.pPoolSizes = &pool_size;
+        VK_SUCCEED( vkCreateDescriptorPool(vk->device, &info, nullptr, &descriptor_pool) );
+    }
+    {
+        VkDescriptorSetAllocateInfo info = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+        info.descriptorPool = descriptor_pool;
+        info.descriptorSetCount = 1;
+        info.pSetLayouts = &descriptor_set_layout;
+        VK_SUCCEED( vkAllocateDescriptorSets(vk->device, &info, &descriptor_set) );
+
+        VkDescriptorBufferInfo buffer_infos[NUM_BINDINGS];
+        VkWriteDescriptorSet writes[NUM_BINDINGS];
+        for (int i = 0; i < NUM_BINDINGS; i++)
+        {
+            buffer_infos[i] = { buffers[i].buffer->buffer, 0, VK_WHOLE_SIZE };
+            writes[i] = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+            writes[i].dstSet = descriptor_set;
+            writes[i].dstBinding = i;
+            writes[i].descriptorCount = 1;
+            writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            writes[i].pBufferInfo = &buffer_infos[i];
+        }
+        vkUpdateDescriptorSets(vk->device, NUM_BINDINGS, writes, 0, nullptr);
+    }
+    {
+        VkPushConstantRange range = {};
+        range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        range.offset = 0;
+        range.size = sizeof(PushConstants);
+        VkPipelineLayoutCreateInfo info = { VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+        info.setLayoutCount = 1;
+        info.pSetLayouts = &descriptor_set_layout;
+        info.pushConstantRangeCount = 1;
+        info.pPushConstantRanges = &range;
+        VK_SUCCEED( vkCreatePipelineLayout(vk->device, &info, nullptr, &pipeline_layout) );
+    }
+    {
+        char shader_path[1024];
+        snprintf(shader_path, sizeof(shader_path), "%s/meshlet_cull.comp.spv", shader_directory);
+        VkShaderModule shader_module;
+        if ( !CreateVulkanShaderModule(vk, shader_path, &shader_module) )
+        {
+            fprintf(stderr, C_RED "[%s] Failed to load the meshlet culling shader.\n" C_RESET, __func__);
+            pipeline = VK_NULL_HANDLE;
+            destroy();
+            return false;
+        }
+        VkComputePipelineCreateInfo info = { VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+        info.stage = { VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO };
+        info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        info.stage.module = shader_module;
+        info.stage.pName = "main";
+        info.layout = pipeline_layout;
+        VK_SUCCEED( vkCreateComputePipelines(vk->device, VK_NULL_HANDLE, 1, &info, nullptr, &pipeline) );
+        vkDestroyShaderModule(vk->device, shader_module, nullptr);
+    }
+    return true;
+}
+
+void MeshletCuller::destroy()
+{
+    vkDestroyPipeline(vk->device, pipeline, nullptr);
+    vkDestroyPipelineLayout(vk->device, pipeline_layout, nullptr);
+    vkDestroyDescriptorPool(vk->device, descriptor_pool, nullptr);
+    vkDestroyDescriptorSetLayout(vk->device, descriptor_set_layout, nullptr);
+    DestroyVulkanBuffer(vk, &draw_buffer);
+    DestroyVulkanBuffer(vk, &output_index_buffer);
+    DestroyVulkanBuffer(vk, &triangle_buffer);
+    DestroyVulkanBuffer(vk, &vertex_buffer);
+    DestroyVulkanBuffer(vk, &meshlet_buffer);
+}
+
+bool MeshletCuller::add_mesh(StagingUploader *uploader, const MeshletData &data, MeshletAllocation *allocation)
+{
+    MeshletAllocation a;
+    a.num_meshlets = data.meshlets.size();
+    a.num_vertices = data.vertices.size();
+    a.num_triangles = data.triangles.size();
+    assert(a.num_meshlets > 0);
+
+    // Allocate everything, unwinding on failure.
+    struct {
+        RangeAllocator *ranges;
+        uint32_t size;
+        uint32_t *offset;
+        const char *name;
+    } requests[] = {
+        { &meshlet_ranges, a.num_meshlets, &a.first_meshlet, "meshlet" },
+        { &vertex_ranges, a.num_vertices, &a.vertex_offset, "vertex" },
+        { &triangle_ranges, a.num_triangles, &a.triangle_offset, "triangle" },
+        { &output_index_ranges, 3 * a.num_triangles, &a.output_first_index, "output index" },
+        { &draw_ranges, 1, &a.draw_index, "draw" },
+    };
+    int num_requests = sizeof(requests) / sizeof(requests[0]);
+    for (int i = 0; i < num_requests; i++)
+    {
+        if ( !requests[i].ranges->allocate(requests[i].size, 1, requests[i].offset) )
+        {
+            fprintf(stderr, C_RED "[%s] Meshlet culler is out of %s space (%u/%u used, %u requested).\n" C_RESET,
+                    __func__, requests[i].name, requests[i].ranges->used(), requests[i].ranges->capacity(), requests[i].size);
+            for (int j = 0; j < i; j++) requests[j].ranges->free(*requests[j].offset, requests[j].size);
+            return false;
+        }
+    }
+
+    VkDeviceSize meshlet_bytes = a.num_meshlets * sizeof(GpuMeshlet);
+    VkDeviceSize vertex_bytes = a.num_vertices * sizeof(uint32_t);
+    VkDeviceSize triangle_bytes = a.num_triangles * sizeof(uint32_t);
+    VkDeviceSize draw_bytes = sizeof(VkDrawIndexedIndirectCommand);
+    uint8_t *staging = uploader->begin(meshlet_bytes + vertex_bytes + triangle_bytes + draw_bytes);
+    assert(staging != nullptr);
+
+    // Meshlet offsets are made absolute into the shared buffers.
+    GpuMeshlet *gpu_meshlets = (GpuMeshlet *) staging;
+    for (uint32_t i = 0; i < a.num_meshlets; i++)
+    {
+        const Meshlet &meshlet = data.meshlets[i];
+        const MeshletBounds &bounds = data.bounds[i];
+        gpu_meshlets[i].sphere = vec4(bounds.center, bounds.radius);
+        gpu_meshlets[i].cone = vec4(bounds.cone_axis, bounds.cone_cutoff);
+        gpu_meshlets[i].vertex_offset = a.vertex_offset + meshlet.vertex_offset;
+        gpu_meshlets[i].triangle_offset = a.triangle_offset + meshlet.triangle_offset;
+        gpu_meshlets[i].vertex_count = meshlet.vertex_count;
+        gpu_meshlets[i].triangle_count = meshlet.triangle_count;
+    }
+    memcpy(staging + meshlet_bytes, &data.vertices[0], vertex_bytes);
+    memcpy(staging + meshlet_bytes + vertex_bytes, &data.triangles[0], triangle_bytes);
+    // Only the index count of the draw changes after this, when it is reset and accumulated by the cull.
+    VkDrawIndexedIndirectCommand *draw = (VkDrawIndexedIndirectCommand *) (staging + meshlet_bytes + vertex_bytes + triangle_bytes);
+    draw->indexCount = 0;
+    draw->instanceCount = 1;
+    draw->firstIndex = a.output_first_index;
+    draw->vertexOffset = 0;
+    draw->firstInstance = 0;
+
+    VkDeviceSize offset = 0;
+    uploader->copy_to_buffer(offset, meshlet_buffer.buffer, a.first_meshlet * sizeof(GpuMeshlet), meshlet_bytes);
+    offset += meshlet_bytes;
+    uploader->copy_to_buffer(offset, vertex_buffer.buffer, a.vertex_offset * sizeof(uint32_t), vertex_bytes);
+    offset += vertex_bytes;
+    uploader->copy_to_buffer(offset, triangle_buffer.buffer, a.triangle_offset * sizeof(uint32_t), triangle_bytes);
+    offset += triangle_bytes;
+    uploader->copy_to_buffer(offset, draw_buffer.buffer, a.draw_index * sizeof(VkDrawIndexedIndirectCommand), draw_bytes);
+    uploader->end_and_wait(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+    *allocation = a;
+    return true;
+}
+
+void MeshletCuller::remove_mesh(const MeshletAllocation &allocation)
+{
+    meshlet_ranges.free(allocation.first_meshlet, allocation.num_meshlets);
+    vertex_ranges.free(allocation.vertex_offset, allocation.num_vertices);
+    triangle_ranges.free(allocation.triangle_offset, allocation.num_triangles);
+    output_index_ranges.free(allocation.output_first_index, 3 * allocation.num_triangles);
+    draw_ranges.free(allocation.draw_index, 1);
+}
+
+void MeshletCuller::record_cull(VkCommandBuffer command_buffer, const MeshletCullRequest *requests, uint32_t num_requests)
+{
+    if ( num_requests == 0 ) return;
+
+    // The previous use of the draws and output indices must finish before they are rewritten.
+    {
+        VkMemoryBarrier barrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+        barrier.srcAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        vkCmdPipelineBarrier(command_buffer,
+                             VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                             1, &barrier, 0, nullptr, 0, nullptr);
+    }
+    for (uint32_t r = 0; r < num_requests; r++)
+    {
+        const MeshletCullRequest &request = requests[r];
+        vkCmdFillBuffer(command_buffer,
+                        draw_buffer.buffer,
+                        request.allocation->draw_index * sizeof(VkDrawIndexedIndirectCommand) + offsetof(VkDrawIndexedIndirectCommand, indexCount),
+                        sizeof(uint32_t),
+                        0);
+        vkCmdFillBuffer(command_buffer,
+                        draw_buffer.buffer,
+                        request.allocation->draw_index * sizeof(VkDrawIndexedIndirectCommand) + offsetof(VkDrawIndexedIndirectCommand, firstInstance),
+                        sizeof(uint32_t),
+                        request.instance_index);
+    }
+    {
+        VkMemoryBarrier barrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        vkCmdPipelineBarrier(command_buffer,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                             1, &barrier, 0, nullptr, 0, nullptr);
+    }
+
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline_layout, 0, 1, &descriptor_set, 0, nullptr);
+    for (uint32_t r = 0; r < num_requests; r++)
+    {
+        const MeshletCullRequest &request = requests[r];
+        PushConstants push_constants;
+        for (int i = 0; i < 6; i++) push_constants.frustum_planes[i] = request.frustum.planes[i];
+        push_constants.viewpoint = request.viewpoint;
+        push_constants.first_meshlet = request.allocation->first_meshlet;
+        push_constants.num_meshlets = request.allocation->num_meshlets;
+        push_constants.vertex_offset = (uint32_t) request.mesh_vertex_offset;
+        push_constants.draw_index = request.allocation->draw_index;
+        vkCmdPushConstants(command_buffer, pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &push_constants);
+        vkCmdDispatch(command_buffer, request.allocation->num_meshlets, 1, 1);
+    }
+
+    {
+        VkMemoryBarrier barrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+        vkCmdPipelineBarrier(command_buffer,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0,
+                             1, &barrier, 0, nullptr, 0, nullptr);
+    }
+}
+
+void MeshletCuller::bind_index_buffer(VkCommandBuffer command_buffer)
+{
+    vkCmdBindIndexBuffer(command_buffer, output_index_buffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+}
+
+void MeshletCuller::record_draw(VkCommandBuffer command_buffer, const MeshletAllocation &allocation)
+{
+    vkCmdDrawIndexedIndirect(command_buffer,
+                             draw_buffer.buffer,
+                             allocation.draw_index * sizeof(VkDrawIndexedIndirectCommand),
+                             1,
+                             sizeof(VkDrawIndexedIndirectCommand));
+}
@@ -0,0 +1,106 @@
+#ifndef RENDERER_MESHLET_CULLER_H_
+#define RENDERER_MESHLET_CULLER_H_
+/* meshlet_culler.h
+ *
+ * GPU culling of meshlets (see meshlets.h) before rasterization.
+ *
+ * Meshlet descriptors, vertex lists and packed triangles of all meshes are sub-allocated from
+ * shared storage buffers. Each frame, the meshlet_cull compute shader culls a mesh's meshlets
+ * against the frustum and their normal cones and expands the visible ones into a 32-bit index
+ * buffer region reserved for that mesh, counting indices into the mesh's indirect draw.
+ * The expanded indices are absolute into the mesh pool vertex buffer, so the draw uses a
+ * vertexOffset of 0.
+ *
+ * This path only needs compute shaders and indirect draws, so it works where mesh shaders are
+ * not available (e.g. lavapipe).
+ */
+#include "engine/platform/vk.h"
+#include "renderer/meshlets.h"
+#include "renderer/mesh_pool.h"
+#include "renderer/staging_uploader.h"
+#include "renderer/camera.hh"
+#include <vector>
+
+#define MESHLET_CULLER_DEFAULT_MESHLET_CAPACITY (1u << 18)
+#define MESHLET_CULLER_DEFAULT_VERTEX_CAPACITY (1u << 24)
+#define MESHLET_CULLER_DEFAULT_TRIANGLE_CAPACITY (1u << 23)
+#define MESHLET_CULLER_DEFAULT_DRAW_CAPACITY 4096u
+
+struct MeshletAllocation
+{
+    uint32_t first_meshlet;
+    uint32_t num_meshlets;
+    uint32_t vertex_offset;   // Into the meshlet vertex buffer.
+    uint32_t num_vertices;
+    uint32_t triangle_offset; // Into the meshlet triangle buffer.
+    uint32_t num_triangles;
+    uint32_t output_first_index; // Region of 3*num_triangles indices in the expanded index buffer.
+    uint32_t draw_index;
+};
+
+struct MeshletCullRequest
+{
+    const MeshletAllocation *allocation;
+    int32_t mesh_vertex_offset; // The mesh's base vertex in the mesh pool.
+    uint32_t instance_index;    // Written to the indirect draw's firstInstance.
+    // In the mesh's object space.
+    Frustum frustum;
+    vec3 viewpoint;
+};
+
+class MeshletCuller
+{
+public:
+    // Loads meshlet_cull.comp.spv from the directory of compiled shaders.
+    bool init(VulkanSystem *vk, const char *shader_directory);
+    void destroy();
+
+    bool add_mesh(StagingUploader *uploader, const MeshletData &data, MeshletAllocation *allocation);
+    void remove_mesh(const MeshletAllocation &allocation);
+
+    // Reset the draws of the given meshes, cull their meshlets and make the results visible to
+    // indirect draws. Record outside of a render pass.
+    void record_cull(VkCommandBuffer command_buffer, const MeshletCullRequest *requests, uint32_t num_requests);
+
+    void bind_index_buffer(VkCommandBuffer command_buffer);
+    void record_draw(VkCommandBuffer command_buffer, const MeshletAllocation &allocation);
+private:
+    struct GpuMeshlet
+    {
+        vec4 sphere;
+        vec4 cone;
+        uint32_t vertex_offset;
+        uint32_t triangle_offset;
+        uint32_t vertex_count;
+        uint32_t triangle_count;
+    };
+    struct PushConstants
+    {
+        vec4 frustum_planes[6];
+        vec3 viewpoint;
+        uint32_t first_meshlet;
+        uint32_t num_meshlets;
+        uint32_t vertex_offset;
+        uint32_t draw_index;
+    };
+
+    VulkanSystem *vk;
+    VulkanBuffer meshlet_buffer;
+    VulkanBuffer vertex_buffer;
+    VulkanBuffer triangle_buffer;
+    VulkanBuffer output_index_buffer;
+    VulkanBuffer draw_buffer;
+    RangeAllocator meshlet_ranges;
+    RangeAllocator vertex_ranges;
+    RangeAllocator triangle_ranges;
+    RangeAllocator output_index_ranges;
+    RangeAllocator draw_ranges;
+
+    VkDescriptorSetLayout descriptor_set_layout;
+    VkDescriptorPool descriptor_pool;
+    VkDescriptorSet descriptor_set;
+    VkPipelineLayout pipeline_layout;
+    VkPipeline pipeline;
+};
+
+#endif // RENDERER_MESHLET_CULLER_H_
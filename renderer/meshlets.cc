@@ -0,0 +1,127 @@
+#include "renderer/meshlets.h"
+#include <math.h>
+#include <assert.h>
+#include <algorithm>
+
+static MeshletBounds compute_meshlet_bounds(const MeshletData &data, const Meshlet &meshlet, const vec3 *positions)
+{
+    MeshletBounds bounds;
+
+    // Bounding sphere around the center of the bounding box.
+    vec3 box_min = positions[data.vertices[meshlet.vertex_offset]];
+    vec3 box_max = box_min;
+    for (uint32_t i = 1; i < meshlet.vertex_count; i++)
+    {
+        vec3 p = positions[data.vertices[meshlet.vertex_offset + i]];
+        box_min = glm::min(box_min, p);
+        box_max = glm::max(box_max, p);
+    }
+    bounds.center = 0.5f * (box_min + box_max);
+    bounds.radius = 0;
+    for (uint32_t i = 0; i < meshlet.vertex_count; i++)
+    {
+        vec3 p = positions[data.vertices[meshlet.vertex_offset + i]];
+        bounds.radius = std::max(bounds.radius, glm::length(p - bounds.center));
+    }
+
+    // Normal cone around the average triangle normal.
+    std::vector<vec3> normals;
+    normals.reserve(meshlet.triangle_count);
+    vec3 normal_sum = vec3(0);
+    for (uint32_t t = 0; t < meshlet.triangle_count; t++)
+    {
+        uint32_t packed = data.triangles[meshlet.triangle_offset + t];
+        vec3 a = positions[data.vertices[meshlet.vertex_offset + (packed & 0xFF)]];
+        vec3 b = positions[data.vertices[meshlet.vertex_offset + ((packed >> 8) & 0xFF)]];
+        vec3 c = positions[data.vertices[meshlet.vertex_offset + ((packed >> 16) & 0xFF)]];
+        vec3 n = glm::cross(b - a, c - a);
+        float length = glm::length(n);
+        if ( length == 0 ) continue; // Degenerate triangles can't be seen, so don't constrain the cone.
+        n /= length;
+        normals.push_back(n);
+        normal_sum += n;
+    }
+    bounds.cone_axis = vec3(0,0,1);
+    bounds.cone_cutoff = 1;
+    float sum_length = glm::length(normal_sum);
+    if ( normals.empty() || sum_length == 0 ) return bounds;
+    bounds.cone_axis = normal_sum / sum_length;
+    float min_dot = 1;
+    for (vec3 n : normals) min_dot = std::min(min_dot, glm::dot(n, bounds.cone_axis));
+    if ( min_dot <= 0 ) return bounds;
+    // A normal at angle theta from the axis faces away from every view direction within 90 - theta
+    // degrees of the axis, so the cutoff is cos(90 - theta) = sin(theta).
+    bounds.cone_cutoff = sqrtf(1 - min_dot*min_dot);
+    return bounds;
+}
+
+void build_meshlets(MeshletData *data,
+                    const uint32_t *indices, uint32_t num_indices,
+                    const vec3 *positions, uint32_t num_vertices)
+{
+    assert(num_indices % 3 == 0);
+    data->meshlets.clear();
+    data->bounds.clear();
+    data->vertices.clear();
+    data->triangles.clear();
+
+    // Mesh vertex -> local index in the current meshlet. Stale entries are detected by checking
+    // the local index against the current meshlet's vertex list.
+    std::vector<uint8_t> local_index(num_vertices, 0);
+    auto in_meshlet = [&](const Meshlet &m, uint32_t v) {
+        uint8_t l = local_index[v];
+        return l < m.vertex_count && data->vertices[m.vertex_offset + l] == v;
+    };
+
+    Meshlet meshlet = {0, 0, 0, 0};
+    auto flush = [&]() {
+        if ( meshlet.triangle_count == 0 ) return;
+        data->meshlets.push_back(meshlet);
+        meshlet.vertex_offset = data->vertices.size();
+        meshlet.triangle_offset = data->triangles.size();
+        meshlet.vertex_count = 0;
+        meshlet.triangle_count = 0;
+    };
+    for (uint32_t i = 0; i < num_indices; i += 3)
+    {
+        const uint32_t *tri = &indices[i];
+        uint32_t new_vertices = 0;
+        for (int k = 0; k < 3; k++)
+        {
+            bool repeated = (k >= 1 && tri[k] == tri[0]) || (k == 2 && tri[2] == tri[1]);
+            if ( !repeated && !in_meshlet(meshlet, tri[k]) ) new_vertices++;
+        }
+        if ( meshlet.vertex_count + new_vertices > MESHLET_MAX_VERTICES || meshlet.triangle_count + 1 > MESHLET_MAX_TRIANGLES )
+            flush();
+
+        uint32_t local[3];
+        for (int k = 0; k < 3; k++)
+        {
+            uint32_t v = tri[k];
+            if ( !in_meshlet(meshlet, v) )
+            {
+                local_index[v] = meshlet.vertex_count++;
+                data->vertices.push_back(v);
+            }
+            local[k] = local_index[v];
+        }
+        data->triangles.push_back(local[0] | (local[1] << 8) | (local[2] << 16));
+        meshlet.triangle_count++;
+    }
+    flush();
+
+    data->bounds.reserve(data->meshlets.size());
+    for (const Meshlet &m : data->meshlets)
+        data->bounds.push_back(compute_meshlet_bounds(*data, m, positions));
+}
+
+bool meshlet_is_culled(const MeshletBounds &bounds, const Frustum &frustum, vec3 viewpoint)
+{
+    for (int i = 0; i < 6; i++)
+    {
+        if ( glm::dot(frustum.planes[i], vec4(bounds.center, 1)) < -bounds.radius )
+            return true;
+    }
+    vec3 to_center = bounds.center - viewpoint;
+    return glm::dot(to_center, bounds.cone_axis) >= bounds.cone_cutoff * glm::length(to_center) + bounds.radius * (1 + bounds.cone_cutoff);
+}
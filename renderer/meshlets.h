@@ -0,0 +1,53 @@
+#ifndef RENDERER_MESHLETS_H_
+#define RENDERER_MESHLETS_H_
+/* meshlets.h
+ *
+ * Splitting of triangle-list meshes into meshlets: small clusters with bounded vertex and
+ * triangle counts, each with a bounding sphere and a normal cone for culling.
+ *
+ * Meshlets are built greedily in index order, so the index buffer should be optimized for
+ * vertex cache locality first (see mesh_optimize.h) to get compact meshlets.
+ */
+#include "renderer/transform.h"
+#include "renderer/camera.hh"
+#include <stdint.h>
+#include <vector>
+
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+
+struct Meshlet
+{
+    uint32_t vertex_offset;   // Into MeshletData::vertices.
+    uint32_t triangle_offset; // Into MeshletData::triangles.
+    uint32_t vertex_count;
+    uint32_t triangle_count;
+};
+
+struct MeshletBounds
+{
+    vec3 center;
+    float radius;
+    // All triangle normals lie within the cone around axis. The meshlet is backfacing from any viewpoint
+    // for which dot(center - viewpoint, axis) >= cone_cutoff * |center - viewpoint| + radius * (1 + cone_cutoff).
+    // A cutoff of 1 means the cone is too wide to ever cull.
+    vec3 cone_axis;
+    float cone_cutoff;
+};
+
+struct MeshletData
+{
+    std::vector<Meshlet> meshlets;
+    std::vector<MeshletBounds> bounds;
+    std::vector<uint32_t> vertices;  // Mesh vertex indices referenced by each meshlet.
+    std::vector<uint32_t> triangles; // Meshlet-local indices, packed as i0 | i1 << 8 | i2 << 16.
+};
+
+void build_meshlets(MeshletData *data,
+                    const uint32_t *indices, uint32_t num_indices,
+                    const vec3 *positions, uint32_t num_vertices);
+
+// Tests in object space. The frustum planes and viewpoint should be transformed into the mesh's object space.
+bool meshlet_is_culled(const MeshletBounds &bounds, const Frustum &frustum, vec3 viewpoint);
+
+#endif // RENDERER_MESHLETS_H_
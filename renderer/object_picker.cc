@@ -0,0 +1,134 @@
+#include "renderer/object_picker.h"
+#include "ansi_color.h"
+#include <stdio.h>
+#include <assert.h>
+#include <math.h>
+#include <algorithm>
+
+bool ObjectPicker::init(VulkanSystem *vk, uint32_t num_frames)
+{
+    assert(num_frames <= OBJECT_PICKER_MAX_FRAMES);
+    m_vk = vk;
+    m_num_frames = num_frames;
+    VkDeviceSize size = OBJECT_PICKER_REGION_SIZE * OBJECT_PICKER_REGION_SIZE * sizeof(uint32_t);
+    for (uint32_t i = 0; i < num_frames; i++)
+    {
+        m_regions[i].pending = false;
+        if ( !CreateVulkanBuffer(vk, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, &m_readback[i]) )
+        {
+            fprintf(stderr, C_RED "[%s] Failed to create the readback buffers.\n" C_RESET, __func__);
+            for (uint32_t j = 0; j < i; j++) DestroyVulkanBuffer(vk, &m_readback[j]);
+            return false;
+        }
+    }
+    return true;
+}
+
+void ObjectPicker::destroy()
+{
+    for (uint32_t i = 0; i < m_num_frames; i++) DestroyVulkanBuffer(m_vk, &m_readback[i]);
+}
+
+void ObjectPicker::begin_frame(uint32_t frame)
+{
+    assert(frame < m_num_frames);
+    m_frame = frame;
+    m_has_result = false;
+    Region &region = m_regions[frame];
+    if ( !region.pending ) return;
+    region.pending = false;
+
+    const VulkanBuffer &readback = m_readback[frame];
+    if ( !(readback.memory_properties & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) )
+    {
+        VkMappedMemoryRange range = { VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE };
+        range.memory = readback.memory;
+        range.offset = 0;
+        range.size = VK_WHOLE_SIZE;
+        VK_SUCCEED( vkInvalidateMappedMemoryRanges(m_vk->device, 1, &range) );
+    }
+    const uint32_t *ids = (const uint32_t *) readback.mapped;
+    m_result.x = region.x;
+    m_result.y = region.y;
+    m_result.frame = frame;
+    m_result.id = ids[region.center_y * region.width + region.center_x];
+    m_result.nearest_id = m_result.id;
+    if ( m_result.id == OBJECT_PICKER_ID_NULL )
+    {
+        uint32_t nearest_distance = UINT32_MAX;
+        for (uint32_t y = 0; y < region.height; y++)
+        {
+            for (uint32_t x = 0; x < region.width; x++)
+            {
+                uint32_t id = ids[y * region.width + x];
+                if ( id == OBJECT_PICKER_ID_NULL ) continue;
+                int dx = (int) x - (int) region.center_x;
+                int dy = (int) y - (int) region.center_y;
+                uint32_t distance = dx*dx + dy*dy;
+                if ( distance < nearest_distance )
+                {
+                    nearest_distance = distance;
+                    m_result.nearest_id = id;
+                }
+            }
+        }
+    }
+    m_has_result = true;
+}
+
+void ObjectPicker::request(float x, float y)
+{
+    m_requested = true;
+    m_request_x = x;
+    m_request_y = y;
+}
+
+void ObjectPicker::record(VkCommandBuffer command_buffer, VkImage ids, VkExtent2D render_extent, uint32_t width, uint32_t height)
+{
+    assert(m_requested && width > 0 && height > 0);
+    m_requested = false;
+    // The render pixel the point is in, clamped to the view.
+    int32_t x = (int32_t) floorf(m_request_x * render_extent.width / width);
+    int32_t y = (int32_t) floorf(m_request_y * render_extent.height / height);
+    x = std::clamp(x, 0, (int32_t) render_extent.width - 1);
+    y = std::clamp(y, 0, (int32_t) render_extent.height - 1);
+    // The region, cut off at the edges of the view.
+    const int32_t radius = OBJECT_PICKER_REGION_SIZE / 2;
+    int32_t x0 = std::max(x - radius, 0);
+    int32_t y0 = std::max(y - radius, 0);
+    int32_t x1 = std::min(x + radius + 1, (int32_t) render_extent.width);
+    int32_t y1 = std::min(y + radius + 1, (int32_t) render_extent.height);
+
+    Region &region = m_regions[m_frame];
+    region.pending = true;
+    region.x = m_request_x;
+    region.y = m_request_y;
+    region.width = x1 - x0;
+    region.height = y1 - y0;
+    region.center_x = x - x0;
+    region.center_y = y - y0;
+
+    VkBufferImageCopy copy = {};
+    copy.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+    copy.imageOffset = { x0, y0, 0 };
+    copy.imageExtent = { region.width, region.height, 1 };
+    vkCmdCopyImageToBuffer(command_buffer, ids, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, m_readback[m_frame].buffer, 1, &copy);
+    VkBufferMemoryBarrier barrier = { VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER };
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = m_readback[m_frame].buffer;
+    barrier.offset = 0;
+    barrier.size = VK_WHOLE_SIZE;
+    vkCmdPipelineBarrier(command_buffer,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+                         0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+bool ObjectPicker::result(ObjectPick *pick) const
+{
+    if ( !m_has_result ) return false;
+    *pick = m_result;
+    return true;
+}
@@ -0,0 +1,85 @@
+#ifndef RENDERER_OBJECT_PICKER_H_
+#define RENDERER_OBJECT_PICKER_H_
+/* object_picker.h
+ *
+ * Picking what is drawn at a point of the view from the main pass's ID target, without waiting
+ * for the GPU.
+ *
+ * A pick is requested for a point of the framebuffer, e.g. a MouseEvent's cursor. The next frame
+ * recorded copies a square of OBJECT_PICKER_REGION_SIZE IDs around the point from the ID target
+ * into the frame slot's readback buffer, and the IDs are read when the frame slot is reused,
+ * whose GPU work has then completed (see DisplayRefreshEvent). So the result is a few frames
+ * late, but exact to the pixel drawn, however dense the scene. Besides the ID under the point,
+ * the nearest ID in the region is found, so that thin objects can be picked without hitting
+ * their pixels exactly.
+ *
+ * The view may be rendered at a lower resolution than the framebuffer (see dynamic_resolution.h),
+ * so points are scaled to the render extent the frame was drawn at.
+ */
+#include "engine/platform/vk.h"
+#include <stdint.h>
+
+#define OBJECT_PICKER_MAX_FRAMES 4
+// In render pixels. Odd, so that the requested point is at its center.
+#define OBJECT_PICKER_REGION_SIZE 9
+// Where nothing was drawn, see main_pass.h.
+#define OBJECT_PICKER_ID_NULL 0
+
+struct ObjectPick
+{
+    // The requested point, in framebuffer pixels.
+    float x;
+    float y;
+    // The frame slot it was recorded in.
+    uint32_t frame;
+    uint32_t id;
+    // The nearest to the point in the region, which is id unless that is OBJECT_PICKER_ID_NULL.
+    uint32_t nearest_id;
+};
+
+class ObjectPicker
+{
+public:
+    bool init(VulkanSystem *vk, uint32_t num_frames);
+    void destroy();
+
+    // Read back the pick recorded in the frame slot's previous use, whose GPU work has completed.
+    void begin_frame(uint32_t frame);
+    // Pick at a point of the framebuffer, in pixels from its top left, in the next frame
+    // recorded. A later request before then replaces it.
+    void request(float x, float y);
+    bool requested() const { return m_requested; }
+    // The frame slot being recorded.
+    uint32_t frame() const { return m_frame; }
+    // Copy the region around the requested point from the ID target, which the main pass leaves
+    // in VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, drawn over the render extent of a framebuffer size.
+    void record(VkCommandBuffer command_buffer, VkImage ids, VkExtent2D render_extent, uint32_t width, uint32_t height);
+    // The pick read back by the last begin_frame, if any.
+    bool result(ObjectPick *pick) const;
+private:
+    // Where a frame slot's region was copied from, pending until read back.
+    struct Region
+    {
+        bool pending;
+        float x;
+        float y;
+        uint32_t width;
+        uint32_t height;
+        // The requested point, in the region.
+        uint32_t center_x;
+        uint32_t center_y;
+    };
+
+    VulkanSystem *m_vk;
+    uint32_t m_num_frames;
+    uint32_t m_frame = 0;
+    bool m_requested = false;
+    float m_request_x;
+    float m_request_y;
+    Region m_regions[OBJECT_PICKER_MAX_FRAMES];
+    VulkanBuffer m_readback[OBJECT_PICKER_MAX_FRAMES];
+    bool m_has_result = false;
+    ObjectPick m_result;
+};
+
+#endif // RENDERER_OBJECT_PICKER_H_
@@ -0,0 +1,205 @@
+#include "renderer/path_tracer.h"
+#include "renderer/image_file.h"
+#include <assert.h>
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+
+// PCG hash ("Hash Functions for GPU Rendering", Jarzynski and Olano), used to seed and step each
+// path's random numbers, so samples don't depend on which worker traced them.
+static uint32_t pcg_hash(uint32_t v)
+{
+    uint32_t state = v * 747796405u + 2891336453u;
+    uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+// In [0, 1).
+static float random_float(uint32_t *state)
+{
+    *state = pcg_hash(*state);
+    return (*state >> 8) * (1.f / 16777216.f);
+}
+
+// A cosine-weighted direction about the unit normal, in the orthonormal basis of "Building an
+// Orthonormal Basis, Revisited" (Duff et al.).
+static vec3 cosine_sample_hemisphere(vec3 normal, float u1, float u2)
+{
+    float r = sqrtf(u1);
+    float phi = 2 * (float) M_PI * u2;
+    float sign = copysignf(1.f, normal.z);
+    float a = -1 / (sign + normal.z);
+    float b = normal.x * normal.y * a;
+    vec3 tangent = vec3(1 + sign * normal.x * normal.x * a, sign * b, -sign * normal.x);
+    vec3 bitangent = vec3(b, sign + normal.y * normal.y * a, -normal.y);
+    return r * cosf(phi) * tangent + r * sinf(phi) * bitangent + sqrtf(std::max(0.f, 1 - u1)) * normal;
+}
+
+void PathTracer::resize(int width, int height)
+{
+    assert(width > 0 && height > 0);
+    m_width = width;
+    m_height = height;
+    m_accumulation.resize(width * height);
+    m_image.resize(4 * width * height);
+    reset();
+}
+
+void PathTracer::reset()
+{
+    m_num_samples = 0;
+    std::fill(m_accumulation.begin(), m_accumulation.end(), vec3(0));
+    std::fill(m_image.begin(), m_image.end(), 0);
+}
+
+void PathTracer::render(JobSystem *jobs, const PathTracerScene &scene)
+{
+    assert(m_width > 0 && m_height > 0);
+    if ( scene.version != m_scene_version )
+    {
+        reset();
+        m_scene_version = scene.version;
+    }
+    int tiles_x = (m_width + PATH_TRACER_TILE_SIZE - 1) / PATH_TRACER_TILE_SIZE;
+    int tiles_y = (m_height + PATH_TRACER_TILE_SIZE - 1) / PATH_TRACER_TILE_SIZE;
+    jobs->parallel_for(tiles_x * tiles_y, 1, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t tile = begin; tile < end; tile++) render_tile(scene, tile % tiles_x, tile / tiles_x);
+    });
+    m_num_samples++;
+}
+
+void PathTracer::render_tile(const PathTracerScene &scene, int tile_x, int tile_y)
+{
+    const uint32_t max_paths = PATH_TRACER_TILE_SIZE * PATH_TRACER_TILE_SIZE;
+    struct Path
+    {
+        uint32_t pixel; // In the tile.
+        uint32_t random;
+        vec3 throughput;
+    };
+    Path paths[max_paths];
+    Ray rays[max_paths];
+    RayHit hits[max_paths];
+    Ray shadow_rays[max_paths];
+    RayHit shadow_hits[max_paths];
+    vec3 shadow_radiance[max_paths]; // Reaching the camera if the shadow ray is unoccluded.
+    uint32_t shadow_pixels[max_paths];
+    vec3 radiance[max_paths];
+
+    int x0 = tile_x * PATH_TRACER_TILE_SIZE;
+    int y0 = tile_y * PATH_TRACER_TILE_SIZE;
+    int tile_width = std::min(PATH_TRACER_TILE_SIZE, m_width - x0);
+    int tile_height = std::min(PATH_TRACER_TILE_SIZE, m_height - y0);
+
+    // Primary rays, jittered within their pixels so the samples converge to the pixel's area.
+    float tan_half_fov = tanf(0.5f * scene.fov_y);
+    float aspect = m_width / (float) m_height;
+    vec3 camera_position = vec3(scene.camera_to_world[3]);
+    uint32_t num_paths = 0;
+    for (int y = 0; y < tile_height; y++)
+    {
+        for (int x = 0; x < tile_width; x++)
+        {
+            Path &path = paths[num_paths];
+            path.pixel = x + PATH_TRACER_TILE_SIZE * y;
+            path.random = pcg_hash((x0 + x + m_width * (y0 + y)) ^ pcg_hash(m_num_samples));
+            path.throughput = vec3(1);
+            radiance[path.pixel] = vec3(0);
+            float px = x0 + x + random_float(&path.random);
+            float py = y0 + y + random_float(&path.random);
+            vec3 view_direction = vec3((2 * px / m_width - 1) * tan_half_fov * aspect, (1 - 2 * py / m_height) * tan_half_fov, -1);
+            Ray &ray = rays[num_paths];
+            ray.origin = camera_position;
+            ray.direction = glm::normalize(vec3(scene.camera_to_world * vec4(view_direction, 0)));
+            ray.max_distance = FLT_MAX;
+            num_paths++;
+        }
+    }
+
+    // Extend the tile's paths a bounce at a time.
+    for (int bounce = 0; bounce < PATH_TRACER_MAX_BOUNCES && num_paths > 0; bounce++)
+    {
+        trace_rays(nullptr, RayQueryType::ClosestHit, *scene.instance_bvh, scene.instances, rays, num_paths, hits);
+        uint32_t num_shadow_rays = 0;
+        uint32_t num_continued = 0;
+        for (uint32_t i = 0; i < num_paths; i++)
+        {
+            if ( hits[i].instance == RAY_MISS ) continue;
+            Path path = paths[i];
+            Ray ray = rays[i];
+            vec3 position = ray.origin + hits[i].distance * ray.direction;
+            vec3 normal = glm::dot(hits[i].normal, ray.direction) < 0 ? hits[i].normal : -hits[i].normal;
+            float scale = std::max({1.f, fabsf(position.x), fabsf(position.y), fabsf(position.z)});
+            vec3 origin = position + PATH_TRACER_RAY_OFFSET * scale * normal;
+
+            // Sample one light, weighted by the number of lights.
+            if ( scene.num_lights > 0 )
+            {
+                uint32_t l = std::min((uint32_t) (random_float(&path.random) * scene.num_lights), scene.num_lights - 1);
+                const PathTracerLight &light = scene.lights[l];
+                vec3 to_light = light.position - origin;
+                float distance_squared = glm::dot(to_light, to_light);
+                float cosine_distance = glm::dot(normal, to_light); // The cosine times the distance.
+                if ( cosine_distance > 0 && distance_squared < light.radius * light.radius )
+                {
+                    // The shadow ray's direction spans the distance to the light, so it stops just short of it.
+                    Ray &shadow_ray = shadow_rays[num_shadow_rays];
+                    shadow_ray.origin = origin;
+                    shadow_ray.direction = to_light;
+                    shadow_ray.max_distance = 1 - PATH_TRACER_RAY_OFFSET;
+                    float irradiance = cosine_distance / (distance_squared * sqrtf(distance_squared));
+                    shadow_radiance[num_shadow_rays] = path.throughput * (PATH_TRACER_ALBEDO / (float) M_PI) * light.color
+                                                     * (irradiance * scene.num_lights);
+                    shadow_pixels[num_shadow_rays] = path.pixel;
+                    num_shadow_rays++;
+                }
+            }
+
+            // The cosine-weighted pdf cancels the diffuse BRDF's cosine and 1/pi, leaving the albedo.
+            path.throughput *= PATH_TRACER_ALBEDO;
+            if ( bounce + 1 >= PATH_TRACER_ROULETTE_BOUNCES )
+            {
+                float survival = std::min(std::max({path.throughput.x, path.throughput.y, path.throughput.z}), 0.95f);
+                if ( random_float(&path.random) >= survival ) continue;
+                path.throughput /= survival;
+            }
+            float u1 = random_float(&path.random);
+            float u2 = random_float(&path.random);
+            paths[num_continued] = path;
+            rays[num_continued].origin = origin;
+            rays[num_continued].direction = cosine_sample_hemisphere(normal, u1, u2);
+            rays[num_continued].max_distance = FLT_MAX;
+            num_continued++;
+        }
+        if ( num_shadow_rays > 0 )
+        {
+            trace_rays(nullptr, RayQueryType::AnyHit, *scene.instance_bvh, scene.instances, shadow_rays, num_shadow_rays, shadow_hits);
+            for (uint32_t i = 0; i < num_shadow_rays; i++)
+            {
+                if ( shadow_hits[i].instance == RAY_MISS ) radiance[shadow_pixels[i]] += shadow_radiance[i];
+            }
+        }
+        num_paths = num_continued;
+    }
+
+    float inverse_num_samples = 1.f / (m_num_samples + 1);
+    for (int y = 0; y < tile_height; y++)
+    {
+        for (int x = 0; x < tile_width; x++)
+        {
+            uint32_t pixel = x0 + x + m_width * (y0 + y);
+            m_accumulation[pixel] += radiance[x + PATH_TRACER_TILE_SIZE * y];
+            vec3 mean = m_accumulation[pixel] * inverse_num_samples;
+            uint8_t *rgba = &m_image[4 * pixel];
+            rgba[0] = encode_srgb(mean.x);
+            rgba[1] = encode_srgb(mean.y);
+            rgba[2] = encode_srgb(mean.z);
+            rgba[3] = 255;
+        }
+    }
+}
+
+bool PathTracer::save_image(const char *path) const
+{
+    return write_ppm_image(path, m_image.data(), m_width, m_height);
+}
@@ -0,0 +1,79 @@
+#ifndef RENDERER_PATH_TRACER_H_
+#define RENDERER_PATH_TRACER_H_
+/* path_tracer.h
+ *
+ * A progressive path tracer on the CPU, as a reference for the rasterized image, and a way to
+ * render without a GPU.
+ *
+ * Surfaces are diffuse with PATH_TRACER_ALBEDO, and point lights fall off with the inverse square
+ * of distance up to their radius, as when rasterized. Each path samples one light per bounce
+ * (next event estimation) and continues in a cosine-weighted direction, with Russian roulette
+ * after PATH_TRACER_ROULETTE_BOUNCES.
+ *
+ * Each render adds a sample per pixel to the accumulated image. The image is split into
+ * PATH_TRACER_TILE_SIZE square tiles, each traced by one job as a wavefront: the paths of the
+ * whole tile are extended a bounce at a time with batched ray queries (see ray_query.h), whose
+ * packets are coherent for primary rays. Tiles share nothing but the scene, which is read-only
+ * while rendering, so throughput scales with the number of workers.
+ */
+#include "engine/jobs/job_system.h"
+#include "renderer/ray_query.h"
+#include <stdint.h>
+#include <vector>
+
+#define PATH_TRACER_TILE_SIZE 16
+#define PATH_TRACER_MAX_BOUNCES 6
+#define PATH_TRACER_ROULETTE_BOUNCES 2
+#define PATH_TRACER_ALBEDO 0.8f
+// Secondary rays start this far off the surface, relative to the distance from the origin, so they
+// don't hit it again.
+#define PATH_TRACER_RAY_OFFSET 1e-4f
+
+struct PathTracerLight
+{
+    vec3 position;
+    float radius;
+    vec3 color;
+};
+
+struct PathTracerScene
+{
+    const Bvh *instance_bvh;
+    const RayQueryInstance *instances;
+    const PathTracerLight *lights;
+    uint32_t num_lights;
+    mat4 camera_to_world; // Rigid. The camera looks down -Z with Y up.
+    float fov_y;
+    // Accumulation restarts when this changes.
+    uint64_t version;
+};
+
+class PathTracer
+{
+public:
+    // Restarts accumulation.
+    void resize(int width, int height);
+    void reset();
+    // Add a sample to every pixel.
+    void render(JobSystem *jobs, const PathTracerScene &scene);
+
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    uint32_t num_samples() const { return m_num_samples; }
+    // The mean of the samples so far, as 8-bit sRGB RGBA rows from the top, ready to be copied
+    // into a VK_FORMAT_R8G8B8A8_SRGB image.
+    const uint8_t *image() const { return m_image.data(); }
+    // Write the image as a binary PPM.
+    bool save_image(const char *path) const;
+private:
+    void render_tile(const PathTracerScene &scene, int tile_x, int tile_y);
+
+    int m_width = 0;
+    int m_height = 0;
+    uint32_t m_num_samples = 0;
+    uint64_t m_scene_version = ~0ull;
+    std::vector<vec3> m_accumulation; // Linear radiance sums.
+    std::vector<uint8_t> m_image;
+};
+
+#endif // RENDERER_PATH_TRACER_H_
@@ -0,0 +1,479 @@
+#include "renderer/rasterizer.h"
+#include "renderer/path_tracer.h"
+#include "renderer/image_file.h"
+#include <assert.h>
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+
+#define SUBPIXEL_SCALE (1 << RASTERIZER_SUBPIXEL_BITS)
+#define NO_TRIANGLE (~0u)
+// Clipping a triangle to the near plane and the four guard band planes leaves at most 8 vertices.
+#define MAX_CLIPPED_VERTICES 8
+
+struct ClipVertex
+{
+    vec4 position;
+    vec2 barycentrics;
+};
+
+// Sutherland-Hodgman: the part of a convex polygon on the positive side of a clip space plane.
+// Clip space is linear in object space, so barycentrics are interpolated linearly too.
+static uint32_t clip_polygon(const ClipVertex *vertices, uint32_t num_vertices, vec4 plane, ClipVertex *clipped)
+{
+    uint32_t num_clipped = 0;
+    for (uint32_t i = 0; i < num_vertices; i++)
+    {
+        const ClipVertex &a = vertices[i];
+        const ClipVertex &b = vertices[(i + 1) % num_vertices];
+        float distance_a = glm::dot(plane, a.position);
+        float distance_b = glm::dot(plane, b.position);
+        if ( distance_a >= 0 ) clipped[num_clipped++] = a;
+        if ( (distance_a >= 0) != (distance_b >= 0) )
+        {
+            float t = distance_a / (distance_a - distance_b);
+            clipped[num_clipped++] = {a.position + t * (b.position - a.position), a.barycentrics + t * (b.barycentrics - a.barycentrics)};
+        }
+    }
+    return num_clipped;
+}
+
+void Rasterizer::resize(int width, int height)
+{
+    // Pixel coordinates are kept in 16 bits.
+    assert(width > 0 && height > 0 && width <= UINT16_MAX && height <= UINT16_MAX);
+    m_width = width;
+    m_height = height;
+    m_tiles_x = (width + RASTERIZER_TILE_SIZE - 1) / RASTERIZER_TILE_SIZE;
+    m_tiles_y = (height + RASTERIZER_TILE_SIZE - 1) / RASTERIZER_TILE_SIZE;
+    m_image.assign(4 * width * height, 0);
+    m_depth.assign(width * height, 1.f);
+    m_bin_offsets.resize(m_tiles_x * m_tiles_y + 1);
+}
+
+void Rasterizer::render(JobSystem *jobs, const RasterizerScene &scene)
+{
+    assert(m_width > 0 && m_height > 0);
+    m_instance_triangles.resize(scene.num_instances + 1);
+    m_instance_triangles[0] = 0;
+    for (uint32_t i = 0; i < scene.num_instances; i++)
+        m_instance_triangles[i + 1] = m_instance_triangles[i] + scene.instances[i].num_triangles;
+    uint32_t num_batches = (m_instance_triangles.back() + RASTERIZER_TRIANGLE_BATCH - 1) / RASTERIZER_TRIANGLE_BATCH;
+    assert(num_batches <= (1u << 16));
+    // Batches keep their storage between frames.
+    if ( m_batches.size() < num_batches ) m_batches.resize(num_batches);
+    jobs->parallel_for(num_batches, 1, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t b = begin; b < end; b++) set_up_batch(scene, b);
+    });
+
+    // Lay out each tile's bin by batch, so its triangles are in submission order.
+    uint32_t num_tiles = m_tiles_x * m_tiles_y;
+    uint32_t num_references = 0;
+    for (uint32_t tile = 0; tile < num_tiles; tile++)
+    {
+        m_bin_offsets[tile] = num_references;
+        for (uint32_t b = 0; b < num_batches; b++)
+        {
+            uint32_t count = m_batches[b].tile_offsets[tile];
+            m_batches[b].tile_offsets[tile] = num_references;
+            num_references += count;
+        }
+    }
+    m_bin_offsets[num_tiles] = num_references;
+    m_bins.resize(num_references);
+    jobs->parallel_for(num_batches, 1, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t b = begin; b < end; b++)
+        {
+            Batch &batch = m_batches[b];
+            for (uint32_t i = 0; i < batch.triangles.size(); i++)
+            {
+                const Triangle &triangle = batch.triangles[i];
+                for (int y = triangle.min_y / RASTERIZER_TILE_SIZE; y <= triangle.max_y / RASTERIZER_TILE_SIZE; y++)
+                {
+                    for (int x = triangle.min_x / RASTERIZER_TILE_SIZE; x <= triangle.max_x / RASTERIZER_TILE_SIZE; x++)
+                        m_bins[batch.tile_offsets[x + m_tiles_x * y]++] = (b << 16) | i;
+                }
+            }
+        }
+    });
+
+    // Conservative screen bounds of the lights' spheres, from their view-space boxes.
+    m_light_bounds.resize(scene.num_lights);
+    for (uint32_t i = 0; i < scene.num_lights; i++)
+    {
+        const RasterizerLight &light = scene.lights[i];
+        vec3 center = vec3(scene.view * vec4(light.position, 1));
+        LightBounds &bounds = m_light_bounds[i];
+        bounds = {0, 0, m_width - 1, m_height - 1};
+        // Behind the camera, so empty.
+        if ( -center.z + light.radius <= 0 )
+        {
+            bounds = {1, 1, 0, 0};
+            continue;
+        }
+        // Spheres reaching behind the camera cover the whole screen.
+        if ( -center.z - light.radius <= 0 ) continue;
+        vec2 min = vec2(FLT_MAX);
+        vec2 max = vec2(-FLT_MAX);
+        for (int c = 0; c < 8; c++)
+        {
+            vec3 corner = center + light.radius * vec3(c & 1 ? 1 : -1, c & 2 ? 1 : -1, c & 4 ? 1 : -1);
+            vec4 clip = scene.projection * vec4(corner, 1);
+            vec2 pixel = (0.5f * vec2(clip.x, clip.y) / clip.w + 0.5f) * vec2(m_width, m_height);
+            min = glm::min(min, pixel);
+            max = glm::max(max, pixel);
+        }
+        bounds.min_x = (int) std::clamp(floorf(min.x), -1.f, (float) m_width);
+        bounds.min_y = (int) std::clamp(floorf(min.y), -1.f, (float) m_height);
+        bounds.max_x = (int) std::clamp(floorf(max.x), -1.f, (float) m_width);
+        bounds.max_y = (int) std::clamp(floorf(max.y), -1.f, (float) m_height);
+    }
+
+    if ( m_worker_lights.size() < jobs->num_workers() ) m_worker_lights.resize(jobs->num_workers());
+    jobs->parallel_for(num_tiles, 1, [&](uint32_t begin, uint32_t end) {
+        std::vector<float> *lights = &m_worker_lights[jobs->worker_index()];
+        for (uint32_t tile = begin; tile < end; tile++) render_tile(scene, tile, lights);
+    });
+}
+
+void Rasterizer::set_up_batch(const RasterizerScene &scene, uint32_t batch_index)
+{
+    Batch &batch = m_batches[batch_index];
+    batch.triangles.clear();
+    batch.tile_offsets.assign(m_tiles_x * m_tiles_y, 0);
+    uint32_t begin = batch_index * RASTERIZER_TRIANGLE_BATCH;
+    uint32_t end = std::min(begin + RASTERIZER_TRIANGLE_BATCH, m_instance_triangles.back());
+
+    // Guard band planes, as multiples of w.
+    float guard_x = 1 + 2.f * RASTERIZER_GUARD_BAND_PIXELS / m_width;
+    float guard_y = 1 + 2.f * RASTERIZER_GUARD_BAND_PIXELS / m_height;
+    const vec4 clip_planes[5] = {
+        vec4(0, 0, 1, 0), // near, z >= 0
+        vec4(-1, 0, 0, guard_x),
+        vec4(1, 0, 0, guard_x),
+        vec4(0, -1, 0, guard_y),
+        vec4(0, 1, 0, guard_y),
+    };
+    const vec2 corner_barycentrics[3] = { vec2(0, 0), vec2(1, 0), vec2(0, 1) };
+
+    // The last instance starting at or before the first triangle, skipping empty ones.
+    uint32_t instance = std::upper_bound(m_instance_triangles.begin(), m_instance_triangles.end(), begin) - m_instance_triangles.begin() - 1;
+    mat4 view_projection = scene.projection * scene.view;
+    mat4 object_to_clip = view_projection * scene.instances[instance].object_to_world;
+    for (uint32_t i = begin; i < end; i++)
+    {
+        while ( i >= m_instance_triangles[instance + 1] )
+        {
+            instance++;
+            object_to_clip = view_projection * scene.instances[instance].object_to_world;
+        }
+        const RasterizerInstance &mesh = scene.instances[instance];
+        uint32_t triangle = i - m_instance_triangles[instance];
+        vec4 clip[3];
+        uint32_t outside_all = 0x3f;
+        bool needs_clipping = false;
+        for (int v = 0; v < 3; v++)
+        {
+            vec4 p = object_to_clip * vec4(mesh.positions[mesh.indices[3*triangle + v]], 1);
+            clip[v] = p;
+            uint32_t outside = (p.x < -p.w) | (p.x > p.w) << 1 | (p.y < -p.w) << 2 | (p.y > p.w) << 3 | (p.z < 0) << 4 | (p.z > p.w) << 5;
+            outside_all &= outside;
+            needs_clipping |= p.z < 0 || fabsf(p.x) > guard_x * p.w || fabsf(p.y) > guard_y * p.w;
+        }
+        // Entirely outside one of the frustum's planes.
+        if ( outside_all != 0 ) continue;
+        if ( !needs_clipping )
+        {
+            emit_triangle(&batch, clip, corner_barycentrics, instance, triangle);
+            continue;
+        }
+
+        ClipVertex polygons[2][MAX_CLIPPED_VERTICES];
+        uint32_t num_vertices = 3;
+        for (int v = 0; v < 3; v++) polygons[0][v] = {clip[v], corner_barycentrics[v]};
+        int current = 0;
+        for (int p = 0; p < 5 && num_vertices > 0; p++)
+        {
+            num_vertices = clip_polygon(polygons[current], num_vertices, clip_planes[p], polygons[1 - current]);
+            current = 1 - current;
+        }
+        // Triangulate as a fan.
+        for (uint32_t v = 2; v < num_vertices; v++)
+        {
+            const ClipVertex *fan[3] = { &polygons[current][0], &polygons[current][v - 1], &polygons[current][v] };
+            vec4 fan_clip[3];
+            vec2 fan_barycentrics[3];
+            for (int k = 0; k < 3; k++)
+            {
+                fan_clip[k] = fan[k]->position;
+                fan_barycentrics[k] = fan[k]->barycentrics;
+            }
+            emit_triangle(&batch, fan_clip, fan_barycentrics, instance, triangle);
+        }
+    }
+}
+
+void Rasterizer::emit_triangle(Batch *batch, const vec4 *clip, const vec2 *barycentrics, uint32_t instance, uint32_t triangle)
+{
+    Triangle t;
+    float depth[3];
+    float half_width = 0.5f * m_width;
+    float half_height = 0.5f * m_height;
+    for (int v = 0; v < 3; v++)
+    {
+        float inverse_w = 1 / clip[v].w;
+        t.x[v] = (int32_t) lrintf((clip[v].x * inverse_w * half_width + half_width) * SUBPIXEL_SCALE);
+        t.y[v] = (int32_t) lrintf((clip[v].y * inverse_w * half_height + half_height) * SUBPIXEL_SCALE);
+        depth[v] = clip[v].z * inverse_w;
+        t.inverse_w[v] = inverse_w;
+        t.barycentrics[v] = barycentrics[v];
+    }
+    int64_t area = (int64_t) (t.x[1] - t.x[0]) * (t.y[2] - t.y[0]) - (int64_t) (t.y[1] - t.y[0]) * (t.x[2] - t.x[0]);
+    // Degenerate once snapped.
+    if ( area == 0 ) return;
+    // Both sides are drawn, so wind every triangle the same way.
+    if ( area < 0 )
+    {
+        std::swap(t.x[1], t.x[2]);
+        std::swap(t.y[1], t.y[2]);
+        std::swap(depth[1], depth[2]);
+        std::swap(t.inverse_w[1], t.inverse_w[2]);
+        std::swap(t.barycentrics[1], t.barycentrics[2]);
+    }
+
+    // The pixels whose centers are within the bounds, clamped to the viewport.
+    int32_t min_x = std::min({t.x[0], t.x[1], t.x[2]});
+    int32_t min_y = std::min({t.y[0], t.y[1], t.y[2]});
+    int32_t max_x = std::max({t.x[0], t.x[1], t.x[2]});
+    int32_t max_y = std::max({t.y[0], t.y[1], t.y[2]});
+    int first_x = std::max((min_x - SUBPIXEL_SCALE / 2 + SUBPIXEL_SCALE - 1) >> RASTERIZER_SUBPIXEL_BITS, 0);
+    int first_y = std::max((min_y - SUBPIXEL_SCALE / 2 + SUBPIXEL_SCALE - 1) >> RASTERIZER_SUBPIXEL_BITS, 0);
+    int last_x = std::min((max_x - SUBPIXEL_SCALE / 2) >> RASTERIZER_SUBPIXEL_BITS, m_width - 1);
+    int last_y = std::min((max_y - SUBPIXEL_SCALE / 2) >> RASTERIZER_SUBPIXEL_BITS, m_height - 1);
+    // Between pixel centers.
+    if ( first_x > last_x || first_y > last_y ) return;
+    t.min_x = first_x;
+    t.min_y = first_y;
+    t.max_x = last_x;
+    t.max_y = last_y;
+
+    // Depth is a plane in screen space.
+    float dx1 = (t.x[1] - t.x[0]) * (1.f / SUBPIXEL_SCALE);
+    float dy1 = (t.y[1] - t.y[0]) * (1.f / SUBPIXEL_SCALE);
+    float dx2 = (t.x[2] - t.x[0]) * (1.f / SUBPIXEL_SCALE);
+    float dy2 = (t.y[2] - t.y[0]) * (1.f / SUBPIXEL_SCALE);
+    float inverse_determinant = 1 / (dx1 * dy2 - dx2 * dy1);
+    float dz1 = depth[1] - depth[0];
+    float dz2 = depth[2] - depth[0];
+    t.depth = depth[0];
+    t.depth_dx = (dz1 * dy2 - dz2 * dy1) * inverse_determinant;
+    t.depth_dy = (dx1 * dz2 - dx2 * dz1) * inverse_determinant;
+    t.instance = instance;
+    t.triangle = triangle;
+
+    assert(batch->triangles.size() < (1u << 16));
+    batch->triangles.push_back(t);
+    for (int y = first_y / RASTERIZER_TILE_SIZE; y <= last_y / RASTERIZER_TILE_SIZE; y++)
+    {
+        for (int x = first_x / RASTERIZER_TILE_SIZE; x <= last_x / RASTERIZER_TILE_SIZE; x++)
+            batch->tile_offsets[x + m_tiles_x * y]++;
+    }
+}
+
+void Rasterizer::render_tile(const RasterizerScene &scene, uint32_t tile, std::vector<float> *lights)
+{
+    const int64_t subpixel_scale = SUBPIXEL_SCALE;
+    int tile_x0 = (tile % m_tiles_x) * RASTERIZER_TILE_SIZE;
+    int tile_y0 = (tile / m_tiles_x) * RASTERIZER_TILE_SIZE;
+    int tile_x1 = std::min(tile_x0 + RASTERIZER_TILE_SIZE, m_width) - 1;
+    int tile_y1 = std::min(tile_y0 + RASTERIZER_TILE_SIZE, m_height) - 1;
+    alignas(32) float depth[RASTERIZER_TILE_SIZE * RASTERIZER_TILE_SIZE];
+    alignas(32) uint32_t visible[RASTERIZER_TILE_SIZE * RASTERIZER_TILE_SIZE]; // Bin references.
+    std::fill(depth, depth + RASTERIZER_TILE_SIZE * RASTERIZER_TILE_SIZE, 1.f);
+    std::fill(visible, visible + RASTERIZER_TILE_SIZE * RASTERIZER_TILE_SIZE, NO_TRIANGLE);
+
+    for (uint32_t b = m_bin_offsets[tile]; b < m_bin_offsets[tile + 1]; b++)
+    {
+        uint32_t reference = m_bins[b];
+        const Triangle &t = m_batches[reference >> 16].triangles[reference & 0xFFFF];
+        int min_x = std::max<int>(t.min_x, tile_x0);
+        int min_y = std::max<int>(t.min_y, tile_y0);
+        int max_x = std::min<int>(t.max_x, tile_x1);
+        int max_y = std::min<int>(t.max_y, tile_y1);
+        // Rows are walked in whole groups of lanes from the tile's left edge.
+        int start_x = tile_x0 + ((min_x - tile_x0) & ~(RASTERIZER_LANES - 1));
+
+        // Edge e is opposite vertex e, and is non-negative inside. Pixels exactly on an edge are
+        // covered only if it is a top or left edge, which the -1 bias excludes otherwise.
+        int64_t row_edges[3];
+        int64_t step_x[3];
+        int64_t step_y[3];
+        int64_t lane_edges[3][RASTERIZER_LANES];
+        for (int e = 0; e < 3; e++)
+        {
+            int a = (e + 1) % 3;
+            int b = (e + 2) % 3;
+            int64_t dx = t.x[b] - t.x[a];
+            int64_t dy = t.y[b] - t.y[a];
+            bool top_left = dy < 0 || (dy == 0 && dx > 0);
+            int64_t px = start_x * subpixel_scale + subpixel_scale / 2;
+            int64_t py = min_y * subpixel_scale + subpixel_scale / 2;
+            row_edges[e] = dx * (py - t.y[a]) - dy * (px - t.x[a]) - (top_left ? 0 : 1);
+            step_x[e] = -dy * subpixel_scale;
+            step_y[e] = dx * subpixel_scale;
+            for (int l = 0; l < RASTERIZER_LANES; l++) lane_edges[e][l] = l * step_x[e];
+        }
+        float lane_depths[RASTERIZER_LANES];
+        for (int l = 0; l < RASTERIZER_LANES; l++) lane_depths[l] = l * t.depth_dx;
+        float vertex_x = t.x[0] * (1.f / SUBPIXEL_SCALE);
+        float vertex_y = t.y[0] * (1.f / SUBPIXEL_SCALE);
+
+        for (int y = min_y; y <= max_y; y++)
+        {
+            int64_t e0 = row_edges[0];
+            int64_t e1 = row_edges[1];
+            int64_t e2 = row_edges[2];
+            float z = t.depth + t.depth_dx * (start_x + 0.5f - vertex_x) + t.depth_dy * (y + 0.5f - vertex_y);
+            for (int x = start_x; x <= max_x; x += RASTERIZER_LANES)
+            {
+                int offset = x - tile_x0 + RASTERIZER_TILE_SIZE * (y - tile_y0);
+                float *depths = &depth[offset];
+                uint32_t *references = &visible[offset];
+                for (int l = 0; l < RASTERIZER_LANES; l++)
+                {
+                    int64_t w0 = e0 + lane_edges[0][l];
+                    int64_t w1 = e1 + lane_edges[1][l];
+                    int64_t w2 = e2 + lane_edges[2][l];
+                    float lane_z = z + lane_depths[l];
+                    // & rather than &&, which would load depths conditionally and keep the loop scalar.
+                    bool pass = ((w0 | w1 | w2) >= 0) & (lane_z < depths[l]);
+                    depths[l] = pass ? lane_z : depths[l];
+                    references[l] = pass ? reference : references[l];
+                }
+                e0 += RASTERIZER_LANES * step_x[0];
+                e1 += RASTERIZER_LANES * step_x[1];
+                e2 += RASTERIZER_LANES * step_x[2];
+                z += RASTERIZER_LANES * t.depth_dx;
+            }
+            for (int e = 0; e < 3; e++) row_edges[e] += step_y[e];
+        }
+    }
+
+    // The lights touching the tile, in SoA rows padded to whole groups of lanes with lights that
+    // reach nothing, so the shading loop over them vectorizes.
+    uint32_t stride = (scene.num_lights + RASTERIZER_LANES - 1) & ~(RASTERIZER_LANES - 1);
+    lights->resize(7 * stride);
+    float *light_x = lights->data();
+    float *light_y = light_x + stride;
+    float *light_z = light_y + stride;
+    float *light_radius_squared = light_z + stride;
+    float *light_red = light_radius_squared + stride;
+    float *light_green = light_red + stride;
+    float *light_blue = light_green + stride;
+    uint32_t num_lights = 0;
+    for (uint32_t i = 0; i < scene.num_lights; i++)
+    {
+        const LightBounds &bounds = m_light_bounds[i];
+        if ( bounds.max_x < tile_x0 || bounds.min_x > tile_x1 || bounds.max_y < tile_y0 || bounds.min_y > tile_y1 ) continue;
+        const RasterizerLight &light = scene.lights[i];
+        light_x[num_lights] = light.position.x;
+        light_y[num_lights] = light.position.y;
+        light_z[num_lights] = light.position.z;
+        light_radius_squared[num_lights] = light.radius * light.radius;
+        light_red[num_lights] = light.color.x;
+        light_green[num_lights] = light.color.y;
+        light_blue[num_lights] = light.color.z;
+        num_lights++;
+    }
+    for (; num_lights % RASTERIZER_LANES != 0; num_lights++)
+    {
+        light_x[num_lights] = light_y[num_lights] = light_z[num_lights] = 0;
+        light_radius_squared[num_lights] = -1;
+        light_red[num_lights] = light_green[num_lights] = light_blue[num_lights] = 0;
+    }
+
+    // Shade each visible pixel once.
+    for (int y = tile_y0; y <= tile_y1; y++)
+    {
+        for (int x = tile_x0; x <= tile_x1; x++)
+        {
+            int offset = x - tile_x0 + RASTERIZER_TILE_SIZE * (y - tile_y0);
+            uint32_t reference = visible[offset];
+            vec3 radiance = vec3(0);
+            if ( reference != NO_TRIANGLE )
+            {
+                const Triangle &t = m_batches[reference >> 16].triangles[reference & 0xFFFF];
+                // Screen-space weights of the vertices at the pixel center, made perspective-correct.
+                int64_t px = x * subpixel_scale + subpixel_scale / 2;
+                int64_t py = y * subpixel_scale + subpixel_scale / 2;
+                float weights[3];
+                float weight_sum = 0;
+                for (int e = 0; e < 3; e++)
+                {
+                    int a = (e + 1) % 3;
+                    int b = (e + 2) % 3;
+                    int64_t edge = (int64_t) (t.x[b] - t.x[a]) * (py - t.y[a]) - (int64_t) (t.y[b] - t.y[a]) * (px - t.x[a]);
+                    weights[e] = edge * t.inverse_w[e];
+                    weight_sum += weights[e];
+                }
+                vec2 barycentrics = (weights[0] * t.barycentrics[0] + weights[1] * t.barycentrics[1] + weights[2] * t.barycentrics[2]) / weight_sum;
+
+                const RasterizerInstance &instance = scene.instances[t.instance];
+                const uint32_t *indices = &instance.indices[3 * t.triangle];
+                vec3 p0 = instance.positions[indices[0]];
+                vec3 n0 = instance.normals[indices[0]];
+                vec3 position = p0 + barycentrics.x * (instance.positions[indices[1]] - p0) + barycentrics.y * (instance.positions[indices[2]] - p0);
+                vec3 normal = n0 + barycentrics.x * (instance.normals[indices[1]] - n0) + barycentrics.y * (instance.normals[indices[2]] - n0);
+                position = vec3(instance.object_to_world * vec4(position, 1));
+                normal = glm::normalize(vec3(instance.object_to_world * vec4(normal, 0)));
+                // Lit on the side it is seen from.
+                if ( glm::dot(normal, scene.camera_position - position) < 0 ) normal = -normal;
+
+                float red[RASTERIZER_LANES] = {};
+                float green[RASTERIZER_LANES] = {};
+                float blue[RASTERIZER_LANES] = {};
+                for (uint32_t first = 0; first < num_lights; first += RASTERIZER_LANES)
+                {
+                    float distance_squared[RASTERIZER_LANES];
+                    float cosine_distance[RASTERIZER_LANES]; // The cosine times the distance.
+                    float distance[RASTERIZER_LANES];
+                    for (int l = 0; l < RASTERIZER_LANES; l++)
+                    {
+                        uint32_t i = first + l;
+                        float dx = light_x[i] - position.x;
+                        float dy = light_y[i] - position.y;
+                        float dz = light_z[i] - position.z;
+                        distance_squared[l] = dx * dx + dy * dy + dz * dz;
+                        cosine_distance[l] = normal.x * dx + normal.y * dy + normal.z * dz;
+                    }
+                    // sqrtf may set errno, so it keeps its loop scalar, on its own.
+                    for (int l = 0; l < RASTERIZER_LANES; l++) distance[l] = sqrtf(distance_squared[l]);
+                    for (int l = 0; l < RASTERIZER_LANES; l++)
+                    {
+                        uint32_t i = first + l;
+                        bool lit = (cosine_distance[l] > 0) & (distance_squared[l] < light_radius_squared[i]);
+                        float irradiance = cosine_distance[l] / (distance_squared[l] * distance[l]);
+                        irradiance = lit ? irradiance : 0.f;
+                        red[l] += light_red[i] * irradiance;
+                        green[l] += light_green[i] * irradiance;
+                        blue[l] += light_blue[i] * irradiance;
+                    }
+                }
+                for (int l = 0; l < RASTERIZER_LANES; l++) radiance += vec3(red[l], green[l], blue[l]);
+                radiance *= PATH_TRACER_ALBEDO / (float) M_PI;
+            }
+            uint32_t pixel = x + m_width * y;
+            uint8_t *rgba = &m_image[4 * pixel];
+            rgba[0] = encode_srgb(radiance.x);
+            rgba[1] = encode_srgb(radiance.y);
+            rgba[2] = encode_srgb(radiance.z);
+            rgba[3] = 255;
+            m_depth[pixel] = depth[offset];
+        }
+    }
+}
+
+bool Rasterizer::save_image(const char *path) const
+{
+    return write_ppm_image(path, m_image.data(), m_width, m_height);
+}
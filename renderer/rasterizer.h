@@ -0,0 +1,138 @@
+#ifndef RENDERER_RASTERIZER_H_
+#define RENDERER_RASTERIZER_H_
+/* rasterizer.h
+ *
+ * A tiled triangle rasterizer on the CPU, for rendering without a GPU, e.g. thumbnails on servers.
+ *
+ * Rasterization follows Vulkan's rules, so coverage and depth match the GPU's: vertices are
+ * snapped to RASTERIZER_SUBPIXEL_BITS of subpixel precision, pixels are covered by their centers
+ * with the top-left fill rule, depth is interpolated linearly in screen space and tested LESS
+ * against a buffer cleared to 1, and triangles are clipped to the near plane. Triangles are drawn from both
+ * sides. Shading is Lambertian with PATH_TRACER_ALBEDO under the point lights, falling off with
+ * the inverse square of distance up to their radius, as the path tracer's direct lighting
+ * without shadows. The main pass shades the same way but shadows lights with a slot in the
+ * shadow atlas (see renderer/shaders/mesh.frag), so images of lit scenes differ from the GPU's
+ * where those lights are occluded.
+ *
+ * A frame runs in three parallel passes:
+ *     geometry: batches of RASTERIZER_TRIANGLE_BATCH triangles are transformed, clipped and set
+ *               up, and counted into the RASTERIZER_TILE_SIZE square tiles their bounds touch.
+ *     binning:  each batch writes references to its triangles into the tiles' bins, laid out by
+ *               the counts so that every bin keeps submission order, whichever job set them up.
+ *     tiles:    each tile's bin is rasterized into a tile-sized depth and visibility buffer,
+ *               testing coverage RASTERIZER_LANES pixels at a time with exact integer edge
+ *               functions laid out so the compiler vectorizes them. Then each visible pixel is
+ *               shaded once, with the lights whose screen bounds touch the tile.
+ */
+#include "engine/jobs/job_system.h"
+#include "renderer/transform.h"
+#include <stdint.h>
+#include <vector>
+
+#define RASTERIZER_TILE_SIZE 64
+#define RASTERIZER_LANES 8
+#define RASTERIZER_SUBPIXEL_BITS 8
+// Input triangles per geometry job. Clipping makes at most 6 of each, so a batch's triangles are
+// referenced by 16 bits.
+#define RASTERIZER_TRIANGLE_BATCH 2048
+// Triangles reaching further than this many pixels off the viewport are clipped to it, which
+// keeps edge functions in 64 bits.
+#define RASTERIZER_GUARD_BAND_PIXELS 16384
+
+struct RasterizerInstance
+{
+    const vec3 *positions;   // Object space.
+    const vec3 *normals;
+    const uint32_t *indices; // Triangle list.
+    uint32_t num_triangles;
+    mat4 object_to_world;    // Rigid, so it also transforms normals.
+};
+
+struct RasterizerLight
+{
+    vec3 position;
+    float radius;
+    vec3 color;
+};
+
+struct RasterizerScene
+{
+    const RasterizerInstance *instances;
+    uint32_t num_instances;
+    const RasterizerLight *lights;
+    uint32_t num_lights;
+    mat4 view;
+    mat4 projection; // To Vulkan clip space, as Camera::projection_matrix.
+    vec3 camera_position;
+};
+
+class Rasterizer
+{
+public:
+    void resize(int width, int height);
+    void render(JobSystem *jobs, const RasterizerScene &scene);
+
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    // 8-bit sRGB RGBA rows from the top, see image_file.h.
+    const uint8_t *image() const { return m_image.data(); }
+    // Clip space depth, 1 where nothing was drawn.
+    const float *depth() const { return m_depth.data(); }
+    // Write the image as a binary PPM.
+    bool save_image(const char *path) const;
+private:
+    // A triangle set up for rasterization, clipped if needed.
+    struct Triangle
+    {
+        // Pixel coordinates with RASTERIZER_SUBPIXEL_BITS fraction bits, with a positive area.
+        int32_t x[3];
+        int32_t y[3];
+        // Depth at the first vertex, and its change per pixel.
+        float depth;
+        float depth_dx;
+        float depth_dy;
+        float inverse_w[3];
+        // Of the instance triangle's second and third vertices, at each vertex.
+        vec2 barycentrics[3];
+        uint32_t instance;
+        uint32_t triangle;
+        // Covered pixels, inclusive.
+        uint16_t min_x;
+        uint16_t min_y;
+        uint16_t max_x;
+        uint16_t max_y;
+    };
+    struct Batch
+    {
+        std::vector<Triangle> triangles;
+        // Triangles per tile, then the batch's first offset in each tile's bin.
+        std::vector<uint32_t> tile_offsets;
+    };
+    struct LightBounds
+    {
+        int min_x;
+        int min_y;
+        int max_x;
+        int max_y;
+    };
+
+    void set_up_batch(const RasterizerScene &scene, uint32_t batch_index);
+    void emit_triangle(Batch *batch, const vec4 *clip, const vec2 *barycentrics, uint32_t instance, uint32_t triangle);
+    // lights is the worker's scratch for the tile's lights.
+    void render_tile(const RasterizerScene &scene, uint32_t tile, std::vector<float> *lights);
+
+    int m_width = 0;
+    int m_height = 0;
+    int m_tiles_x = 0;
+    int m_tiles_y = 0;
+    std::vector<uint8_t> m_image;
+    std::vector<float> m_depth;
+    std::vector<uint32_t> m_instance_triangles; // Prefix sums of the instances' triangle counts.
+    std::vector<Batch> m_batches;
+    std::vector<uint32_t> m_bins;               // (batch << 16 | triangle) references, by tile.
+    std::vector<uint32_t> m_bin_offsets;        // Indexed by tile, and one past the last.
+    std::vector<LightBounds> m_light_bounds;    // Pixels, inclusive.
+    std::vector<std::vector<float>> m_worker_lights;
+};
+
+#endif // RENDERER_RASTERIZER_H_
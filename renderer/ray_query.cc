@@ -0,0 +1,257 @@
+#include "renderer/ray_query.h"
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+
+// Rays in SoA layout, so each loop over the lanes vectorizes. Rays that are finished, or pad
+// the last packet, have a negative max distance, so they miss every box and triangle.
+struct RayPacket
+{
+    float origin[3][RAY_PACKET_SIZE];
+    float direction[3][RAY_PACKET_SIZE];
+    float inverse_direction[3][RAY_PACKET_SIZE];
+    float max_distance[RAY_PACKET_SIZE];
+};
+
+// The hits found so far. Triangles are in the mesh BVH's leaf order.
+struct PacketHits
+{
+    uint32_t instance[RAY_PACKET_SIZE];
+    uint32_t triangle[RAY_PACKET_SIZE];
+    float distance[RAY_PACKET_SIZE];
+    float u[RAY_PACKET_SIZE];
+    float v[RAY_PACKET_SIZE];
+};
+
+static void set_inverse_directions(RayPacket *packet)
+{
+    for (int axis = 0; axis < 3; axis++)
+    {
+        for (int l = 0; l < RAY_PACKET_SIZE; l++)
+        {
+            // Axis-parallel rays get a huge inverse instead of an infinite one, which would give
+            // NaNs for box planes through the origin.
+            float d = packet->direction[axis][l];
+            packet->inverse_direction[axis][l] = 1.f / (fabsf(d) > 1e-30f ? d : 1e-30f);
+        }
+    }
+}
+
+static float packet_max_distance(const RayPacket &packet)
+{
+    float max_distance = packet.max_distance[0];
+    for (int l = 1; l < RAY_PACKET_SIZE; l++) max_distance = std::max(max_distance, packet.max_distance[l]);
+    return max_distance;
+}
+
+// Whether any of the rays hit the box (slab test), and the nearest entry distance among them.
+static bool intersect_box(const RayPacket &packet, const BvhNode &node, float *nearest_entry)
+{
+    float entries[RAY_PACKET_SIZE];
+    for (int l = 0; l < RAY_PACKET_SIZE; l++)
+    {
+        float tx0 = (node.min.x - packet.origin[0][l]) * packet.inverse_direction[0][l];
+        float tx1 = (node.max.x - packet.origin[0][l]) * packet.inverse_direction[0][l];
+        float ty0 = (node.min.y - packet.origin[1][l]) * packet.inverse_direction[1][l];
+        float ty1 = (node.max.y - packet.origin[1][l]) * packet.inverse_direction[1][l];
+        float tz0 = (node.min.z - packet.origin[2][l]) * packet.inverse_direction[2][l];
+        float tz1 = (node.max.z - packet.origin[2][l]) * packet.inverse_direction[2][l];
+        float t_near = std::max(std::max(std::min(tx0, tx1), std::min(ty0, ty1)), std::max(std::min(tz0, tz1), 0.f));
+        float t_far = std::min(std::min(std::max(tx0, tx1), std::max(ty0, ty1)), std::min(std::max(tz0, tz1), packet.max_distance[l]));
+        entries[l] = t_near <= t_far ? t_near : FLT_MAX;
+    }
+    float nearest = entries[0];
+    for (int l = 1; l < RAY_PACKET_SIZE; l++) nearest = std::min(nearest, entries[l]);
+    *nearest_entry = nearest;
+    return nearest != FLT_MAX;
+}
+
+// Moller-Trumbore. Rays hitting the triangle before their max distance record the hit, and
+// their max distance becomes the hit's, or negative to finish them for any-hit queries.
+static void intersect_triangle(RayPacket *packet, PacketHits *hits, bool any_hit,
+                               uint32_t instance, uint32_t triangle, vec3 v0, vec3 v1, vec3 v2)
+{
+    vec3 e1 = v1 - v0;
+    vec3 e2 = v2 - v0;
+    for (int l = 0; l < RAY_PACKET_SIZE; l++)
+    {
+        float dx = packet->direction[0][l];
+        float dy = packet->direction[1][l];
+        float dz = packet->direction[2][l];
+        float sx = packet->origin[0][l] - v0.x;
+        float sy = packet->origin[1][l] - v0.y;
+        float sz = packet->origin[2][l] - v0.z;
+        // p = d x e2, q = s x e1
+        float px = dy * e2.z - dz * e2.y;
+        float py = dz * e2.x - dx * e2.z;
+        float pz = dx * e2.y - dy * e2.x;
+        float qx = sy * e1.z - sz * e1.y;
+        float qy = sz * e1.x - sx * e1.z;
+        float qz = sx * e1.y - sy * e1.x;
+        float det = e1.x * px + e1.y * py + e1.z * pz;
+        float inverse_det = 1.f / det;
+        float u = (sx * px + sy * py + sz * pz) * inverse_det;
+        float v = (dx * qx + dy * qy + dz * qz) * inverse_det;
+        float t = (e2.x * qx + e2.y * qy + e2.z * qz) * inverse_det;
+        // Parallel rays have a zero determinant, and NaNs fail every comparison.
+        bool hit = det != 0 && u >= 0 && v >= 0 && u + v <= 1 && t >= 0 && t < packet->max_distance[l];
+        packet->max_distance[l] = hit ? (any_hit ? -1.f : t) : packet->max_distance[l];
+        hits->instance[l] = hit ? instance : hits->instance[l];
+        hits->triangle[l] = hit ? triangle : hits->triangle[l];
+        hits->distance[l] = hit ? t : hits->distance[l];
+        hits->u[l] = hit ? u : hits->u[l];
+        hits->v[l] = hit ? v : hits->v[l];
+    }
+}
+
+// Visit the leaves of the BVH hit by any of the packet's rays, nearest first. leaf(node) may
+// shorten the rays, and nodes entered beyond every ray's max distance are skipped.
+template <typename Leaf>
+static void traverse(RayPacket *packet, const Bvh &bvh, Leaf &&leaf)
+{
+    const std::vector<BvhNode> &nodes = bvh.nodes();
+    if ( nodes.empty() ) return;
+    struct Entry
+    {
+        uint32_t node;
+        float distance;
+    };
+    // Each level leaves at most one sibling behind.
+    Entry stack[BVH_MAX_DEPTH + 2];
+    uint32_t stack_size = 0;
+    float distance;
+    if ( !intersect_box(*packet, nodes[0], &distance) ) return;
+    stack[stack_size++] = {0, distance};
+    while ( stack_size > 0 )
+    {
+        Entry entry = stack[--stack_size];
+        // Closer hits may have been found since the node was pushed.
+        if ( entry.distance > packet_max_distance(*packet) ) continue;
+        const BvhNode &node = nodes[entry.node];
+        if ( node.is_leaf() )
+        {
+            leaf(node);
+            continue;
+        }
+        float left_distance;
+        float right_distance;
+        bool left = intersect_box(*packet, nodes[node.first], &left_distance);
+        bool right = intersect_box(*packet, nodes[node.first + 1], &right_distance);
+        // Push the farther child first, so the nearer is visited first.
+        if ( left && right && left_distance > right_distance )
+        {
+            stack[stack_size++] = {node.first, left_distance};
+            stack[stack_size++] = {node.first + 1, right_distance};
+            continue;
+        }
+        if ( right ) stack[stack_size++] = {node.first + 1, right_distance};
+        if ( left ) stack[stack_size++] = {node.first, left_distance};
+    }
+}
+
+static void trace_packet(RayQueryType type,
+                         const Bvh &instance_bvh,
+                         const RayQueryInstance *instances,
+                         const Ray *rays,
+                         uint32_t num_rays,
+                         RayHit *ray_hits)
+{
+    bool any_hit = type == RayQueryType::AnyHit;
+    RayPacket packet;
+    PacketHits hits;
+    for (uint32_t l = 0; l < RAY_PACKET_SIZE; l++)
+    {
+        const Ray &ray = rays[std::min(l, num_rays - 1)];
+        for (int axis = 0; axis < 3; axis++)
+        {
+            packet.origin[axis][l] = ray.origin[axis];
+            packet.direction[axis][l] = ray.direction[axis];
+        }
+        packet.max_distance[l] = l < num_rays ? ray.max_distance : -1.f;
+        hits.instance[l] = RAY_MISS;
+    }
+    set_inverse_directions(&packet);
+
+    const std::vector<uint32_t> &instance_primitives = instance_bvh.primitives();
+    traverse(&packet, instance_bvh, [&](const BvhNode &leaf) {
+        for (uint32_t i = leaf.first; i < leaf.first + leaf.count; i++)
+        {
+            uint32_t instance_index = instance_primitives[i];
+            const RayQueryInstance &instance = instances[instance_index];
+            // Affine transforms keep distances along the rays, so max distances carry over.
+            const mat4 &m = instance.world_to_object;
+            RayPacket object_packet;
+            for (int r = 0; r < 3; r++)
+            {
+                for (int l = 0; l < RAY_PACKET_SIZE; l++)
+                {
+                    object_packet.origin[r][l] = m[0][r] * packet.origin[0][l] + m[1][r] * packet.origin[1][l]
+                                               + m[2][r] * packet.origin[2][l] + m[3][r];
+                    object_packet.direction[r][l] = m[0][r] * packet.direction[0][l] + m[1][r] * packet.direction[1][l]
+                                                  + m[2][r] * packet.direction[2][l];
+                }
+            }
+            for (int l = 0; l < RAY_PACKET_SIZE; l++) object_packet.max_distance[l] = packet.max_distance[l];
+            set_inverse_directions(&object_packet);
+
+            const MeshBvh &mesh = *instance.mesh;
+            traverse(&object_packet, mesh.bvh, [&](const BvhNode &mesh_leaf) {
+                for (uint32_t t = mesh_leaf.first; t < mesh_leaf.first + mesh_leaf.count; t++)
+                {
+                    intersect_triangle(&object_packet, &hits, any_hit, instance_index, t,
+                                       mesh.positions[mesh.indices[3*t]],
+                                       mesh.positions[mesh.indices[3*t + 1]],
+                                       mesh.positions[mesh.indices[3*t + 2]]);
+                }
+            });
+            for (int l = 0; l < RAY_PACKET_SIZE; l++) packet.max_distance[l] = object_packet.max_distance[l];
+        }
+    });
+
+    for (uint32_t l = 0; l < num_rays; l++)
+    {
+        RayHit &hit = ray_hits[l];
+        hit.instance = hits.instance[l];
+        if ( hit.instance == RAY_MISS )
+        {
+            hit.triangle = RAY_MISS;
+            hit.distance = rays[l].max_distance;
+            hit.barycentrics = vec2(0);
+            hit.normal = vec3(0);
+            continue;
+        }
+        const RayQueryInstance &instance = instances[hit.instance];
+        const MeshBvh &mesh = *instance.mesh;
+        uint32_t t = hits.triangle[l];
+        hit.triangle = mesh.bvh.primitives()[t];
+        hit.distance = hits.distance[l];
+        hit.barycentrics = vec2(hits.u[l], hits.v[l]);
+        vec3 v0 = mesh.positions[mesh.indices[3*t]];
+        vec3 normal = glm::cross(mesh.positions[mesh.indices[3*t + 1]] - v0, mesh.positions[mesh.indices[3*t + 2]] - v0);
+        // Normals transform by the inverse transpose of the object-to-world transform.
+        const mat4 &m = instance.world_to_object;
+        hit.normal = glm::normalize(vec3(glm::dot(vec3(m[0]), normal), glm::dot(vec3(m[1]), normal), glm::dot(vec3(m[2]), normal)));
+    }
+}
+
+void trace_rays(JobSystem *jobs,
+                RayQueryType type,
+                const Bvh &instance_bvh,
+                const RayQueryInstance *instances,
+                const Ray *rays,
+                uint32_t num_rays,
+                RayHit *hits)
+{
+    uint32_t num_packets = (num_rays + RAY_PACKET_SIZE - 1) / RAY_PACKET_SIZE;
+    auto trace = [&](uint32_t begin, uint32_t end) {
+        for (uint32_t p = begin; p < end; p++)
+        {
+            uint32_t first = p * RAY_PACKET_SIZE;
+            trace_packet(type, instance_bvh, instances, &rays[first], std::min<uint32_t>(RAY_PACKET_SIZE, num_rays - first), &hits[first]);
+        }
+    };
+    if ( jobs != nullptr && num_rays >= RAY_QUERY_PARALLEL_MIN_RAYS )
+        jobs->parallel_for(num_packets, RAY_QUERY_GRAIN, trace);
+    else
+        trace(0, num_packets);
+}
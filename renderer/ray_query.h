@@ -0,0 +1,66 @@
+#ifndef RENDERER_RAY_QUERY_H_
+#define RENDERER_RAY_QUERY_H_
+/* ray_query.h
+ *
+ * Batched ray queries against mesh instances on the CPU, for picking and visibility without a
+ * GPU readback.
+ *
+ * A scene is an instance BVH whose primitives are RayQueryInstances, each a MeshBvh under a
+ * transform. Rays are traced in packets of RAY_PACKET_SIZE: every node is tested against the
+ * whole packet, with the per-ray arithmetic laid out so the compiler vectorizes it, and a node is
+ * entered if any of the packet's rays hit it. Rays from the same point in similar directions
+ * (a camera, a light) share most of their traversal. Batches of at least
+ * RAY_QUERY_PARALLEL_MIN_RAYS are split over jobs.
+ *
+ * Distances are in units of the ray direction's length, so they are the same in world and
+ * object space.
+ */
+#include "engine/jobs/job_system.h"
+#include "renderer/bvh.h"
+#include <stdint.h>
+
+#define RAY_PACKET_SIZE 8
+#define RAY_QUERY_PARALLEL_MIN_RAYS 1024
+// Packets per job.
+#define RAY_QUERY_GRAIN 16
+#define RAY_MISS (~0u)
+
+enum class RayQueryType
+{
+    ClosestHit,
+    // Stop at the first hit found, which need not be the closest. For visibility tests.
+    AnyHit
+};
+
+struct Ray
+{
+    vec3 origin;
+    vec3 direction;
+    float max_distance;
+};
+
+struct RayHit
+{
+    uint32_t instance; // The instance BVH primitive, RAY_MISS if nothing was hit.
+    uint32_t triangle; // In the mesh's original index order.
+    float distance;
+    vec2 barycentrics; // Of the triangle's second and third vertices.
+    vec3 normal;       // The triangle's unit normal in world space, by its winding.
+};
+
+struct RayQueryInstance
+{
+    const MeshBvh *mesh;
+    mat4 world_to_object; // Affine.
+};
+
+// instances are indexed by the instance BVH's primitives.
+void trace_rays(JobSystem *jobs,
+                RayQueryType type,
+                const Bvh &instance_bvh,
+                const RayQueryInstance *instances,
+                const Ray *rays,
+                uint32_t num_rays,
+                RayHit *hits);
+
+#endif // RENDERER_RAY_QUERY_H_
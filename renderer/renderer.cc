@@ -1,42 +1,1507 @@
 #include "renderer/renderer.h"
+#include "renderer/mesh_optimize.h"
+#include "renderer/meshlets.h"
+#include "renderer/asset_file.h"
+#include "engine/memory/memory_tracking.h"
+#include "ansi_color.h"
 #include <stdio.h>
 #include <assert.h>
+#include <math.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
 
-void Renderer::render(int x, int y, int width, int height)
+#define FRAME_BINDING_UNIFORMS 0
+#define FRAME_BINDING_INSTANCES 1
+#define FRAME_BINDING_POINT_LIGHTS 2
+#define FRAME_BINDING_LIGHT_CLUSTERS 3
+#define FRAME_BINDING_LIGHT_INDICES 4
+
+// False if the box is entirely behind one of the frustum's planes.
+static bool frustum_overlaps_aabb(const Frustum &frustum, const Aabb &box)
+{
+    for (int p = 0; p < 6; p++)
+    {
+        const vec4 &plane = frustum.planes[p];
+        // The corner furthest along the plane's normal.
+        vec3 corner = vec3(plane.x >= 0 ? box.max.x : box.min.x,
+                           plane.y >= 0 ? box.max.y : box.min.y,
+                           plane.z >= 0 ? box.max.z : box.min.z);
+        if ( glm::dot(vec3(plane), corner) + plane.w < 0 ) return false;
+    }
+    return true;
+}
+
+void Renderer::render(int x, int y, int width, int height, uint32_t frame_slot,
+                      VkCommandBuffer command_buffer, uint32_t swap_chain_image)
 {
-    printf("rendering...\n");
+    MemoryScope memory_scope(MemorySubsystem::Renderer);
+    assert(graphics_api != GraphicsAPI::None && jobs != nullptr);
+    frame_arenas.begin_frame(frame_slot);
+    frame_capture.begin_frame(frame_slot);
+    if ( graphics_api == GraphicsAPI::CPU )
+    {
+        frame_number++;
+        resume_render_thread_coroutines();
+        update_acceleration_structures();
+        viewport_width = width;
+        viewport_height = height;
+        rasterize(width, height);
+        if ( frame_capture.capturing() ) frame_capture.capture(rasterizer.image(), width, height);
+        if ( cpu_pick_requested )
+        {
+            cpu_pick_requested = false;
+            pick_on_cpu(cpu_pick_x, cpu_pick_y);
+        }
+        return;
+    }
+    frame_ring.begin_frame(frame_slot);
+    descriptor_heap.begin_frame(frame_slot);
+    // Storage of meshes destroyed during the slot's previous use is no longer read by the GPU.
+    recording_frame_slot = frame_slot;
+    for (const PolygonMesh &mesh : removed_polygon_meshes[frame_slot])
+    {
+        free_polygon_mesh_storage(mesh);
+        if ( mesh.has_meshlets ) meshlet_culler.remove_mesh(mesh.meshlets);
+    }
+    removed_polygon_meshes[frame_slot].clear();
+    frame_number++;
+    resume_render_thread_coroutines();
+    update_acceleration_structures();
+    update_shadows();
+    viewport_width = width;
+    viewport_height = height;
+    if ( width > 0 && height > 0 && (main_pass.width() != (uint32_t) width || main_pass.height() != (uint32_t) height) )
+    {
+        bool resized_main_pass = main_pass.resize(width, height);
+        assert(resized_main_pass);
+    }
+    main_pass.begin_frame(frame_slot);
+    dynamic_resolution.begin_frame(frame_slot);
+    object_picker.begin_frame(frame_slot);
+    ObjectPick pick;
+    if ( object_picker.result(&pick) )
+    {
+        latest_pick.x = pick.x;
+        latest_pick.y = pick.y;
+        latest_pick.entity = picked_entity(pick.frame, pick.id);
+        latest_pick.nearest = picked_entity(pick.frame, pick.nearest_id);
+        has_pick_result = true;
+    }
+    render_extent = dynamic_resolution.render_extent(width, height);
+    write_frame_uniforms(height > 0 ? width / (float) height : 1.f);
+    // LODs are selected by their error in rendered pixels.
+    update_polygon_meshes(render_extent.height);
+    // The recording writes frame data too, so the ring is flushed after it.
+    assert(command_buffer != VK_NULL_HANDLE);
+    record_frame(command_buffer, swap_chain_image);
+    frame_ring.end_frame();
 }
 
 void Renderer::set_api(VulkanSystem *_vk)
 {
+    MemoryScope memory_scope(MemorySubsystem::Renderer);
     assert(graphics_api == GraphicsAPI::None);
     graphics_api = GraphicsAPI::Vulkan;
     vk = _vk;
+    render_thread = std::this_thread::get_id();
+
+    bool created_uploader = uploader.init(vk);
+    assert(created_uploader);
+    bool created_mesh_pool = mesh_pool.init(vk, MESH_POOL_DEFAULT_VERTEX_WORD_CAPACITY, MESH_POOL_DEFAULT_INDEX_WORD_CAPACITY);
+    assert(created_mesh_pool);
+    bool created_meshlet_culler = meshlet_culler.init(vk, RENDERER_SHADER_DIRECTORY);
+    assert(created_meshlet_culler);
+
+    VkDeviceSize binding_ranges[RENDERER_NUM_FRAME_BINDINGS];
+    binding_ranges[FRAME_BINDING_UNIFORMS] = sizeof(GpuFrameUniforms);
+    binding_ranges[FRAME_BINDING_INSTANCES] = RENDERER_MAX_POLYGON_MESHES * sizeof(GpuInstance);
+    binding_ranges[FRAME_BINDING_POINT_LIGHTS] = RENDERER_MAX_POINT_LIGHTS * sizeof(GpuPointLight);
+    binding_ranges[FRAME_BINDING_LIGHT_CLUSTERS] = NUM_LIGHT_CLUSTERS * sizeof(GpuLightCluster);
+    binding_ranges[FRAME_BINDING_LIGHT_INDICES] = LIGHT_CLUSTERS_MAX_LIGHT_INDICES * sizeof(uint32_t);
+    VkDescriptorType binding_types[RENDERER_NUM_FRAME_BINDINGS];
+    binding_types[FRAME_BINDING_UNIFORMS] = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    binding_types[FRAME_BINDING_INSTANCES] = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+    binding_types[FRAME_BINDING_POINT_LIGHTS] = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+    binding_types[FRAME_BINDING_LIGHT_CLUSTERS] = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+    binding_types[FRAME_BINDING_LIGHT_INDICES] = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+    bool created_frame_ring = frame_ring.init(vk, PLATFORM_FRAMES_IN_FLIGHT, RENDERER_FRAME_RING_BUFFER_SIZE,
+                                              *std::max_element(binding_ranges, binding_ranges + RENDERER_NUM_FRAME_BINDINGS));
+    assert(created_frame_ring);
+    {
+        VkDescriptorSetLayoutBinding bindings[RENDERER_NUM_FRAME_BINDINGS];
+        for (int i = 0; i < RENDERER_NUM_FRAME_BINDINGS; i++)
+        {
+            bindings[i] = {};
+            bindings[i].binding = i;
+            bindings[i].descriptorType = binding_types[i];
+            bindings[i].descriptorCount = 1;
+            bindings[i].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+        }
+        VkDescriptorSetLayoutCreateInfo info = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+        info.bindingCount = RENDERER_NUM_FRAME_BINDINGS;
+        info.pBindings = bindings;
+        VK_SUCCEED( vkCreateDescriptorSetLayout(vk->device, &info, nullptr, &frame_descriptor_set_layout) );
+    }
+    {
+        VkDescriptorPoolSize pool_sizes[2] = {
+            { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1 },
+            { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, RENDERER_NUM_FRAME_BINDINGS - 1 },
+        };
+        VkDescriptorPoolCreateInfo info = { VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+        info.maxSets = 1;
+        info.poolSizeCount = 2;
+        info.pPoolSizes = pool_sizes;
+        VK_SUCCEED( vkCreateDescriptorPool(vk->device, &info, nullptr, &frame_descriptor_pool) );
+    }
+    {
+        VkDescriptorSetAllocateInfo info = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+        info.descriptorPool = frame_descriptor_pool;
+        info.descriptorSetCount = 1;
+        info.pSetLayouts = &frame_descriptor_set_layout;
+        VK_SUCCEED( vkAllocateDescriptorSets(vk->device, &info, &frame_descriptor_set) );
+
+        // Written once. Each frame only changes the dynamic offsets.
+        VkDescriptorBufferInfo buffer_infos[RENDERER_NUM_FRAME_BINDINGS];
+        VkWriteDescriptorSet writes[RENDERER_NUM_FRAME_BINDINGS];
+        for (int i = 0; i < RENDERER_NUM_FRAME_BINDINGS; i++)
+        {
+            buffer_infos[i] = frame_ring.descriptor_info(binding_ranges[i]);
+            writes[i] = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+            writes[i].dstSet = frame_descriptor_set;
+            writes[i].dstBinding = i;
+            writes[i].descriptorCount = 1;
+            writes[i].descriptorType = binding_types[i];
+            writes[i].pBufferInfo = &buffer_infos[i];
+        }
+        vkUpdateDescriptorSets(vk->device, RENDERER_NUM_FRAME_BINDINGS, writes, 0, nullptr);
+    }
+
+    bool created_descriptor_heap = descriptor_heap.init(vk, PLATFORM_FRAMES_IN_FLIGHT);
+    assert(created_descriptor_heap);
+    mesh_vertex_buffer_index = descriptor_heap.add_storage_buffer(mesh_pool.vertices(), 0, VK_WHOLE_SIZE);
+    mesh_index_buffer_index = descriptor_heap.add_storage_buffer(mesh_pool.indices(), 0, VK_WHOLE_SIZE);
+    bool created_shadow_atlas = shadow_atlas.init(vk, &descriptor_heap, frame_descriptor_set_layout);
+    assert(created_shadow_atlas);
+    bool created_main_pass = main_pass.init(vk, PLATFORM_FRAMES_IN_FLIGHT);
+    assert(created_main_pass);
+    bool created_dynamic_resolution = dynamic_resolution.init(vk, PLATFORM_FRAMES_IN_FLIGHT);
+    assert(created_dynamic_resolution);
+    frame_capture.init(vk, PLATFORM_FRAMES_IN_FLIGHT);
+    bool created_object_picker = object_picker.init(vk, PLATFORM_FRAMES_IN_FLIGHT);
+    assert(created_object_picker);
+    {
+        VkDescriptorSetLayout set_layouts[2] = { frame_descriptor_set_layout, descriptor_heap.set_layout() };
+        VkPushConstantRange range = {};
+        range.stageFlags = VK_SHADER_STAGE_ALL_GRAPHICS;
+        range.offset = 0;
+        range.size = sizeof(GpuDrawConstants);
+        VkPipelineLayoutCreateInfo info = { VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+        info.setLayoutCount = 2;
+        info.pSetLayouts = set_layouts;
+        info.pushConstantRangeCount = 1;
+        info.pPushConstantRanges = &range;
+        VK_SUCCEED( vkCreatePipelineLayout(vk->device, &info, nullptr, &draw_pipeline_layout) );
+    }
+    bool created_draw_pipelines = draw_pipelines.init(vk, RENDERER_SHADER_DIRECTORY, draw_pipeline_layout, main_pass, shadow_atlas);
+    assert(created_draw_pipelines);
+    for (int i = 0; i < RENDERER_NUM_FRAME_BINDINGS; i++) frame_dynamic_offsets[i] = 0;
+}
+
+void Renderer::set_cpu_api()
+{
+    assert(graphics_api == GraphicsAPI::None);
+    graphics_api = GraphicsAPI::CPU;
+    render_thread = std::this_thread::get_id();
+    frame_capture.init(nullptr, PLATFORM_FRAMES_IN_FLIGHT);
+}
+
+void Renderer::set_job_system(JobSystem *_jobs)
+{
+    MemoryScope memory_scope(MemorySubsystem::Renderer);
+    assert(_jobs != nullptr && jobs == nullptr);
+    jobs = _jobs;
+    bool created_frame_arenas = frame_arenas.init(PLATFORM_FRAMES_IN_FLIGHT, jobs->num_workers(), RENDERER_FRAME_ARENA_BLOCK_SIZE);
+    assert(created_frame_arenas);
+}
+
+LinearArena *Renderer::frame_arena()
+{
+    int worker = jobs->worker_index();
+    assert(worker >= 0);
+    return frame_arenas.arena(worker);
+}
+
+void Renderer::set_gpu_completion_waiter(VulkanCompletionWaiter *_gpu_waiter)
+{
+    assert(_gpu_waiter != nullptr);
+    gpu_waiter = _gpu_waiter;
+}
+
+void Renderer::RenderThreadAwaitable::await_suspend(std::coroutine_handle<> handle)
+{
+    std::lock_guard<std::mutex> lock(renderer->render_thread_mutex);
+    renderer->render_thread_coroutines.push_back(handle);
+}
+
+void Renderer::resume_render_thread_coroutines()
+{
+    std::vector<std::coroutine_handle<>> coroutines;
+    {
+        std::lock_guard<std::mutex> lock(render_thread_mutex);
+        coroutines.swap(render_thread_coroutines);
+    }
+    for (std::coroutine_handle<> handle : coroutines) handle.resume();
 }
 
 RenderEntity Renderer::get_camera()
 {
-    return (RenderEntityType::Camera << 32) & 0;
+    return render_entity(RenderEntityType::Camera, 0);
+}
+
+RenderTransform Renderer::create_transform(vec3 position, vec3 euler_angles)
+{
+    return Transform{position, euler_angles};
+}
+
+RenderEntity Renderer::create_polygon_mesh(PolygonMeshCreateInfo info)
+{
+    MemoryScope memory_scope(MemorySubsystem::Renderer);
+    assert(graphics_api != GraphicsAPI::None);
+    assert(info.num_vertices > 0 && info.num_indices > 0 && info.num_indices % 3 == 0);
+    // Without a GPU, only what ray queries and the path tracer need is kept.
+    bool on_gpu = graphics_api == GraphicsAPI::Vulkan;
+
+    // Reordered copies of the mesh data, if optimizing.
+    std::vector<vec3> optimized_positions;
+    std::vector<vec3> optimized_normals;
+    std::vector<uint32_t> optimized_indices;
+    if ( info.optimize )
+    {
+        optimized_positions.assign(info.positions, info.positions + info.num_vertices);
+        optimized_normals.assign(info.normals, info.normals + info.num_vertices);
+        optimized_indices.assign(info.indices, info.indices + info.num_indices);
+        MeshOptimizeReport report;
+        optimize_mesh(&optimized_indices[0], info.num_indices,
+                      &optimized_positions[0], &optimized_normals[0], info.num_vertices,
+                      vertex_format_info(info.vertex_format).stride,
+                      &report);
+        if ( info.optimize_report != nullptr ) *info.optimize_report = report;
+        info.positions = &optimized_positions[0];
+        info.normals = &optimized_normals[0];
+        info.indices = &optimized_indices[0];
+    }
+
+    std::vector<MeshLodLevel> lod_levels;
+    if ( info.build_lods && on_gpu )
+    {
+        build_lod_chain(&lod_levels, info.indices, info.num_indices, info.positions, info.num_vertices, MESH_LOD_MAX_LEVELS);
+        // The simplified LODs keep the vertex order, so only their triangle order is optimized.
+        for (size_t i = 1; i < lod_levels.size() && info.optimize; i++)
+            optimize_vertex_cache(&lod_levels[i].indices[0], lod_levels[i].indices.size(), info.num_vertices);
+    }
+
+    PolygonMesh mesh;
+    mesh.active = true;
+    mesh.allocation = {};
+    if ( on_gpu && !mesh_pool.allocate(info.vertex_format, info.num_vertices, info.num_indices, &mesh.allocation) )
+    {
+        fprintf(stderr, C_RED "[%s] Failed to allocate mesh storage.\n" C_RESET, __func__);
+        return RENDER_ENTITY_NULL;
+    }
+    VertexQuantization quantization = compute_vertex_quantization(info.positions, info.num_vertices);
+    if ( info.vertex_format == VertexFormat::Float )
+        mesh.dequantization_matrix = mat4(1.f);
+    else
+        mesh.dequantization_matrix = quantization.dequantization_matrix();
+    if ( on_gpu ) mesh_pool.upload(&uploader, mesh.allocation, quantization, info.positions, info.normals, info.indices);
+
+    mesh.bounds_center = quantization.bounds_min + 0.5f * quantization.bounds_extent;
+    mesh.bounds_radius = 0;
+    for (int i = 0; i < info.num_vertices; i++)
+        mesh.bounds_radius = std::max(mesh.bounds_radius, glm::length(info.positions[i] - mesh.bounds_center));
+    mesh.bounds_box.min = quantization.bounds_min;
+    mesh.bounds_box.max = quantization.bounds_min + quantization.bounds_extent;
+
+    mesh.num_lods = 1;
+    mesh.lods[0] = { MeshPool::index_range(mesh.allocation), 0 };
+    mesh.lod = 0;
+    for (size_t i = 1; i < lod_levels.size(); i++)
+    {
+        PolygonMeshLod &lod = mesh.lods[mesh.num_lods];
+        if ( !mesh_pool.allocate_indices(mesh.allocation, lod_levels[i].indices.size(), &lod.indices) )
+        {
+            fprintf(stderr, C_RED "[%s] Failed to allocate LOD %zu, the LOD chain will stop at LOD %zu.\n" C_RESET, __func__, i, i - 1);
+            break;
+        }
+        lod.error = lod_levels[i].error;
+        mesh_pool.upload_indices(&uploader, mesh.allocation, lod.indices, &lod_levels[i].indices[0]);
+        mesh.num_lods++;
+    }
+
+    mesh.has_meshlets = false;
+    if ( info.build_meshlets && on_gpu )
+    {
+        MeshletData meshlet_data;
+        build_meshlets(&meshlet_data, info.indices, info.num_indices, info.positions, info.num_vertices);
+        if ( !meshlet_culler.add_mesh(&uploader, meshlet_data, &mesh.meshlets) )
+        {
+            fprintf(stderr, C_RED "[%s] Failed to add meshlets, the mesh will be drawn without meshlet culling.\n" C_RESET, __func__);
+        }
+        else
+        {
+            mesh.has_meshlets = true;
+        }
+    }
+
+    // Ray queries and picking test LOD 0's triangles on the CPU.
+    MeshBvh mesh_bvh;
+    mesh_bvh.build(jobs, info.positions, info.num_vertices, info.indices, info.num_indices);
+
+    RenderEntity entity = add_polygon_mesh(mesh, Transform{vec3(0), vec3(0)}, std::move(mesh_bvh));
+    // The CPU rasterizer shades with the vertex normals.
+    if ( !on_gpu )
+    {
+        PolygonMeshGeometry &geometry = polygon_mesh_geometries[polygon_meshes[render_entity_index(entity)].geometry];
+        geometry.normals.assign(info.normals, info.normals + info.num_vertices);
+    }
+    return entity;
+}
+
+RenderEntity Renderer::create_polygon_mesh_instance(RenderEntity entity)
+{
+    MemoryScope memory_scope(MemorySubsystem::Renderer);
+    assert(render_entity_type(entity) == RenderEntityType::PolygonMesh);
+    uint32_t index = render_entity_index(entity);
+    assert(index < polygon_meshes.size() && polygon_meshes[index].active);
+    // Copied, as adding may grow polygon_meshes.
+    PolygonMesh mesh = polygon_meshes[index];
+    mesh.lod = 0;
+    return add_polygon_mesh_to_geometry(mesh, polygon_mesh_transforms[index]);
+}
+
+RenderEntity Renderer::add_polygon_mesh(const PolygonMesh &mesh, Transform transform, MeshBvh &&mesh_bvh)
+{
+    uint32_t geometry;
+    if ( !free_polygon_mesh_geometry_indices.empty() )
+    {
+        geometry = free_polygon_mesh_geometry_indices.back();
+        free_polygon_mesh_geometry_indices.pop_back();
+    }
+    else
+    {
+        geometry = polygon_mesh_geometries.size();
+        polygon_mesh_geometries.emplace_back();
+    }
+    polygon_mesh_geometries[geometry].bvh = std::move(mesh_bvh);
+    PolygonMesh geometry_mesh = mesh;
+    geometry_mesh.geometry = geometry;
+    return add_polygon_mesh_to_geometry(geometry_mesh, transform);
+}
+
+RenderEntity Renderer::add_polygon_mesh_to_geometry(const PolygonMesh &mesh, Transform transform)
+{
+    uint32_t index;
+    if ( !free_polygon_mesh_indices.empty() )
+    {
+        index = free_polygon_mesh_indices.back();
+        free_polygon_mesh_indices.pop_back();
+        polygon_meshes[index] = mesh;
+        polygon_mesh_transforms[index] = transform;
+    }
+    else
+    {
+        index = polygon_meshes.size();
+        polygon_meshes.push_back(mesh);
+        polygon_mesh_transforms.push_back(transform);
+        // Grown here, so that picking doesn't allocate in the frame.
+        for (std::vector<uint32_t> &meshes : pick_instance_meshes) meshes.resize(polygon_meshes.size());
+    }
+    PolygonMeshGeometry &geometry = polygon_mesh_geometries[mesh.geometry];
+    polygon_meshes[index].geometry_slot = geometry.meshes.size();
+    geometry.meshes.push_back(index);
+    // Dynamic until it settles, when it is baked into the static shadows it reaches.
+    polygon_meshes[index].moved_frame = frame_number;
+    instance_bvh_stale = true;
+    scene_version++;
+    return render_entity(RenderEntityType::PolygonMesh, index);
+}
+
+RenderEntity Renderer::create_point_light()
+{
+    MemoryScope memory_scope(MemorySubsystem::Renderer);
+    PointLight light;
+    light.active = true;
+    light.color = vec4(1);
+    light.radius = point_light_radius(light.color);
+    return add_point_light(light, Transform{vec3(0), vec3(0)});
+}
+
+RenderEntity Renderer::add_point_light(const PointLight &light, Transform transform)
+{
+    uint32_t index;
+    if ( !free_point_light_indices.empty() )
+    {
+        index = free_point_light_indices.back();
+        free_point_light_indices.pop_back();
+        point_lights[index] = light;
+        point_light_transforms[index] = transform;
+    }
+    else
+    {
+        index = point_lights.size();
+        point_lights.push_back(light);
+        point_light_transforms.push_back(transform);
+    }
+    scene_version++;
+    return render_entity(RenderEntityType::PointLight, index);
+}
+
+bool Renderer::allocate_asset_meshes(const AssetFile &file,
+                                     const char *path,
+                                     std::vector<PolygonMesh> *meshes,
+                                     std::vector<AssetChunkDecode> *decodes,
+                                     std::vector<VkDeviceSize> *staging_offsets,
+                                     VkDeviceSize *staging_size)
+{
+    MemoryScope memory_scope(MemorySubsystem::Assets);
+    const AssetFileHeader &header = file.header();
+    meshes->resize(header.num_meshes);
+    *staging_size = 0;
+    auto add_decode = [&](uint32_t chunk) {
+        decodes->push_back({chunk, nullptr, nullptr});
+        staging_offsets->push_back(*staging_size);
+        *staging_size += (file.chunks()[chunk].size + 15) & ~15ull;
+    };
+    for (uint32_t m = 0; m < header.num_meshes; m++)
+    {
+        const AssetMesh &asset_mesh = file.meshes()[m];
+        PolygonMesh &mesh = (*meshes)[m];
+        bool allocated = mesh_pool.allocate(asset_mesh.vertex_format, asset_mesh.num_vertices, asset_mesh.lods[0].num_indices, &mesh.allocation);
+        if ( allocated )
+        {
+            mesh.num_lods = 1;
+            mesh.lods[0] = { MeshPool::index_range(mesh.allocation), 0 };
+            for (uint32_t i = 1; i < asset_mesh.num_lods && allocated; i++)
+            {
+                allocated = mesh_pool.allocate_indices(mesh.allocation, asset_mesh.lods[i].num_indices, &mesh.lods[i].indices);
+                mesh.lods[i].error = asset_mesh.lods[i].error;
+                if ( allocated ) mesh.num_lods++;
+            }
+            if ( !allocated ) free_polygon_mesh_storage(mesh);
+        }
+        if ( !allocated )
+        {
+            fprintf(stderr, C_RED "[%s] Out of mesh pool space loading \"%s\".\n" C_RESET, __func__, path);
+            for (uint32_t i = 0; i < m; i++) free_polygon_mesh_storage((*meshes)[i]);
+            return false;
+        }
+        add_decode(asset_mesh.vertex_chunk);
+        for (uint32_t i = 0; i < asset_mesh.num_lods; i++) add_decode(asset_mesh.lods[i].index_chunk);
+
+        mesh.active = true;
+        VertexQuantization quantization;
+        quantization.bounds_min = vec3(asset_mesh.bounds_min[0], asset_mesh.bounds_min[1], asset_mesh.bounds_min[2]);
+        quantization.bounds_extent = vec3(asset_mesh.bounds_extent[0], asset_mesh.bounds_extent[1], asset_mesh.bounds_extent[2]);
+        if ( asset_mesh.vertex_format == VertexFormat::Float )
+            mesh.dequantization_matrix = mat4(1.f);
+        else
+            mesh.dequantization_matrix = quantization.dequantization_matrix();
+        mesh.bounds_center = vec3(asset_mesh.bounds_center[0], asset_mesh.bounds_center[1], asset_mesh.bounds_center[2]);
+        mesh.bounds_radius = asset_mesh.bounds_radius;
+        mesh.bounds_box.min = quantization.bounds_min;
+        mesh.bounds_box.max = quantization.bounds_min + quantization.bounds_extent;
+        mesh.lod = 0;
+        mesh.has_meshlets = false;
+    }
+    return true;
+}
+
+void Renderer::free_polygon_mesh_storage(const PolygonMesh &mesh)
+{
+    for (uint32_t i = 1; i < mesh.num_lods; i++) mesh_pool.free_indices(mesh.lods[i].indices);
+    mesh_pool.free(mesh.allocation);
+}
+
+void Renderer::record_asset_mesh_copies(const std::vector<PolygonMesh> &meshes, const std::vector<VkDeviceSize> &staging_offsets)
+{
+    size_t decode = 0;
+    for (const PolygonMesh &mesh : meshes)
+    {
+        mesh_pool.copy_vertices(&uploader, staging_offsets[decode++], mesh.allocation);
+        for (uint32_t i = 0; i < mesh.num_lods; i++)
+            mesh_pool.copy_indices(&uploader, staging_offsets[decode++], mesh.lods[i].indices);
+    }
+}
+
+void Renderer::build_asset_mesh_bvhs(const AssetFile &file,
+                                     const std::vector<PolygonMesh> &meshes,
+                                     const uint8_t *decoded,
+                                     const std::vector<VkDeviceSize> &staging_offsets,
+                                     std::vector<MeshBvh> *mesh_bvhs)
+{
+    MemoryScope memory_scope(MemorySubsystem::Assets);
+    // Each mesh's vertex chunk is followed by its LODs' index chunks, as laid out by allocate_asset_meshes.
+    std::vector<size_t> first_decodes(meshes.size());
+    size_t decode = 0;
+    for (size_t m = 0; m < meshes.size(); m++)
+    {
+        first_decodes[m] = decode;
+        decode += 1 + meshes[m].num_lods;
+    }
+    mesh_bvhs->resize(meshes.size());
+    // A job per mesh, so each BVH is built serially.
+    jobs->parallel_for(meshes.size(), 1, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t m = begin; m < end; m++)
+        {
+            const AssetMesh &asset_mesh = file.meshes()[m];
+            VertexQuantization quantization;
+            quantization.bounds_min = vec3(asset_mesh.bounds_min[0], asset_mesh.bounds_min[1], asset_mesh.bounds_min[2]);
+            quantization.bounds_extent = vec3(asset_mesh.bounds_extent[0], asset_mesh.bounds_extent[1], asset_mesh.bounds_extent[2]);
+            std::vector<vec3> positions(asset_mesh.num_vertices);
+            decode_vertex_positions(asset_mesh.vertex_format, quantization, decoded + staging_offsets[first_decodes[m]],
+                                    asset_mesh.num_vertices, &positions[0]);
+            uint32_t num_indices = asset_mesh.lods[0].num_indices;
+            std::vector<uint32_t> indices(num_indices);
+            const uint8_t *stored_indices = decoded + staging_offsets[first_decodes[m] + 1];
+            if ( meshes[m].allocation.index_type == VK_INDEX_TYPE_UINT16 )
+            {
+                for (uint32_t i = 0; i < num_indices; i++)
+                {
+                    uint16_t index;
+                    memcpy(&index, stored_indices + 2*i, 2);
+                    indices[i] = index;
+                }
+            }
+            else
+            {
+                memcpy(&indices[0], stored_indices, num_indices * sizeof(uint32_t));
+            }
+            (*mesh_bvhs)[m].build(nullptr, &positions[0], asset_mesh.num_vertices, &indices[0], num_indices);
+        }
+    });
+}
+
+void Renderer::add_asset_entities(const AssetFile &file,
+                                  const std::vector<PolygonMesh> &meshes,
+                                  std::vector<MeshBvh> *mesh_bvhs,
+                                  std::vector<RenderEntity> *entities)
+{
+    MemoryScope memory_scope(MemorySubsystem::Assets);
+    const AssetFileHeader &header = file.header();
+    for (uint32_t i = 0; i < header.num_meshes; i++)
+    {
+        const AssetMesh &asset_mesh = file.meshes()[i];
+        Transform transform;
+        transform.position = vec3(asset_mesh.position[0], asset_mesh.position[1], asset_mesh.position[2]);
+        transform.euler_angles = vec3(asset_mesh.euler_angles[0], asset_mesh.euler_angles[1], asset_mesh.euler_angles[2]);
+        entities->push_back(add_polygon_mesh(meshes[i], transform, std::move((*mesh_bvhs)[i])));
+    }
+    for (uint32_t i = 0; i < header.num_point_lights; i++)
+    {
+        const AssetPointLight &asset_light = file.point_lights()[i];
+        PointLight light;
+        light.active = true;
+        light.color = vec4(asset_light.color[0], asset_light.color[1], asset_light.color[2], asset_light.color[3]);
+        light.radius = point_light_radius(light.color);
+        Transform transform;
+        transform.position = vec3(asset_light.position[0], asset_light.position[1], asset_light.position[2]);
+        transform.euler_angles = vec3(asset_light.euler_angles[0], asset_light.euler_angles[1], asset_light.euler_angles[2]);
+        entities->push_back(add_point_light(light, transform));
+    }
+}
+
+bool Renderer::load_asset_file(const char *path, std::vector<RenderEntity> *entities, RenderAssetLoadStats *stats)
+{
+    MemoryScope memory_scope(MemorySubsystem::Assets);
+    assert(graphics_api == GraphicsAPI::Vulkan && jobs != nullptr);
+    AssetFile file;
+    if ( !file.open(path) ) return false;
+
+    // Allocate every mesh, and lay out every chunk in one staging batch.
+    std::vector<PolygonMesh> meshes;
+    std::vector<AssetChunkDecode> decodes;
+    std::vector<VkDeviceSize> staging_offsets;
+    VkDeviceSize staging_size;
+    if ( !allocate_asset_meshes(file, path, &meshes, &decodes, &staging_offsets, &staging_size) )
+    {
+        file.close();
+        return false;
+    }
+
+    // Decode into host memory, where the meshes' BVHs are built from it, then copy it all to
+    // the mesh pool in one submission. Staging memory is write-combined, so it isn't read back.
+    std::vector<MeshBvh> mesh_bvhs;
+    if ( !decodes.empty() )
+    {
+        std::vector<uint8_t> decoded(staging_size);
+        for (size_t i = 0; i < decodes.size(); i++) decodes[i].destination = &decoded[staging_offsets[i]];
+        if ( !decode_asset_chunks(jobs, file, &decodes[0], decodes.size()) )
+        {
+            fprintf(stderr, C_RED "[%s] Failed to decode \"%s\".\n" C_RESET, __func__, path);
+            for (PolygonMesh &mesh : meshes) free_polygon_mesh_storage(mesh);
+            file.close();
+            return false;
+        }
+        build_asset_mesh_bvhs(file, meshes, &decoded[0], staging_offsets, &mesh_bvhs);
+        uint8_t *staging = uploader.begin(staging_size);
+        assert(staging != nullptr);
+        memcpy(staging, &decoded[0], staging_size);
+        record_asset_mesh_copies(meshes, staging_offsets);
+        uploader.end_and_wait(VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT);
+    }
+
+    add_asset_entities(file, meshes, &mesh_bvhs, entities);
+    if ( stats != nullptr )
+    {
+        stats->num_polygon_meshes = file.header().num_meshes;
+        stats->num_point_lights = file.header().num_point_lights;
+        stats->num_chunks = decodes.size();
+    }
+    file.close();
+    return true;
+}
+
+Task<bool> Renderer::load_asset_file_async(AsyncFileIO *io, std::string path, std::vector<RenderEntity> *entities,
+                                           RenderAssetLoadStats *stats)
+{
+    assert(graphics_api == GraphicsAPI::Vulkan && jobs != nullptr && gpu_waiter != nullptr);
+    co_await on_render_thread();
+    AssetFile file;
+    if ( !file.open(path.c_str()) ) co_return false;
+    std::vector<PolygonMesh> meshes;
+    std::vector<AssetChunkDecode> decodes;
+    std::vector<VkDeviceSize> staging_offsets;
+    VkDeviceSize staging_size;
+    if ( !allocate_asset_meshes(file, path.c_str(), &meshes, &decodes, &staging_offsets, &staging_size) )
+    {
+        file.close();
+        co_return false;
+    }
+
+    std::vector<MeshBvh> mesh_bvhs;
+    if ( !decodes.empty() )
+    {
+        // Chunks are stored one after another, so read them all in one request instead of
+        // faulting them in through the mapping, then decode them on workers.
+        uint64_t read_begin = UINT64_MAX;
+        uint64_t read_end = 0;
+        for (const AssetChunkDecode &decode : decodes)
+        {
+            const AssetChunk &chunk = file.chunks()[decode.chunk];
+            read_begin = std::min(read_begin, chunk.offset);
+            read_end = std::max(read_end, chunk.offset + chunk.stored_size);
+        }
+        // A scope can't be held across a suspension, which may resume on another thread.
+        std::vector<uint8_t> stored;
+        std::vector<uint8_t> decoded;
+        {
+            MemoryScope memory_scope(MemorySubsystem::Assets);
+            stored.resize(read_end - read_begin);
+            decoded.resize(staging_size);
+        }
+        bool succeeded = false;
+        int fd = open(path.c_str(), O_RDONLY);
+        if ( fd >= 0 )
+        {
+            IOReadRequest request = {};
+            request.fd = fd;
+            request.offset = read_begin;
+            request.size = stored.size();
+            request.destination = &stored[0];
+            request.priority = IOPriority::Normal;
+            IOReadResult result = co_await io->read_async(jobs, request);
+            close(fd);
+            if ( result.error == 0 && !result.cancelled && result.bytes_read == stored.size() )
+            {
+                for (size_t i = 0; i < decodes.size(); i++)
+                {
+                    decodes[i].source = &stored[file.chunks()[decodes[i].chunk].offset - read_begin];
+                    decodes[i].destination = &decoded[staging_offsets[i]];
+                }
+                MemoryScope memory_scope(MemorySubsystem::Assets);
+                succeeded = decode_asset_chunks(jobs, file, &decodes[0], decodes.size());
+                if ( succeeded ) build_asset_mesh_bvhs(file, meshes, &decoded[0], staging_offsets, &mesh_bvhs);
+            }
+        }
+        co_await on_render_thread();
+        if ( !succeeded )
+        {
+            fprintf(stderr, C_RED "[%s] Failed to read \"%s\".\n" C_RESET, __func__, path.c_str());
+            for (PolygonMesh &mesh : meshes) free_polygon_mesh_storage(mesh);
+            file.close();
+            co_return false;
+        }
+        uint8_t *staging = uploader.begin(staging_size);
+        assert(staging != nullptr);
+        memcpy(staging, &decoded[0], staging_size);
+        record_asset_mesh_copies(meshes, staging_offsets);
+        uint64_t value = uploader.end_async(VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT);
+        co_await gpu_waiter->timeline_reached(uploader.semaphore(), value);
+        co_await on_render_thread();
+    }
+
+    add_asset_entities(file, meshes, &mesh_bvhs, entities);
+    if ( stats != nullptr )
+    {
+        stats->num_polygon_meshes = file.header().num_meshes;
+        stats->num_point_lights = file.header().num_point_lights;
+        stats->num_chunks = decodes.size();
+    }
+    file.close();
+    co_return true;
+}
+
+void Renderer::destroy_entity(RenderEntity entity)
+{
+    MemoryScope memory_scope(MemorySubsystem::Renderer);
+    uint32_t index = render_entity_index(entity);
+    scene_version++;
+    switch (render_entity_type(entity))
+    {
+    case RenderEntityType::Camera:
+        assert(0 && "The camera cannot be destroyed.");
+        break;
+    case RenderEntityType::PolygonMesh:
+    {
+        assert(index < polygon_meshes.size() && polygon_meshes[index].active);
+        PolygonMesh &mesh = polygon_meshes[index];
+        PolygonMeshGeometry &geometry = polygon_mesh_geometries[mesh.geometry];
+        uint32_t last_mesh = geometry.meshes.back();
+        geometry.meshes[mesh.geometry_slot] = last_mesh;
+        polygon_meshes[last_mesh].geometry_slot = mesh.geometry_slot;
+        geometry.meshes.pop_back();
+        if ( graphics_api == GraphicsAPI::Vulkan )
+        {
+            // Frames in flight may still draw it, so its storage is freed when their slot is reused.
+            if ( geometry.meshes.empty() ) removed_polygon_meshes[recording_frame_slot].push_back(mesh);
+            if ( polygon_mesh_is_static(index) ) shadow_invalidations.push_back(polygon_mesh_world_bounds(index));
+        }
+        if ( geometry.meshes.empty() )
+        {
+            geometry.bvh = MeshBvh();
+            geometry.normals = std::vector<vec3>();
+            free_polygon_mesh_geometry_indices.push_back(mesh.geometry);
+        }
+        mesh.active = false;
+        instance_bvh_stale = true;
+        free_polygon_mesh_indices.push_back(index);
+        break;
+    }
+    case RenderEntityType::PointLight:
+        assert(index < point_lights.size() && point_lights[index].active);
+        shadow_atlas.remove_light(index);
+        point_lights[index].active = false;
+        free_point_light_indices.push_back(index);
+        break;
+    }
 }
 
 void Renderer::set_transform(RenderEntity entity, Transform transform)
 {
-    RenderEntityType type = entity >> 32;
-    uint32_t index = entity & ((1 << 32)-1);
-    switch (type)
+    MemoryScope memory_scope(MemorySubsystem::Renderer);
+    uint32_t index = render_entity_index(entity);
+    scene_version++;
+    switch (render_entity_type(entity))
     {
     case RenderEntityType::Camera:
         //-Dirty camera.
         camera_transform = transform;
         break;
     case RenderEntityType::PolygonMesh:
-        //-Dirty acceleration structures.
-        assert(index >= 0 && index < polygon_mesh_transforms.size());
+        assert(index < polygon_mesh_transforms.size());
+        // Refit at the next update. A stale BVH is rebuilt from the current transforms anyway.
+        if ( !instance_bvh_stale ) moved_instance_bvh_primitives.push_back(polygon_meshes[index].instance_bvh_primitive);
+        // A static caster leaving its place is removed from the static shadows it was baked into.
+        if ( graphics_api == GraphicsAPI::Vulkan && polygon_mesh_is_static(index) )
+            shadow_invalidations.push_back(polygon_mesh_world_bounds(index));
         polygon_mesh_transforms[index] = transform;
+        polygon_meshes[index].moved_frame = frame_number;
         break;
     case RenderEntityType::PointLight:
-        assert(index >= 0 && index < point_light_transforms.size());
+        assert(index < point_light_transforms.size());
         point_light_transforms[index] = transform;
+        shadow_atlas.invalidate_light(index);
+        break;
+    }
+}
+
+void Renderer::set_attribute(RenderEntity entity, AttributeType attribute, vec4 value)
+{
+    uint32_t index = render_entity_index(entity);
+    switch (attribute)
+    {
+    case AttributeType::Color:
+        // Only point lights have a color so far.
+        assert(render_entity_type(entity) == RenderEntityType::PointLight);
+        assert(index < point_lights.size() && point_lights[index].active);
+        point_lights[index].color = value;
+        point_lights[index].radius = point_light_radius(value);
+        shadow_atlas.invalidate_light(index);
+        scene_version++;
         break;
     }
 }
+
+void Renderer::set_lod_error_threshold(float pixels)
+{
+    assert(pixels >= 0);
+    lod_error_threshold = pixels;
+}
+
+uint32_t Renderer::polygon_mesh_num_lods(RenderEntity mesh) const
+{
+    assert(render_entity_type(mesh) == RenderEntityType::PolygonMesh);
+    uint32_t index = render_entity_index(mesh);
+    assert(index < polygon_meshes.size() && polygon_meshes[index].active);
+    return polygon_meshes[index].num_lods;
+}
+
+const PolygonMeshLod &Renderer::polygon_mesh_lod(RenderEntity mesh, uint32_t lod) const
+{
+    assert(lod < polygon_mesh_num_lods(mesh));
+    return polygon_meshes[render_entity_index(mesh)].lods[lod];
+}
+
+void Renderer::set_depth_prepass(DepthPrepassMode mode)
+{
+    main_pass.set_mode(mode);
+}
+
+void Renderer::set_gpu_time_budget(float milliseconds, float min_scale)
+{
+    dynamic_resolution.set_min_scale(min_scale);
+    dynamic_resolution.set_budget(milliseconds);
+}
+
+bool Renderer::start_capture(const char *path_format, ImageFileFormat format)
+{
+    assert(graphics_api != GraphicsAPI::None && jobs != nullptr);
+    // With Vulkan, frames are copied from the swap chain images after the main pass.
+    if ( graphics_api == GraphicsAPI::Vulkan && !(vk->swap_chain_usage & VK_IMAGE_USAGE_TRANSFER_SRC_BIT) )
+    {
+        fprintf(stderr, C_RED "[%s] The swap chain images can't be copied from, so frames can't be captured.\n" C_RESET, __func__);
+        return false;
+    }
+    return frame_capture.start(jobs, path_format, format);
+}
+
+void Renderer::stop_capture()
+{
+    frame_capture.stop();
+}
+
+void Renderer::write_frame_uniforms(float aspect)
+{
+    mat4 view = glm::inverse(camera_transform.matrix());
+
+    // Compact the active lights, keeping their view-space spheres for clustering.
+    uint32_t max_point_lights = std::min<size_t>(point_lights.size(), RENDERER_MAX_POINT_LIGHTS);
+    GpuPointLight *lights = frame_ring.allocate<GpuPointLight>(max_point_lights, &frame_dynamic_offsets[FRAME_BINDING_POINT_LIGHTS]);
+    LinearArena *arena = frame_arena();
+    float *light_x = (float *) arena->allocate(4 * max_point_lights * sizeof(float), alignof(float));
+    float *light_y = light_x + max_point_lights;
+    float *light_depth = light_y + max_point_lights;
+    float *light_radius = light_depth + max_point_lights;
+    uint32_t num_point_lights = 0;
+    if ( lights != nullptr )
+    {
+        for (uint32_t i = 0; i < point_lights.size() && num_point_lights < max_point_lights; i++)
+        {
+            if ( !point_lights[i].active ) continue;
+            GpuPointLight light;
+            light.position = vec4(point_light_transforms[i].position, point_lights[i].radius);
+            light.color = point_lights[i].color;
+            light.shadow_slot = shadow_atlas.slot(i);
+            lights[num_point_lights] = light;
+            vec3 view_position = vec3(view * vec4(point_light_transforms[i].position, 1));
+            light_x[num_point_lights] = view_position.x;
+            light_y[num_point_lights] = view_position.y;
+            light_depth[num_point_lights] = -view_position.z;
+            light_radius[num_point_lights] = point_lights[i].radius;
+            num_point_lights++;
+        }
+    }
+
+    light_clusters.set_projection(camera.fov_y, aspect, camera.near_plane, camera.far_plane);
+    LightClusterLights cluster_lights = { num_point_lights, light_x, light_y, light_depth, light_radius };
+    light_clusters.assign(jobs, &frame_arenas, cluster_lights, &frame_ring,
+                          &frame_dynamic_offsets[FRAME_BINDING_LIGHT_CLUSTERS],
+                          &frame_dynamic_offsets[FRAME_BINDING_LIGHT_INDICES]);
+
+    GpuFrameUniforms *uniforms = frame_ring.allocate<GpuFrameUniforms>(1, &frame_dynamic_offsets[FRAME_BINDING_UNIFORMS]);
+    if ( uniforms != nullptr )
+    {
+        // Built on the stack, as the ring buffer may be write-combined.
+        GpuFrameUniforms u = {};
+        u.view = view;
+        u.projection = camera.projection_matrix(aspect);
+        u.view_projection = u.projection * u.view;
+        u.camera_position = vec4(camera_transform.position, 1);
+        u.viewport_size = vec2(render_extent.width, render_extent.height);
+        u.cluster_z_scale = light_clusters.z_scale();
+        u.cluster_z_bias = light_clusters.z_bias();
+        u.num_point_lights = num_point_lights;
+        u.shadow_atlas = shadow_atlas.atlas_index();
+        u.shadow_sampler = shadow_atlas.sampler_index();
+        *uniforms = u;
+    }
+}
+
+void Renderer::update_polygon_meshes(int viewport_height)
+{
+    assert(polygon_meshes.size() <= RENDERER_MAX_POLYGON_MESHES);
+    // An object-space error e at distance d projects to e * pixels_per_unit / d pixels.
+    float pixels_per_unit = viewport_height / (2 * tanf(0.5f * camera.fov_y));
+    vec3 camera_position = camera_transform.position;
+    jobs->parallel_for(polygon_meshes.size(), RENDERER_LOD_SELECTION_GRAIN, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; i++)
+        {
+            PolygonMesh &mesh = polygon_meshes[i];
+            if ( !mesh.active ) continue;
+            mat4 transform = polygon_mesh_transforms[i].matrix();
+            // Transforms are rigid, so object-space errors are world-space errors.
+            vec3 center = vec3(transform * vec4(mesh.bounds_center, 1));
+            float distance = std::max(glm::length(center - camera_position) - mesh.bounds_radius, camera.near_plane);
+            mesh.distance = distance;
+            mesh.lod = 0;
+            for (uint32_t lod = mesh.num_lods - 1; lod > 0; lod--)
+            {
+                if ( mesh.lods[lod].error * pixels_per_unit / distance <= lod_error_threshold )
+                {
+                    mesh.lod = lod;
+                    break;
+                }
+            }
+        }
+    });
+
+    // The geometries keep their lists of meshes, so only the LODs need sorting: a counting sort
+    // of each geometry's meshes by LOD gives the instance slots of its draws.
+    polygon_mesh_draws.clear();
+    uint32_t num_instances = 0;
+    for (const PolygonMeshGeometry &geometry : polygon_mesh_geometries)
+    {
+        if ( geometry.meshes.empty() ) continue;
+        uint32_t first_mesh = geometry.meshes[0];
+        if ( polygon_mesh_uses_meshlets(first_mesh) )
+        {
+            polygon_meshes[first_mesh].instance_slot = num_instances++;
+            continue;
+        }
+        uint32_t lod_slots[MESH_LOD_MAX_LEVELS] = {};
+        float lod_distances[MESH_LOD_MAX_LEVELS];
+        std::fill(lod_distances, lod_distances + MESH_LOD_MAX_LEVELS, INFINITY);
+        for (uint32_t mesh : geometry.meshes)
+        {
+            uint32_t lod = polygon_meshes[mesh].lod;
+            lod_slots[lod]++;
+            lod_distances[lod] = std::min(lod_distances[lod], polygon_meshes[mesh].distance);
+        }
+        for (uint32_t lod = 0; lod < polygon_meshes[first_mesh].num_lods; lod++)
+        {
+            uint32_t count = lod_slots[lod];
+            if ( count > 0 ) polygon_mesh_draws.push_back({first_mesh, lod, num_instances, count, lod_distances[lod]});
+            lod_slots[lod] = num_instances;
+            num_instances += count;
+        }
+        for (uint32_t mesh : geometry.meshes) polygon_meshes[mesh].instance_slot = lod_slots[polygon_meshes[mesh].lod]++;
+    }
+
+    // The pipeline is chosen by vertex format. The mesh pool's vertex buffer is always bound,
+    // so the index buffer is the only buffer binding that changes between draws.
+    uint32_t num_draws = polygon_mesh_draws.size();
+    assert(num_draws <= DRAW_SORT_MAX_DRAWS);
+    ArenaVector<uint64_t> keys(num_draws, frame_arena());
+    ArenaVector<uint64_t> key_scratch(num_draws, frame_arena());
+    ArenaVector<PolygonMeshDraw> unsorted_draws(polygon_mesh_draws.begin(), polygon_mesh_draws.end(), frame_arena());
+    jobs->parallel_for(num_draws, DRAW_SORT_JOB_KEYS, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; i++)
+        {
+            const PolygonMeshDraw &draw = unsorted_draws[i];
+            const MeshAllocation &allocation = polygon_meshes[draw.mesh].allocation;
+            keys[i] = draw_sort_key(DrawPass::Opaque,
+                                    (uint32_t) allocation.vertex_format,
+                                    allocation.index_type == VK_INDEX_TYPE_UINT32 ? 1 : 0,
+                                    draw.distance,
+                                    i);
+        }
+    });
+    const uint64_t *sorted_keys = sort_draw_keys(jobs, frame_arena(), keys.data(), key_scratch.data(), num_draws);
+    jobs->parallel_for(num_draws, DRAW_SORT_JOB_KEYS, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; i++) polygon_mesh_draws[i] = unsorted_draws[draw_sort_key_index(sorted_keys[i])];
+    });
+
+    // Indexed by instance slot.
+    GpuInstance *instances = frame_ring.allocate<GpuInstance>(num_instances, &frame_dynamic_offsets[FRAME_BINDING_INSTANCES]);
+    if ( instances == nullptr ) return;
+    jobs->parallel_for(polygon_meshes.size(), RENDERER_LOD_SELECTION_GRAIN, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; i++)
+        {
+            const PolygonMesh &mesh = polygon_meshes[i];
+            if ( !mesh.active ) continue;
+            mat4 transform = polygon_mesh_transforms[i].matrix();
+            GpuInstance instance;
+            instance.model = transform * mesh.dequantization_matrix;
+            instance.normal_matrix = transform;
+            instances[mesh.instance_slot] = instance;
+        }
+    });
+}
+
+mat4 Renderer::polygon_mesh_model_matrix(uint32_t index) const
+{
+    assert(index < polygon_meshes.size());
+    return polygon_mesh_transforms[index].matrix() * polygon_meshes[index].dequantization_matrix;
+}
+
+vec4 Renderer::polygon_mesh_world_bounds(uint32_t index) const
+{
+    assert(index < polygon_meshes.size());
+    // Transforms are rigid, so the radius is unchanged.
+    vec3 center = vec3(polygon_mesh_transforms[index].matrix() * vec4(polygon_meshes[index].bounds_center, 1));
+    return vec4(center, polygon_meshes[index].bounds_radius);
+}
+
+bool Renderer::polygon_mesh_uses_meshlets(uint32_t index) const
+{
+    assert(index < polygon_meshes.size());
+    const PolygonMesh &mesh = polygon_meshes[index];
+    return mesh.has_meshlets && mesh.lod == 0 && polygon_mesh_geometries[mesh.geometry].meshes.size() == 1;
+}
+
+bool Renderer::polygon_mesh_is_static(uint32_t index) const
+{
+    assert(index < polygon_meshes.size());
+    return frame_number - polygon_meshes[index].moved_frame >= RENDERER_SHADOW_SETTLE_FRAMES;
+}
+
+Aabb Renderer::polygon_mesh_world_box(uint32_t index) const
+{
+    assert(index < polygon_meshes.size());
+    return transform_aabb(polygon_mesh_transforms[index].matrix(), polygon_meshes[index].bounds_box);
+}
+
+void Renderer::update_acceleration_structures()
+{
+    if ( !instance_bvh_stale && !moved_instance_bvh_primitives.empty() )
+    {
+        for (uint32_t primitive : moved_instance_bvh_primitives)
+        {
+            uint32_t mesh = instance_bvh_meshes[primitive];
+            instance_bvh_bounds[primitive] = polygon_mesh_world_box(mesh);
+            instance_bvh_ray_instances[primitive].world_to_object = glm::inverse(polygon_mesh_transforms[mesh].matrix());
+        }
+        instance_bvh.refit(&instance_bvh_bounds[0], &moved_instance_bvh_primitives[0], moved_instance_bvh_primitives.size());
+        // Refitting keeps the tree valid but loosens it as meshes drift from where they were split.
+        if ( frame_number % RENDERER_BVH_QUALITY_CHECK_INTERVAL == 0 && instance_bvh.degraded() )
+        {
+            instance_bvh_stale = true;
+            num_degraded_instance_bvh_rebuilds++;
+        }
+    }
+    moved_instance_bvh_primitives.clear();
+    if ( !instance_bvh_stale ) return;
+
+    instance_bvh_meshes.clear();
+    instance_bvh_bounds.clear();
+    instance_bvh_ray_instances.clear();
+    for (uint32_t i = 0; i < polygon_meshes.size(); i++)
+    {
+        if ( !polygon_meshes[i].active ) continue;
+        polygon_meshes[i].instance_bvh_primitive = instance_bvh_meshes.size();
+        instance_bvh_meshes.push_back(i);
+        instance_bvh_bounds.push_back(polygon_mesh_world_box(i));
+        // Meshes are only added on a rebuild, so the pointers are stable until the next one.
+        const MeshBvh *mesh_bvh = &polygon_mesh_geometries[polygon_meshes[i].geometry].bvh;
+        instance_bvh_ray_instances.push_back({mesh_bvh, glm::inverse(polygon_mesh_transforms[i].matrix())});
+    }
+    instance_bvh.build(jobs, instance_bvh_bounds.data(), instance_bvh_bounds.size());
+    instance_bvh_stale = false;
+}
+
+void Renderer::query_rays(RayQueryType type, const Ray *rays, uint32_t num_rays, RenderRayHit *hits)
+{
+    MemoryScope memory_scope(MemorySubsystem::Renderer);
+    assert(std::this_thread::get_id() == render_thread && jobs != nullptr);
+    // Take in changes made since the last render.
+    update_acceleration_structures();
+    ray_hits.resize(num_rays);
+    trace_rays(jobs, type, instance_bvh, instance_bvh_ray_instances.data(), rays, num_rays, ray_hits.data());
+    for (uint32_t i = 0; i < num_rays; i++)
+    {
+        const RayHit &ray_hit = ray_hits[i];
+        RenderRayHit &hit = hits[i];
+        hit.entity = ray_hit.instance == RAY_MISS ? RENDER_ENTITY_NULL
+                   : render_entity(RenderEntityType::PolygonMesh, instance_bvh_meshes[ray_hit.instance]);
+        hit.triangle = ray_hit.triangle;
+        hit.distance = ray_hit.distance;
+        hit.barycentrics = ray_hit.barycentrics;
+    }
+}
+
+Ray Renderer::camera_ray(float x, float y) const
+{
+    float width = std::max(viewport_width, 1);
+    float height = std::max(viewport_height, 1);
+    float tan_half_fov = tanf(0.5f * camera.fov_y);
+    // The camera looks down -Z in view space, with Y up.
+    vec3 view_direction = vec3((2 * x / width - 1) * tan_half_fov * width / height, (1 - 2 * y / height) * tan_half_fov, -1);
+    Ray ray;
+    ray.origin = camera_transform.position;
+    ray.direction = glm::normalize(vec3(camera_transform.matrix() * vec4(view_direction, 0)));
+    ray.max_distance = camera.far_plane;
+    return ray;
+}
+
+RenderEntity Renderer::pick(float x, float y)
+{
+    Ray ray = camera_ray(x, y);
+    RenderRayHit hit;
+    query_rays(RayQueryType::ClosestHit, &ray, 1, &hit);
+    return hit.entity;
+}
+
+void Renderer::request_pick(float x, float y)
+{
+    assert(graphics_api != GraphicsAPI::None);
+    if ( graphics_api == GraphicsAPI::CPU )
+    {
+        cpu_pick_requested = true;
+        cpu_pick_x = x;
+        cpu_pick_y = y;
+        return;
+    }
+    // The picker only answers once frames are recorded.
+    if ( !recorded_frame )
+    {
+        pick_on_cpu(x, y);
+        return;
+    }
+    object_picker.request(x, y);
+}
+
+void Renderer::pick_on_cpu(float x, float y)
+{
+    latest_pick.x = x;
+    latest_pick.y = y;
+    latest_pick.entity = pick(x, y);
+    latest_pick.nearest = latest_pick.entity;
+    has_pick_result = true;
+}
+
+bool Renderer::pick_result(RenderPick *pick)
+{
+    if ( !has_pick_result ) return false;
+    *pick = latest_pick;
+    has_pick_result = false;
+    return true;
+}
+
+RenderEntity Renderer::picked_entity(uint32_t frame, uint32_t id) const
+{
+    const std::vector<uint32_t> &meshes = pick_instance_meshes[frame];
+    if ( id == OBJECT_PICKER_ID_NULL || id - 1 >= meshes.size() ) return RENDER_ENTITY_NULL;
+    uint32_t mesh = meshes[id - 1];
+    // Meshes destroyed since the frame are not picked.
+    if ( mesh >= polygon_meshes.size() || !polygon_meshes[mesh].active ) return RENDER_ENTITY_NULL;
+    return render_entity(RenderEntityType::PolygonMesh, mesh);
+}
+
+void Renderer::path_trace(PathTracer *path_tracer)
+{
+    MemoryScope memory_scope(MemorySubsystem::Renderer);
+    assert(std::this_thread::get_id() == render_thread && jobs != nullptr);
+    update_acceleration_structures();
+    path_tracer_lights.clear();
+    for (uint32_t i = 0; i < point_lights.size(); i++)
+    {
+        if ( !point_lights[i].active ) continue;
+        PathTracerLight light;
+        light.position = point_light_transforms[i].position;
+        light.radius = point_lights[i].radius;
+        light.color = vec3(point_lights[i].color);
+        path_tracer_lights.push_back(light);
+    }
+    PathTracerScene scene;
+    scene.instance_bvh = &instance_bvh;
+    scene.instances = instance_bvh_ray_instances.data();
+    scene.lights = path_tracer_lights.data();
+    scene.num_lights = path_tracer_lights.size();
+    scene.camera_to_world = camera_transform.matrix();
+    scene.fov_y = camera.fov_y;
+    scene.version = scene_version;
+    path_tracer->render(jobs, scene);
+}
+
+void Renderer::rasterize(int width, int height)
+{
+    if ( width <= 0 || height <= 0 ) return;
+    if ( rasterizer.width() != width || rasterizer.height() != height ) rasterizer.resize(width, height);
+    RasterizerScene scene;
+    scene.view = glm::inverse(camera_transform.matrix());
+    scene.projection = camera.projection_matrix(width / (float) height);
+    scene.camera_position = camera_transform.position;
+
+    Frustum frustum = frustum_from_matrix(scene.projection * scene.view);
+    rasterizer_instances.clear();
+    auto overlaps = [&](const Aabb &box) { return frustum_overlaps_aabb(frustum, box); };
+    instance_bvh.query(overlaps, [&](uint32_t primitive) {
+        if ( !overlaps(instance_bvh_bounds[primitive]) ) return;
+        uint32_t index = instance_bvh_meshes[primitive];
+        const PolygonMeshGeometry &geometry = polygon_mesh_geometries[polygon_meshes[index].geometry];
+        RasterizerInstance instance;
+        instance.positions = geometry.bvh.positions.data();
+        instance.normals = geometry.normals.data();
+        instance.indices = geometry.bvh.indices.data();
+        instance.num_triangles = geometry.bvh.indices.size() / 3;
+        instance.object_to_world = polygon_mesh_transforms[index].matrix();
+        rasterizer_instances.push_back(instance);
+    });
+    rasterizer_lights.clear();
+    for (uint32_t i = 0; i < point_lights.size(); i++)
+    {
+        if ( !point_lights[i].active ) continue;
+        rasterizer_lights.push_back({point_light_transforms[i].position, point_lights[i].radius, vec3(point_lights[i].color)});
+    }
+    scene.instances = rasterizer_instances.data();
+    scene.num_instances = rasterizer_instances.size();
+    scene.lights = rasterizer_lights.data();
+    scene.num_lights = rasterizer_lights.size();
+    rasterizer.render(jobs, scene);
+}
+
+void Renderer::update_shadows()
+{
+    // Meshes that have just settled are baked into the static shadows they reach. The others
+    // that have not settled are dynamic casters.
+    ArenaVector<vec4> dynamic_bounds(frame_arena());
+    for (uint32_t i = 0; i < polygon_meshes.size(); i++)
+    {
+        if ( !polygon_meshes[i].active ) continue;
+        uint64_t frames_since_moved = frame_number - polygon_meshes[i].moved_frame;
+        if ( frames_since_moved == RENDERER_SHADOW_SETTLE_FRAMES )
+            shadow_invalidations.push_back(polygon_mesh_world_bounds(i));
+        else if ( frames_since_moved < RENDERER_SHADOW_SETTLE_FRAMES )
+            dynamic_bounds.push_back(polygon_mesh_world_bounds(i));
+    }
+
+    // Prefer the lights covering the most of the view, approximated by radius over distance.
+    struct Candidate
+    {
+        float priority;
+        uint32_t light;
+    };
+    ArenaVector<Candidate> candidates(frame_arena());
+    for (uint32_t i = 0; i < point_lights.size(); i++)
+    {
+        if ( !point_lights[i].active ) continue;
+        float distance = glm::length(point_light_transforms[i].position - camera_transform.position);
+        float priority = point_lights[i].radius / std::max(distance - point_lights[i].radius, camera.near_plane);
+        candidates.push_back({priority, i});
+    }
+    uint32_t num_shadowed = std::min<uint32_t>(candidates.size(), SHADOW_ATLAS_MAX_LIGHTS);
+    std::partial_sort(candidates.begin(), candidates.begin() + num_shadowed, candidates.end(),
+                      [](const Candidate &a, const Candidate &b) { return a.priority > b.priority; });
+    ShadowAtlasLight shadowed[SHADOW_ATLAS_MAX_LIGHTS];
+    for (uint32_t i = 0; i < num_shadowed; i++)
+    {
+        ShadowAtlasLight &light = shadowed[i];
+        light.light = candidates[i].light;
+        light.position = point_light_transforms[light.light].position;
+        light.radius = point_lights[light.light].radius;
+        light.has_dynamic_casters = false;
+        for (vec4 bounds : dynamic_bounds)
+        {
+            float reach = light.radius + bounds.w;
+            vec3 d = vec3(bounds) - light.position;
+            if ( glm::dot(d, d) <= reach * reach )
+            {
+                light.has_dynamic_casters = true;
+                break;
+            }
+        }
+    }
+    shadow_atlas.assign(shadowed, num_shadowed);
+    for (vec4 bounds : shadow_invalidations) shadow_atlas.invalidate_sphere(vec3(bounds), bounds.w);
+    shadow_invalidations.clear();
+}
+
+void Renderer::record_shadow_maps(VkCommandBuffer command_buffer)
+{
+    VkPipelineLayout pipeline_layout = shadow_atlas.pipeline_layout();
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, 0, 1, &frame_descriptor_set,
+                            RENDERER_NUM_FRAME_BINDINGS, frame_dynamic_offsets);
+    descriptor_heap.bind(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, 1);
+    mesh_pool.bind_vertex_buffer(command_buffer);
+    auto draw_casters = [&](VkCommandBuffer command_buffer, uint32_t light, const mat4 &view_projection, bool static_casters) {
+        // The face's far plane is at the light's radius, so this also culls casters out of its reach.
+        // Only the instance BVH's subtrees overlapping the face are visited.
+        Frustum frustum = frustum_from_matrix(view_projection);
+        auto overlaps = [&](const Aabb &box) { return frustum_overlaps_aabb(frustum, box); };
+        VertexFormat bound_vertex_format = VertexFormat::NUM;
+        VkIndexType bound_index_type = VK_INDEX_TYPE_MAX_ENUM;
+        instance_bvh.query(overlaps, [&](uint32_t primitive) {
+            uint32_t i = instance_bvh_meshes[primitive];
+            const PolygonMesh &mesh = polygon_meshes[i];
+            if ( !mesh.active || polygon_mesh_is_static(i) != static_casters ) return;
+            if ( !overlaps(instance_bvh_bounds[primitive]) ) return;
+            if ( bound_vertex_format != mesh.allocation.vertex_format )
+            {
+                bound_vertex_format = mesh.allocation.vertex_format;
+                vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, draw_pipelines.shadow(bound_vertex_format));
+                GpuShadowConstants constants = {};
+                constants.view_projection = view_projection;
+                constants.vertex_buffer = mesh_vertex_buffer_index;
+                constants.index_buffer = mesh_index_buffer_index;
+                constants.vertex_format = (uint32_t) bound_vertex_format;
+                vkCmdPushConstants(command_buffer, pipeline_layout, VK_SHADER_STAGE_ALL_GRAPHICS, 0, sizeof(GpuShadowConstants), &constants);
+            }
+            if ( bound_index_type != mesh.allocation.index_type )
+            {
+                mesh_pool.bind_index_buffer(command_buffer, mesh.allocation.index_type);
+                bound_index_type = mesh.allocation.index_type;
+            }
+            const MeshIndexRange &indices = mesh.lods[mesh.lod].indices;
+            vkCmdDrawIndexed(command_buffer,
+                             indices.num_indices,
+                             1,
+                             indices.first_index(bound_index_type),
+                             mesh.allocation.vertex_offset(),
+                             mesh.instance_slot);
+        });
+    };
+    shadow_atlas.record(command_buffer, draw_casters);
+}
+
+void Renderer::push_draw_constants(VkCommandBuffer command_buffer, VertexFormat vertex_format)
+{
+    GpuDrawConstants constants = {};
+    constants.vertex_buffer = mesh_vertex_buffer_index;
+    constants.index_buffer = mesh_index_buffer_index;
+    constants.vertex_format = (uint32_t) vertex_format;
+    vkCmdPushConstants(command_buffer, draw_pipeline_layout, VK_SHADER_STAGE_ALL_GRAPHICS, 0, sizeof(GpuDrawConstants), &constants);
+}
+
+void Renderer::record_frame(VkCommandBuffer command_buffer, uint32_t swap_chain_image)
+{
+    dynamic_resolution.record_begin(command_buffer);
+    record_shadow_maps(command_buffer);
+    record_meshlet_culling(command_buffer, viewport_height > 0 ? viewport_width / (float) viewport_height : 1.f);
+    bool picking = object_picker.requested();
+    record_main_pass(command_buffer, swap_chain_image);
+    if ( picking ) record_pick(command_buffer);
+    if ( frame_capture.capturing() )
+    {
+        frame_capture.record(command_buffer, vk->swap_chain_images[swap_chain_image], VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+                             MAIN_PASS_COLOR_FORMAT, viewport_width, viewport_height);
+    }
+    dynamic_resolution.record_end(command_buffer);
+    recorded_frame = true;
+}
+
+void Renderer::record_main_pass(VkCommandBuffer command_buffer, uint32_t swap_chain_image)
+{
+    // The same draws in the same order in both stages, so that depth is EQUAL where it should be.
+    main_pass.record(command_buffer, swap_chain_image, render_extent, object_picker.requested(),
+                     [this](VkCommandBuffer command_buffer, MainPassStage stage) {
+        record_polygon_mesh_draws(command_buffer, stage);
+        record_meshlet_draws(command_buffer, stage);
+    });
+}
+
+void Renderer::record_pick(VkCommandBuffer command_buffer)
+{
+    // The IDs are instance slots plus one, which are reassigned every frame.
+    std::vector<uint32_t> &meshes = pick_instance_meshes[object_picker.frame()];
+    for (uint32_t i = 0; i < polygon_meshes.size(); i++)
+    {
+        if ( polygon_meshes[i].active ) meshes[polygon_meshes[i].instance_slot] = i;
+    }
+    object_picker.record(command_buffer, main_pass.id_image(), render_extent, viewport_width, viewport_height);
+}
+
+void Renderer::record_polygon_mesh_draws(VkCommandBuffer command_buffer, MainPassStage stage)
+{
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, draw_pipeline_layout, 0, 1, &frame_descriptor_set,
+                            RENDERER_NUM_FRAME_BINDINGS, frame_dynamic_offsets);
+    descriptor_heap.bind(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, draw_pipeline_layout, 1);
+    mesh_pool.bind_vertex_buffer(command_buffer);
+    VertexFormat bound_vertex_format = VertexFormat::NUM;
+    VkIndexType bound_index_type = VK_INDEX_TYPE_MAX_ENUM;
+    for (const PolygonMeshDraw &draw : polygon_mesh_draws)
+    {
+        const PolygonMesh &mesh = polygon_meshes[draw.mesh];
+        if ( bound_vertex_format != mesh.allocation.vertex_format )
+        {
+            bound_vertex_format = mesh.allocation.vertex_format;
+            vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                              draw_pipelines.main_pass(main_pass.prepass(), stage, bound_vertex_format));
+            push_draw_constants(command_buffer, bound_vertex_format);
+        }
+        if ( bound_index_type != mesh.allocation.index_type )
+        {
+            mesh_pool.bind_index_buffer(command_buffer, mesh.allocation.index_type);
+            bound_index_type = mesh.allocation.index_type;
+        }
+        const MeshIndexRange &indices = mesh.lods[draw.lod].indices;
+        vkCmdDrawIndexed(command_buffer,
+                         indices.num_indices,
+                         draw.num_instances,
+                         indices.first_index(bound_index_type),
+                         mesh.allocation.vertex_offset(),
+                         draw.first_instance);
+    }
+}
+
+void Renderer::record_meshlet_culling(VkCommandBuffer command_buffer, float aspect)
+{
+    mat4 camera_matrix = camera_transform.matrix();
+    mat4 view_projection = camera.projection_matrix(aspect) * glm::inverse(camera_matrix);
+    ArenaVector<MeshletCullRequest> requests(frame_arena());
+    for (uint32_t i = 0; i < polygon_meshes.size(); i++)
+    {
+        PolygonMesh &mesh = polygon_meshes[i];
+        if ( !mesh.active || !polygon_mesh_uses_meshlets(i) ) continue;
+        // Meshlet bounds are in the unquantized object space, so dequantization is not applied.
+        mat4 model = polygon_mesh_transforms[i].matrix();
+        MeshletCullRequest request;
+        request.allocation = &mesh.meshlets;
+        request.mesh_vertex_offset = mesh.allocation.vertex_offset();
+        request.instance_index = mesh.instance_slot;
+        // Planes extracted from the full model-view-projection are in object space.
+        request.frustum = frustum_from_matrix(view_projection * model);
+        request.viewpoint = vec3(glm::inverse(model) * camera_matrix[3]);
+        requests.push_back(request);
+    }
+    meshlet_culler.record_cull(command_buffer, requests.data(), requests.size());
+    num_meshlet_meshes_drawn = requests.size();
+}
+
+void Renderer::record_meshlet_draws(VkCommandBuffer command_buffer, MainPassStage stage)
+{
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, draw_pipeline_layout, 0, 1, &frame_descriptor_set,
+                            RENDERER_NUM_FRAME_BINDINGS, frame_dynamic_offsets);
+    descriptor_heap.bind(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, draw_pipeline_layout, 1);
+    mesh_pool.bind_vertex_buffer(command_buffer);
+    meshlet_culler.bind_index_buffer(command_buffer);
+    for (int format = 0; format < NUM_VERTEX_FORMATS; format++)
+    {
+        bool bound = false;
+        for (uint32_t i = 0; i < polygon_meshes.size(); i++)
+        {
+            const PolygonMesh &mesh = polygon_meshes[i];
+            if ( !mesh.active || !polygon_mesh_uses_meshlets(i) ) continue;
+            if ( mesh.allocation.vertex_format != (VertexFormat) format ) continue;
+            if ( !bound )
+            {
+                vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                  draw_pipelines.main_pass(main_pass.prepass(), stage, (VertexFormat) format));
+                push_draw_constants(command_buffer, (VertexFormat) format);
+                bound = true;
+            }
+            meshlet_culler.record_draw(command_buffer, mesh.meshlets);
+        }
+    }
+}
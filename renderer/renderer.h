@@ -2,7 +2,42 @@
 #define RENDERER_H_
 #include "engine/platform/platform.h"
 #include "engine/platform/vk.h"
+#include "engine/jobs/job_system.h"
+#include "engine/jobs/task.h"
+#include "engine/memory/frame_arena.h"
+#include "engine/io/async_file_io.h"
+#include "engine/platform/vk_completion.h"
+#include "renderer/transform.h"
+#include "renderer/camera.hh"
+#include "renderer/mesh_pool.h"
+#include "renderer/mesh_optimize.h"
+#include "renderer/staging_uploader.h"
+#include "renderer/frame_ring_buffer.h"
+#include "renderer/descriptor_heap.h"
+#include "renderer/light_clusters.h"
+#include "renderer/shadow_atlas.h"
+#include "renderer/meshlet_culler.h"
+#include "renderer/mesh_simplify.h"
+#include "renderer/bvh.h"
+#include "renderer/ray_query.h"
+#include "renderer/path_tracer.h"
+#include "renderer/rasterizer.h"
+#include "renderer/draw_sort.h"
+#include "renderer/main_pass.h"
+#include "renderer/draw_pipelines.h"
+#include "renderer/dynamic_resolution.h"
+#include "renderer/frame_capture.h"
+#include "renderer/object_picker.h"
 #include <vector>
+#include <algorithm>
+#include <math.h>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <coroutine>
+
+class AssetFile;
+struct AssetChunkDecode;
 
 typedef uint64_t RenderEntity;
 enum class RenderEntityType
@@ -11,6 +46,83 @@ enum class RenderEntityType
     PolygonMesh,
     PointLight
 };
+#define RENDER_ENTITY_NULL (~0ull)
+// Where the compiled SPIR-V shaders are loaded from. The GNUmakefile defines this as the absolute
+// path of build/shaders, so that applications do not depend on the working directory.
+#ifndef RENDERER_SHADER_DIRECTORY
+#define RENDERER_SHADER_DIRECTORY "build/shaders"
+#endif
+// Initial size of each thread's per-frame arena. Arenas grow to fit the largest frame.
+#define RENDERER_FRAME_ARENA_BLOCK_SIZE (256 * 1024)
+// Polygon meshes per LOD selection job.
+#define RENDERER_LOD_SELECTION_GRAIN 256
+// Per frame in flight, for uniform and instance data.
+#define RENDERER_FRAME_RING_BUFFER_SIZE (16 * 1024 * 1024)
+// Bounds of the frame descriptor set's dynamic storage buffer bindings.
+#define RENDERER_MAX_POLYGON_MESHES 65536
+#define RENDERER_MAX_POINT_LIGHTS 4096
+#define RENDERER_NUM_FRAME_BINDINGS 5
+// A polygon mesh that has not moved for this many frames is a static shadow caster, see shadow_atlas.h.
+#define RENDERER_SHADOW_SETTLE_FRAMES 30
+// The instance BVH is checked for degradation from refits this often, in frames.
+#define RENDERER_BVH_QUALITY_CHECK_INTERVAL 16
+// Point lights fall off with the inverse square of distance, and are cut off at this intensity.
+#define RENDERER_POINT_LIGHT_CUTOFF (1.f / 256.f)
+
+// A RenderEntity packs its type in the high 32 bits and an index into the type's storage in the low 32 bits.
+inline RenderEntity render_entity(RenderEntityType type, uint32_t index)
+{
+    return (((uint64_t) type) << 32) | index;
+}
+inline RenderEntityType render_entity_type(RenderEntity entity)
+{
+    return (RenderEntityType) (entity >> 32);
+}
+inline uint32_t render_entity_index(RenderEntity entity)
+{
+    return (uint32_t) (entity & 0xFFFFFFFFull);
+}
+
+struct RenderRayHit
+{
+    RenderEntity entity; // RENDER_ENTITY_NULL if nothing was hit.
+    uint32_t triangle;   // Of the polygon mesh's LOD 0, in the order it was created with.
+    float distance;      // In units of the ray direction's length, the ray's max distance if nothing was hit.
+    vec2 barycentrics;   // Of the triangle's second and third vertices.
+};
+
+struct RenderPick
+{
+    // The requested point.
+    float x;
+    float y;
+    RenderEntity entity; // The polygon mesh drawn at the point, RENDER_ENTITY_NULL if none.
+    // The polygon mesh drawn nearest to the point within OBJECT_PICKER_REGION_SIZE / 2 rendered
+    // pixels, which is entity unless that is RENDER_ENTITY_NULL.
+    RenderEntity nearest;
+};
+
+// What an asset file load created, see Renderer::load_asset_file.
+struct RenderAssetLoadStats
+{
+    uint32_t num_polygon_meshes;
+    uint32_t num_point_lights;
+    uint32_t num_chunks; // Decoded and uploaded.
+};
+
+enum class GraphicsAPI
+{
+    None,
+    Vulkan,
+    // No GPU. render rasterizes on the CPU (see rasterizer.h), and entities are kept for ray
+    // queries and the path tracer.
+    CPU
+};
+
+enum class AttributeType
+{
+    Color,
+};
 
 struct PolygonMeshCreateInfo
 {
@@ -18,18 +130,185 @@ struct PolygonMeshCreateInfo
     vec3 *positions;
     vec3 *normals;
     int num_indices;
-    uint16_t *indices;
+    // Triangle list. Stored as 16-bit indices on the GPU when the mesh has at most 65536 vertices.
+    uint32_t *indices;
+    // Quantized formats store positions relative to the mesh bounds, see vertex_format.h.
+    VertexFormat vertex_format = VertexFormat::Float;
+    // Reorder triangles and vertices for the GPU, see mesh_optimize.h. The caller's arrays are not modified.
+    bool optimize = false;
+    // If not null when optimizing, receives the vertex cache and fetch statistics before and after.
+    MeshOptimizeReport *optimize_report = nullptr;
+    // Split the mesh into meshlets that are culled on the GPU each frame, see meshlet_culler.h.
+    bool build_meshlets = false;
+    // Build a chain of simplified LODs, selected each frame by projected error, see mesh_simplify.h.
+    bool build_lods = false;
+};
+
+struct PolygonMeshLod
+{
+    MeshIndexRange indices;
+    float error; // Object-space deviation from LOD 0.
+};
+
+struct PolygonMesh
+{
+    bool active;
+    // Its index in polygon_mesh_geometries, and its place in the geometry's list of meshes. The
+    // allocation, bounds, LODs and meshlets are the geometry's, copied into each of its meshes.
+    uint32_t geometry;
+    uint32_t geometry_slot;
+    MeshAllocation allocation;
+    // Identity for unquantized vertex formats.
+    mat4 dequantization_matrix;
+    // Bounding sphere and box in object space.
+    vec3 bounds_center;
+    float bounds_radius;
+    Aabb bounds_box;
+    // LOD 0 uses the allocation's own indices. Only LOD 0 has meshlets.
+    uint32_t num_lods;
+    PolygonMeshLod lods[MESH_LOD_MAX_LEVELS];
+    uint32_t lod; // Selected for the current frame.
+    float distance; // From the camera to its bounding sphere in the current frame, at least the near plane.
+    bool has_meshlets;
+    MeshletAllocation meshlets;
+    uint64_t moved_frame; // When it was created or last moved.
+    uint32_t instance_bvh_primitive; // Its primitive in the instance BVH, when the BVH is not stale.
+    uint32_t instance_slot; // Its GpuInstance in the current frame.
+};
+
+// What the polygon meshes created from one create_polygon_mesh (or asset file mesh) share. Its
+// meshes are drawn together, as one instanced draw per LOD. It is freed with the last of them.
+struct PolygonMeshGeometry
+{
+    // The polygon meshes using it, in no order. A mesh is removed by moving the last one into
+    // its place, so the list is kept up to date as meshes come and go.
+    std::vector<uint32_t> meshes;
+    MeshBvh bvh; // LOD 0's triangles, for ray queries, the path tracer and the CPU rasterizer.
+    // Object-space vertex normals, indexed as the BVH positions. Only kept with the CPU API.
+    std::vector<vec3> normals;
+};
+
+// An instanced draw of a geometry's meshes at one LOD, whose instance slots are consecutive.
+struct PolygonMeshDraw
+{
+    uint32_t mesh; // One of the drawn meshes, for the geometry's storage.
+    uint32_t lod;
+    uint32_t first_instance;
+    uint32_t num_instances;
+    float distance; // The nearest of its meshes'.
+};
+
+struct PointLight
+{
+    bool active;
+    vec4 color;
+    float radius; // Beyond which the light is ignored.
+};
+inline float point_light_radius(vec4 color)
+{
+    return sqrtf(std::max({color.x, color.y, color.z}) / RENDERER_POINT_LIGHT_CUTOFF);
 }
 
+// Shader data written each frame to the frame ring buffer, laid out the same in std140 and std430.
+// Bound as dynamic buffers in the frame descriptor set:
+//     binding 0: uniform GpuFrameUniforms
+//     binding 1: buffer GpuInstance[], indexed by gl_InstanceIndex, which is the polygon mesh's instance_slot
+//     binding 2: buffer GpuPointLight[], num_point_lights of them
+//     binding 3: buffer GpuLightCluster[NUM_LIGHT_CLUSTERS] (see light_clusters.h)
+//     binding 4: buffer uint[], the clusters' point light indices
+struct GpuFrameUniforms
+{
+    mat4 view;
+    mat4 projection;
+    mat4 view_projection;
+    vec4 camera_position;
+    vec2 viewport_size;
+    // A fragment's cluster slice is floor(log(view depth) * cluster_z_scale + cluster_z_bias).
+    float cluster_z_scale;
+    float cluster_z_bias;
+    uint32_t num_point_lights;
+    // The point light shadow atlas and its comparison sampler in the descriptor heap.
+    DescriptorIndex shadow_atlas;
+    DescriptorIndex shadow_sampler;
+    uint32_t padding;
+};
+struct GpuInstance
+{
+    mat4 model;         // As polygon_mesh_model_matrix.
+    mat4 normal_matrix; // The entity's transform. Transforms are rigid, so this is its own inverse transpose.
+};
+struct GpuPointLight
+{
+    vec4 position; // w is the radius.
+    vec4 color;
+    uint32_t shadow_slot; // In the shadow atlas, SHADOW_SLOT_NULL if unshadowed.
+    uint32_t padding[3];
+};
+// Push constants of the draw pipeline layout, selecting resources in the descriptor heap (set 1).
+// Pushed when the vertex format changes, so shaders can pull vertices in any format.
+struct GpuDrawConstants
+{
+    DescriptorIndex vertex_buffer;
+    DescriptorIndex index_buffer;
+    uint32_t vertex_format;
+    uint32_t padding;
+};
+
 class Renderer
 {
 public:
-    void render(int x, int y, int width, int height);
+    // frame_slot is the platform's frame in flight (see DisplayRefreshEvent), whose previous
+    // GPU work has completed, so its per-frame memory can be reused.
+    // With Vulkan, the frame is recorded into command_buffer, which the platform submits after
+    // waiting for swap_chain_image's acquisition at the transfer stage, leaving the image ready
+    // to present (see DisplayRefreshEvent). The viewport must be the swap chain's extent.
+    // With the CPU API, the viewport is rasterized into cpu_frame(), x and y are ignored, and
+    // there is no command buffer.
+    void render(int x, int y, int width, int height, uint32_t frame_slot,
+                VkCommandBuffer command_buffer = VK_NULL_HANDLE, uint32_t swap_chain_image = 0);
     void set_api(VulkanSystem *_vk);
+    // Run without a GPU, e.g. to render thumbnails or path trace on a server. Asset files can't be loaded.
+    void set_cpu_api();
+    // With the CPU API, the image and depth of the last render.
+    const Rasterizer &cpu_frame() const { return rasterizer; }
+    // Jobs are used for asset decoding and per-entity work such as LOD selection.
+    // Must be set before loading asset files or rendering.
+    void set_job_system(JobSystem *_jobs);
+    // Used by coroutines to wait for uploads. Must be set before loading asset files asynchronously.
+    void set_gpu_completion_waiter(VulkanCompletionWaiter *_gpu_waiter);
+
+    // co_await on_render_thread() continues a coroutine on the render thread, at the start of
+    // the next render, or immediately if already on the render thread (the thread that set the API).
+    class RenderThreadAwaitable
+    {
+    public:
+        bool await_ready() { return std::this_thread::get_id() == renderer->render_thread; }
+        void await_suspend(std::coroutine_handle<> handle);
+        void await_resume() {}
+    private:
+        friend class Renderer;
+        RenderThreadAwaitable(Renderer *_renderer) : renderer{_renderer} {}
+        Renderer *renderer;
+    };
+    RenderThreadAwaitable on_render_thread() { return RenderThreadAwaitable(this); }
 
-    RenderEntity create_polygon_mesh(RenderPolygonCreateInfo info);
+    RenderEntity create_polygon_mesh(PolygonMeshCreateInfo info);
+    // Create a polygon mesh sharing another's geometry, at the same transform. Meshes sharing
+    // geometry are drawn with one instanced draw, so scenes with many copies of a part should
+    // create it once and instance it.
+    RenderEntity create_polygon_mesh_instance(RenderEntity mesh);
     RenderEntity create_point_light();
     RenderEntity get_camera();
+    // Create the polygon meshes and point lights stored in an asset file (see asset_file.h),
+    // appending their entities. Nothing is created if loading fails. What was created is written
+    // to stats, if given.
+    bool load_asset_file(const char *path, std::vector<RenderEntity> *entities, RenderAssetLoadStats *stats = nullptr);
+    // Coroutine version of load_asset_file. Chunks are read with the given AsyncFileIO and decoded
+    // on workers, and the coroutine waits for the upload on the GPU completion waiter, so no thread
+    // blocks while the file loads. Renderer state is only touched on the render thread, where
+    // the entities are appended once the upload completes.
+    Task<bool> load_asset_file_async(AsyncFileIO *io, std::string path, std::vector<RenderEntity> *entities,
+                                     RenderAssetLoadStats *stats = nullptr);
 
     RenderTransform create_transform(vec3 position, vec3 euler_angles);
     void set_transform(RenderEntity entity, RenderTransform transform);
@@ -37,15 +316,230 @@ public:
     void destroy_entity(RenderEntity entity);
     void set_attribute(RenderEntity entity, AttributeType attribute, vec4 value);
 
+    // Trace rays against the polygon meshes' LOD 0 triangles on the CPU, see ray_query.h. Large
+    // batches are split over jobs. Call from the render thread.
+    void query_rays(RayQueryType type, const Ray *rays, uint32_t num_rays, RenderRayHit *hits);
+    // The times the instance BVH was rebuilt because refitting moved meshes degraded it.
+    uint64_t degraded_instance_bvh_rebuilds() const { return num_degraded_instance_bvh_rebuilds; }
+    // The ray from the camera through a point of the last rendered viewport, in pixels from its top
+    // left (a MouseEvent's cursor is normalized from the bottom left), with a unit direction and
+    // the far plane as its max distance.
+    Ray camera_ray(float x, float y) const;
+    // The polygon mesh seen at a point of the last rendered viewport, or RENDER_ENTITY_NULL.
+    RenderEntity pick(float x, float y);
+    // Pick what the next frame draws at a point of the viewport (in pixels, as camera_ray), read
+    // back from the GPU without waiting for it, see object_picker.h. The result is exact to the
+    // pixel, and comes from pick_result once the frame's GPU work has completed, when its frame
+    // slot is rendered again. A later request before the next frame replaces it. With the CPU
+    // API, the next render picks with a ray query, as pick does, and with Vulkan so does the
+    // request itself until a frame has been recorded, so a result always comes.
+    void request_pick(float x, float y);
+    // The latest pick completed since the last call, if any.
+    bool pick_result(RenderPick *pick);
+
+    // Add a sample per pixel to the path tracer's image of the scene from the camera, see
+    // path_tracer.h. Accumulation restarts when any entity changes. Works with either API.
+    void path_trace(PathTracer *path_tracer);
+
+    // The coarsest LOD whose projected error is at most this many pixels is drawn.
+    void set_lod_error_threshold(float pixels);
+    // A polygon mesh's LOD chain, see mesh_simplify.h. There is only LOD 0, the mesh itself with
+    // an error of 0, unless the mesh was built with LODs on the GPU.
+    uint32_t polygon_mesh_num_lods(RenderEntity mesh) const;
+    const PolygonMeshLod &polygon_mesh_lod(RenderEntity mesh, uint32_t lod) const;
+    // Whether opaque geometry is drawn to depth before it is shaded, see main_pass.h. Auto by
+    // default, choosing from the measured overdraw, so scenes known to need it or not can fix it.
+    void set_depth_prepass(DepthPrepassMode mode);
+    // Smoothed samples passing the depth test per pixel, 0 until measured.
+    float measured_overdraw() const { return main_pass.overdraw(); }
+    // Scale the resolution the view is rendered at to keep the GPU's frame time within a budget,
+    // upscaling to the framebuffer, see dynamic_resolution.h. 0, the default, renders at the
+    // framebuffer size. min_scale bounds the scale of each axis.
+    void set_gpu_time_budget(float milliseconds, float min_scale = DYNAMIC_RESOLUTION_DEFAULT_MIN_SCALE);
+    float resolution_scale() const { return dynamic_resolution.scale(); }
+    // Smoothed, 0 until measured.
+    float gpu_frame_milliseconds() const { return dynamic_resolution.gpu_milliseconds(); }
+    // The meshes whose meshlets were culled and drawn in the last recorded frame, see meshlet_culler.h.
+    uint32_t meshlet_meshes_drawn() const { return num_meshlet_meshes_drawn; }
+
+    // Write the rendered frames to image files named by path_format with the capture's frame
+    // number, e.g. "frames/%05u.qoi", encoding them on workers, see frame_capture.h. Returns false
+    // if already capturing, or with Vulkan if the swap chain images can't be copied from.
+    bool start_capture(const char *path_format, ImageFileFormat format);
+    // Finish writing the captured frames. Call between renders, and before the renderer is destroyed.
+    void stop_capture();
+
 private:
+    // Add a polygon mesh with new geometry, owning the mesh's storage and its LOD 0 BVH.
+    RenderEntity add_polygon_mesh(const PolygonMesh &mesh, Transform transform, MeshBvh &&mesh_bvh);
+    // Add a polygon mesh of mesh.geometry.
+    RenderEntity add_polygon_mesh_to_geometry(const PolygonMesh &mesh, Transform transform);
+    RenderEntity add_point_light(const PointLight &light, Transform transform);
+
+    // Asset loading steps shared by load_asset_file and load_asset_file_async.
+    // Allocates mesh storage for every mesh in the file and lays out its chunks in one staging batch.
+    bool allocate_asset_meshes(const AssetFile &file,
+                               const char *path,
+                               std::vector<PolygonMesh> *meshes,
+                               std::vector<AssetChunkDecode> *decodes,
+                               std::vector<VkDeviceSize> *staging_offsets,
+                               VkDeviceSize *staging_size);
+    void free_polygon_mesh_storage(const PolygonMesh &mesh);
+    void record_asset_mesh_copies(const std::vector<PolygonMesh> &meshes, const std::vector<VkDeviceSize> &staging_offsets);
+    // Build the meshes' triangle BVHs from their decoded chunks, laid out at the staging offsets.
+    void build_asset_mesh_bvhs(const AssetFile &file,
+                               const std::vector<PolygonMesh> &meshes,
+                               const uint8_t *decoded,
+                               const std::vector<VkDeviceSize> &staging_offsets,
+                               std::vector<MeshBvh> *mesh_bvhs);
+    void add_asset_entities(const AssetFile &file,
+                            const std::vector<PolygonMesh> &meshes,
+                            std::vector<MeshBvh> *mesh_bvhs,
+                            std::vector<RenderEntity> *entities);
+
+    void resume_render_thread_coroutines();
+    // Transient memory for the current frame, for the calling worker thread.
+    LinearArena *frame_arena();
+
+    void push_draw_constants(VkCommandBuffer command_buffer, VertexFormat vertex_format);
+    // Record the frame's GPU work into a swap chain image, timed for dynamic resolution: the shadow
+    // maps and meshlet culling, then the main pass, and its capture while capturing.
+    void record_frame(VkCommandBuffer command_buffer, uint32_t swap_chain_image);
+    // Record the main pass over the render extent, drawing the polygon meshes and meshlets for
+    // each of its stages, and its scaling into a swap chain image. IDs are stored if a pick is requested.
+    void record_main_pass(VkCommandBuffer command_buffer, uint32_t swap_chain_image);
+    // Record the copy of the requested pick's IDs, keeping the polygon mesh of each instance
+    // slot of the frame to map them back to entities.
+    void record_pick(VkCommandBuffer command_buffer);
+    // Make latest_pick with a ray query, as pick does.
+    void pick_on_cpu(float x, float y);
+    // The polygon mesh of an ID read back in a frame slot, if it still exists.
+    RenderEntity picked_entity(uint32_t frame, uint32_t id) const;
+    // Bind the mesh pool once and make the frame's instanced draws in their sorted order (see
+    // update_polygon_meshes) for a main pass stage, binding state only when it changes.
+    void record_polygon_mesh_draws(VkCommandBuffer command_buffer, MainPassStage stage);
+    // Write the frame uniforms and point lights to the frame ring buffer, and assign the
+    // point lights to clusters.
+    void write_frame_uniforms(float aspect);
+    // Select each polygon mesh's LOD from the screen-space projection of its LOD errors, in
+    // parallel. Then give each geometry's meshes at each LOD consecutive instance slots, making
+    // an instanced draw of them, sort the draws by their sort keys (see draw_sort.h), and write
+    // the instance data to the frame ring buffer.
+    void update_polygon_meshes(int viewport_height);
+    // Rebuild the instance BVH if meshes were added or removed or refitting has degraded it,
+    // and otherwise refit it to the meshes moved since the last update.
+    void update_acceleration_structures();
+    // Give the point lights with the most screen influence slots in the shadow atlas, and
+    // invalidate the shadows that the frame's changes to static casters reach.
+    void update_shadows();
+    // Re-render the shadow atlas tiles invalidated by update_shadows. Recorded before the render pass.
+    void record_shadow_maps(VkCommandBuffer command_buffer);
+    // Rasterize the meshes overlapping the view on the CPU, with the CPU API.
+    void rasterize(int width, int height);
+    // Cull the meshlets of every active mesh against the camera. Recorded before the render pass.
+    void record_meshlet_culling(VkCommandBuffer command_buffer, float aspect);
+    // Draw the surviving meshlets with the compute-expanded index buffer, for a main pass stage.
+    void record_meshlet_draws(VkCommandBuffer command_buffer, MainPassStage stage);
+
+    // The model matrix applied to the stored vertex positions, with dequantization folded in.
+    // Normals are stored in object space, so they should be transformed by the normal matrix
+    // of the entity's transform alone.
+    mat4 polygon_mesh_model_matrix(uint32_t index) const;
+    // World-space bounding sphere, as (center, radius).
+    vec4 polygon_mesh_world_bounds(uint32_t index) const;
+    bool polygon_mesh_is_static(uint32_t index) const;
+    // Meshlet culling is per mesh, so only a geometry's one mesh uses its meshlets, at LOD 0.
+    // Instanced meshes are drawn whole.
+    bool polygon_mesh_uses_meshlets(uint32_t index) const;
+    // World-space bounding box.
+    Aabb polygon_mesh_world_box(uint32_t index) const;
+
+    GraphicsAPI graphics_api = GraphicsAPI::None;
     VulkanSystem *vk;
+    JobSystem *jobs = nullptr;
+    VulkanCompletionWaiter *gpu_waiter = nullptr;
+
+    std::thread::id render_thread;
+    std::mutex render_thread_mutex;
+    std::vector<std::coroutine_handle<>> render_thread_coroutines;
+
+    StagingUploader uploader;
+    MeshPool mesh_pool;
+    MeshletCuller meshlet_culler;
+    uint32_t num_meshlet_meshes_drawn = 0;
+    FrameArenas frame_arenas;
+    FrameRingBuffer frame_ring;
+    LightClusters light_clusters;
+    ShadowAtlas shadow_atlas;
+    MainPass main_pass;
+    DrawPipelines draw_pipelines;
+    DynamicResolution dynamic_resolution;
+    FrameCapture frame_capture;
+    ObjectPicker object_picker;
+    // Per frame slot, the polygon mesh of each instance slot, kept in frames recording a pick.
+    // Sized as polygon_meshes.
+    std::vector<uint32_t> pick_instance_meshes[PLATFORM_FRAMES_IN_FLIGHT];
+    bool has_pick_result = false;
+    RenderPick latest_pick;
+    // Whether a Vulkan frame has been recorded, before which picks are made on the CPU.
+    bool recorded_frame = false;
+    // With the CPU API, picks are made by the next render.
+    bool cpu_pick_requested = false;
+    float cpu_pick_x;
+    float cpu_pick_y;
+    // World-space spheres in which static shadow casters changed since the last update_shadows.
+    std::vector<vec4> shadow_invalidations;
+    // A BVH over the world-space boxes of the active polygon meshes. Its primitives index
+    // instance_bvh_meshes and instance_bvh_bounds.
+    Bvh instance_bvh;
+    std::vector<uint32_t> instance_bvh_meshes;
+    std::vector<Aabb> instance_bvh_bounds;
+    std::vector<RayQueryInstance> instance_bvh_ray_instances;
+    std::vector<uint32_t> moved_instance_bvh_primitives; // Since the last update.
+    std::vector<RayHit> ray_hits; // query_rays scratch.
+    bool instance_bvh_stale = true; // Meshes were added or removed since the last build.
+    uint64_t num_degraded_instance_bvh_rebuilds = 0;
+    uint64_t frame_number = 0;
+    // Counts changes to entities, to restart the path tracer's accumulation.
+    uint64_t scene_version = 0;
+    std::vector<PathTracerLight> path_tracer_lights;
+    Rasterizer rasterizer;
+    std::vector<RasterizerInstance> rasterizer_instances;
+    std::vector<RasterizerLight> rasterizer_lights;
+    // The framebuffer, in which the camera_ray and pick coordinates are.
+    int viewport_width = 0;
+    int viewport_height = 0;
+    // The part of the framebuffer-sized targets drawn this frame, see dynamic_resolution.h.
+    VkExtent2D render_extent = { 0, 0 };
+
+    // Per-frame data is bound with this frame's offsets into the ring buffer.
+    VkDescriptorSetLayout frame_descriptor_set_layout;
+    VkDescriptorPool frame_descriptor_pool;
+    VkDescriptorSet frame_descriptor_set;
+    uint32_t frame_dynamic_offsets[RENDERER_NUM_FRAME_BINDINGS];
+    DescriptorHeap descriptor_heap;
+    DescriptorIndex mesh_vertex_buffer_index;
+    DescriptorIndex mesh_index_buffer_index;
+    // Set 0 is the frame descriptor set, set 1 the descriptor heap, and push constants are GpuDrawConstants.
+    VkPipelineLayout draw_pipeline_layout;
+    // The frame slot of the last render, and per frame slot, the destroyed polygon meshes whose
+    // storage is freed when the slot is next rendered.
+    uint32_t recording_frame_slot = 0;
+    std::vector<PolygonMesh> removed_polygon_meshes[PLATFORM_FRAMES_IN_FLIGHT];
+
+    float lod_error_threshold = 1.f;
 
     Camera camera;
     Transform camera_transform;
     std::vector<PolygonMesh> polygon_meshes;
     std::vector<Transform> polygon_mesh_transforms;
+    std::vector<uint32_t> free_polygon_mesh_indices;
+    std::vector<PolygonMeshGeometry> polygon_mesh_geometries;
+    std::vector<uint32_t> free_polygon_mesh_geometry_indices;
+    std::vector<PolygonMeshDraw> polygon_mesh_draws; // The frame's, of the meshes not drawn by meshlets.
     std::vector<PointLight> point_lights;
     std::vector<Transform> point_light_transforms;
+    std::vector<uint32_t> free_point_light_indices;
 };
 
 #endif // RENDERER_H_
@@ -0,0 +1,44 @@
+/*
+ * The frame descriptor set (set 0), as written each frame to the frame ring buffer.
+ *
+ * See GpuFrameUniforms, GpuInstance and GpuPointLight in renderer/renderer.h, and GpuLightCluster
+ * in renderer/light_clusters.h, which these must match.
+ */
+layout(std140, set = 0, binding = 0) uniform FrameUniforms
+{
+    mat4 view;
+    mat4 projection;
+    mat4 view_projection;
+    vec4 camera_position;
+    vec2 viewport_size; // The render extent.
+    float cluster_z_scale;
+    float cluster_z_bias;
+    uint num_point_lights;
+    uint shadow_atlas;   // In the descriptor heap's sampled images.
+    uint shadow_sampler; // In the descriptor heap's samplers.
+    uint frame_padding;
+};
+
+struct Instance
+{
+    mat4 model;         // Including the dequantization of the mesh's vertex format.
+    mat4 normal_matrix; // Rigid.
+};
+layout(std430, set = 0, binding = 1) readonly buffer Instances { Instance instances[]; };
+
+struct PointLight
+{
+    vec4 position; // w is the radius.
+    vec4 color;
+    uint shadow_slot;
+    uint light_padding[3];
+};
+layout(std430, set = 0, binding = 2) readonly buffer PointLights { PointLight point_lights[]; };
+
+struct LightCluster
+{
+    uint offset;
+    uint count;
+};
+layout(std430, set = 0, binding = 3) readonly buffer LightClusters { LightCluster light_clusters[]; };
+layout(std430, set = 0, binding = 4) readonly buffer LightIndices { uint light_indices[]; };
@@ -0,0 +1,102 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+#extension GL_EXT_nonuniform_qualifier : require
+/*
+ * Polygon mesh shading in the main pass: Lambertian with PATH_TRACER_ALBEDO under the point
+ * lights of the fragment's light cluster, falling off with the inverse square of distance up to
+ * their radius. Surfaces are lit on the side they are seen from. Lights with a slot in the shadow
+ * atlas are shadowed by it, sampling the cube face the fragment is in under the face's projection
+ * (see renderer/shadow_atlas.h). The CPU rasterizer (see renderer/rasterizer.h) shades the same
+ * way without shadows, so the two only match where no shadowed light is occluded.
+ *
+ * Also writes the instance's ID to the ID target, see renderer/main_pass.h.
+ */
+#include "frame.glsl"
+
+// The descriptor heap, see renderer/descriptor_heap.h.
+layout(set = 1, binding = 1) uniform texture2D sampled_images[];
+layout(set = 1, binding = 2) uniform sampler samplers[];
+
+// Specialized with the constants of renderer/light_clusters.h, renderer/path_tracer.h and
+// renderer/shadow_atlas.h.
+layout(constant_id = 0) const uint LIGHT_CLUSTERS_X = 16;
+layout(constant_id = 1) const uint LIGHT_CLUSTERS_Y = 9;
+layout(constant_id = 2) const uint LIGHT_CLUSTERS_Z = 24;
+layout(constant_id = 3) const float ALBEDO = 0.8;
+layout(constant_id = 4) const uint SHADOW_ATLAS_SIZE = 4096;
+layout(constant_id = 5) const uint SHADOW_ATLAS_TILE_SIZE = 256;
+layout(constant_id = 6) const float SHADOW_ATLAS_NEAR_FACTOR = 0.01;
+layout(constant_id = 7) const uint SHADOW_SLOT_NULL = 0xFFFFFFFFu;
+
+layout(location = 0) in vec3 v_position;
+layout(location = 1) in vec3 v_normal;
+layout(location = 2) flat in uint v_id;
+
+layout(location = 0) out vec4 out_color;
+layout(location = 1) out uint out_id;
+
+uint light_cluster(vec3 position)
+{
+    uvec2 tile = uvec2(gl_FragCoord.xy / viewport_size * vec2(LIGHT_CLUSTERS_X, LIGHT_CLUSTERS_Y));
+    tile = min(tile, uvec2(LIGHT_CLUSTERS_X - 1, LIGHT_CLUSTERS_Y - 1));
+    float depth = -(view * vec4(position, 1)).z;
+    int slice = int(floor(log(depth) * cluster_z_scale + cluster_z_bias));
+    uint z = uint(clamp(slice, 0, int(LIGHT_CLUSTERS_Z) - 1));
+    return tile.x + LIGHT_CLUSTERS_X * (tile.y + LIGHT_CLUSTERS_Y * z);
+}
+
+// As ShadowAtlas::face_view_projection.
+const vec3 SHADOW_FACE_DIRECTIONS[6] = { vec3(1,0,0), vec3(-1,0,0), vec3(0,1,0), vec3(0,-1,0), vec3(0,0,1), vec3(0,0,-1) };
+const vec3 SHADOW_FACE_UPS[6] = { vec3(0,1,0), vec3(0,1,0), vec3(0,0,-1), vec3(0,0,1), vec3(0,1,0), vec3(0,1,0) };
+
+// 1 where the light reaches the position, 0 where it is shadowed, filtered in between.
+float light_visibility(PointLight light, vec3 position)
+{
+    if ( light.shadow_slot == SHADOW_SLOT_NULL ) return 1;
+    vec3 d = position - light.position.xyz;
+    vec3 a = abs(d);
+    uint face;
+    if ( a.x >= a.y && a.x >= a.z ) face = d.x >= 0 ? 0 : 1;
+    else if ( a.y >= a.z ) face = d.y >= 0 ? 2 : 3;
+    else face = d.z >= 0 ? 4 : 5;
+    // The face's view looks down its direction, with y flipped for Vulkan clip space.
+    vec3 forward = SHADOW_FACE_DIRECTIONS[face];
+    vec3 right = normalize(cross(forward, SHADOW_FACE_UPS[face]));
+    vec3 up = cross(right, forward);
+    float major = dot(forward, d);
+    vec2 ndc = vec2(dot(right, d), -dot(up, d)) / major;
+    float far = light.position.w;
+    float near = far * SHADOW_ATLAS_NEAR_FACTOR;
+    float depth = far * (major - near) / ((far - near) * major);
+
+    // Kept within the face's tile, so that filtering does not reach its neighbours.
+    uint tiles_per_row = SHADOW_ATLAS_SIZE / SHADOW_ATLAS_TILE_SIZE;
+    uint tile = 6 * light.shadow_slot + face;
+    float tile_size = float(SHADOW_ATLAS_TILE_SIZE);
+    vec2 tile_origin = vec2(tile % tiles_per_row, tile / tiles_per_row) * tile_size;
+    vec2 texel = tile_origin + clamp((0.5 * ndc + 0.5) * tile_size, vec2(0.5), vec2(tile_size - 0.5));
+    return texture(sampler2DShadow(sampled_images[shadow_atlas], samplers[shadow_sampler]),
+                   vec3(texel / float(SHADOW_ATLAS_SIZE), depth));
+}
+
+void main()
+{
+    vec3 normal = normalize(v_normal);
+    if ( dot(normal, camera_position.xyz - v_position) < 0 ) normal = -normal;
+
+    LightCluster cluster = light_clusters[light_cluster(v_position)];
+    vec3 radiance = vec3(0);
+    for (uint i = 0; i < cluster.count; i++)
+    {
+        PointLight light = point_lights[light_indices[cluster.offset + i]];
+        vec3 to_light = light.position.xyz - v_position;
+        float distance_squared = dot(to_light, to_light);
+        float cosine_distance = dot(normal, to_light);
+        if ( cosine_distance <= 0 || distance_squared >= light.position.w * light.position.w ) continue;
+        float visibility = light_visibility(light, v_position);
+        radiance += visibility * light.color.rgb * cosine_distance / (distance_squared * sqrt(distance_squared));
+    }
+    // The color target is sRGB, so this is encoded on store.
+    out_color = vec4(radiance * ALBEDO / 3.14159265, 1);
+    out_id = v_id;
+}
@@ -0,0 +1,49 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+/*
+ * Polygon mesh vertices for the main pass's shading stage.
+ *
+ * Vertices are fetched by the vertex input in the mesh's vertex format, which the pipeline is
+ * specialized for (see renderer/vertex_format.h). Quantized positions are in [0,1]^3, and their
+ * dequantization is folded into the instance's model matrix. Quantized normals are octahedral,
+ * and only their first two components are fetched.
+ *
+ * The instance's ID is gl_InstanceIndex plus one, see renderer/main_pass.h.
+ */
+#include "frame.glsl"
+
+// VertexFormat::Float
+layout(constant_id = 0) const uint VERTEX_FORMAT = 0;
+
+layout(location = 0) in vec3 a_position;
+layout(location = 1) in vec3 a_normal;
+
+// As in mesh_depth.vert.
+invariant gl_Position;
+
+layout(location = 0) out vec3 v_position; // World space.
+layout(location = 1) out vec3 v_normal;   // World space, not normalized.
+layout(location = 2) flat out uint v_id;
+
+vec2 sign_not_zero(vec2 v)
+{
+    return vec2(v.x >= 0 ? 1 : -1, v.y >= 0 ? 1 : -1);
+}
+
+vec3 octahedral_decode(vec2 e)
+{
+    vec3 n = vec3(e, 1 - abs(e.x) - abs(e.y));
+    if ( n.z < 0 ) n.xy = (1 - abs(e.yx)) * sign_not_zero(e);
+    return normalize(n);
+}
+
+void main()
+{
+    Instance instance = instances[gl_InstanceIndex];
+    vec4 position = instance.model * vec4(a_position, 1);
+    vec3 normal = VERTEX_FORMAT == 0 ? a_normal : octahedral_decode(a_normal.xy);
+    gl_Position = view_projection * position;
+    v_position = position.xyz;
+    v_normal = mat3(instance.normal_matrix) * normal;
+    v_id = gl_InstanceIndex + 1;
+}
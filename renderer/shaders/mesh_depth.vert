@@ -0,0 +1,18 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+/*
+ * Polygon mesh vertices for the main pass's depth pre-pass, which only fetches positions and has
+ * no fragment shader. It must transform positions exactly as mesh.vert does, so that the shading
+ * stage's depth is EQUAL to the pre-pass's.
+ */
+#include "frame.glsl"
+
+layout(location = 0) in vec3 a_position;
+
+// The pre-pass and shading stages must compute the same depth.
+invariant gl_Position;
+
+void main()
+{
+    gl_Position = view_projection * (instances[gl_InstanceIndex].model * vec4(a_position, 1));
+}
@@ -0,0 +1,23 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+/*
+ * Polygon mesh vertices for a cube face of a point light's shadow map, which only fetches
+ * positions and has no fragment shader. See renderer/shadow_atlas.h.
+ */
+#include "frame.glsl"
+
+// GpuShadowConstants.
+layout(push_constant) uniform ShadowConstants
+{
+    mat4 face_view_projection;
+    uint vertex_buffer;
+    uint index_buffer;
+    uint vertex_format;
+};
+
+layout(location = 0) in vec3 a_position;
+
+void main()
+{
+    gl_Position = face_view_projection * (instances[gl_InstanceIndex].model * vec4(a_position, 1));
+}
@@ -0,0 +1,402 @@
+#include "renderer/shadow_atlas.h"
+#include "ansi_color.h"
+#include <stdio.h>
+#include <assert.h>
+#include <algorithm>
+
+// The atlas is written through one of the render passes and transitioned to `layout` at its end,
+// with the given dependencies on the work before and after it.
+static VkRenderPass create_render_pass(VulkanSystem *vk,
+                                       VkImageLayout initial_layout,
+                                       VkImageLayout final_layout,
+                                       VkPipelineStageFlags src_stages, VkAccessFlags src_access,
+                                       VkPipelineStageFlags dst_stages, VkAccessFlags dst_access)
+{
+    VkAttachmentDescription attachment = {};
+    attachment.format = SHADOW_ATLAS_FORMAT;
+    attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    // Tiles that are not redrawn keep their contents.
+    attachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+    attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachment.initialLayout = initial_layout;
+    attachment.finalLayout = final_layout;
+    VkAttachmentReference depth_reference = { 0, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+    VkSubpassDescription subpass = {};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.pDepthStencilAttachment = &depth_reference;
+    VkSubpassDependency dependencies[2] = {};
+    dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[0].dstSubpass = 0;
+    dependencies[0].srcStageMask = src_stages;
+    dependencies[0].srcAccessMask = src_access;
+    dependencies[0].dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    dependencies[0].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    dependencies[1].srcSubpass = 0;
+    dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[1].srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    dependencies[1].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    dependencies[1].dstStageMask = dst_stages;
+    dependencies[1].dstAccessMask = dst_access;
+    VkRenderPassCreateInfo info = { VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO };
+    info.attachmentCount = 1;
+    info.pAttachments = &attachment;
+    info.subpassCount = 1;
+    info.pSubpasses = &subpass;
+    info.dependencyCount = 2;
+    info.pDependencies = dependencies;
+    VkRenderPass render_pass;
+    VK_SUCCEED( vkCreateRenderPass(vk->device, &info, nullptr, &render_pass) );
+    return render_pass;
+}
+
+bool ShadowAtlas::init(VulkanSystem *_vk, DescriptorHeap *_descriptor_heap, VkDescriptorSetLayout frame_set_layout)
+{
+    vk = _vk;
+    descriptor_heap = _descriptor_heap;
+    layouts_initialized = false;
+    for (Slot &slot : slots) slot.light = SHADOW_SLOT_NULL;
+    light_slots.clear();
+
+    // The static atlas is only read by copies into the sampled atlas.
+    static_render_pass = create_render_pass(vk,
+                                            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                                            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                                            VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                                            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+    sampled_render_pass = create_render_pass(vk,
+                                             VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                             VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                                             VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                                             VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+    if ( !create_image(&static_atlas,
+                       VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                       static_render_pass)
+         || !create_image(&sampled_atlas,
+                          VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                          sampled_render_pass) )
+    {
+        fprintf(stderr, C_RED "[%s] Failed to create the %dx%d shadow atlas.\n" C_RESET, __func__, SHADOW_ATLAS_SIZE, SHADOW_ATLAS_SIZE);
+        return false;
+    }
+    {
+        VkSamplerCreateInfo info = { VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+        info.magFilter = VK_FILTER_LINEAR;
+        info.minFilter = VK_FILTER_LINEAR;
+        info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+        info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        info.compareEnable = VK_TRUE;
+        info.compareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+        info.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+        VK_SUCCEED( vkCreateSampler(vk->device, &info, nullptr, &sampler) );
+    }
+    atlas_descriptor_index = descriptor_heap->add_sampled_image(sampled_atlas.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    sampler_descriptor_index = descriptor_heap->add_sampler(sampler);
+    if ( atlas_descriptor_index == DESCRIPTOR_INDEX_NULL || sampler_descriptor_index == DESCRIPTOR_INDEX_NULL ) return false;
+    {
+        VkDescriptorSetLayout set_layouts[2] = { frame_set_layout, descriptor_heap->set_layout() };
+        VkPushConstantRange range = {};
+        range.stageFlags = VK_SHADER_STAGE_ALL_GRAPHICS;
+        range.offset = 0;
+        range.size = sizeof(GpuShadowConstants);
+        VkPipelineLayoutCreateInfo info = { VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+        info.setLayoutCount = 2;
+        info.pSetLayouts = set_layouts;
+        info.pushConstantRangeCount = 1;
+        info.pPushConstantRanges = &range;
+        VK_SUCCEED( vkCreatePipelineLayout(vk->device, &info, nullptr, &shadow_pipeline_layout) );
+    }
+    printf(C_CYAN "Shadow atlas: %dx%d, %d lights of %dx%d cube faces.\n" C_RESET,
+           SHADOW_ATLAS_SIZE, SHADOW_ATLAS_SIZE, SHADOW_ATLAS_MAX_LIGHTS, SHADOW_ATLAS_TILE_SIZE, SHADOW_ATLAS_TILE_SIZE);
+    return true;
+}
+
+void ShadowAtlas::destroy()
+{
+    descriptor_heap->remove(DescriptorHeapArray::SampledImage, atlas_descriptor_index);
+    descriptor_heap->remove(DescriptorHeapArray::Sampler, sampler_descriptor_index);
+    vkDestroyPipelineLayout(vk->device, shadow_pipeline_layout, nullptr);
+    vkDestroySampler(vk->device, sampler, nullptr);
+    destroy_image(&static_atlas);
+    destroy_image(&sampled_atlas);
+    vkDestroyRenderPass(vk->device, static_render_pass, nullptr);
+    vkDestroyRenderPass(vk->device, sampled_render_pass, nullptr);
+}
+
+bool ShadowAtlas::create_image(AtlasImage *atlas_image, VkImageUsageFlags usage, VkRenderPass render_pass)
+{
+    {
+        VkImageCreateInfo info = { VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
+        info.imageType = VK_IMAGE_TYPE_2D;
+        info.format = SHADOW_ATLAS_FORMAT;
+        info.extent = { SHADOW_ATLAS_SIZE, SHADOW_ATLAS_SIZE, 1 };
+        info.mipLevels = 1;
+        info.arrayLayers = 1;
+        info.samples = VK_SAMPLE_COUNT_1_BIT;
+        info.tiling = VK_IMAGE_TILING_OPTIMAL;
+        info.usage = usage;
+        info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        if ( vkCreateImage(vk->device, &info, nullptr, &atlas_image->image) != VK_SUCCESS ) return false;
+    }
+    {
+        VkMemoryRequirements requirements;
+        vkGetImageMemoryRequirements(vk->device, atlas_image->image, &requirements);
+        uint32_t memory_type = VulkanFindMemoryType(vk->physical_device, requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        if ( memory_type == UINT32_MAX ) return false;
+        VkMemoryAllocateInfo info = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
+        info.allocationSize = requirements.size;
+        info.memoryTypeIndex = memory_type;
+        if ( vkAllocateMemory(vk->device, &info, nullptr, &atlas_image->memory) != VK_SUCCESS ) return false;
+        VK_SUCCEED( vkBindImageMemory(vk->device, atlas_image->image, atlas_image->memory, 0) );
+    }
+    {
+        VkImageViewCreateInfo info = { VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
+        info.image = atlas_image->image;
+        info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        info.format = SHADOW_ATLAS_FORMAT;
+        info.subresourceRange = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 };
+        VK_SUCCEED( vkCreateImageView(vk->device, &info, nullptr, &atlas_image->view) );
+    }
+    {
+        VkFramebufferCreateInfo info = { VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO };
+        info.renderPass = render_pass;
+        info.attachmentCount = 1;
+        info.pAttachments = &atlas_image->view;
+        info.width = SHADOW_ATLAS_SIZE;
+        info.height = SHADOW_ATLAS_SIZE;
+        info.layers = 1;
+        VK_SUCCEED( vkCreateFramebuffer(vk->device, &info, nullptr, &atlas_image->framebuffer) );
+    }
+    return true;
+}
+
+void ShadowAtlas::destroy_image(AtlasImage *atlas_image)
+{
+    vkDestroyFramebuffer(vk->device, atlas_image->framebuffer, nullptr);
+    vkDestroyImageView(vk->device, atlas_image->view, nullptr);
+    vkDestroyImage(vk->device, atlas_image->image, nullptr);
+    vkFreeMemory(vk->device, atlas_image->memory, nullptr);
+}
+
+void ShadowAtlas::free_slot(uint32_t slot)
+{
+    assert(slots[slot].light != SHADOW_SLOT_NULL);
+    light_slots[slots[slot].light] = SHADOW_SLOT_NULL;
+    slots[slot].light = SHADOW_SLOT_NULL;
+}
+
+void ShadowAtlas::assign(const ShadowAtlasLight *lights, uint32_t num_lights)
+{
+    num_lights = std::min<uint32_t>(num_lights, SHADOW_ATLAS_MAX_LIGHTS);
+    bool kept[SHADOW_ATLAS_MAX_LIGHTS] = {};
+    for (uint32_t i = 0; i < num_lights; i++)
+    {
+        if ( lights[i].light >= light_slots.size() ) light_slots.resize(lights[i].light + 1, SHADOW_SLOT_NULL);
+        uint32_t s = light_slots[lights[i].light];
+        if ( s != SHADOW_SLOT_NULL ) kept[s] = true;
+    }
+    // Slots of lights left out are freed before any are handed out, so they can be reused.
+    uint32_t free_slots[SHADOW_ATLAS_MAX_LIGHTS];
+    uint32_t num_free_slots = 0;
+    for (uint32_t s = 0; s < SHADOW_ATLAS_MAX_LIGHTS; s++)
+    {
+        if ( kept[s] ) continue;
+        if ( slots[s].light != SHADOW_SLOT_NULL ) free_slot(s);
+        free_slots[num_free_slots++] = s;
+    }
+
+    for (uint32_t i = 0; i < num_lights; i++)
+    {
+        const ShadowAtlasLight &light = lights[i];
+        uint32_t s = light_slots[light.light];
+        if ( s == SHADOW_SLOT_NULL )
+        {
+            assert(num_free_slots > 0);
+            s = free_slots[--num_free_slots];
+            light_slots[light.light] = s;
+            slots[s].light = light.light;
+            slots[s].static_dirty = true;
+            slots[s].had_dynamic_casters = false;
+        }
+        slots[s].position = light.position;
+        slots[s].radius = light.radius;
+        slots[s].has_dynamic_casters = light.has_dynamic_casters;
+    }
+}
+
+void ShadowAtlas::invalidate_light(uint32_t light)
+{
+    uint32_t s = slot(light);
+    if ( s != SHADOW_SLOT_NULL ) slots[s].static_dirty = true;
+}
+
+void ShadowAtlas::remove_light(uint32_t light)
+{
+    uint32_t s = slot(light);
+    if ( s != SHADOW_SLOT_NULL ) free_slot(s);
+}
+
+void ShadowAtlas::invalidate_sphere(vec3 center, float radius)
+{
+    for (Slot &slot : slots)
+    {
+        if ( slot.light == SHADOW_SLOT_NULL || slot.static_dirty ) continue;
+        float reach = slot.radius + radius;
+        vec3 d = center - slot.position;
+        if ( glm::dot(d, d) <= reach * reach ) slot.static_dirty = true;
+    }
+}
+
+VkRect2D ShadowAtlas::tile_rect(uint32_t slot, int face)
+{
+    uint32_t tile = 6 * slot + face;
+    VkRect2D rect;
+    rect.offset.x = (tile % SHADOW_ATLAS_TILES_PER_ROW) * SHADOW_ATLAS_TILE_SIZE;
+    rect.offset.y = (tile / SHADOW_ATLAS_TILES_PER_ROW) * SHADOW_ATLAS_TILE_SIZE;
+    rect.extent = { SHADOW_ATLAS_TILE_SIZE, SHADOW_ATLAS_TILE_SIZE };
+    return rect;
+}
+
+mat4 ShadowAtlas::face_view_projection(vec3 position, float radius, int face)
+{
+    static const vec3 directions[6] = { vec3(1,0,0), vec3(-1,0,0), vec3(0,1,0), vec3(0,-1,0), vec3(0,0,1), vec3(0,0,-1) };
+    static const vec3 ups[6] = { vec3(0,1,0), vec3(0,1,0), vec3(0,0,-1), vec3(0,0,1), vec3(0,1,0), vec3(0,1,0) };
+    mat4 projection = glm::perspective(glm::radians(90.f), 1.f, radius * SHADOW_ATLAS_NEAR_FACTOR, radius);
+    // Vulkan clip space has y pointing down.
+    projection[1][1] *= -1;
+    return projection * glm::lookAt(position, position + directions[face], ups[face]);
+}
+
+void ShadowAtlas::record(VkCommandBuffer command_buffer, const DrawCasters &draw_casters)
+{
+    if ( !layouts_initialized )
+    {
+        VkImageMemoryBarrier barriers[2];
+        for (int i = 0; i < 2; i++)
+        {
+            barriers[i] = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+            barriers[i].srcAccessMask = 0;
+            barriers[i].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            barriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barriers[i].subresourceRange = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 };
+        }
+        barriers[0].image = static_atlas.image;
+        barriers[0].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barriers[0].dstAccessMask = 0;
+        barriers[1].image = sampled_atlas.image;
+        barriers[1].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        barriers[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        vkCmdPipelineBarrier(command_buffer,
+                             VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+                             0, nullptr, 0, nullptr, 2, barriers);
+        layouts_initialized = true;
+    }
+
+    bool any_static = false;
+    bool any_refresh = false;
+    for (const Slot &slot : slots)
+    {
+        if ( slot.light == SHADOW_SLOT_NULL ) continue;
+        any_static |= slot.static_dirty;
+        any_refresh |= slot.static_dirty || slot.has_dynamic_casters || slot.had_dynamic_casters;
+    }
+    if ( !any_refresh ) return;
+
+    auto begin_face = [&](uint32_t s, int face) {
+        VkRect2D rect = tile_rect(s, face);
+        VkViewport viewport = { (float) rect.offset.x, (float) rect.offset.y, (float) rect.extent.width, (float) rect.extent.height, 0, 1 };
+        vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+        vkCmdSetScissor(command_buffer, 0, 1, &rect);
+        return rect;
+    };
+    VkRenderPassBeginInfo begin_info = { VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO };
+    begin_info.renderArea = { { 0, 0 }, { SHADOW_ATLAS_SIZE, SHADOW_ATLAS_SIZE } };
+
+    // Re-render the invalidated static tiles.
+    if ( any_static )
+    {
+        begin_info.renderPass = static_render_pass;
+        begin_info.framebuffer = static_atlas.framebuffer;
+        vkCmdBeginRenderPass(command_buffer, &begin_info, VK_SUBPASS_CONTENTS_INLINE);
+        for (uint32_t s = 0; s < SHADOW_ATLAS_MAX_LIGHTS; s++)
+        {
+            const Slot &slot = slots[s];
+            if ( slot.light == SHADOW_SLOT_NULL || !slot.static_dirty ) continue;
+            for (int face = 0; face < 6; face++)
+            {
+                VkClearAttachment clear = {};
+                clear.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+                clear.clearValue.depthStencil = { 1.f, 0 };
+                VkClearRect clear_rect = { begin_face(s, face), 0, 1 };
+                vkCmdClearAttachments(command_buffer, 1, &clear, 1, &clear_rect);
+                draw_casters(command_buffer, slot.light, face_view_projection(slot.position, slot.radius, face), true);
+            }
+        }
+        vkCmdEndRenderPass(command_buffer);
+    }
+
+    // Copy the refreshed lights' static tiles to the sampled atlas, then draw their dynamic casters over them.
+    {
+        VkImageMemoryBarrier barrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+        barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = sampled_atlas.image;
+        barrier.subresourceRange = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 };
+        vkCmdPipelineBarrier(command_buffer,
+                             VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                             0, nullptr, 0, nullptr, 1, &barrier);
+    }
+    VkImageCopy copies[6 * SHADOW_ATLAS_MAX_LIGHTS];
+    uint32_t num_copies = 0;
+    for (uint32_t s = 0; s < SHADOW_ATLAS_MAX_LIGHTS; s++)
+    {
+        const Slot &slot = slots[s];
+        if ( slot.light == SHADOW_SLOT_NULL ) continue;
+        if ( !slot.static_dirty && !slot.has_dynamic_casters && !slot.had_dynamic_casters ) continue;
+        for (int face = 0; face < 6; face++)
+        {
+            VkRect2D rect = tile_rect(s, face);
+            VkImageCopy &copy = copies[num_copies++];
+            copy.srcSubresource = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 0, 1 };
+            copy.srcOffset = { rect.offset.x, rect.offset.y, 0 };
+            copy.dstSubresource = copy.srcSubresource;
+            copy.dstOffset = copy.srcOffset;
+            copy.extent = { rect.extent.width, rect.extent.height, 1 };
+        }
+    }
+    vkCmdCopyImage(command_buffer,
+                   static_atlas.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                   sampled_atlas.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                   num_copies, copies);
+
+    begin_info.renderPass = sampled_render_pass;
+    begin_info.framebuffer = sampled_atlas.framebuffer;
+    vkCmdBeginRenderPass(command_buffer, &begin_info, VK_SUBPASS_CONTENTS_INLINE);
+    for (uint32_t s = 0; s < SHADOW_ATLAS_MAX_LIGHTS; s++)
+    {
+        const Slot &slot = slots[s];
+        if ( slot.light == SHADOW_SLOT_NULL || !slot.has_dynamic_casters ) continue;
+        for (int face = 0; face < 6; face++)
+        {
+            begin_face(s, face);
+            draw_casters(command_buffer, slot.light, face_view_projection(slot.position, slot.radius, face), false);
+        }
+    }
+    vkCmdEndRenderPass(command_buffer);
+
+    for (Slot &slot : slots)
+    {
+        slot.static_dirty = false;
+        slot.had_dynamic_casters = slot.has_dynamic_casters;
+    }
+}
@@ -0,0 +1,135 @@
+#ifndef RENDERER_SHADOW_ATLAS_H_
+#define RENDERER_SHADOW_ATLAS_H_
+/* shadow_atlas.h
+ *
+ * Cached point light shadow maps, packed into a shared depth atlas.
+ *
+ * A shadowed light is given a slot of six square tiles, one per cube face. Re-rendering every
+ * cube every frame would cost more than the main pass, so each light's shadow is cached and split
+ * by how its casters move:
+ *     - The static atlas holds each light's static casters (meshes that have not moved for a
+ *       while). A light's static tiles are only re-rendered when they are invalidated: when the
+ *       light moves or gets its slot, or a static caster inside its radius changes.
+ *     - The sampled atlas holds the static tiles with the dynamic casters drawn over them. A
+ *       light's tiles are refreshed, by copying its static tiles and drawing its dynamic casters,
+ *       only when its static tiles changed or it has (or just had) dynamic casters.
+ * A light with nothing moving near it costs nothing per frame.
+ *
+ * Faces are rendered with a 90 degree perspective projection from the light's position, from
+ * radius * SHADOW_ATLAS_NEAR_FACTOR to the radius, looking down +X, -X, +Y, -Y, +Z, -Z. Tile t of
+ * the atlas, where t = 6 * slot + face, is at
+ *     (t % SHADOW_ATLAS_TILES_PER_ROW, t / SHADOW_ATLAS_TILES_PER_ROW) * SHADOW_ATLAS_TILE_SIZE
+ * and a shader compares the depth of the major axis distance under the same projection.
+ *
+ * Call only from the render thread.
+ */
+#include "engine/platform/vk.h"
+#include "renderer/descriptor_heap.h"
+#include "renderer/transform.h"
+#include <stdint.h>
+#include <vector>
+#include <functional>
+
+#define SHADOW_ATLAS_SIZE 4096
+#define SHADOW_ATLAS_TILE_SIZE 256
+#define SHADOW_ATLAS_TILES_PER_ROW (SHADOW_ATLAS_SIZE / SHADOW_ATLAS_TILE_SIZE)
+#define SHADOW_ATLAS_MAX_LIGHTS (SHADOW_ATLAS_TILES_PER_ROW * SHADOW_ATLAS_TILES_PER_ROW / 6)
+#define SHADOW_ATLAS_FORMAT VK_FORMAT_D16_UNORM
+#define SHADOW_ATLAS_NEAR_FACTOR 0.01f
+#define SHADOW_SLOT_NULL (~0u)
+
+// Push constants of the shadow pipeline layout, as GpuDrawConstants with the face's transform.
+struct GpuShadowConstants
+{
+    mat4 view_projection;
+    DescriptorIndex vertex_buffer;
+    DescriptorIndex index_buffer;
+    uint32_t vertex_format;
+    uint32_t padding;
+};
+
+// A light requesting a slot for this frame.
+struct ShadowAtlasLight
+{
+    uint32_t light; // The point light index.
+    vec3 position;
+    float radius;
+    bool has_dynamic_casters;
+};
+
+class ShadowAtlas
+{
+public:
+    // Faces are drawn with a pipeline layout of the frame descriptor set (set 0), the descriptor
+    // heap (set 1), and GpuShadowConstants push constants.
+    bool init(VulkanSystem *vk, DescriptorHeap *descriptor_heap, VkDescriptorSetLayout frame_set_layout);
+    void destroy();
+
+    // Give slots to the lights, which are in priority order, for at most SHADOW_ATLAS_MAX_LIGHTS of
+    // them. Lights that already have a slot keep it and its cache, and lights left out lose theirs.
+    void assign(const ShadowAtlasLight *lights, uint32_t num_lights);
+    // SHADOW_SLOT_NULL if the light is not shadowed this frame.
+    uint32_t slot(uint32_t light) const { return light < light_slots.size() ? light_slots[light] : SHADOW_SLOT_NULL; }
+
+    // The light has moved, so its static tiles are re-rendered.
+    void invalidate_light(uint32_t light);
+    // The light is destroyed, and its index may be reused.
+    void remove_light(uint32_t light);
+    // Static casters within the sphere have changed, so the static tiles of the lights reaching it are re-rendered.
+    void invalidate_sphere(vec3 center, float radius);
+
+    // Record this frame's shadow map updates, outside of a render pass. draw_casters records the
+    // draws of a light's static or dynamic casters into a face, pushing GpuShadowConstants with
+    // the given transform. The viewport and scissor are set to the face's tile.
+    typedef std::function<void(VkCommandBuffer command_buffer, uint32_t light, const mat4 &view_projection, bool static_casters)> DrawCasters;
+    void record(VkCommandBuffer command_buffer, const DrawCasters &draw_casters);
+
+    static mat4 face_view_projection(vec3 position, float radius, int face);
+
+    VkPipelineLayout pipeline_layout() const { return shadow_pipeline_layout; }
+    // What the pipelines drawing faces are built with. The static and sampled atlases' render
+    // passes are compatible, so they draw into either.
+    VkRenderPass render_pass() const { return static_render_pass; }
+    // The sampled atlas, and a depth comparison sampler for it, in the descriptor heap.
+    DescriptorIndex atlas_index() const { return atlas_descriptor_index; }
+    DescriptorIndex sampler_index() const { return sampler_descriptor_index; }
+private:
+    struct Slot
+    {
+        uint32_t light; // SHADOW_SLOT_NULL if free.
+        vec3 position;
+        float radius;
+        bool static_dirty;
+        bool has_dynamic_casters;
+        bool had_dynamic_casters; // When the sampled tiles were last refreshed.
+    };
+    struct AtlasImage
+    {
+        VkImage image;
+        VkDeviceMemory memory;
+        VkImageView view;
+        VkFramebuffer framebuffer;
+    };
+    bool create_image(AtlasImage *atlas_image, VkImageUsageFlags usage, VkRenderPass render_pass);
+    void destroy_image(AtlasImage *atlas_image);
+    void free_slot(uint32_t slot);
+    static VkRect2D tile_rect(uint32_t slot, int face);
+
+    VulkanSystem *vk;
+    DescriptorHeap *descriptor_heap;
+    // The static atlas is kept in TRANSFER_SRC_OPTIMAL and the sampled atlas in SHADER_READ_ONLY_OPTIMAL.
+    AtlasImage static_atlas;
+    AtlasImage sampled_atlas;
+    bool layouts_initialized;
+    VkRenderPass static_render_pass;
+    VkRenderPass sampled_render_pass;
+    VkSampler sampler;
+    VkPipelineLayout shadow_pipeline_layout;
+    DescriptorIndex atlas_descriptor_index;
+    DescriptorIndex sampler_descriptor_index;
+
+    Slot slots[SHADOW_ATLAS_MAX_LIGHTS];
+    std::vector<uint32_t> light_slots; // Indexed by light.
+};
+
+#endif // RENDERER_SHADOW_ATLAS_H_
@@ -0,0 +1,157 @@
+#include "renderer/staging_uploader.h"
+#include "ansi_color.h"
+#include <stdio.h>
+#include <assert.h>
+
+bool StagingUploader::init(VulkanSystem *_vk)
+{
+    vk = _vk;
+    last_value = 0;
+    current_batch = UINT32_MAX;
+    {
+        VkCommandPoolCreateInfo info = { VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO };
+        info.queueFamilyIndex = vk->graphics_family;
+        info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+        VK_SUCCEED( vkCreateCommandPool(vk->device, &info, nullptr, &command_pool) );
+    }
+    {
+        VkSemaphoreTypeCreateInfo type_info = { VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO };
+        type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+        type_info.initialValue = 0;
+        VkSemaphoreCreateInfo info = { VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+        info.pNext = &type_info;
+        VK_SUCCEED( vkCreateSemaphore(vk->device, &info, nullptr, &timeline) );
+    }
+    return true;
+}
+
+void StagingUploader::destroy()
+{
+    VkSemaphoreWaitInfo wait_info = { VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO };
+    wait_info.semaphoreCount = 1;
+    wait_info.pSemaphores = &timeline;
+    wait_info.pValues = &last_value;
+    VK_SUCCEED( vkWaitSemaphores(vk->device, &wait_info, ~0ull) );
+    for (Batch &batch : batches)
+    {
+        if ( batch.staging_buffer.buffer != VK_NULL_HANDLE )
+            DestroyVulkanBuffer(vk, &batch.staging_buffer);
+    }
+    batches.clear();
+    vkDestroySemaphore(vk->device, timeline, nullptr);
+    vkDestroyCommandPool(vk->device, command_pool, nullptr);
+}
+
+uint8_t *StagingUploader::begin(VkDeviceSize size)
+{
+    assert(current_batch == UINT32_MAX);
+
+    // Take a completed batch, preferring one whose staging buffer is large enough.
+    uint64_t completed_value;
+    VK_SUCCEED( vkGetSemaphoreCounterValue(vk->device, timeline, &completed_value) );
+    uint32_t chosen = UINT32_MAX;
+    for (uint32_t i = 0; i < batches.size(); i++)
+    {
+        if ( batches[i].value > completed_value ) continue;
+        if ( chosen == UINT32_MAX || (batches[i].staging_buffer.size >= size && batches[chosen].staging_buffer.size < size) )
+            chosen = i;
+    }
+    if ( chosen == UINT32_MAX && batches.size() < STAGING_UPLOADER_MAX_BATCHES )
+    {
+        Batch batch;
+        batch.staging_buffer = {};
+        batch.value = 0;
+        VkCommandBufferAllocateInfo info = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
+        info.commandPool = command_pool;
+        info.commandBufferCount = 1;
+        info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        VK_SUCCEED( vkAllocateCommandBuffers(vk->device, &info, &batch.command_buffer) );
+        batches.push_back(batch);
+        chosen = batches.size() - 1;
+    }
+    if ( chosen == UINT32_MAX )
+    {
+        // Every batch is in flight, wait for the oldest.
+        chosen = 0;
+        for (uint32_t i = 1; i < batches.size(); i++)
+            if ( batches[i].value < batches[chosen].value ) chosen = i;
+        VkSemaphoreWaitInfo wait_info = { VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO };
+        wait_info.semaphoreCount = 1;
+        wait_info.pSemaphores = &timeline;
+        wait_info.pValues = &batches[chosen].value;
+        VK_SUCCEED( vkWaitSemaphores(vk->device, &wait_info, ~0ull) );
+    }
+
+    Batch &batch = batches[chosen];
+    if ( batch.staging_buffer.buffer == VK_NULL_HANDLE || batch.staging_buffer.size < size )
+    {
+        if ( batch.staging_buffer.buffer != VK_NULL_HANDLE )
+            DestroyVulkanBuffer(vk, &batch.staging_buffer);
+        if ( !CreateVulkanBuffer(vk,
+                                 size,
+                                 VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                 &batch.staging_buffer) )
+        {
+            fprintf(stderr, C_RED "[%s] Failed to create a %llu byte staging buffer.\n" C_RESET, __func__, (unsigned long long) size);
+            batch.staging_buffer = {};
+            return nullptr;
+        }
+    }
+    current_batch = chosen;
+    VK_SUCCEED( vkResetCommandBuffer(batch.command_buffer, 0) );
+    VkCommandBufferBeginInfo begin_info = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    VK_SUCCEED( vkBeginCommandBuffer(batch.command_buffer, &begin_info) );
+    return (uint8_t *) batch.staging_buffer.mapped;
+}
+
+void StagingUploader::copy_to_buffer(VkDeviceSize staging_offset, VkBuffer dst_buffer, VkDeviceSize dst_offset, VkDeviceSize size)
+{
+    assert(current_batch != UINT32_MAX);
+    Batch &batch = batches[current_batch];
+    assert(staging_offset + size <= batch.staging_buffer.size);
+    VkBufferCopy region = {};
+    region.srcOffset = staging_offset;
+    region.dstOffset = dst_offset;
+    region.size = size;
+    vkCmdCopyBuffer(batch.command_buffer, batch.staging_buffer.buffer, dst_buffer, 1, &region);
+}
+
+uint64_t StagingUploader::end_async(VkPipelineStageFlags dst_stages, VkAccessFlags dst_access)
+{
+    assert(current_batch != UINT32_MAX);
+    Batch &batch = batches[current_batch];
+    current_batch = UINT32_MAX;
+
+    VkMemoryBarrier barrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = dst_access;
+    vkCmdPipelineBarrier(batch.command_buffer,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, dst_stages, 0,
+                         1, &barrier, 0, nullptr, 0, nullptr);
+    VK_SUCCEED( vkEndCommandBuffer(batch.command_buffer) );
+
+    batch.value = ++last_value;
+    VkTimelineSemaphoreSubmitInfo timeline_info = { VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO };
+    timeline_info.signalSemaphoreValueCount = 1;
+    timeline_info.pSignalSemaphoreValues = &batch.value;
+    VkSubmitInfo submit_info = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
+    submit_info.pNext = &timeline_info;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &batch.command_buffer;
+    submit_info.signalSemaphoreCount = 1;
+    submit_info.pSignalSemaphores = &timeline;
+    VK_SUCCEED( vkQueueSubmit(vk->graphics_queue, 1, &submit_info, VK_NULL_HANDLE) );
+    return batch.value;
+}
+
+void StagingUploader::end_and_wait(VkPipelineStageFlags dst_stages, VkAccessFlags dst_access)
+{
+    uint64_t value = end_async(dst_stages, dst_access);
+    VkSemaphoreWaitInfo wait_info = { VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO };
+    wait_info.semaphoreCount = 1;
+    wait_info.pSemaphores = &timeline;
+    wait_info.pValues = &value;
+    VK_SUCCEED( vkWaitSemaphores(vk->device, &wait_info, ~0ull) );
+}
@@ -0,0 +1,56 @@
+#ifndef RENDERER_STAGING_UPLOADER_H_
+#define RENDERER_STAGING_UPLOADER_H_
+/* staging_uploader.h
+ *
+ * Copies data to device-local buffers through a host-visible staging buffer.
+ *
+ * Usage:
+ *     uint8_t *staging = uploader.begin(total_size);
+ *     ... write total_size bytes to staging ...
+ *     uploader.copy_to_buffer(0, dst_buffer, dst_offset, size);
+ *     ...
+ *     uploader.end_and_wait(VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+ *
+ * Batches can instead be submitted with end_async, which returns the value the uploader's
+ * timeline semaphore reaches when the batch completes, for coroutines to co_await (see
+ * engine/platform/vk_completion.h). Each batch in flight keeps its own staging buffer and
+ * command buffer, so a new batch can begin before earlier ones complete.
+ */
+#include "engine/platform/vk.h"
+#include <stdint.h>
+#include <vector>
+
+// Batches in flight beyond this make begin wait for the oldest.
+#define STAGING_UPLOADER_MAX_BATCHES 16
+
+class StagingUploader
+{
+public:
+    bool init(VulkanSystem *vk);
+    void destroy();
+
+    // Returns mapped staging memory of at least size bytes, growing the staging buffer if needed,
+    // and begins recording the copies of this batch.
+    uint8_t *begin(VkDeviceSize size);
+    void copy_to_buffer(VkDeviceSize staging_offset, VkBuffer dst_buffer, VkDeviceSize dst_offset, VkDeviceSize size);
+    // Submits the copies, making them visible to the given stages and accesses, and blocks until they complete.
+    void end_and_wait(VkPipelineStageFlags dst_stages, VkAccessFlags dst_access);
+    // Submits the copies without waiting, returning the value semaphore() is signaled to when they complete.
+    uint64_t end_async(VkPipelineStageFlags dst_stages, VkAccessFlags dst_access);
+    VkSemaphore semaphore() const { return timeline; }
+private:
+    struct Batch
+    {
+        VulkanBuffer staging_buffer;
+        VkCommandBuffer command_buffer;
+        uint64_t value; // The timeline value signaled when the batch's last submission completes.
+    };
+    VulkanSystem *vk;
+    VkCommandPool command_pool;
+    VkSemaphore timeline;
+    uint64_t last_value;
+    std::vector<Batch> batches;
+    uint32_t current_batch;
+};
+
+#endif // RENDERER_STAGING_UPLOADER_H_
@@ -0,0 +1,30 @@
+#ifndef RENDERER_TRANSFORM_H_
+#define RENDERER_TRANSFORM_H_
+// Vulkan clip space depth is [0,1].
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+using glm::vec2;
+using glm::vec3;
+using glm::vec4;
+using glm::mat3;
+using glm::mat4;
+
+struct Transform
+{
+    vec3 position;
+    vec3 euler_angles; // Radians, applied in Y (yaw), X (pitch), Z (roll) order.
+
+    mat4 matrix() const
+    {
+        mat4 m = glm::translate(mat4(1.f), position);
+        m = glm::rotate(m, euler_angles.y, vec3(0,1,0));
+        m = glm::rotate(m, euler_angles.x, vec3(1,0,0));
+        m = glm::rotate(m, euler_angles.z, vec3(0,0,1));
+        return m;
+    }
+};
+typedef Transform RenderTransform;
+
+#endif // RENDERER_TRANSFORM_H_
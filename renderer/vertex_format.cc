@@ -0,0 +1,161 @@
+#include "renderer/vertex_format.h"
+#include <math.h>
+#include <string.h>
+#include <assert.h>
+#include <algorithm>
+
+static const VertexFormatInfo g_vertex_format_infos[NUM_VERTEX_FORMATS] = {
+    // Float
+    { 24, 2, {{0, 0, VK_FORMAT_R32G32B32_SFLOAT, 0},
+              {1, 0, VK_FORMAT_R32G32B32_SFLOAT, 12}} },
+    // QuantizedOct16
+    { 12, 2, {{0, 0, VK_FORMAT_R16G16B16A16_UNORM, 0},
+              {1, 0, VK_FORMAT_R16G16_SNORM, 8}} },
+    // QuantizedOct8
+    { 8, 2, {{0, 0, VK_FORMAT_R16G16B16A16_UNORM, 0},
+             {1, 0, VK_FORMAT_R8G8_SNORM, 6}} },
+};
+
+const VertexFormatInfo &vertex_format_info(VertexFormat format)
+{
+    assert((int) format < NUM_VERTEX_FORMATS);
+    return g_vertex_format_infos[(int) format];
+}
+
+const char *vertex_format_name(VertexFormat format)
+{
+    switch (format)
+    {
+    case VertexFormat::Float: return "Float";
+    case VertexFormat::QuantizedOct16: return "QuantizedOct16";
+    case VertexFormat::QuantizedOct8: return "QuantizedOct8";
+    }
+    return "UNKNOWN";
+}
+
+mat4 VertexQuantization::dequantization_matrix() const
+{
+    return glm::scale(glm::translate(mat4(1.f), bounds_min), bounds_extent);
+}
+
+VertexQuantization compute_vertex_quantization(const vec3 *positions, uint32_t num_vertices)
+{
+    assert(num_vertices > 0);
+    vec3 bounds_min = positions[0];
+    vec3 bounds_max = positions[0];
+    for (uint32_t i = 1; i < num_vertices; i++)
+    {
+        bounds_min = glm::min(bounds_min, positions[i]);
+        bounds_max = glm::max(bounds_max, positions[i]);
+    }
+    return VertexQuantization{bounds_min, bounds_max - bounds_min};
+}
+
+static inline float sign_not_zero(float v)
+{
+    return v >= 0 ? 1.f : -1.f;
+}
+
+vec2 octahedral_encode(vec3 n)
+{
+    // Project onto the octahedron |x|+|y|+|z| = 1, then fold the lower hemisphere over the diagonals.
+    float l1_norm = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+    if ( !(l1_norm >= VERTEX_FORMAT_MIN_NORMAL_L1_NORM) ) return vec2(0, 0);
+    n /= l1_norm;
+    if ( n.z >= 0 ) return vec2(n.x, n.y);
+    return vec2((1 - fabsf(n.y)) * sign_not_zero(n.x),
+                (1 - fabsf(n.x)) * sign_not_zero(n.y));
+}
+
+vec3 octahedral_decode(vec2 e)
+{
+    vec3 n = vec3(e.x, e.y, 1 - fabsf(e.x) - fabsf(e.y));
+    if ( n.z < 0 )
+    {
+        n.x = (1 - fabsf(e.y)) * sign_not_zero(e.x);
+        n.y = (1 - fabsf(e.x)) * sign_not_zero(e.y);
+    }
+    return glm::normalize(n);
+}
+
+static inline uint16_t quantize_unorm16(float v)
+{
+    return (uint16_t) lrintf(std::clamp(v, 0.f, 1.f) * 65535.f);
+}
+
+static inline int16_t quantize_snorm16(float v)
+{
+    return (int16_t) lrintf(std::clamp(v, -1.f, 1.f) * 32767.f);
+}
+
+static inline int8_t quantize_snorm8(float v)
+{
+    return (int8_t) lrintf(std::clamp(v, -1.f, 1.f) * 127.f);
+}
+
+void encode_vertices(VertexFormat format,
+                     const VertexQuantization &quantization,
+                     const vec3 *positions,
+                     const vec3 *normals,
+                     uint32_t num_vertices,
+                     void *out)
+{
+    uint8_t *bytes = (uint8_t *) out;
+    if ( format == VertexFormat::Float )
+    {
+        for (uint32_t i = 0; i < num_vertices; i++)
+        {
+            memcpy(bytes + 24*i, &positions[i], 12);
+            memcpy(bytes + 24*i + 12, &normals[i], 12);
+        }
+        return;
+    }
+
+    // Flat axes have zero extent. Their quantized coordinate is irrelevant, so avoid dividing by zero.
+    vec3 inverse_extent;
+    for (int j = 0; j < 3; j++)
+        inverse_extent[j] = quantization.bounds_extent[j] > 0 ? 1.f / quantization.bounds_extent[j] : 0.f;
+
+    uint32_t stride = vertex_format_info(format).stride;
+    for (uint32_t i = 0; i < num_vertices; i++)
+    {
+        uint8_t *v = bytes + stride*i;
+        vec3 p = (positions[i] - quantization.bounds_min) * inverse_extent;
+        uint16_t qp[4] = { quantize_unorm16(p.x), quantize_unorm16(p.y), quantize_unorm16(p.z), 0 };
+        vec2 e = octahedral_encode(normals[i]);
+        if ( format == VertexFormat::QuantizedOct16 )
+        {
+            int16_t qn[2] = { quantize_snorm16(e.x), quantize_snorm16(e.y) };
+            memcpy(v, qp, 8);
+            memcpy(v + 8, qn, 4);
+        }
+        else
+        {
+            int8_t qn[2] = { quantize_snorm8(e.x), quantize_snorm8(e.y) };
+            memcpy(v, qp, 6);
+            memcpy(v + 6, qn, 2);
+        }
+    }
+}
+
+void decode_vertex_positions(VertexFormat format,
+                             const VertexQuantization &quantization,
+                             const void *vertices,
+                             uint32_t num_vertices,
+                             vec3 *positions)
+{
+    const uint8_t *bytes = (const uint8_t *) vertices;
+    uint32_t stride = vertex_format_info(format).stride;
+    for (uint32_t i = 0; i < num_vertices; i++)
+    {
+        const uint8_t *v = bytes + stride*i;
+        if ( format == VertexFormat::Float )
+        {
+            memcpy(&positions[i], v, 12);
+            continue;
+        }
+        uint16_t qp[3];
+        memcpy(qp, v, 6);
+        positions[i] = quantization.bounds_min + vec3(qp[0], qp[1], qp[2]) * (1.f / 65535.f) * quantization.bounds_extent;
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef RENDERER_VERTEX_FORMAT_H_
+#define RENDERER_VERTEX_FORMAT_H_
+/* vertex_format.h
+ *
+ * Vertex layouts stored in the mesh pool.
+ *
+ * The quantized formats store positions as 16-bit unorm values relative to the mesh's
+ * bounding box, and normals octahedral-encoded into two snorm components. The bounding
+ * box mapping is undone by the mesh's dequantization matrix, which is folded into its
+ * model matrix, so shaders read positions as if they were in [0,1]^3 object space.
+ *
+ *     Float          24 bytes  float32x3 position, float32x3 normal
+ *     QuantizedOct16 12 bytes  unorm16x3 position (+ 16-bit pad), snorm16x2 octahedral normal
+ *     QuantizedOct8   8 bytes  unorm16x3 position, snorm8x2 octahedral normal
+ *
+ * The QuantizedOct8 normal overlaps the fourth component of the position attribute,
+ * which is fetched as R16G16B16A16_UNORM and whose w must be ignored by shaders.
+ */
+#include <vulkan/vulkan.h>
+#include "renderer/transform.h"
+#include <stdint.h>
+
+enum class VertexFormat : uint8_t
+{
+    Float,
+    QuantizedOct16,
+    QuantizedOct8,
+    NUM
+};
+#define NUM_VERTEX_FORMATS ((int) VertexFormat::NUM)
+
+struct VertexFormatInfo
+{
+    uint32_t stride; // In bytes. Always a multiple of 4.
+    uint32_t num_attributes;
+    VkVertexInputAttributeDescription attributes[2]; // location 0: position, location 1: normal.
+};
+const VertexFormatInfo &vertex_format_info(VertexFormat format);
+const char *vertex_format_name(VertexFormat format);
+
+struct VertexQuantization
+{
+    vec3 bounds_min;
+    vec3 bounds_extent;
+
+    // Maps quantized [0,1]^3 positions back to object space.
+    mat4 dequantization_matrix() const;
+};
+VertexQuantization compute_vertex_quantization(const vec3 *positions, uint32_t num_vertices);
+
+// Normals whose components' absolute values sum to less than this, e.g. of degenerate
+// triangles, are encoded as +Z.
+#define VERTEX_FORMAT_MIN_NORMAL_L1_NORM 1e-12f
+vec2 octahedral_encode(vec3 n);
+vec3 octahedral_decode(vec2 e);
+
+// Write num_vertices vertices in the given format to out, which must have room for
+// num_vertices * vertex_format_info(format).stride bytes.
+void encode_vertices(VertexFormat format,
+                     const VertexQuantization &quantization,
+                     const vec3 *positions,
+                     const vec3 *normals,
+                     uint32_t num_vertices,
+                     void *out);
+// The inverse of encode_vertices for positions, up to quantization. Reads num_vertices vertices
+// in the given format, writing their object-space positions.
+void decode_vertex_positions(VertexFormat format,
+                             const VertexQuantization &quantization,
+                             const void *vertices,
+                             uint32_t num_vertices,
+                             vec3 *positions);
+
+#endif // RENDERER_VERTEX_FORMAT_H_